@@ -22,8 +22,14 @@
 #include "libdtm/dtm.h"
 #include "libdtree/dtree.h"
 #include "libdtree/dtree_attr.h"
+#include "libdtree/dtree_binary.h"
+#include "libdtree/dtree_buf.h"
 #include "libdtree/dtree_cronus.h"
 #include "libdtree/dtree_dump.h"
+#include "libdtree/dtree_export.h"
+#include "libdtree/dtree_import.h"
+
+#include "attribute.h"
 
 
 static struct dtm_node *target_translate(struct dtm_node *root, const char *target)
@@ -46,86 +52,150 @@ static int do_create(const char *dtb, const char *infodb, const char *out_dtb)
 }
 
 
-struct do_dump_state {
-	const char *target;
-	struct dtm_node *node;
-	bool done;
-	bool print;
-};
-
-static int do_dump_node(struct dtm_node *root, struct dtm_node *node, void *priv)
+/* Select a single node by device tree path or cronus target */
+static int target_filter(struct dtree_export_filter *filter, const char *target)
 {
-	struct do_dump_state *state = (struct do_dump_state *)priv;
-
-	if (state->done)
-		return 1;
-
-	if (state->target) {
-		state->node = target_translate(root, state->target);
-		state->target = NULL;
-	} else {
-		state->print = true;
-	}
+	if (target[0] == '/')
+		return dtree_export_filter_add_path(filter, target, false);
 
-	/* Single node */
-	if (state->node && node == state->node) {
-		state->done = true;
-		state->print = true;
-	}
+	return dtree_export_filter_add_target(filter, target);
+}
 
-	if (state->print)
-		dtree_dump_print_node(node, stdout);
+static int do_dump_node(struct dtm_node *root, struct dtm_node *node, void *priv)
+{
+	struct dtree_buf *buf = (struct dtree_buf *)priv;
 
+	dtree_dump_buf_print_node(node, buf);
 	return 0;
 }
 
 static int do_dump_attr(const struct dtree_attr *attr, void *priv)
 {
-	struct do_dump_state *state = (struct do_dump_state *)priv;
-
-	if (!state->print)
-		return 0;
+	struct dtree_buf *buf = (struct dtree_buf *)priv;
 
-	dtree_dump_print_attr_name(attr, stdout);
+	dtree_dump_buf_print_attr_name(attr, buf);
 
 	if (attr->count <= 4) {
-		dtree_dump_print_attr(attr, stdout);
+		dtree_dump_buf_print_attr(attr, buf);
 	} else {
-		printf("[%d]", attr->count);
+		dtree_buf_putc(buf, '[');
+		dtree_buf_dec(buf, attr->count);
+		dtree_buf_putc(buf, ']');
 	}
 
-	printf("\n");
+	dtree_buf_putc(buf, '\n');
 
 	return 0;
 }
 
 static int do_dump(const char *dtb, const char *infodb, const char *target)
 {
-	struct do_dump_state state;
+	struct dtree_export_filter *filter = NULL;
+	struct dtree_buf buf;
 	int ret;
 
-	state = (struct do_dump_state) {
-		.target = target,
-		.done = false,
-		.print = false,
-	};
+	if (target) {
+		filter = dtree_export_filter_new();
+		if (!filter)
+			return -1;
 
-	ret = dtree_export(dtb, infodb, NULL, do_dump_node, do_dump_attr, &state);
+		if (target_filter(filter, target)) {
+			dtree_export_filter_free(filter);
+			return -1;
+		}
+	}
+
+	/* Same output buffer for all the nodes and attributes */
+	dtree_buf_init(&buf, stdout);
+
+	ret = dtree_export_filtered(dtb, infodb, NULL, filter, do_dump_node, do_dump_attr, &buf);
 	if (ret > 0)
 		ret = 0;
 
+	if (!dtree_buf_flush(&buf) && ret == 0)
+		ret = -1;
+
+	dtree_buf_free(&buf);
+
+	if (filter)
+		dtree_export_filter_free(filter);
+
 	return ret;
 }
 
-static int do_export(const char *dtb, const char *infodb, const char *attrdb)
+/*
+ * Remove export options following the sub-command
+ *
+ * --target selects a subtree by device tree path, or nodes by cronus target
+ * pattern, --class selects nodes of a class.
+ */
+int export_options(int *argc, const char **argv, struct dtree_export_filter *filter)
 {
-	return dtree_cronus_export(dtb, infodb, attrdb, stdout);
+	int flags = 0, skip, i, ret;
+
+	while (*argc > 2 && strncmp(argv[2], "--", 2) == 0) {
+		skip = 1;
+
+		if (strcmp(argv[2], "--non-default") == 0) {
+			flags |= DTREE_EXPORT_NON_DEFAULT;
+		} else if (strcmp(argv[2], "--binary") == 0) {
+			flags |= DTREE_EXPORT_BINARY;
+		} else if (strcmp(argv[2], "--target") == 0 && *argc > 3) {
+			if (argv[3][0] == '/')
+				ret = dtree_export_filter_add_path(filter, argv[3], true);
+			else
+				ret = dtree_export_filter_add_target(filter, argv[3]);
+			if (ret) {
+				fprintf(stderr, "Invalid target %s\n", argv[3]);
+				return -1;
+			}
+			skip = 2;
+		} else if (strcmp(argv[2], "--class") == 0 && *argc > 3) {
+			if (dtree_export_filter_add_class(filter, argv[3])) {
+				fprintf(stderr, "Invalid class %s\n", argv[3]);
+				return -1;
+			}
+			skip = 2;
+		} else {
+			return -1;
+		}
+
+		for (i=2; i<*argc-skip; i++)
+			argv[i] = argv[i+skip];
+		*argc -= skip;
+	}
+
+	return flags;
 }
 
-static int do_import(const char *dtb, const char *infodb, const char *dump_file)
+static int do_export(const char *dtb, const char *infodb, const char *attrdb,
+		     struct dtree_export_filter *filter, int flags)
 {
+	const char *threads;
+	int nthreads = 1, ret;
+
+	threads = getenv("PDATA_EXPORT_THREADS");
+	if (threads)
+		nthreads = atoi(threads);
+
+	if (flags & DTREE_EXPORT_BINARY)
+		ret = dtree_binary_export(dtb, infodb, attrdb, filter, stdout, flags);
+	else
+		ret = dtree_cronus_export_parallel(dtb, infodb, attrdb, filter, stdout, nthreads, flags);
+	dtree_export_filter_free(filter);
+	return ret;
+}
+
+static int do_import(const char *dtb, const char *infodb, const char *dump_file, bool stats)
+{
+	struct dtree_import_stats istats;
+	const char *threads;
 	FILE *fp;
-	int ret;
+	int nthreads = 1, ret;
+
+	threads = getenv("PDATA_IMPORT_THREADS");
+	if (threads)
+		nthreads = atoi(threads);
 
 	fp = fopen(dump_file, "r");
 	if (!fp) {
@@ -133,16 +203,62 @@ static int do_import(const char *dtb, const char *infodb, const char *dump_file)
 		return 1;
 	}
 
-	ret = dtree_cronus_import(dtb, infodb, fp);
+	if (dtree_binary_check(fp))
+		ret = dtree_binary_import(dtb, infodb, fp);
+	else
+		ret = dtree_cronus_import_parallel(dtb, infodb, fp, nthreads);
 	fclose(fp);
+
+	if (ret == 0 && stats) {
+		dtree_import_get_stats(&istats);
+		printf("%d attributes updated, %d unchanged, %zu bytes in %d pages written\n",
+		       istats.updated, istats.unchanged, istats.bytes, istats.pages);
+	}
+
 	return ret;
 }
 
-struct do_read_state {
-	const char *target;
-	const char *attr_name;
+/* Remove import options following the sub-command */
+static bool import_options(int *argc, const char **argv)
+{
+	int i;
 
-	struct dtm_node *node;
+	if (*argc < 3 || strcmp(argv[2], "--stats") != 0)
+		return false;
+
+	for (i=2; i<*argc-1; i++)
+		argv[i] = argv[i+1];
+	*argc -= 1;
+
+	return true;
+}
+
+/* Remove migrate options following the sub-command, returns old infodb */
+static const char *migrate_options(int *argc, const char **argv)
+{
+	const char *old_infodb;
+	int i;
+
+	if (*argc < 4 || strcmp(argv[2], "--old-infodb") != 0)
+		return NULL;
+
+	old_infodb = argv[3];
+	for (i=2; i<*argc-2; i++)
+		argv[i] = argv[i+2];
+	*argc -= 2;
+
+	return old_infodb;
+}
+
+static int do_migrate(const char *old_dtb, const char *new_dtb,
+		      const char *infodb, const char *old_infodb,
+		      const char *attrdb)
+{
+	return dtree_migrate(old_dtb, new_dtb, infodb, old_infodb, attrdb);
+}
+
+struct do_read_state {
+	struct dtree_buf *buf;
 	bool matched;
 };
 
@@ -150,55 +266,81 @@ static int do_read_node(struct dtm_node *root, struct dtm_node *node, void *priv
 {
 	struct do_read_state *state = (struct do_read_state *)priv;
 
-	if (state->matched)
-		return 1;
+	state->matched = true;
+	return 0;
+}
 
-	if (state->target) {
-		state->node = target_translate(root, state->target);
-		if (!state->node) {
-			fprintf(stderr, "No such target %s\n", state->target);
-			return -1;
-		}
-		state->target = NULL;
-	}
+/* Format in memory with the buffer of the caller, then write to fp */
+static void print_attr(const struct dtree_attr *attr, struct dtree_buf *buf, FILE *fp)
+{
+	buf->len = 0;
 
-	if (state->node && node == state->node) {
-		state->matched = true;
-	}
+	dtree_dump_buf_print_attr_name(attr, buf);
+	dtree_buf_puts(buf, " = ");
+	dtree_dump_buf_print_attr(attr, buf);
+	dtree_buf_putc(buf, '\n');
 
-	return 0;
+	if (!buf->error)
+		fwrite(buf->data, 1, buf->len, fp);
 }
 
 static int do_read_attr(const struct dtree_attr *attr, void *priv)
 {
 	struct do_read_state *state = (struct do_read_state *)priv;
 
-	if (!state->matched)
-		return 0;
-
-	if (strcmp(attr->name, state->attr_name) == 0) {
-		dtree_dump_print_attr_name(attr, stdout);
-		printf(" = ");
-		dtree_dump_print_attr(attr, stdout);
-		printf("\n");
-		return 1;
-	}
-
-	return 0;
+	print_attr(attr, state->buf, stdout);
+	return 1;
 }
 
 static int do_read(const char *dtb, const char *infodb, const char *target, const char *attr_name)
 {
 	struct do_read_state state;
+	struct dtree_export_filter *filter;
+	struct dtree_buf buf;
 	int ret;
 
+	dtree_buf_init(&buf, NULL);
 	state = (struct do_read_state) {
-		.target = target,
-		.attr_name = attr_name,
+		.buf = &buf,
 		.matched = false,
 	};
 
-	ret = dtree_export(dtb, infodb, NULL, do_read_node, do_read_attr, &state);
+	/* Single target, read the attribute directly from the device tree */
+	if (!strpbrk(target, "*?[")) {
+		ret = dtree_read(dtb, infodb, target, attr_name, do_read_attr, &state);
+		dtree_buf_free(&buf);
+		if (ret == DTREE_READ_NO_TARGET) {
+			fprintf(stderr, "No such target %s\n", target);
+			return -1;
+		}
+		if (ret == DTREE_READ_NO_ATTR) {
+			fprintf(stderr, "No such attribute %s\n", attr_name);
+			return 1;
+		}
+		if (ret > 0)
+			ret = 0;
+
+		return ret;
+	}
+
+	filter = dtree_export_filter_new();
+	if (!filter)
+		return -1;
+
+	if (target_filter(filter, target) ||
+	    dtree_export_filter_add_attr(filter, attr_name)) {
+		dtree_export_filter_free(filter);
+		return -1;
+	}
+
+	ret = dtree_export_filtered(dtb, infodb, NULL, filter, do_read_node, do_read_attr, &state);
+	dtree_export_filter_free(filter);
+	dtree_buf_free(&buf);
+
+	if (ret == 0 && !state.matched) {
+		fprintf(stderr, "No such target %s\n", target);
+		return -1;
+	}
 	if (ret == 0) {
 		fprintf(stderr, "No such attribute %s\n", attr_name);
 		return 1;
@@ -247,46 +389,98 @@ static int do_translate(const char *dtb, const char *target)
 	return 0;
 }
 
+static int do_journal(const char *dtb)
+{
+	if (!dtm_file_journal_create(dtb))
+		return -1;
+
+	return 0;
+}
+
+static int do_compact(const char *dtb)
+{
+	if (dtm_file_compact(dtb) != 0) {
+		fprintf(stderr, "Failed to compact %s\n", dtb);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int do_overlay(const char *dtb, const char *overlay)
+{
+	if (!dtm_file_overlay_create(dtb, overlay))
+		return -1;
+
+	return 0;
+}
+
+static int do_flatten(const char *dtb, const char *out)
+{
+	if (dtm_file_flatten(dtb, out) != 0) {
+		fprintf(stderr, "Failed to flatten %s\n", dtb);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int do_image(const char *dtb)
+{
+	char *image;
+	int ret;
+
+	image = dtm_file_image_name(dtb);
+	if (!image)
+		return -1;
+
+	ret = dtm_image_create(dtb, image);
+	if (ret != 0)
+		fprintf(stderr, "Failed to create image %s\n", image);
+
+	free(image);
+	return ret;
+}
+
+static int do_stats(const char *dtb, const char *infodb)
+{
+	int ret;
+
+	ret = dtree_stats_tree(dtb, infodb, stdout);
+	if (ret != 0)
+		fprintf(stderr, "Failed to read %s\n", dtb);
+
+	return ret;
+}
+
 struct do_write_state {
 	const char *target;
 	const char *attr_name;
 	const char **argv;
 	int argc;
-
-	struct dtm_node *root;
-	struct dtm_node *node;
-	struct dtree_attr *attr;
 };
 
-static int do_write_parse(void *ctx, void *priv)
+/* Set the value of an attribute of the current import node */
+static int write_attr(void *ctx, const char *attr_name, const char **argv, int argc,
+		      struct dtree_attr **out, FILE *err)
 {
-	struct do_write_state *state = (struct do_write_state *)priv;
 	struct dtree_attr *attr;
 	uint8_t *ptr;
 	int count, ret, i;
 
-	state->root = dtree_import_root(ctx);
-	state->node = target_translate(state->root, state->target);
-	if (!state->node) {
-		fprintf(stderr, "No such target %s\n", state->target);
-		return -1;
-	}
-
-	dtree_import_set_node(state->node, ctx);
-
-	ret = dtree_import_attr(state->attr_name, ctx, &attr);
+	ret = dtree_import_attr(attr_name, ctx, &attr);
 	if (ret < 0) {
-		fprintf(stderr, "No such attribute %s\n", state->attr_name);
+		fprintf(err, "No such attribute %s\n", attr_name);
 		return -1;
 	}
-	state->attr = attr;
+	*out = attr;
 
 	count = attr->count;
 	if (attr->type == DTREE_ATTR_TYPE_COMPLEX)
 		count *= strlen(attr->spec);
 
-	if (state->argc != count) {
-		fprintf(stderr, "Insufficient values %d, expected %d\n", state->argc, count);
+	if (argc != count) {
+		fprintf(err, "Insufficient values %d, expected %d\n", argc, count);
 		return -1;
 	}
 
@@ -299,23 +493,23 @@ static int do_write_parse(void *ctx, void *priv)
 			count = i * strlen(attr->spec);
 
 			for (j=0; j<strlen(attr->spec); j++) {
-				val = strtoull(state->argv[count+j], NULL, 0);
+				val = strtoull(argv[count+j], NULL, 0);
 				data_size = attr->spec[j] - '0';
 				dtree_attr_set_num(ptr, data_size, val);
 				ptr += data_size;
 			}
 
 		} else if (attr->type == DTREE_ATTR_TYPE_STRING) {
-			if (strlen(state->argv[i]) > attr->elem_size) {
-				fprintf(stderr, "Value too long %zu, expected %d\n", strlen(state->argv[i]), attr->elem_size);
+			if (strlen(argv[i]) > attr->elem_size) {
+				fprintf(err, "Value too long %zu, expected %d\n", strlen(argv[i]), attr->elem_size);
 				return -1;
 			}
-			dtree_attr_set_string(attr, ptr, state->argv[i]);
+			dtree_attr_set_string(attr, ptr, argv[i]);
 			ptr += attr->elem_size;
 
 		} else {
-			if (!dtree_attr_set_enum(attr, ptr, state->argv[i]))
-				dtree_attr_set_value(attr, ptr, state->argv[i]);
+			if (!dtree_attr_set_enum(attr, ptr, argv[i]))
+				dtree_attr_set_value(attr, ptr, argv[i]);
 			ptr += attr->elem_size;
 		}
 
@@ -327,17 +521,15 @@ static int do_write_parse(void *ctx, void *priv)
 	return 0;
 }
 
-static int do_write_export(struct do_write_state *state)
+static int do_write_export(const char *override, struct dtree_cronus_index *index,
+			   struct dtm_node *node, struct dtree_attr *attr)
 {
+	struct dtree_buf buf;
 	FILE *fp;
-	const char *override;
-	char *path;
-
-	override = getenv("PDATA_ATTR_OVERRIDE");
-	if (!override)
-		return 0;
+	const char *path;
+	int ret = 0;
 
-	path = dtree_to_cronus_target(state->root, state->node);
+	path = dtree_cronus_index_target(index, node);
 	if (!path) {
 		fprintf(stderr, "Failed to translate node\n");
 		return -1;
@@ -349,19 +541,67 @@ static int do_write_export(struct do_write_state *state)
 		return -1;
 	}
 
-	dtree_cronus_print_node(path, fp);
-	dtree_cronus_print_attr(state->attr, fp);
+	dtree_buf_init(&buf, fp);
+	dtree_cronus_buf_print_node(path, &buf);
+	dtree_cronus_buf_print_attr(attr, &buf);
+	if (!dtree_buf_flush(&buf))
+		ret = -1;
+	dtree_buf_free(&buf);
 
-	free(path);
 	fclose(fp);
-	return 0;
+	return ret;
+}
+
+static int do_write_parse(void *ctx, void *priv)
+{
+	struct do_write_state *state = (struct do_write_state *)priv;
+	struct dtree_cronus_index *index = NULL;
+	struct dtm_node *root, *node;
+	struct dtree_attr *attr;
+	const char *override;
+	int ret = -1;
+
+	root = dtree_import_root(ctx);
+	override = getenv("PDATA_ATTR_OVERRIDE");
+
+	/* Same cronus target index for the lookup and the override export */
+	if (state->target[0] != '/' || override) {
+		index = dtree_cronus_index_new(root);
+		if (!index) {
+			fprintf(stderr, "Failed to index cronus targets\n");
+			return -1;
+		}
+	}
+
+	if (state->target[0] == '/')
+		node = dtm_find_node_by_path(root, state->target);
+	else
+		node = dtree_cronus_index_lookup(index, state->target);
+	if (!node) {
+		fprintf(stderr, "No such target %s\n", state->target);
+		goto done;
+	}
+
+	dtree_import_set_node(node, ctx);
+
+	ret = write_attr(ctx, state->attr_name, state->argv, state->argc, &attr, stderr);
+	if (ret != 0)
+		goto done;
+
+	if (override)
+		ret = do_write_export(override, index, node, attr);
+
+done:
+	if (index)
+		dtree_cronus_index_free(index);
+
+	return ret;
 }
 
 static int do_write(const char *dtb, const char *infodb, const char *target,
 		    const char *attr_name, const char **argv, int argc)
 {
 	struct do_write_state state;
-	int rc;
 
 	state = (struct do_write_state) {
 		.target = target,
@@ -370,34 +610,384 @@ static int do_write(const char *dtb, const char *infodb, const char *target,
 		.argc = argc,
 	};
 
-	rc = dtree_import(dtb, infodb, do_write_parse, &state);
-	if (rc != 0)
-		return rc;
+	return dtree_import(dtb, infodb, do_write_parse, &state);
+}
+
+/*
+ * Commands run against a device tree loaded for import, used by batch and
+ * serve.  The command line is in argv[1] onwards, same as sub-commands.
+ *
+ *   read <target> <attribute>
+ *   write <target> <attribute> <value>...
+ *   translate <target>
+ *   export [<export-options>]
+ */
+int session_init(struct attr_session *session, void *ctx, FILE *out, FILE *err)
+{
+	*session = (struct attr_session) {
+		.root = dtree_import_root(ctx),
+		.out = out,
+		.err = err,
+	};
+
+	session->buf = malloc(sizeof(struct dtree_buf));
+	if (!session->buf)
+		return -1;
 
-	return do_write_export(&state);
+	dtree_buf_init(session->buf, NULL);
+
+	session->index = dtree_cronus_index_new(session->root);
+	if (!session->index) {
+		free(session->buf);
+		return -1;
+	}
+
+	return 0;
+}
+
+void session_fini(struct attr_session *session)
+{
+	dtree_cronus_index_free(session->index);
+	dtree_buf_free(session->buf);
+	free(session->buf);
+}
+
+static struct dtm_node *session_node(struct attr_session *session, const char *target)
+{
+	if (target[0] == '/')
+		return dtm_find_node_by_path(session->root, target);
+
+	return dtree_cronus_index_lookup(session->index, target);
+}
+
+static int session_read(struct attr_session *session, void *ctx, int argc, const char **argv)
+{
+	struct dtm_node *node;
+	struct dtree_attr *attr;
+
+	if (argc != 4) {
+		fprintf(session->err, "Usage: read <target> <attribute>\n");
+		return -1;
+	}
+
+	node = session_node(session, argv[2]);
+	if (!node) {
+		fprintf(session->err, "No such target %s\n", argv[2]);
+		return -1;
+	}
+
+	dtree_import_set_node(node, ctx);
+
+	if (dtree_import_attr(argv[3], ctx, &attr) < 0) {
+		fprintf(session->err, "No such attribute %s\n", argv[3]);
+		return 1;
+	}
+
+	print_attr(attr, session->buf, session->out);
+	return 0;
+}
+
+static int session_write(struct attr_session *session, void *ctx, int argc, const char **argv)
+{
+	struct dtm_node *node;
+	struct dtree_attr *attr;
+	const char *target;
+	int ret;
+
+	if (argc < 5) {
+		fprintf(session->err, "Usage: write <target> <attribute> <value>\n");
+		return -1;
+	}
+
+	node = session_node(session, argv[2]);
+	if (!node) {
+		fprintf(session->err, "No such target %s\n", argv[2]);
+		return -1;
+	}
+
+	dtree_import_set_node(node, ctx);
+
+	ret = write_attr(ctx, argv[3], &argv[4], argc - 4, &attr, session->err);
+	if (ret != 0)
+		return ret;
+
+	if (session->override) {
+		target = dtree_cronus_index_target(session->index, node);
+		if (!target) {
+			fprintf(session->err, "Failed to translate node\n");
+			return -1;
+		}
+
+		dtree_cronus_buf_print_node(target, session->override);
+		dtree_cronus_buf_print_attr(attr, session->override);
+	}
+
+	return 0;
+}
+
+static int session_translate(struct attr_session *session, int argc, const char **argv)
+{
+	const char *target, *cname;
+	struct dtm_node *node;
+	char *path;
+
+	if (argc != 3) {
+		fprintf(session->err, "Usage: translate <target>\n");
+		return -1;
+	}
+
+	target = argv[2];
+
+	node = session_node(session, target);
+	if (!node) {
+		fprintf(session->err, "Failed to translate %s\n", target);
+		return 2;
+	}
+
+	if (target[0] == '/') {
+		cname = dtree_cronus_index_target(session->index, node);
+		if (!cname) {
+			fprintf(session->err, "Failed to translate %s\n", target);
+			return 2;
+		}
+
+		fprintf(session->out, "%s ---> %s\n", target, cname);
+	} else {
+		path = dtm_node_path(node);
+		if (!path) {
+			fprintf(session->err, "Failed to translate %s\n", target);
+			return 2;
+		}
+
+		fprintf(session->out, "%s ---> %s\n", target, path);
+		free(path);
+	}
+
+	return 0;
+}
+
+static int session_export(struct attr_session *session, void *ctx, int argc, const char **argv)
+{
+	struct dtree_export_filter *filter;
+	struct dtree_export_ctx *ectx;
+	int flags, ret;
+
+	filter = dtree_export_filter_new();
+	if (!filter)
+		return -1;
+
+	flags = export_options(&argc, argv, filter);
+	if (flags < 0 || argc != 2) {
+		fprintf(session->err, "Usage: export [<export-options>]\n");
+		dtree_export_filter_free(filter);
+		return -1;
+	}
+
+	ret = dtree_export_open_tree(session->root, dtree_import_infodb(ctx), filter, flags, &ectx);
+	dtree_export_filter_free(filter);
+	if (ret)
+		return ret;
+
+	if (flags & DTREE_EXPORT_BINARY)
+		ret = dtree_binary_export_ctx(ectx, session->out);
+	else
+		ret = dtree_cronus_export_ctx(ectx, session->out);
+	dtree_export_close(ectx);
+	return ret;
+}
+
+int session_command(struct attr_session *session, void *ctx, int argc, const char **argv)
+{
+	if (argc < 2)
+		return -1;
+
+	if (strcmp(argv[1], "read") == 0)
+		return session_read(session, ctx, argc, argv);
+	else if (strcmp(argv[1], "write") == 0)
+		return session_write(session, ctx, argc, argv);
+	else if (strcmp(argv[1], "translate") == 0)
+		return session_translate(session, argc, argv);
+	else if (strcmp(argv[1], "export") == 0)
+		return session_export(session, ctx, argc, argv);
+
+	fprintf(session->err, "Invalid command %s\n", argv[1]);
+	return -1;
+}
+
+/*
+ * Batch of commands, one command per line
+ *
+ * Empty lines and lines starting with # are ignored.  The device tree and
+ * infodb are loaded only once, and all the writes are written to the device
+ * tree file at the end.  If any command fails, nothing is written.
+ */
+struct do_batch_state {
+	FILE *fp;
+	struct dtree_buf *override;
+
+	const char **argv;
+	int argc, argv_allocated;
+};
+
+static bool batch_split(struct do_batch_state *state, char *line)
+{
+	char *tok, *saveptr = NULL;
+
+	/* argv[0] is unused, same as sub-commands */
+	state->argc = 1;
+
+	for (tok = strtok_r(line, " \t\n", &saveptr);
+	     tok;
+	     tok = strtok_r(NULL, " \t\n", &saveptr)) {
+		if (state->argc >= state->argv_allocated) {
+			const char **argv;
+			int n = state->argv_allocated ? state->argv_allocated * 2 : 32;
+
+			argv = realloc(state->argv, n * sizeof(char *));
+			if (!argv)
+				return false;
+
+			state->argv = argv;
+			state->argv_allocated = n;
+			state->argv[0] = "batch";
+		}
+
+		state->argv[state->argc++] = tok;
+	}
+
+	return true;
+}
+
+static int do_batch_parse(void *ctx, void *priv)
+{
+	struct do_batch_state *state = (struct do_batch_state *)priv;
+	struct attr_session session;
+	char *line = NULL;
+	size_t len = 0;
+	int lineno = 0, ret = 0;
+
+	dtree_import_defer(ctx);
+
+	if (session_init(&session, ctx, stdout, stderr))
+		return -1;
+
+	session.override = state->override;
+
+	while (getline(&line, &len, state->fp) != -1) {
+		lineno++;
+
+		if (!batch_split(state, line)) {
+			ret = -1;
+			break;
+		}
+
+		if (state->argc == 1 || state->argv[1][0] == '#')
+			continue;
+
+		ret = session_command(&session, ctx, state->argc, state->argv);
+		if (ret != 0) {
+			fprintf(stderr, "Batch failed at line %d, no attributes written\n", lineno);
+			break;
+		}
+	}
+
+	free(line);
+	session_fini(&session);
+	return ret;
+}
+
+static int do_batch(const char *dtb, const char *infodb, const char *filename)
+{
+	struct do_batch_state state;
+	struct dtree_buf override;
+	const char *override_path;
+	FILE *fp;
+	int ret;
+
+	state = (struct do_batch_state) {
+		.fp = stdin,
+	};
+
+	if (filename && strcmp(filename, "-") != 0) {
+		state.fp = fopen(filename, "r");
+		if (!state.fp) {
+			fprintf(stderr, "Failed to open %s\n", filename);
+			return -1;
+		}
+	}
+
+	/* Override records are appended only if the whole batch succeeds */
+	override_path = getenv("PDATA_ATTR_OVERRIDE");
+	dtree_buf_init(&override, NULL);
+	if (override_path)
+		state.override = &override;
+
+	ret = dtree_import(dtb, infodb, do_batch_parse, &state);
+	fflush(stdout);
+
+	if (state.fp != stdin)
+		fclose(state.fp);
+	free(state.argv);
+
+	if (ret == 0 && override.len > 0) {
+		fp = fopen(override_path, "a");
+		if (!fp) {
+			fprintf(stderr, "Failed to open %s in append mode\n", override_path);
+			ret = -1;
+		} else {
+			if (fwrite(override.data, 1, override.len, fp) != override.len)
+				ret = -1;
+			fclose(fp);
+		}
+	}
+
+	dtree_buf_free(&override);
+	return ret;
 }
 
 static void bmc_usage(const char *prog)
 {
-	fprintf(stderr, "Usage: %s export [<attr-list>]\n", prog);
-	fprintf(stderr, "       %s import <attr-dump>\n", prog);
+	fprintf(stderr, "Usage: %s export [<export-options>] [<attr-list>]\n", prog);
+	fprintf(stderr, "       %s import [--stats] <attr-dump>\n", prog);
+	fprintf(stderr, "       %s migrate [--old-infodb <old-infodb>] <old-dtb> <attr-list>\n", prog);
 	fprintf(stderr, "       %s read <target> <attribute>\n", prog);
 	fprintf(stderr, "       %s write <target> <attribute> <value>\n", prog);
 	fprintf(stderr, "       %s translate <target>\n", prog);
+	fprintf(stderr, "       %s batch [<batch-file>]\n", prog);
+	fprintf(stderr, "       %s serve [<socket>]\n", prog);
+	fprintf(stderr, "       %s journal\n", prog);
+	fprintf(stderr, "       %s compact\n", prog);
+	fprintf(stderr, "       %s overlay <overlay>\n", prog);
+	fprintf(stderr, "       %s flatten <out-dtb>\n", prog);
+	fprintf(stderr, "       %s image\n", prog);
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  <export-options>\n");
+	fprintf(stderr, "    --non-default     - Export only attributes with value different from default\n");
+	fprintf(stderr, "    --binary          - Export in binary format, for import only\n");
+	fprintf(stderr, "    --target <target> - Export only target (and its children for device tree path)\n");
+	fprintf(stderr, "                        e.g. p10:k0:n0:s0:p00:c* or /proc0\n");
+	fprintf(stderr, "    --class <class>   - Export only targets of a class, e.g. core\n");
 	fprintf(stderr, "  <attr-list>   - Filename containing list of attribute names to export\n");
 	fprintf(stderr, "  <attr-dump>   - Filename containing targets and attribute values\n");
+	fprintf(stderr, "  <old-dtb>     - Device tree to copy attribute values from\n");
 	fprintf(stderr, "  <target>      - Device tree target\n");
 	fprintf(stderr, "                  e.g. p10:k0:n0:s0:p00 (cronus) or /proc0 (device tree path)\n");
 	fprintf(stderr, "  <attribute>   - Name of an attribute\n");
 	fprintf(stderr, "  <value>       - Value of the attribute\n");
+	fprintf(stderr, "  <batch-file>  - Filename containing read, write, translate and export\n");
+	fprintf(stderr, "                  commands, one per line (default stdin)\n");
+	fprintf(stderr, "  <socket>      - Path of unix domain socket (default $PDATA_SOCKET)\n");
+	fprintf(stderr, "  <overlay>     - Device tree with only the attribute values overridden\n");
+	fprintf(stderr, "  <out-dtb>     - Device tree to write\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Sub-Command:\n");
 	fprintf(stderr, "  export        - Used to print all attribute values\n");
 	fprintf(stderr, "                  e.g. %s export > attributes_dump.txt\n", prog);
 	fprintf(stderr, "  import        - Used to update device tree with attribute values\n");
 	fprintf(stderr, "                  e.g. %s import attributes_dump.txt\n", prog);
+	fprintf(stderr, "  migrate       - Used to copy attribute values from another device tree\n");
+	fprintf(stderr, "                  e.g. %s migrate old.dtb preserved_attrs_list\n", prog);
 	fprintf(stderr, "  read          - Used to print a single attribute value for a target\n");
 	fprintf(stderr, "                  e.g. %s read p10:k0:n0:s0:p00 ATTR_NAME\n", prog);
 	fprintf(stderr, "  write         - Used to modify a single attribute value for a target\n");
@@ -405,32 +995,109 @@ static void bmc_usage(const char *prog)
 	fprintf(stderr, "  translate     - Used to translate target name between cronus and device tree\n");
 	fprintf(stderr, "                  e.g. %s translate p10:k0:n0:s0:p00\n", prog);
 	fprintf(stderr, "                  e.g. %s translate /proc0\n", prog);
+	fprintf(stderr, "  batch         - Used to run many commands at once\n");
+	fprintf(stderr, "                  e.g. %s batch commands.txt\n", prog);
+	fprintf(stderr, "  serve         - Used to keep device tree loaded and serve other commands\n");
+	fprintf(stderr, "                  if $PDATA_SOCKET is set, other commands use the server\n");
+	fprintf(stderr, "                  e.g. %s serve /run/pdata.sock\n", prog);
+	fprintf(stderr, "  journal       - Used to write attribute values to a journal next to device tree\n");
+	fprintf(stderr, "                  instead of modifying device tree, e.g. %s journal\n", prog);
+	fprintf(stderr, "  compact       - Used to fold the journal back into device tree\n");
+	fprintf(stderr, "                  e.g. %s compact\n", prog);
+	fprintf(stderr, "  overlay       - Used to create an overlay on top of device tree, which then\n");
+	fprintf(stderr, "                  can be used as device tree, e.g. %s overlay lab.dtb\n", prog);
+	fprintf(stderr, "  flatten       - Used to write device tree with overlay and journal merged\n");
+	fprintf(stderr, "                  e.g. %s flatten merged.dtb\n", prog);
+	fprintf(stderr, "  image         - Used to write pre-parsed image of device tree, which is shared\n");
+	fprintf(stderr, "                  by all the exports until device tree is modified\n");
+	fprintf(stderr, "                  e.g. %s image\n", prog);
 	fprintf(stderr, "\n");
 
 	exit(1);
 }
 
+/*
+ * Commands which can be run by the server, i.e. which do not need a file or
+ * the environment of the client
+ */
+static bool serve_command(int argc, const char **argv)
+{
+	int i;
+
+	if (strcmp(argv[1], "read") == 0)
+		return argc == 4;
+
+	if (strcmp(argv[1], "translate") == 0)
+		return argc == 3;
+
+	if (strcmp(argv[1], "write") == 0)
+		return argc >= 5 && !getenv("PDATA_ATTR_OVERRIDE");
+
+	/* Only export options, no attribute list */
+	if (strcmp(argv[1], "export") == 0) {
+		for (i=2; i<argc; i++) {
+			if (strcmp(argv[i], "--non-default") == 0)
+				continue;
+			if ((strcmp(argv[i], "--target") == 0 ||
+			     strcmp(argv[i], "--class") == 0) && i+1 < argc) {
+				i++;
+				continue;
+			}
+			return false;
+		}
+		return true;
+	}
+
+	return false;
+}
+
 static int bmc_main(const char *dtb, const char *infodb, int argc, const char **argv)
 {
+	const char *socket_path;
 	int ret = -1;
 
 	if (argc < 2)
 		bmc_usage(argv[0]);
 
+	/* Use the server if running, otherwise run the command locally */
+	socket_path = getenv("PDATA_SOCKET");
+	if (socket_path && serve_command(argc, argv)) {
+		if (serve_request(socket_path, dtb, infodb, argc, argv, &ret) == 0)
+			return ret;
+	}
+
 	if (strcmp(argv[1], "export") == 0) {
-		if (argc != 2 && argc != 3)
+		struct dtree_export_filter *filter;
+		int flags;
+
+		filter = dtree_export_filter_new();
+		if (!filter)
+			return -1;
+
+		flags = export_options(&argc, argv, filter);
+		if (flags < 0 || (argc != 2 && argc != 3))
 			bmc_usage(argv[0]);
 
 		if (argc == 2)
-			ret = do_export(dtb, infodb, NULL);
+			ret = do_export(dtb, infodb, NULL, filter, flags);
 		else
-			ret = do_export(dtb, infodb, argv[2]);
+			ret = do_export(dtb, infodb, argv[2], filter, flags);
 
 	} else if (strcmp(argv[1], "import") == 0) {
+		bool stats = import_options(&argc, argv);
+
 		if (argc != 3)
 			bmc_usage(argv[0]);
 
-		ret = do_import(dtb, infodb, argv[2]);
+		ret = do_import(dtb, infodb, argv[2], stats);
+
+	} else if (strcmp(argv[1], "migrate") == 0) {
+		const char *old_infodb = migrate_options(&argc, argv);
+
+		if (argc != 4)
+			bmc_usage(argv[0]);
+
+		ret = do_migrate(argv[2], dtb, infodb, old_infodb, argv[3]);
 
 	} else if (strcmp(argv[1], "read") == 0) {
 		if (argc != 4)
@@ -450,6 +1117,50 @@ static int bmc_main(const char *dtb, const char *infodb, int argc, const char **
 
 		ret = do_write(dtb, infodb, argv[2], argv[3], &argv[4], argc-4);
 
+	} else if (strcmp(argv[1], "batch") == 0) {
+		if (argc != 2 && argc != 3)
+			bmc_usage(argv[0]);
+
+		ret = do_batch(dtb, infodb, argc == 3 ? argv[2] : NULL);
+
+	} else if (strcmp(argv[1], "serve") == 0) {
+		if (argc == 3)
+			socket_path = argv[2];
+		else if (argc != 2 || !socket_path)
+			bmc_usage(argv[0]);
+
+		ret = do_serve(dtb, infodb, socket_path);
+
+	} else if (strcmp(argv[1], "journal") == 0) {
+		if (argc != 2)
+			bmc_usage(argv[0]);
+
+		ret = do_journal(dtb);
+
+	} else if (strcmp(argv[1], "compact") == 0) {
+		if (argc != 2)
+			bmc_usage(argv[0]);
+
+		ret = do_compact(dtb);
+
+	} else if (strcmp(argv[1], "overlay") == 0) {
+		if (argc != 3)
+			bmc_usage(argv[0]);
+
+		ret = do_overlay(dtb, argv[2]);
+
+	} else if (strcmp(argv[1], "flatten") == 0) {
+		if (argc != 3)
+			bmc_usage(argv[0]);
+
+		ret = do_flatten(dtb, argv[2]);
+
+	} else if (strcmp(argv[1], "image") == 0) {
+		if (argc != 2)
+			bmc_usage(argv[0]);
+
+		ret = do_image(dtb);
+
 	} else {
 		bmc_usage(argv[0]);
 	}
@@ -461,11 +1172,21 @@ static void usage(const char *prog)
 {
 	fprintf(stderr, "Usage: %s create <dtb> <infodb> <out-dtb>\n", prog);
 	fprintf(stderr, "       %s dump <dtb> <infodb> [<target>]\n", prog);
-	fprintf(stderr, "       %s export <dtb> <infodb> [<attr-list>]\n", prog);
-	fprintf(stderr, "       %s import <dtb> <infodb> <attr-dump>\n", prog);
+	fprintf(stderr, "       %s export [--non-default] [--binary] [--target <target>] [--class <class>]\n", prog);
+	fprintf(stderr, "                 <dtb> <infodb> [<attr-list>]\n");
+	fprintf(stderr, "       %s import [--stats] <dtb> <infodb> <attr-dump>\n", prog);
+	fprintf(stderr, "       %s migrate [--old-infodb <old-infodb>] <old-dtb> <new-dtb> <infodb> <attr-list>\n", prog);
 	fprintf(stderr, "       %s read <dtb> <infodb> <target> <attribute>\n", prog);
 	fprintf(stderr, "       %s translate <dtb> <target>\n", prog);
 	fprintf(stderr, "       %s write <dtb> <infodb> <target> <attribute> <value>\n", prog);
+	fprintf(stderr, "       %s batch <dtb> <infodb> [<batch-file>]\n", prog);
+	fprintf(stderr, "       %s serve <dtb> <infodb> <socket>\n", prog);
+	fprintf(stderr, "       %s journal <dtb>\n", prog);
+	fprintf(stderr, "       %s compact <dtb>\n", prog);
+	fprintf(stderr, "       %s overlay <base-dtb> <overlay>\n", prog);
+	fprintf(stderr, "       %s flatten <dtb> <out-dtb>\n", prog);
+	fprintf(stderr, "       %s image <dtb>\n", prog);
+	fprintf(stderr, "       %s stats <dtb> [<infodb>]\n", prog);
 	exit(1);
 }
 
@@ -474,6 +1195,9 @@ int main(int argc, const char **argv)
 	const char *dtb, *infodb;
 	int ret = -1;
 
+	/* Printed at exit with PDATA_STATS set */
+	dtree_stats_init();
+
 	dtb = getenv("PDBG_DTB");
 	infodb = getenv("PDATA_INFODB");
 	if (dtb && infodb) {
@@ -499,19 +1223,37 @@ int main(int argc, const char **argv)
 			ret = do_dump(argv[2], argv[3], argv[4]);
 
 	} else if (strcmp(argv[1], "export") == 0) {
-		if (argc != 4 && argc != 5)
+		struct dtree_export_filter *filter;
+		int flags;
+
+		filter = dtree_export_filter_new();
+		if (!filter)
+			return -1;
+
+		flags = export_options(&argc, argv, filter);
+		if (flags < 0 || (argc != 4 && argc != 5))
 			usage(argv[0]);
 
 		if (argc == 4)
-			ret = do_export(argv[2], argv[3], NULL);
+			ret = do_export(argv[2], argv[3], NULL, filter, flags);
 		else
-			ret = do_export(argv[2], argv[3], argv[4]);
+			ret = do_export(argv[2], argv[3], argv[4], filter, flags);
 
 	} else if (strcmp(argv[1], "import") == 0) {
+		bool stats = import_options(&argc, argv);
+
 		if (argc != 5)
 			usage(argv[0]);
 
-		ret = do_import(argv[2], argv[3], argv[4]);
+		ret = do_import(argv[2], argv[3], argv[4], stats);
+
+	} else if (strcmp(argv[1], "migrate") == 0) {
+		const char *old_infodb = migrate_options(&argc, argv);
+
+		if (argc != 6)
+			usage(argv[0]);
+
+		ret = do_migrate(argv[2], argv[3], argv[4], old_infodb, argv[5]);
 
 	} else if (strcmp(argv[1], "read") == 0) {
 		if (argc != 6)
@@ -531,6 +1273,54 @@ int main(int argc, const char **argv)
 
 		ret = do_write(argv[2], argv[3], argv[4], argv[5], &argv[6], argc-6);
 
+	} else if (strcmp(argv[1], "batch") == 0) {
+		if (argc != 4 && argc != 5)
+			usage(argv[0]);
+
+		ret = do_batch(argv[2], argv[3], argc == 5 ? argv[4] : NULL);
+
+	} else if (strcmp(argv[1], "serve") == 0) {
+		if (argc != 5)
+			usage(argv[0]);
+
+		ret = do_serve(argv[2], argv[3], argv[4]);
+
+	} else if (strcmp(argv[1], "journal") == 0) {
+		if (argc != 3)
+			usage(argv[0]);
+
+		ret = do_journal(argv[2]);
+
+	} else if (strcmp(argv[1], "compact") == 0) {
+		if (argc != 3)
+			usage(argv[0]);
+
+		ret = do_compact(argv[2]);
+
+	} else if (strcmp(argv[1], "overlay") == 0) {
+		if (argc != 4)
+			usage(argv[0]);
+
+		ret = do_overlay(argv[2], argv[3]);
+
+	} else if (strcmp(argv[1], "flatten") == 0) {
+		if (argc != 4)
+			usage(argv[0]);
+
+		ret = do_flatten(argv[2], argv[3]);
+
+	} else if (strcmp(argv[1], "image") == 0) {
+		if (argc != 3)
+			usage(argv[0]);
+
+		ret = do_image(argv[2]);
+
+	} else if (strcmp(argv[1], "stats") == 0) {
+		if (argc != 3 && argc != 4)
+			usage(argv[0]);
+
+		ret = do_stats(argv[2], argc == 4 ? argv[3] : NULL);
+
 	} else {
 		usage(argv[0]);
 	}
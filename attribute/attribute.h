@@ -0,0 +1,51 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __ATTRIBUTE_H__
+#define __ATTRIBUTE_H__
+
+#include <stdio.h>
+
+struct dtm_node;
+struct dtree_buf;
+struct dtree_cronus_index;
+struct dtree_export_filter;
+
+/* Commands run against a device tree loaded for import */
+struct attr_session {
+	struct dtm_node *root;
+	struct dtree_cronus_index *index;
+	FILE *out;
+	FILE *err;
+
+	/* Formatting buffer for the values read, reused for all the commands */
+	struct dtree_buf *buf;
+
+	/* Records for PDATA_ATTR_OVERRIDE, NULL if not required */
+	struct dtree_buf *override;
+};
+
+int export_options(int *argc, const char **argv, struct dtree_export_filter *filter);
+
+int session_init(struct attr_session *session, void *ctx, FILE *out, FILE *err);
+void session_fini(struct attr_session *session);
+int session_command(struct attr_session *session, void *ctx, int argc, const char **argv);
+
+int do_serve(const char *dtb, const char *infodb, const char *path);
+int serve_request(const char *path, const char *dtb, const char *infodb,
+		  int argc, const char **argv, int *status);
+
+#endif /* __ATTRIBUTE_H__ */
@@ -0,0 +1,515 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "libdtm/dtm.h"
+#include "libdtree/dtree.h"
+
+#include "attribute.h"
+
+/*
+ * Attributes server
+ *
+ * The server keeps the device tree, the infodb and the cronus target index
+ * loaded, and runs one command per connection on a unix domain socket.
+ *
+ * Request:  device tree and infodb of the client (absolute paths), followed
+ *           by the words of the command (sub-command onwards), each
+ *           terminated by NUL, till the client shuts down the connection
+ *           for writing
+ * Response: status, length of output and length of error output (each as
+ *           32-bit integer in network byte order), followed by the output
+ *           and the error output
+ *
+ * The device tree is reloaded when it (or infodb) is modified by any other
+ * process.  The server keeps the device tree open for writing and updates
+ * it in place using mmap, which does not generate inotify events, so only
+ * the changes by other processes are noticed.  If the device tree has a
+ * journal, the journal is watched as well, and writes by the server also
+ * cause a reload.
+ *
+ * The socket is accessible only to the user running the server, and is not
+ * taken over from another server which is still running.  A request for a
+ * different device tree or infodb than the server's is rejected.
+ */
+
+#define SERVE_REQUEST_MAX	65536
+#define SERVE_TIMEOUT_SEC	5
+
+/* Return value of the server loop to reload the device tree */
+#define SERVE_RELOAD		1
+
+struct serve_reply {
+	uint32_t status;
+	uint32_t out_len;
+	uint32_t err_len;
+};
+
+struct do_serve_state {
+	int sock;
+	int inotify;
+	char *dtb;
+	char *infodb;
+};
+
+static volatile sig_atomic_t serve_stop;
+
+static void serve_signal(int sig)
+{
+	serve_stop = 1;
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+	const char *ptr = (const char *)buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(fd, ptr, len, MSG_NOSIGNAL);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		ptr += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+static bool read_all(int fd, void *buf, size_t len)
+{
+	char *ptr = (char *)buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = read(fd, ptr, len);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+
+		ptr += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+/* Split NUL terminated words into argv[1] onwards */
+static int serve_split(char *buf, size_t len, const char **argv, int max)
+{
+	size_t i, start = 0;
+	int argc = 1;
+
+	argv[0] = "serve";
+
+	for (i=0; i<len; i++) {
+		if (buf[i] != '\0')
+			continue;
+
+		if (argc == max)
+			return -1;
+
+		argv[argc++] = &buf[start];
+		start = i+1;
+	}
+
+	/* Last word is not terminated */
+	if (start != len)
+		return -1;
+
+	return argc;
+}
+
+/* Absolute path of a file, or the path as is if it cannot be resolved */
+static char *serve_path(const char *path)
+{
+	char *real;
+
+	real = realpath(path, NULL);
+	if (real)
+		return real;
+
+	return strdup(path);
+}
+
+static void serve_client(int fd, struct attr_session *session, void *ctx,
+			 struct do_serve_state *state)
+{
+	struct serve_reply reply;
+	struct timeval tv = { .tv_sec = SERVE_TIMEOUT_SEC };
+	const char **argv = NULL;
+	char *buf, *out_buf = NULL, *err_buf = NULL;
+	size_t len = 0, out_len = 0, err_len = 0;
+	ssize_t n;
+	int argc, ret;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	buf = malloc(SERVE_REQUEST_MAX);
+	if (!buf)
+		return;
+
+	while (len < SERVE_REQUEST_MAX) {
+		n = read(fd, buf + len, SERVE_REQUEST_MAX - len);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1)
+			goto done;
+		if (n == 0)
+			break;
+
+		len += n;
+	}
+
+	/* At most one word per byte */
+	argv = malloc((len + 2) * sizeof(char *));
+	if (!argv)
+		goto done;
+
+	session->out = open_memstream(&out_buf, &out_len);
+	session->err = open_memstream(&err_buf, &err_len);
+	if (!session->out || !session->err)
+		goto done;
+
+	argc = serve_split(buf, len, argv, len + 2);
+	if (argc < 4) {
+		fprintf(session->err, "Invalid request\n");
+		ret = -1;
+	} else if (strcmp(argv[1], state->dtb) != 0 || strcmp(argv[2], state->infodb) != 0) {
+		fprintf(session->err, "Server serves %s and %s, not %s and %s\n",
+			state->dtb, state->infodb, argv[1], argv[2]);
+		ret = -1;
+	} else {
+		/* Command starts after device tree and infodb */
+		argv[2] = argv[0];
+		ret = session_command(session, ctx, argc - 2, &argv[2]);
+	}
+
+	fclose(session->out);
+	fclose(session->err);
+	session->out = NULL;
+	session->err = NULL;
+
+	reply = (struct serve_reply) {
+		.status = htonl((uint32_t)ret),
+		.out_len = htonl(out_len),
+		.err_len = htonl(err_len),
+	};
+
+	if (write_all(fd, &reply, sizeof(reply)) &&
+	    write_all(fd, out_buf, out_len))
+		write_all(fd, err_buf, err_len);
+
+done:
+	if (session->out)
+		fclose(session->out);
+	if (session->err)
+		fclose(session->err);
+	free(out_buf);
+	free(err_buf);
+	free(argv);
+	free(buf);
+}
+
+static int do_serve_parse(void *ctx, void *priv)
+{
+	struct do_serve_state *state = (struct do_serve_state *)priv;
+	struct attr_session session;
+	struct pollfd pfd[2];
+	int fd, ret = 0;
+
+	if (session_init(&session, ctx, NULL, NULL))
+		return -1;
+
+	pfd[0] = (struct pollfd) { .fd = state->sock, .events = POLLIN };
+	pfd[1] = (struct pollfd) { .fd = state->inotify, .events = POLLIN };
+
+	while (!serve_stop) {
+		if (poll(pfd, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+
+			perror("poll");
+			ret = -1;
+			break;
+		}
+
+		if (pfd[1].revents) {
+			ret = SERVE_RELOAD;
+			break;
+		}
+
+		if (pfd[0].revents) {
+			fd = accept(state->sock, NULL, NULL);
+			if (fd == -1)
+				continue;
+
+			serve_client(fd, &session, ctx, state);
+			close(fd);
+		}
+	}
+
+	session_fini(&session);
+	return ret;
+}
+
+/* Discard pending events, including the ones caused by the server itself */
+static void serve_drain(int fd)
+{
+	char buf[4096];
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+}
+
+/* Check for a server already running on the socket */
+static bool serve_running(const struct sockaddr_un *addr)
+{
+	bool running;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return false;
+
+	running = (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0);
+	close(fd);
+	return running;
+}
+
+static int serve_socket(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct stat st;
+	mode_t mask;
+	int fd, ret;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path too long %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	/* Remove stale socket, but nothing else */
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			fprintf(stderr, "%s exists and is not a socket\n", path);
+			return -1;
+		}
+
+		if (serve_running(&addr)) {
+			fprintf(stderr, "Server already running on %s\n", path);
+			return -1;
+		}
+
+		unlink(path);
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		perror("socket");
+		return -1;
+	}
+
+	/* Only the owner can connect, i.e. run commands */
+	mask = umask(0177);
+	ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+
+	if (ret == -1) {
+		fprintf(stderr, "Failed to bind %s\n", path);
+		close(fd);
+		return -1;
+	}
+
+	if (listen(fd, 16) == -1) {
+		perror("listen");
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+
+	return fd;
+}
+
+int do_serve(const char *dtb, const char *infodb, const char *path)
+{
+	struct do_serve_state state;
+	struct sigaction sa = { .sa_handler = serve_signal };
+	uint32_t mask;
+	char *journal;
+	int ret;
+
+	state = (struct do_serve_state) {
+		.sock = -1,
+		.inotify = -1,
+	};
+
+	journal = dtm_file_journal_name(dtb);
+	state.dtb = serve_path(dtb);
+	state.infodb = serve_path(infodb);
+	if (!journal || !state.dtb || !state.infodb) {
+		ret = -1;
+		goto done;
+	}
+
+	state.sock = serve_socket(path);
+	if (state.sock == -1) {
+		ret = -1;
+		goto done;
+	}
+
+	state.inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (state.inotify == -1) {
+		perror("inotify_init1");
+		ret = -1;
+		goto done;
+	}
+
+	/* No SA_RESTART, so that poll() is interrupted */
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	mask = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF;
+
+	do {
+		/* Watches are added again, in case the files are replaced */
+		if (inotify_add_watch(state.inotify, dtb, mask) == -1 ||
+		    inotify_add_watch(state.inotify, infodb, mask) == -1) {
+			fprintf(stderr, "Failed to watch %s and %s\n", dtb, infodb);
+			ret = -1;
+			break;
+		}
+
+		/* Journal is optional */
+		inotify_add_watch(state.inotify, journal, mask);
+
+		ret = dtree_import(dtb, infodb, do_serve_parse, &state);
+		serve_drain(state.inotify);
+	} while (ret == SERVE_RELOAD && !serve_stop);
+
+done:
+	if (state.inotify != -1)
+		close(state.inotify);
+	if (state.sock != -1) {
+		close(state.sock);
+		unlink(path);
+	}
+	free(state.dtb);
+	free(state.infodb);
+	free(journal);
+	return ret;
+}
+
+/*
+ * Run a command using the server, returns -1 if the server is not running,
+ * otherwise the status of the command.
+ */
+int serve_request(const char *path, const char *dtb, const char *infodb,
+		  int argc, const char **argv, int *status)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct serve_reply reply;
+	char *buf, *dtb_path, *infodb_path;
+	size_t len, out_len, err_len;
+	bool ok;
+	int fd, i;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return -1;
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	/* Server checks that it has the same device tree and infodb */
+	dtb_path = serve_path(dtb);
+	infodb_path = serve_path(infodb);
+	ok = dtb_path && infodb_path &&
+	     write_all(fd, dtb_path, strlen(dtb_path) + 1) &&
+	     write_all(fd, infodb_path, strlen(infodb_path) + 1);
+	free(dtb_path);
+	free(infodb_path);
+	if (!ok)
+		goto fail;
+
+	for (i=1; i<argc; i++) {
+		if (!write_all(fd, argv[i], strlen(argv[i]) + 1))
+			goto fail;
+	}
+	shutdown(fd, SHUT_WR);
+
+	if (!read_all(fd, &reply, sizeof(reply)))
+		goto fail;
+
+	out_len = ntohl(reply.out_len);
+	err_len = ntohl(reply.err_len);
+
+	len = out_len > err_len ? out_len : err_len;
+	buf = malloc(len ? len : 1);
+	if (!buf)
+		goto fail;
+
+	if (!read_all(fd, buf, out_len)) {
+		free(buf);
+		goto fail;
+	}
+	fwrite(buf, 1, out_len, stdout);
+
+	if (!read_all(fd, buf, err_len)) {
+		free(buf);
+		goto fail;
+	}
+	fwrite(buf, 1, err_len, stderr);
+
+	free(buf);
+	close(fd);
+
+	*status = (int)ntohl(reply.status);
+	return 0;
+
+fail:
+	fprintf(stderr, "Lost connection to server %s\n", path);
+	close(fd);
+	*status = -1;
+	return 0;
+}
@@ -54,6 +54,41 @@ $ATTRIBUTES export $DTB1 $INFODB > $DUMP2
 echo "Check for export diff"
 diff $DUMP $DUMP2
 
+echo "Import dtb using multiple threads"
+$ATTRIBUTES create $DTB $INFODB $DTB1
+PDATA_IMPORT_THREADS=4 $ATTRIBUTES import $DTB1 $INFODB $DUMP
+$ATTRIBUTES export $DTB1 $INFODB > $DUMP2
+diff $DUMP $DUMP2
+
+echo "Export non-default attributes"
+$ATTRIBUTES export --non-default $DTB1 $INFODB > $DUMP2
+
+echo "Import non-default attributes into default dtb"
+$ATTRIBUTES create $DTB $INFODB $DTB1
+$ATTRIBUTES import $DTB1 $INFODB $DUMP2
+$ATTRIBUTES export $DTB1 $INFODB > $DUMP2
+
+echo "Check for export diff"
+diff $DUMP $DUMP2
+
+echo "Re-import unchanged attributes"
+$ATTRIBUTES import --stats $DTB1 $INFODB $DUMP > ./import.out
+grep -q "^0 attributes updated" ./import.out
+
+echo "Export filtered targets"
+test $($ATTRIBUTES export --target /proc0 $DTB1 $INFODB | grep -c "^target") -eq 1
+test $($ATTRIBUTES export --class proc $DTB1 $INFODB | grep -c "^target") -eq 2
+test $($ATTRIBUTES export --target 'p10:k0:n0:s0:p0[1-9]' $DTB1 $INFODB | grep -c "^target") -eq 1
+test $($ATTRIBUTES export --target 'p10:k0:n0:s0:p0[5-9]' $DTB1 $INFODB | grep -c "^target") -eq 0
+
+echo "Export unknown targets"
+$ATTRIBUTES export --target /nosuch $DTB1 $INFODB > $DUMP2 && exit 1
+test ! -s $DUMP2
+$ATTRIBUTES export --target p10:k0:n0:s0:p07 $DTB1 $INFODB > $DUMP2 && exit 1
+test ! -s $DUMP2
+$ATTRIBUTES dump $DTB1 $INFODB /nosuch > $DUMP2 && exit 1
+test ! -s $DUMP2
+
 echo "Read attributes for /"
 $ATTRIBUTES read $DTB1 $INFODB / ATTR_TEST1
 $ATTRIBUTES read $DTB1 $INFODB / ATTR_TEST2
@@ -67,3 +102,161 @@ $ATTRIBUTES read $DTB1 $INFODB /proc0 ATTR_TEST6
 echo "Read attributes for /proc1"
 $ATTRIBUTES read $DTB1 $INFODB /proc1 ATTR_TEST5
 $ATTRIBUTES read $DTB1 $INFODB /proc1 ATTR_TEST6
+
+echo "Batch read, write and translate"
+cat > ./batch <<EOB
+# comment
+read /proc0 ATTR_TEST5
+write /proc0 ATTR_TEST5 processor3
+read /proc0 ATTR_TEST5
+translate /proc0
+EOB
+$ATTRIBUTES batch $DTB1 $INFODB ./batch > ./batch.out
+$ATTRIBUTES read $DTB1 $INFODB /proc0 ATTR_TEST5 | grep -q processor3
+test $(grep -c "ATTR_TEST5" ./batch.out) -eq 2
+
+echo "Failed batch writes nothing"
+printf "write /proc0 ATTR_TEST5 processor4\nwrite /proc0 ATTR_NOPE 1\n" | $ATTRIBUTES batch $DTB1 $INFODB - && exit 1
+$ATTRIBUTES read $DTB1 $INFODB /proc0 ATTR_TEST5 | grep -q processor3
+
+echo "Serve attributes"
+SOCK="./attributes.sock"
+PDBG_DTB=$DTB1 PDATA_INFODB=$INFODB $ATTRIBUTES serve $SOCK &
+SERVE_PID=$!
+for i in 1 2 3 4 5 6 7 8 9 10 ; do
+	[ -S $SOCK ] && break
+	sleep 0.2
+done
+test -S $SOCK
+test $(stat -c %a $SOCK) = 600
+PDBG_DTB=$DTB1 PDATA_INFODB=$INFODB $ATTRIBUTES serve $SOCK 2>&1 | grep -q "already running"
+test -S $SOCK
+PDBG_DTB=$DTB1 PDATA_INFODB=$INFODB PDATA_SOCKET=$SOCK $ATTRIBUTES write /proc1 ATTR_TEST5 processor5
+PDBG_DTB=$DTB1 PDATA_INFODB=$INFODB PDATA_SOCKET=$SOCK $ATTRIBUTES read /proc1 ATTR_TEST5 | grep -q processor5
+$ATTRIBUTES read $DTB1 $INFODB /proc1 ATTR_TEST5 | grep -q processor5
+PDBG_DTB=$DTB PDATA_INFODB=$INFODB PDATA_SOCKET=$SOCK $ATTRIBUTES write /proc1 ATTR_TEST5 processor6 2>&1 | grep -q "Server serves"
+$ATTRIBUTES read $DTB1 $INFODB /proc1 ATTR_TEST5 | grep -q processor5
+kill $SERVE_PID
+wait $SERVE_PID || true
+echo "not a socket" > $SOCK
+PDBG_DTB=$DTB1 PDATA_INFODB=$INFODB $ATTRIBUTES serve $SOCK && exit 1
+grep -q "not a socket" $SOCK
+rm -f $SOCK
+
+echo "Migrate attributes from old dtb"
+OLD_INFODB="./old_info.db"
+OLD_DTB="./old.dtb"
+sed -e 's/^ATTR_TEST2 uint16/ATTR_TEST2 uint8/' $INFODB > $OLD_INFODB
+$ATTRIBUTES create $DTB $OLD_INFODB $OLD_DTB
+$ATTRIBUTES write $OLD_DTB $OLD_INFODB / ATTR_TEST2 1 2 3 4 5 255
+$ATTRIBUTES write $OLD_DTB $OLD_INFODB /proc0 ATTR_TEST5 migrated
+$ATTRIBUTES create $DTB $INFODB $DTB1
+printf "ATTR_TEST2\nATTR_TEST5\n" > ./migrate_list
+$ATTRIBUTES migrate $OLD_DTB $DTB1 $INFODB ./migrate_list
+$ATTRIBUTES read $DTB1 $INFODB / ATTR_TEST2 | grep -q "0x0005 0x00ff"
+$ATTRIBUTES read $DTB1 $INFODB /proc0 ATTR_TEST5 | grep -q migrated
+! $ATTRIBUTES read $DTB1 $INFODB /proc1 ATTR_TEST5 | grep -q migrated
+
+echo "Migrate 1-D array with changed element size"
+sed -e 's/^ATTR_TEST3 uint32/ATTR_TEST3 uint16/' $INFODB > $OLD_INFODB
+$ATTRIBUTES create $DTB $OLD_INFODB $OLD_DTB
+$ATTRIBUTES write $OLD_DTB $OLD_INFODB / ATTR_TEST3 1 2 3 4
+$ATTRIBUTES create $DTB $INFODB $DTB1
+printf "ATTR_TEST3\n" > ./migrate_list
+$ATTRIBUTES migrate $OLD_DTB $DTB1 $INFODB ./migrate_list && exit 1
+! $ATTRIBUTES read $DTB1 $INFODB / ATTR_TEST3 | grep -q "0x00010002"
+$ATTRIBUTES migrate --old-infodb $OLD_INFODB $OLD_DTB $DTB1 $INFODB ./migrate_list
+$ATTRIBUTES read $DTB1 $INFODB / ATTR_TEST3 | grep -q "0x00000001).*0x00000002).*0x00000003).*0x00000004)"
+
+echo "Migrate attribute with changed type of the same size"
+sed -e 's/^ATTR_TEST4 uint64 0 0 0/ATTR_TEST4 uint8 1 8 0 0/' $INFODB > $OLD_INFODB
+$ATTRIBUTES create $DTB $OLD_INFODB $OLD_DTB
+$ATTRIBUTES write $OLD_DTB $OLD_INFODB / ATTR_TEST4 1 2 3 4 5 6 7 8
+$ATTRIBUTES create $DTB $INFODB $DTB1
+printf "ATTR_TEST4\n" > ./migrate_list
+$ATTRIBUTES migrate --old-infodb $OLD_INFODB $OLD_DTB $DTB1 $INFODB ./migrate_list
+$ATTRIBUTES read $DTB1 $INFODB / ATTR_TEST4 | grep -q "0x0000000000000001"
+
+echo "Binary export and import"
+$ATTRIBUTES export $DTB1 $INFODB > $DUMP
+$ATTRIBUTES export --binary $DTB1 $INFODB > ./attr_dump.bin
+$ATTRIBUTES create $DTB $INFODB $DTB1
+$ATTRIBUTES import $DTB1 $INFODB ./attr_dump.bin
+$ATTRIBUTES export $DTB1 $INFODB > $DUMP2
+diff $DUMP $DUMP2
+LC_ALL=C sed -e 's/ATTR_TEST4/compatible/' ./attr_dump.bin > ./attr_dump_bad.bin
+$ATTRIBUTES import $DTB1 $INFODB ./attr_dump_bad.bin 2>&1 | grep -q "Unknown attribute compatible"
+$ATTRIBUTES import $DTB1 $INFODB ./attr_dump_bad.bin 2>/dev/null && exit 1
+rm -f ./attr_dump_bad.bin
+
+echo "Import from a pipe"
+printf 'target = k0\nATTR_TEST4 u64 0x99\n' | $ATTRIBUTES import $DTB1 $INFODB /dev/stdin
+$ATTRIBUTES read $DTB1 $INFODB / ATTR_TEST4 | grep -q "0x0000000000000099"
+
+echo "Import into journal and compact"
+$ATTRIBUTES create $DTB $INFODB $DTB1
+$ATTRIBUTES journal $DTB1
+cp $DTB1 ./test2.dtb
+$ATTRIBUTES import $DTB1 $INFODB ./attr_dump.bin
+cmp $DTB1 ./test2.dtb
+$ATTRIBUTES export $DTB1 $INFODB > $DUMP2
+diff $DUMP $DUMP2
+$ATTRIBUTES compact $DTB1
+test $(wc -c < $DTB1.journal) -eq 16
+$ATTRIBUTES export $DTB1 $INFODB > $DUMP2
+diff $DUMP $DUMP2
+rm -f $DTB1.journal ./test2.dtb
+
+echo "Import into overlay and flatten"
+OVERLAY="./test_overlay.dtb"
+$ATTRIBUTES create $DTB $INFODB $DTB1
+cp $DTB1 ./test2.dtb
+$ATTRIBUTES overlay $DTB1 $OVERLAY
+$ATTRIBUTES import $OVERLAY $INFODB ./attr_dump.bin
+cmp $DTB1 ./test2.dtb
+$ATTRIBUTES export $OVERLAY $INFODB > $DUMP2
+diff $DUMP $DUMP2
+$ATTRIBUTES write $OVERLAY $INFODB /proc1 ATTR_TEST5 overlay
+$ATTRIBUTES read $OVERLAY $INFODB /proc1 ATTR_TEST5 | grep -q overlay
+$ATTRIBUTES flatten $OVERLAY ./test2.dtb
+$ATTRIBUTES read ./test2.dtb $INFODB /proc1 ATTR_TEST5 | grep -q overlay
+# Base written in place still matches, base of same size with other names does not
+$ATTRIBUTES write $DTB1 $INFODB /proc0 ATTR_TEST5 base
+$ATTRIBUTES read $OVERLAY $INFODB /proc1 ATTR_TEST5 | grep -q overlay
+cp $DTB1 ./test2.dtb
+LC_ALL=C sed -e 's/ATTR_TEST4/ATTR_TESTX/' ./test2.dtb > $DTB1
+cmp -s $DTB1 ./test2.dtb && exit 1
+test $(wc -c < $DTB1) -eq $(wc -c < ./test2.dtb)
+$ATTRIBUTES read $OVERLAY $INFODB /proc1 ATTR_TEST5 2>&1 | grep -q "does not match base"
+cp ./test2.dtb $DTB1
+rm -f $OVERLAY ./test2.dtb
+
+echo "Export with tree image"
+$ATTRIBUTES import $DTB1 $INFODB ./attr_dump.bin
+$ATTRIBUTES read $DTB1 $INFODB p10:k0:n0:s0:p01 ATTR_TEST5 > ./test_read
+# Old device tree, so that the image is checked by file status only
+touch -d 2020-01-01 $DTB1
+$ATTRIBUTES image $DTB1
+test -f $DTB1.image
+$ATTRIBUTES export $DTB1 $INFODB > $DUMP2
+diff $DUMP $DUMP2
+$ATTRIBUTES read $DTB1 $INFODB p10:k0:n0:s0:p01 ATTR_TEST5 | diff ./test_read -
+$ATTRIBUTES read $DTB1 $INFODB /proc1 ATTR_TEST5 | diff ./test_read -
+$ATTRIBUTES write $DTB1 $INFODB /proc1 ATTR_TEST5 image
+$ATTRIBUTES export $DTB1 $INFODB | grep -q image
+$ATTRIBUTES read $DTB1 $INFODB /proc1 ATTR_TEST5 | grep -q image
+rm -f $DTB1.image ./test_read
+
+echo "Export with statistics"
+PDATA_STATS=./test_stats.json $ATTRIBUTES export $DTB1 $INFODB > $DUMP2
+grep -q '"traverse": { "calls": 1,' ./test_stats.json
+PDATA_STATS=1 $ATTRIBUTES export $DTB1 $INFODB 2>&1 >/dev/null | grep -q "^bytes_written"
+rm -f ./test_stats.json
+
+echo "Tree statistics"
+$ATTRIBUTES stats $DTB1 > ./test_stats.txt
+grep -q "^  nodes  *[1-9]" ./test_stats.txt
+$ATTRIBUTES stats $DTB1 $INFODB > ./test_stats.txt
+grep -q "^  TARGET_TYPE_PROC_CHIP  *2 " ./test_stats.txt
+grep -q "^  ATTR_TEST5 " ./test_stats.txt
+rm -f ./test_stats.txt
@@ -0,0 +1,120 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "libdtree/dtree.h"
+
+/*
+ * Measure the throughput of cronus export (attributes export)
+ *
+ * The output of the first export is used to find the size of the dump,
+ * all the further exports are written to /dev/null.  With <max-threads>,
+ * parallel export is measured for 1 to <max-threads> worker threads.
+ */
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_export(const char *dtb, const char *infodb,
+			int count, int nthreads, long size)
+{
+	FILE *fp;
+	double start, elapsed;
+	int i, ret;
+
+	fp = fopen("/dev/null", "w");
+	if (!fp) {
+		perror("/dev/null");
+		return -1;
+	}
+
+	start = now();
+	for (i=0; i<count; i++) {
+		ret = dtree_cronus_export_parallel(dtb, infodb, NULL, NULL, fp, nthreads, 0);
+		if (ret != 0) {
+			fprintf(stderr, "Export failed, ret=%d\n", ret);
+			fclose(fp);
+			return -1;
+		}
+	}
+	elapsed = now() - start;
+
+	fclose(fp);
+
+	printf("export: threads=%d, %d iterations, %ld bytes, %.3f ms/export, %.1f MB/s\n",
+	       nthreads, count, size, elapsed * 1000 / count,
+	       (double)size * count / elapsed / (1024 * 1024));
+
+	return 0;
+}
+
+int main(int argc, const char **argv)
+{
+	FILE *fp;
+	long size;
+	int count = 10, max_threads = 1, i, ret;
+
+	if (argc < 3 || argc > 5) {
+		fprintf(stderr, "Usage: %s <dtb> <infodb> [<iterations> [<max-threads>]]\n", argv[0]);
+		exit(1);
+	}
+
+	if (argc >= 4)
+		count = atoi(argv[3]);
+
+	if (count <= 0) {
+		fprintf(stderr, "Invalid iterations %s\n", argv[3]);
+		exit(1);
+	}
+
+	if (argc == 5)
+		max_threads = atoi(argv[4]);
+
+	if (max_threads <= 0) {
+		fprintf(stderr, "Invalid threads %s\n", argv[4]);
+		exit(1);
+	}
+
+	fp = tmpfile();
+	if (!fp) {
+		perror("tmpfile");
+		exit(1);
+	}
+
+	ret = dtree_cronus_export(argv[1], argv[2], NULL, fp);
+	if (ret != 0) {
+		fprintf(stderr, "Export failed, ret=%d\n", ret);
+		exit(1);
+	}
+
+	size = ftell(fp);
+	fclose(fp);
+
+	for (i=1; i<=max_threads; i++) {
+		if (bench_export(argv[1], argv[2], count, i, size) != 0)
+			exit(1);
+	}
+
+	return 0;
+}
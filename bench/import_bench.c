@@ -0,0 +1,186 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "libdtree/dtree.h"
+
+/*
+ * Measure the throughput of cronus import (attributes import)
+ *
+ * The dump is imported into a copy of the device tree once before measuring,
+ * so all the measured imports parse the whole dump and find the attributes
+ * unchanged.  With <max-threads>, parallel import is measured for 1 to <max-threads>
+ * worker threads.
+ */
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int copy_file(const char *src, const char *dst)
+{
+	FILE *in, *out;
+	char buf[65536];
+	size_t n;
+	int ret = 0;
+
+	in = fopen(src, "r");
+	if (!in) {
+		perror(src);
+		return -1;
+	}
+
+	out = fopen(dst, "w");
+	if (!out) {
+		perror(dst);
+		fclose(in);
+		return -1;
+	}
+
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+		if (fwrite(buf, 1, n, out) != n) {
+			ret = -1;
+			break;
+		}
+	}
+
+	if (ferror(in))
+		ret = -1;
+
+	fclose(in);
+	if (fclose(out) != 0)
+		ret = -1;
+
+	return ret;
+}
+
+static int bench_import(const char *dtb, const char *infodb, const char *dump,
+			int count, int nthreads, long size)
+{
+	FILE *fp;
+	double start, elapsed;
+	int i, ret;
+
+	fp = fopen(dump, "r");
+	if (!fp) {
+		perror(dump);
+		return -1;
+	}
+
+	start = now();
+	for (i=0; i<count; i++) {
+		rewind(fp);
+
+		ret = dtree_cronus_import_parallel(dtb, infodb, fp, nthreads);
+		if (ret != 0) {
+			fprintf(stderr, "Import failed, ret=%d\n", ret);
+			fclose(fp);
+			return -1;
+		}
+	}
+	elapsed = now() - start;
+
+	fclose(fp);
+
+	printf("import: threads=%d, %d iterations, %ld bytes, %.3f ms/import, %.1f MB/s\n",
+	       nthreads, count, size, elapsed * 1000 / count,
+	       (double)size * count / elapsed / (1024 * 1024));
+
+	return 0;
+}
+
+int main(int argc, const char **argv)
+{
+	FILE *fp;
+	char dtb[] = "/tmp/import_bench.XXXXXX";
+	long size;
+	int count = 10, max_threads = 1, fd, i, ret = 0;
+
+	if (argc < 4 || argc > 6) {
+		fprintf(stderr, "Usage: %s <dtb> <infodb> <dump> [<iterations> [<max-threads>]]\n", argv[0]);
+		exit(1);
+	}
+
+	if (argc >= 5)
+		count = atoi(argv[4]);
+
+	if (count <= 0) {
+		fprintf(stderr, "Invalid iterations %s\n", argv[4]);
+		exit(1);
+	}
+
+	if (argc == 6)
+		max_threads = atoi(argv[5]);
+
+	if (max_threads <= 0) {
+		fprintf(stderr, "Invalid threads %s\n", argv[5]);
+		exit(1);
+	}
+
+	fp = fopen(argv[3], "r");
+	if (!fp) {
+		perror(argv[3]);
+		exit(1);
+	}
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fclose(fp);
+
+	fd = mkstemp(dtb);
+	if (fd == -1) {
+		perror("mkstemp");
+		exit(1);
+	}
+	close(fd);
+
+	if (copy_file(argv[1], dtb) != 0) {
+		unlink(dtb);
+		exit(1);
+	}
+
+	fp = fopen(argv[3], "r");
+	if (!fp) {
+		perror(argv[3]);
+		unlink(dtb);
+		exit(1);
+	}
+
+	ret = dtree_cronus_import(dtb, argv[2], fp);
+	fclose(fp);
+	if (ret != 0) {
+		fprintf(stderr, "Import failed, ret=%d\n", ret);
+		unlink(dtb);
+		exit(1);
+	}
+
+	for (i=1; i<=max_threads; i++) {
+		ret = bench_import(dtb, argv[2], argv[3], count, i, size);
+		if (ret != 0)
+			break;
+	}
+
+	unlink(dtb);
+	return ret == 0 ? 0 : 1;
+}
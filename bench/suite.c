@@ -0,0 +1,794 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "libdtm/dtm.h"
+#include "libdtree/dtree.h"
+#include "libdtree/dtree_infodb.h"
+
+#include "synth.h"
+
+/*
+ * Benchmark suite for libdtm and libdtree
+ *
+ * The synthetic trees of each size are generated in <workdir>, and each
+ * benchmark runs in a child process, so the peak RSS is per benchmark.
+ * An operation is repeated in batches of doubling size till it has run
+ * for the minimum time.  The results are printed as a table, and written
+ * as JSON with one result per line, which is also the format read back
+ * as the baseline.  Any result slower, allocating more or using more
+ * memory than the baseline by more than the threshold is a regression.
+ */
+
+#define SUITE_NAME_LEN	64
+#define SUITE_PATH_LEN	1024
+
+struct suite_size {
+	const char *name;
+	struct synth_spec spec;
+};
+
+static const struct suite_size suite_size[] = {
+	{ "small",  { .nodes = 1, .procs = 1, .chiplets = 2, .eqs = 2, .cores = 2,
+		      .mcs = 1, .omis = 2, .dimms = 1, .attrs = 5, .seed = 1 } },
+	{ "medium", { .nodes = 1, .procs = 2, .chiplets = 8, .eqs = 8, .cores = 4,
+		      .mcs = 4, .omis = 4, .dimms = 1, .attrs = 20, .seed = 1 } },
+	{ "huge",   { .nodes = 4, .procs = 4, .chiplets = 8, .eqs = 8, .cores = 4,
+		      .mcs = 4, .omis = 4, .dimms = 2, .attrs = 40, .seed = 1 } },
+};
+
+#define SUITE_SIZE_COUNT	(sizeof(suite_size) / sizeof(suite_size[0]))
+
+struct suite_bench;
+
+struct suite_ctx {
+	const char *size;
+	const struct synth_spec *spec;
+	const char *dir;
+	const struct suite_bench *bench;
+	double min_time;
+	char base[SUITE_PATH_LEN];
+	char infodb[SUITE_PATH_LEN];
+	char dtb[SUITE_PATH_LEN];
+	char tmp[SUITE_PATH_LEN];
+	char dump[SUITE_PATH_LEN];
+	char target[SUITE_PATH_LEN];
+	char leaf[SUITE_NAME_LEN];
+	char attr[SUITE_NAME_LEN];
+	struct dtm_node *root;
+	FILE *null;
+};
+
+struct suite_result {
+	char name[SUITE_NAME_LEN];
+	char size[SUITE_NAME_LEN];
+	long iterations;
+	double ns_per_op;
+	double ops_per_sec;
+	double allocs_per_op;
+	long peak_rss_kb;
+};
+
+struct suite_bench {
+	const char *name;
+	int (*fn)(struct suite_ctx *ctx);
+	bool tree;
+};
+
+/*
+ * Count the allocations by wrapping the allocator, all the calls from the
+ * libraries (and libc itself) resolve to these.
+ */
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long suite_allocs;
+
+void *malloc(size_t size)
+{
+	__atomic_add_fetch(&suite_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	__atomic_add_fetch(&suite_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	__atomic_add_fetch(&suite_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+
+static unsigned long suite_alloc_count(void)
+{
+	return __atomic_load_n(&suite_allocs, __ATOMIC_RELAXED);
+}
+#else
+static unsigned long suite_alloc_count(void)
+{
+	return 0;
+}
+#endif
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct dtm_node *suite_read(const char *filename)
+{
+	struct dtm_file *dfile;
+	struct dtm_node *root;
+
+	dfile = dtm_file_open(filename, false);
+	if (!dfile)
+		return NULL;
+
+	root = dtm_file_read(dfile);
+	dtm_file_close(dfile);
+	return root;
+}
+
+static int bench_file_read(struct suite_ctx *ctx)
+{
+	struct dtm_node *root;
+
+	root = suite_read(ctx->dtb);
+	if (!root)
+		return -1;
+
+	dtm_tree_free(root);
+	return 0;
+}
+
+static int bench_file_write(struct suite_ctx *ctx)
+{
+	struct dtm_file *dfile;
+
+	dfile = dtm_file_create(ctx->tmp);
+	if (!dfile)
+		return -1;
+
+	if (!dtm_file_write(dfile, ctx->root)) {
+		dtm_file_close(dfile);
+		return -1;
+	}
+
+	return dtm_file_close(dfile);
+}
+
+static int bench_tree_copy(struct suite_ctx *ctx)
+{
+	struct dtm_node *root;
+
+	root = dtm_tree_copy(ctx->root);
+	if (!root)
+		return -1;
+
+	dtm_tree_free(root);
+	return 0;
+}
+
+static int bench_find_name(struct suite_ctx *ctx)
+{
+	return dtm_find_node_by_name(ctx->root, ctx->leaf) ? 0 : -1;
+}
+
+static int bench_find_path(struct suite_ctx *ctx)
+{
+	return dtm_find_node_by_path(ctx->root, ctx->target) ? 0 : -1;
+}
+
+/* None of the nodes match, so the whole tree is searched */
+static int bench_find_compatible(struct suite_ctx *ctx)
+{
+	return dtm_find_node_by_compatible(ctx->root, "ibm,synth-none") ? -1 : 0;
+}
+
+static int bench_infodb_load(struct suite_ctx *ctx)
+{
+	struct dtree_infodb infodb;
+
+	if (!dtree_infodb_load(ctx->infodb, &infodb))
+		return -1;
+
+	dtree_infodb_free(&infodb);
+	return 0;
+}
+
+static int bench_create(struct suite_ctx *ctx)
+{
+	return dtree_create(ctx->base, ctx->infodb, ctx->tmp);
+}
+
+static int bench_export_node(struct dtm_node *root, struct dtm_node *node, void *priv)
+{
+	return 0;
+}
+
+static int bench_export_attr(const struct dtree_attr *attr, void *priv)
+{
+	return 0;
+}
+
+static int bench_export(struct suite_ctx *ctx)
+{
+	return dtree_export(ctx->dtb, ctx->infodb, NULL,
+			    bench_export_node, bench_export_attr, NULL);
+}
+
+static int bench_cronus_export(struct suite_ctx *ctx)
+{
+	return dtree_cronus_export(ctx->dtb, ctx->infodb, NULL, ctx->null);
+}
+
+/* The dump has the same values, so the tree is parsed but not modified */
+static int bench_cronus_import(struct suite_ctx *ctx)
+{
+	FILE *fp;
+	int ret;
+
+	fp = fopen(ctx->dump, "r");
+	if (!fp)
+		return -1;
+
+	ret = dtree_cronus_import(ctx->dtb, ctx->infodb, fp);
+	fclose(fp);
+	return ret;
+}
+
+static int bench_read(struct suite_ctx *ctx)
+{
+	return dtree_read(ctx->dtb, ctx->infodb, ctx->target, ctx->attr,
+			  bench_export_attr, NULL);
+}
+
+/* Write a different value every time, so the file is always modified */
+static int bench_set_property(struct suite_ctx *ctx)
+{
+	struct dtm_file *dfile;
+	const void *value;
+	uint8_t *buf;
+	int offset, len, ret = -1;
+
+	dfile = dtm_file_open(ctx->dtb, true);
+	if (!dfile)
+		return -1;
+
+	offset = dtm_file_node_offset(dfile, ctx->target);
+	if (offset < 0)
+		goto done;
+
+	value = dtm_file_get_property(dfile, offset, ctx->attr, &len);
+	if (!value || len <= 0)
+		goto done;
+
+	buf = malloc(len);
+	if (!buf)
+		goto done;
+
+	memcpy(buf, value, len);
+	buf[len-1] ^= 1;
+
+	if (dtm_file_set_property(dfile, offset, ctx->attr, buf, len))
+		ret = 0;
+
+	free(buf);
+
+done:
+	if (dtm_file_close(dfile) != 0)
+		ret = -1;
+
+	return ret;
+}
+
+static const struct suite_bench suite_bench[] = {
+	{ "dtm_file_read", bench_file_read, false },
+	{ "dtm_file_write", bench_file_write, true },
+	{ "dtm_tree_copy", bench_tree_copy, true },
+	{ "dtm_find_node_by_name", bench_find_name, true },
+	{ "dtm_find_node_by_path", bench_find_path, true },
+	{ "dtm_find_node_by_compatible", bench_find_compatible, true },
+	{ "dtree_infodb_load", bench_infodb_load, false },
+	{ "dtree_create", bench_create, false },
+	{ "dtree_export", bench_export, false },
+	{ "dtree_cronus_export", bench_cronus_export, false },
+	{ "dtree_cronus_import", bench_cronus_import, false },
+	{ "dtree_read", bench_read, false },
+	{ "dtm_file_set_property", bench_set_property, false },
+};
+
+#define SUITE_BENCH_COUNT	(sizeof(suite_bench) / sizeof(suite_bench[0]))
+
+static int suite_measure(struct suite_ctx *ctx, void *out)
+{
+	const struct suite_bench *bench = ctx->bench;
+	struct suite_result *res = (struct suite_result *)out;
+	struct rusage usage;
+	unsigned long allocs;
+	double start, elapsed = 0;
+	long batch = 1, count = 0, i;
+
+	if (bench->tree) {
+		ctx->root = suite_read(ctx->dtb);
+		if (!ctx->root)
+			return -1;
+	}
+
+	ctx->null = fopen("/dev/null", "w");
+	if (!ctx->null)
+		return -1;
+
+	/* Warm up the page cache and the libraries */
+	if (bench->fn(ctx) != 0)
+		return -1;
+
+	allocs = suite_alloc_count();
+
+	while (elapsed < ctx->min_time) {
+		start = now();
+		for (i=0; i<batch; i++) {
+			if (bench->fn(ctx) != 0)
+				return -1;
+		}
+		elapsed += now() - start;
+		count += batch;
+		batch *= 2;
+	}
+
+	allocs = suite_alloc_count() - allocs;
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return -1;
+
+	*res = (struct suite_result) {
+		.iterations = count,
+		.ns_per_op = elapsed * 1e9 / count,
+		.ops_per_sec = count / elapsed,
+		.allocs_per_op = (double)allocs / count,
+		.peak_rss_kb = usage.ru_maxrss,
+	};
+	snprintf(res->name, sizeof(res->name), "%s", bench->name);
+	snprintf(res->size, sizeof(res->size), "%s", ctx->size);
+
+	return 0;
+}
+
+/*
+ * Run a step in a child process, which sends back the output.  Nothing
+ * allocated by the step stays in the parent, so the children forked later
+ * start with the same footprint.
+ */
+static int suite_fork(int (*fn)(struct suite_ctx *ctx, void *out),
+		      struct suite_ctx *ctx, void *out, size_t len)
+{
+	pid_t pid;
+	ssize_t n;
+	int fd[2], status;
+
+	if (pipe(fd) != 0) {
+		perror("pipe");
+		return -1;
+	}
+
+	fflush(NULL);
+
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		close(fd[0]);
+		close(fd[1]);
+		return -1;
+	}
+
+	if (pid == 0) {
+		close(fd[0]);
+		if (fn(ctx, out) != 0)
+			_exit(1);
+		if (write(fd[1], out, len) != len)
+			_exit(1);
+		_exit(0);
+	}
+
+	close(fd[1]);
+	do {
+		n = read(fd[0], out, len);
+	} while (n == -1 && errno == EINTR);
+	close(fd[0]);
+
+	if (waitpid(pid, &status, 0) == -1)
+		return -1;
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || n != len)
+		return -1;
+
+	return 0;
+}
+
+/* The last leaf node is the deepest (a dimm, when there are any) */
+static int suite_target(struct suite_ctx *ctx)
+{
+	struct dtm_node *root, *node, *child;
+	char *path;
+	int ret = -1;
+
+	root = suite_read(ctx->dtb);
+	if (!root)
+		return -1;
+
+	node = root;
+	while ((child = dtm_node_next_child(node, NULL)) != NULL) {
+		do {
+			node = child;
+		} while ((child = dtm_node_next_child(dtm_node_parent(node), node)) != NULL);
+	}
+
+	path = dtm_node_path(node);
+	if (!path)
+		goto done;
+
+	snprintf(ctx->target, sizeof(ctx->target), "%s", path);
+	snprintf(ctx->leaf, sizeof(ctx->leaf), "%s", dtm_node_name(node));
+	free(path);
+	ret = 0;
+
+done:
+	dtm_tree_free(root);
+	return ret;
+}
+
+/* Generate the trees of a size, the paths are sent back in ctx */
+static int suite_prepare(struct suite_ctx *ctx, void *out)
+{
+	FILE *fp;
+	int ret;
+
+	snprintf(ctx->base, sizeof(ctx->base), "%s/%s.base.dtb", ctx->dir, ctx->size);
+	snprintf(ctx->infodb, sizeof(ctx->infodb), "%s/%s.db", ctx->dir, ctx->size);
+	snprintf(ctx->dtb, sizeof(ctx->dtb), "%s/%s.dtb", ctx->dir, ctx->size);
+	snprintf(ctx->tmp, sizeof(ctx->tmp), "%s/%s.tmp.dtb", ctx->dir, ctx->size);
+	snprintf(ctx->dump, sizeof(ctx->dump), "%s/%s.dump", ctx->dir, ctx->size);
+
+	if (synth_dtb(ctx->spec, ctx->base) < 0) {
+		fprintf(stderr, "Failed to write %s\n", ctx->base);
+		return -1;
+	}
+
+	if (synth_infodb(ctx->spec, ctx->infodb) < 0)
+		return -1;
+
+	if (dtree_create(ctx->base, ctx->infodb, ctx->dtb) != 0) {
+		fprintf(stderr, "Failed to create %s\n", ctx->dtb);
+		return -1;
+	}
+
+	if (suite_target(ctx) != 0) {
+		fprintf(stderr, "Failed to find target in %s\n", ctx->dtb);
+		return -1;
+	}
+
+	snprintf(ctx->attr, sizeof(ctx->attr), "ATTR_SYNTH_DIMM_0");
+
+	fp = fopen(ctx->dump, "w");
+	if (!fp) {
+		perror(ctx->dump);
+		return -1;
+	}
+
+	ret = dtree_cronus_export(ctx->dtb, ctx->infodb, NULL, fp);
+	if (fclose(fp) != 0)
+		ret = -1;
+
+	if (ret != 0) {
+		fprintf(stderr, "Failed to export %s\n", ctx->dtb);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void suite_print(FILE *out, const struct suite_result *res)
+{
+	fprintf(out, "%-28s %-6s %10ld %14.1f %12.1f %10.1f %10ld\n",
+	       res->name, res->size, res->iterations, res->ns_per_op,
+	       res->ops_per_sec, res->allocs_per_op, res->peak_rss_kb);
+}
+
+static int suite_write_json(const char *filename, const struct suite_result *res, int count)
+{
+	FILE *fp;
+	int i;
+
+	if (strcmp(filename, "-") == 0) {
+		fp = stdout;
+	} else {
+		fp = fopen(filename, "w");
+		if (!fp) {
+			perror(filename);
+			return -1;
+		}
+	}
+
+	fprintf(fp, "{\n  \"benchmarks\": [\n");
+	for (i=0; i<count; i++) {
+		fprintf(fp, "    { \"name\": \"%s\", \"size\": \"%s\", \"iterations\": %ld, "
+			    "\"ns_per_op\": %.1f, \"ops_per_sec\": %.1f, "
+			    "\"allocs_per_op\": %.1f, \"peak_rss_kb\": %ld }%s\n",
+			res[i].name, res[i].size, res[i].iterations,
+			res[i].ns_per_op, res[i].ops_per_sec,
+			res[i].allocs_per_op, res[i].peak_rss_kb,
+			(i < count-1) ? "," : "");
+	}
+	fprintf(fp, "  ]\n}\n");
+
+	if (fp == stdout)
+		return 0;
+
+	if (fclose(fp) != 0) {
+		perror(filename);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Read back the results from the JSON written by suite_write_json */
+static int suite_read_json(const char *filename, struct suite_result **out)
+{
+	struct suite_result *res = NULL, *tmp, r;
+	FILE *fp;
+	char line[1024];
+	int count = 0;
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		perror(filename);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, " { \"name\": \"%63[^\"]\", \"size\": \"%63[^\"]\", "
+				 "\"iterations\": %ld, \"ns_per_op\": %lf, "
+				 "\"ops_per_sec\": %lf, \"allocs_per_op\": %lf, "
+				 "\"peak_rss_kb\": %ld",
+			   r.name, r.size, &r.iterations, &r.ns_per_op,
+			   &r.ops_per_sec, &r.allocs_per_op, &r.peak_rss_kb) != 7)
+			continue;
+
+		tmp = reallocarray(res, count+1, sizeof(struct suite_result));
+		if (!tmp) {
+			free(res);
+			fclose(fp);
+			return -1;
+		}
+
+		res = tmp;
+		res[count++] = r;
+	}
+
+	fclose(fp);
+
+	if (count == 0) {
+		fprintf(stderr, "No results in %s\n", filename);
+		free(res);
+		return -1;
+	}
+
+	*out = res;
+	return count;
+}
+
+static bool suite_regressed(FILE *out, const char *what, const struct suite_result *res,
+			    double base, double value, double threshold)
+{
+	if (value <= base * (1 + threshold / 100) || value - base < 0.5)
+		return false;
+
+	if (base > 0)
+		fprintf(out, "REGRESSION %s (%s) %s: %.1f -> %.1f (+%.1f%%)\n",
+		       res->name, res->size, what, base, value,
+		       (value - base) * 100 / base);
+	else
+		fprintf(out, "REGRESSION %s (%s) %s: %.1f -> %.1f\n",
+		       res->name, res->size, what, base, value);
+
+	return true;
+}
+
+static int suite_compare(FILE *out, const char *filename, const struct suite_result *res,
+			 int count, double threshold)
+{
+	struct suite_result *base;
+	int base_count, regressions = 0, i, j;
+
+	base_count = suite_read_json(filename, &base);
+	if (base_count < 0)
+		return -1;
+
+	for (i=0; i<count; i++) {
+		for (j=0; j<base_count; j++) {
+			if (strcmp(res[i].name, base[j].name) == 0 &&
+			    strcmp(res[i].size, base[j].size) == 0)
+				break;
+		}
+
+		if (j == base_count)
+			continue;
+
+		if (suite_regressed(out, "ns/op", &res[i], base[j].ns_per_op, res[i].ns_per_op, threshold))
+			regressions++;
+		if (suite_regressed(out, "allocs/op", &res[i], base[j].allocs_per_op, res[i].allocs_per_op, threshold))
+			regressions++;
+		if (suite_regressed(out, "peak RSS KB", &res[i], base[j].peak_rss_kb, res[i].peak_rss_kb, threshold))
+			regressions++;
+	}
+
+	free(base);
+
+	if (regressions == 0)
+		fprintf(out, "No regressions against %s (threshold %.1f%%)\n", filename, threshold);
+
+	return regressions;
+}
+
+static bool suite_selected(const char *list, const char *name)
+{
+	size_t len = strlen(name);
+	const char *p;
+
+	if (!list)
+		return true;
+
+	for (p = list; (p = strstr(p, name)) != NULL; p += len) {
+		if ((p == list || p[-1] == ',') && (p[len] == ',' || p[len] == '\0'))
+			return true;
+	}
+
+	return false;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<options>] <workdir>\n", prog);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  --sizes LIST      - Tree sizes to run (small,medium,huge)\n");
+	fprintf(stderr, "  --filter TEXT     - Run only benchmarks with TEXT in the name\n");
+	fprintf(stderr, "  --time MS         - Minimum time per benchmark in ms (500)\n");
+	fprintf(stderr, "  --json FILE       - Write the results as JSON (- for stdout)\n");
+	fprintf(stderr, "  --baseline FILE   - Compare with the results saved with --json\n");
+	fprintf(stderr, "  --threshold PCT   - Regression threshold in percent (10)\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Exit status is 2 if any result regressed against the baseline\n");
+	exit(1);
+}
+
+int main(int argc, const char **argv)
+{
+	const char *sizes = NULL, *filter = NULL, *json = NULL, *baseline = NULL;
+	struct suite_result *res;
+	struct suite_ctx ctx;
+	FILE *out;
+	double min_time = 0.5, threshold = 10;
+	int count = 0, failed = 0, ret, i, s, b;
+
+	for (i=1; i+1<argc && strncmp(argv[i], "--", 2) == 0; i+=2) {
+		if (strcmp(argv[i], "--sizes") == 0) {
+			sizes = argv[i+1];
+		} else if (strcmp(argv[i], "--filter") == 0) {
+			filter = argv[i+1];
+		} else if (strcmp(argv[i], "--time") == 0) {
+			min_time = atoi(argv[i+1]) / 1000.0;
+			if (min_time <= 0) {
+				fprintf(stderr, "Invalid time %s\n", argv[i+1]);
+				exit(1);
+			}
+		} else if (strcmp(argv[i], "--json") == 0) {
+			json = argv[i+1];
+		} else if (strcmp(argv[i], "--baseline") == 0) {
+			baseline = argv[i+1];
+		} else if (strcmp(argv[i], "--threshold") == 0) {
+			threshold = atof(argv[i+1]);
+			if (threshold < 0) {
+				fprintf(stderr, "Invalid threshold %s\n", argv[i+1]);
+				exit(1);
+			}
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	if (argc - i != 1)
+		usage(argv[0]);
+
+	res = calloc(SUITE_SIZE_COUNT * SUITE_BENCH_COUNT, sizeof(struct suite_result));
+	if (!res) {
+		perror("calloc");
+		exit(1);
+	}
+
+	/* The table goes to stderr when the JSON goes to stdout */
+	out = (json && strcmp(json, "-") == 0) ? stderr : stdout;
+
+	fprintf(out, "%-28s %-6s %10s %14s %12s %10s %10s\n",
+	       "benchmark", "size", "iterations", "ns/op", "ops/sec", "allocs/op", "peak KB");
+
+	for (s=0; s<SUITE_SIZE_COUNT; s++) {
+		if (!suite_selected(sizes, suite_size[s].name))
+			continue;
+
+		ctx = (struct suite_ctx) {
+			.size = suite_size[s].name,
+			.spec = &suite_size[s].spec,
+			.dir = argv[i],
+			.min_time = min_time,
+		};
+
+		if (suite_fork(suite_prepare, &ctx, &ctx, sizeof(ctx)) != 0) {
+			fprintf(stderr, "Failed to prepare %s trees\n", suite_size[s].name);
+			exit(1);
+		}
+
+		for (b=0; b<SUITE_BENCH_COUNT; b++) {
+			if (filter && !strstr(suite_bench[b].name, filter))
+				continue;
+
+			ctx.bench = &suite_bench[b];
+			if (suite_fork(suite_measure, &ctx, &res[count], sizeof(res[count])) != 0) {
+				fprintf(stderr, "Benchmark %s (%s) failed\n",
+					suite_bench[b].name, ctx.size);
+				failed++;
+				continue;
+			}
+
+			suite_print(out, &res[count]);
+			count++;
+		}
+	}
+
+	if (json && suite_write_json(json, res, count) != 0)
+		exit(1);
+
+	ret = failed ? 1 : 0;
+
+	if (baseline) {
+		int regressions = suite_compare(out, baseline, res, count, threshold);
+
+		if (regressions < 0)
+			ret = 1;
+		else if (regressions > 0 && ret == 0)
+			ret = 2;
+	}
+
+	free(res);
+	return ret;
+}
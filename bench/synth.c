@@ -0,0 +1,124 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "synth.h"
+
+/*
+ * Generate a synthetic system device tree and infodb
+ *
+ * The device tree has the same shape as a p10 system, with the number of
+ * units given by the spec.  Each node has only the index property, same
+ * as the device tree compiled from the system description, and the
+ * attributes are added by "attributes create <dtb> <infodb> <out-dtb>".
+ *
+ * The infodb has the given number of attributes for each target type,
+ * covering all the attribute types, enums, 0 to 3 dimensional arrays and
+ * complex types.  Half of the attributes have a default value.
+ */
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<spec>] <out-dtb> <out-infodb>\n", prog);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Spec (default):\n");
+	fprintf(stderr, "  --nodes N     - Number of nodes (1)\n");
+	fprintf(stderr, "  --procs N     - Number of procs per node (2)\n");
+	fprintf(stderr, "  --chiplets N  - Number of chiplets per proc (8)\n");
+	fprintf(stderr, "  --eqs N       - Number of eqs per proc (8)\n");
+	fprintf(stderr, "  --cores N     - Number of cores per eq (4)\n");
+	fprintf(stderr, "  --mcs N       - Number of mcs per proc (4)\n");
+	fprintf(stderr, "  --omis N      - Number of omis per mc (4)\n");
+	fprintf(stderr, "  --dimms N     - Number of dimms per omi (1)\n");
+	fprintf(stderr, "  --attrs N     - Number of attributes per target type (20)\n");
+	fprintf(stderr, "  --seed N      - Seed for the attribute values (1)\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Add the attributes with: attributes create <dtb> <infodb> <out-dtb>,\n");
+	fprintf(stderr, "with <out-dtb> and <out-infodb> from here as <dtb> and <infodb>\n");
+	exit(1);
+}
+
+int main(int argc, const char **argv)
+{
+	int seed = 1;
+	struct synth_spec spec = {
+		.nodes = 1,
+		.procs = 2,
+		.chiplets = 8,
+		.eqs = 8,
+		.cores = 4,
+		.mcs = 4,
+		.omis = 4,
+		.dimms = 1,
+		.attrs = 20,
+	};
+	struct {
+		const char *name;
+		int *value;
+		int min;
+	} option[] = {
+		{ "--nodes", &spec.nodes, 1 },
+		{ "--procs", &spec.procs, 1 },
+		{ "--chiplets", &spec.chiplets, 0 },
+		{ "--eqs", &spec.eqs, 0 },
+		{ "--cores", &spec.cores, 0 },
+		{ "--mcs", &spec.mcs, 0 },
+		{ "--omis", &spec.omis, 0 },
+		{ "--dimms", &spec.dimms, 0 },
+		{ "--attrs", &spec.attrs, 1 },
+		{ "--seed", &seed, 0 },
+	};
+	int nodes, attrs, i, j;
+
+	for (i=1; i+1<argc && strncmp(argv[i], "--", 2) == 0; i+=2) {
+		for (j=0; j<sizeof(option)/sizeof(option[0]); j++) {
+			if (strcmp(argv[i], option[j].name) == 0)
+				break;
+		}
+
+		if (j == sizeof(option)/sizeof(option[0]))
+			usage(argv[0]);
+
+		*option[j].value = atoi(argv[i+1]);
+		if (*option[j].value < option[j].min) {
+			fprintf(stderr, "Invalid value %s for %s\n", argv[i+1], argv[i]);
+			exit(1);
+		}
+	}
+
+	if (argc - i != 2)
+		usage(argv[0]);
+
+	spec.seed = seed;
+
+	nodes = synth_dtb(&spec, argv[i]);
+	if (nodes < 0) {
+		fprintf(stderr, "Failed to write %s\n", argv[i]);
+		exit(1);
+	}
+
+	attrs = synth_infodb(&spec, argv[i+1]);
+	if (attrs < 0)
+		exit(1);
+
+	printf("%d targets, %d attributes per target type, %d attributes\n",
+	       nodes, spec.attrs, attrs);
+
+	return 0;
+}
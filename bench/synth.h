@@ -0,0 +1,39 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SYNTH_H__
+#define __SYNTH_H__
+
+struct synth_spec {
+	int nodes;
+	int procs;
+	int chiplets;
+	int eqs;
+	int cores;
+	int mcs;
+	int omis;
+	int dimms;
+	int attrs;
+	unsigned int seed;
+};
+
+/* Write the synthetic device tree, returns the number of nodes, -1 on failure */
+int synth_dtb(const struct synth_spec *spec, const char *filename);
+
+/* Write the infodb, returns the number of attributes, -1 on failure */
+int synth_infodb(const struct synth_spec *spec, const char *filename);
+
+#endif /* __SYNTH_H__ */
@@ -0,0 +1,341 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <endian.h>
+
+#include "libdtm/dtm.h"
+
+#include "synth.h"
+
+/*
+ * Generator of the synthetic device tree and infodb, used by synth and by
+ * the benchmark suite to create the trees of different sizes.
+ */
+
+static const char *synth_target[] = {
+	"TARGET_TYPE_SYSTEM",
+	"TARGET_TYPE_PROC_CHIP",
+	"TARGET_TYPE_PERV",
+	"TARGET_TYPE_EQ",
+	"TARGET_TYPE_FC",
+	"TARGET_TYPE_CORE",
+	"TARGET_TYPE_MC",
+	"TARGET_TYPE_MI",
+	"TARGET_TYPE_MCC",
+	"TARGET_TYPE_OMI",
+	"TARGET_TYPE_OCMB_CHIP",
+	"TARGET_TYPE_MEM_PORT",
+	"TARGET_TYPE_DIMM",
+};
+
+#define SYNTH_TARGET_COUNT	(sizeof(synth_target) / sizeof(synth_target[0]))
+
+static const char *synth_type[] = {
+	"uint8", "uint16", "uint32", "uint64",
+	"int8", "int16", "int32", "int64",
+	"str", "complex",
+};
+
+#define SYNTH_TYPE_COUNT	(sizeof(synth_type) / sizeof(synth_type[0]))
+
+static const char *synth_complex[] = { "1", "42", "412", "8421", "2222" };
+
+#define SYNTH_COMPLEX_COUNT	(sizeof(synth_complex) / sizeof(synth_complex[0]))
+
+static const int synth_dim[4][4] = {
+	{ 0 },
+	{ 1, 4 },
+	{ 2, 2, 3 },
+	{ 3, 2, 2, 2 },
+};
+
+static uint32_t synth_state;
+
+/* Deterministic values for the same seed */
+static uint32_t synth_rand(void)
+{
+	synth_state = synth_state * 1103515245 + 12345;
+	return synth_state >> 8;
+}
+
+static void synth_attr_name(char *name, size_t len, int target, int i)
+{
+	snprintf(name, len, "ATTR_SYNTH_%s_%d", synth_target[target] + strlen("TARGET_TYPE_"), i);
+}
+
+static void synth_attr(FILE *fp, int target, int i)
+{
+	const char *type = synth_type[i % SYNTH_TYPE_COUNT];
+	const char *spec = synth_complex[i % SYNTH_COMPLEX_COUNT];
+	int row = i / SYNTH_TYPE_COUNT;
+	const int *dim = synth_dim[row % 4];
+	char name[64];
+	bool is_str = (strcmp(type, "str") == 0);
+	bool is_complex = (strcmp(type, "complex") == 0);
+	bool is_enum = (!is_str && !is_complex && i % 3 == 0);
+	int strsize = (row % 2) ? 32 : 16;
+	int count = 1, j, k;
+
+	synth_attr_name(name, sizeof(name), target, i);
+	fprintf(fp, "%s %s", name, type);
+
+	if (is_str)
+		fprintf(fp, " %d", strsize);
+	else if (is_complex)
+		fprintf(fp, " %s", spec);
+
+	fprintf(fp, " %d", dim[0]);
+	for (j=1; j<=dim[0]; j++) {
+		fprintf(fp, " %d", dim[j]);
+		count *= dim[j];
+	}
+
+	if (!is_str && !is_complex) {
+		if (is_enum)
+			fprintf(fp, " 3 SYNTH_ZERO 0x0 SYNTH_ONE 0x1 SYNTH_TWO 0x2");
+		else
+			fprintf(fp, " 0");
+	}
+
+	/* Every other attribute of each type has a default value */
+	if ((i + row) % 2 == 0) {
+		fprintf(fp, " 0\n");
+		return;
+	}
+
+	fprintf(fp, " 1");
+	for (j=0; j<count; j++) {
+		if (is_str) {
+			fprintf(fp, " s%u", synth_rand() % 100000);
+		} else if (is_complex) {
+			for (k=0; k<strlen(spec); k++)
+				fprintf(fp, " 0x%x", synth_rand() & 0x7f);
+		} else if (is_enum) {
+			static const char *key[] = { "SYNTH_ZERO", "SYNTH_ONE", "SYNTH_TWO" };
+
+			fprintf(fp, " %s", key[synth_rand() % 3]);
+		} else {
+			fprintf(fp, " 0x%x", synth_rand() & 0x7f);
+		}
+	}
+	fprintf(fp, "\n");
+}
+
+int synth_infodb(const struct synth_spec *spec, const char *filename)
+{
+	FILE *fp;
+	char name[64];
+	int t, i, id;
+
+	fp = fopen(filename, "w");
+	if (!fp) {
+		perror(filename);
+		return -1;
+	}
+
+	synth_state = spec->seed;
+
+	fprintf(fp, "all");
+	for (t=0; t<SYNTH_TARGET_COUNT; t++) {
+		for (i=0; i<spec->attrs; i++) {
+			synth_attr_name(name, sizeof(name), t, i);
+			fprintf(fp, " %s", name);
+		}
+	}
+	fprintf(fp, "\n");
+
+	for (t=0; t<SYNTH_TARGET_COUNT; t++) {
+		for (i=0; i<spec->attrs; i++)
+			synth_attr(fp, t, i);
+	}
+
+	fprintf(fp, "targets");
+	for (t=0; t<SYNTH_TARGET_COUNT; t++)
+		fprintf(fp, " %s", synth_target[t]);
+	fprintf(fp, "\n");
+
+	id = 0;
+	for (t=0; t<SYNTH_TARGET_COUNT; t++) {
+		fprintf(fp, "%s", synth_target[t]);
+		for (i=0; i<spec->attrs; i++)
+			fprintf(fp, " %d", id++);
+		fprintf(fp, "\n");
+	}
+
+	if (fclose(fp) != 0) {
+		perror(filename);
+		return -1;
+	}
+
+	return spec->attrs * SYNTH_TARGET_COUNT;
+}
+
+static int synth_node_count;
+
+static struct dtm_node *synth_node(struct dtm_node *parent, const char *class, int index)
+{
+	struct dtm_node *node;
+	char name[64];
+	uint32_t value = htobe32(index);
+
+	snprintf(name, sizeof(name), "%s%d", class, index);
+
+	node = dtm_node_add_child(parent, name);
+	if (!node)
+		return NULL;
+
+	if (dtm_node_add_property(node, "index", &value, sizeof(value)) != 0)
+		return NULL;
+
+	synth_node_count += 1;
+	return node;
+}
+
+static bool synth_mc(const struct synth_spec *spec, struct dtm_node *proc, int m)
+{
+	struct dtm_node *mc, *mi, *mcc, *omi, *ocmb, *port;
+	int per_mcc = (spec->omis + 1) / 2;
+	int c, o, d, index;
+
+	mc = synth_node(proc, "mc", m);
+	if (!mc)
+		return false;
+
+	mi = synth_node(mc, "mi", m);
+	if (!mi)
+		return false;
+
+	for (c=0; c<2 && c*per_mcc < spec->omis; c++) {
+		mcc = synth_node(mi, "mcc", m*2 + c);
+		if (!mcc)
+			return false;
+
+		for (o=c*per_mcc; o<(c+1)*per_mcc && o<spec->omis; o++) {
+			index = m * spec->omis + o;
+
+			omi = synth_node(mcc, "omi", index);
+			if (!omi)
+				return false;
+
+			ocmb = synth_node(omi, "ocmb", index);
+			if (!ocmb)
+				return false;
+
+			port = synth_node(ocmb, "mem_port", index);
+			if (!port)
+				return false;
+
+			for (d=0; d<spec->dimms; d++) {
+				if (!synth_node(port, "dimm", index * spec->dimms + d))
+					return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+static bool synth_eq(const struct synth_spec *spec, struct dtm_node *proc, int e)
+{
+	struct dtm_node *eq, *fc;
+	int per_fc = (spec->cores + 1) / 2;
+	int f, c;
+
+	eq = synth_node(proc, "eq", e);
+	if (!eq)
+		return false;
+
+	for (f=0; f<2; f++) {
+		fc = synth_node(eq, "fc", e*2 + f);
+		if (!fc)
+			return false;
+
+		for (c=f*per_fc; c<(f+1)*per_fc && c<spec->cores; c++) {
+			if (!synth_node(fc, "core", e * spec->cores + c))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+static bool synth_proc(const struct synth_spec *spec, struct dtm_node *root, int p)
+{
+	struct dtm_node *proc;
+	int i;
+
+	proc = synth_node(root, "proc", p);
+	if (!proc)
+		return false;
+
+	for (i=0; i<spec->chiplets; i++) {
+		if (!synth_node(proc, "chiplet", i))
+			return false;
+	}
+
+	for (i=0; i<spec->eqs; i++) {
+		if (!synth_eq(spec, proc, i))
+			return false;
+	}
+
+	for (i=0; i<spec->mcs; i++) {
+		if (!synth_mc(spec, proc, i))
+			return false;
+	}
+
+	return true;
+}
+
+int synth_dtb(const struct synth_spec *spec, const char *filename)
+{
+	struct dtm_file *dfile;
+	struct dtm_node *root;
+	int p, ret = -1;
+
+	root = dtm_tree_new();
+	if (!root)
+		return -1;
+
+	synth_node_count = 1;
+
+	/* Procs of all the nodes (drawers) are numbered across the system */
+	for (p=0; p<spec->nodes * spec->procs; p++) {
+		if (!synth_proc(spec, root, p))
+			goto done;
+	}
+
+	dfile = dtm_file_create(filename);
+	if (!dfile)
+		goto done;
+
+	if (!dtm_file_write(dfile, root)) {
+		dtm_file_close(dfile);
+		goto done;
+	}
+
+	if (dtm_file_close(dfile) != 0)
+		goto done;
+
+	ret = synth_node_count;
+
+done:
+	dtm_tree_free(root);
+	return ret;
+}
@@ -17,8 +17,11 @@
 #ifndef __DTM_H__
 #define __DTM_H__
 
+#include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <limits.h>
 
 /**
  * @brief Abstract data type representing FDT on disk and in memory
@@ -40,6 +43,11 @@ struct dtm_nodelist;
  */
 struct dtm_property;
 
+/**
+ * @brief Abstract data type representing pre-parsed tree image
+ */
+struct dtm_image;
+
 /**
  * @brief Callback for each node during travese
  *
@@ -49,6 +57,21 @@ struct dtm_property;
  */
 typedef int (*dtm_traverse_node_fn)(struct dtm_node *node, void *priv);
 
+/**
+ * @brief Return value of node callback to skip the properties of the node
+ *
+ * The traverse continues with the children of the node.
+ */
+#define DTM_TRAVERSE_SKIP	(INT_MIN)
+
+/**
+ * @brief Return value of node callback to skip the node and its children
+ *
+ * The properties of the node and the whole subtree are skipped, the traverse
+ * continues with the next sibling.
+ */
+#define DTM_TRAVERSE_PRUNE	(INT_MIN + 1)
+
 /**
  * @brief Callback for each node property during travese
  *
@@ -117,6 +140,287 @@ bool dtm_file_write(struct dtm_file *dfile, struct dtm_node *root);
  */
 bool dtm_file_update_node(struct dtm_file *dfile, struct dtm_node *node, const char *name);
 
+/**
+ * @brief Get the amount of data modified in FDT file opened for write
+ *
+ * Properties written with the same value are not counted.  If the file has
+ * an override journal, the data appended to the journal is counted.
+ *
+ * @param[in] dfile  dtm_file for FDT file opened for write
+ * @param[out] bytes  Number of bytes modified
+ * @param[out] pages  Number of pages modified
+ */
+void dtm_file_dirty(struct dtm_file *dfile, size_t *bytes, int *pages);
+
+/**
+ * @brief Callback for each node during scan of FDT file
+ *
+ * @param[in] dfile  dtm_file for FDT file opened for read
+ * @param[in] offset  Offset of the node in FDT blob
+ * @param[in] depth  Depth of the node, 0 for root node
+ * @param[in] name  Name of the node
+ * @param[in] priv  Private data for scan
+ * @return 0 to continue scan, non-zero value will stop scan
+ */
+typedef int (*dtm_file_scan_fn)(struct dtm_file *dfile, int offset, int depth, const char *name, void *priv);
+
+/**
+ * @brief Scan all the nodes of FDT file without reading it into a tree
+ *
+ * The nodes are scanned in depth-first order, same as the order of nodes in
+ * FDT blob.
+ *
+ * @param[in] dfile  dtm_file for FDT file opened for read
+ * @param[in] fn  Callback function called for each node
+ * @param[in] priv  Private data for callback
+ * @return 0 if all nodes are scanned, -1 on failure, otherwise the non-zero
+ *         value returned by callback
+ */
+int dtm_file_scan(struct dtm_file *dfile, dtm_file_scan_fn fn, void *priv);
+
+/**
+ * @brief Get the offset of a node in FDT file
+ *
+ * @param[in] dfile  dtm_file for FDT file opened for read
+ * @param[in] path  Device tree path of the node
+ * @return offset of the node, -1 if not found
+ */
+int dtm_file_node_offset(struct dtm_file *dfile, const char *path);
+
+/**
+ * @brief Get the value of a property directly from FDT file
+ *
+ * The value points into the FDT blob and is valid till the file is closed.
+ *
+ * @param[in] dfile  dtm_file for FDT file opened for read
+ * @param[in] offset  Offset of the node
+ * @param[in] name  Name of the property
+ * @param[out] value_len  Length of the property
+ * @return pointer to the value of the property, NULL if not found
+ */
+const void *dtm_file_get_property(struct dtm_file *dfile, int offset, const char *name, int *value_len);
+
+/**
+ * @brief Get the name of a node directly from FDT file
+ *
+ * @param[in] dfile  dtm_file for FDT file opened for read
+ * @param[in] offset  Offset of the node
+ * @return name of the node, NULL on failure
+ */
+const char *dtm_file_node_name(struct dtm_file *dfile, int offset);
+
+/**
+ * @brief Get the next child of a node in FDT file
+ *
+ * @param[in] dfile  dtm_file for FDT file opened for read
+ * @param[in] parent  Offset of the parent node
+ * @param[in] prev  Offset of the previous child, -1 for the first child
+ * @return offset of the child node, -1 if there are no more children
+ */
+int dtm_file_next_subnode(struct dtm_file *dfile, int parent, int prev);
+
+/**
+ * @brief Get the offset of a child node by name in FDT file
+ *
+ * @param[in] dfile  dtm_file for FDT file opened for read
+ * @param[in] parent  Offset of the parent node
+ * @param[in] name  Name of the child node
+ * @return offset of the child node, -1 if not found
+ */
+int dtm_file_subnode_offset(struct dtm_file *dfile, int parent, const char *name);
+
+/**
+ * @brief Callback for each property during scan of a node in FDT file
+ *
+ * @param[in] dfile  dtm_file for FDT file opened for read
+ * @param[in] offset  Offset of the node in FDT blob
+ * @param[in] name  Name of the property
+ * @param[in] value  Value of the property, pointing into FDT blob
+ * @param[in] value_len  Length of the property
+ * @param[in] priv  Private data for scan
+ * @return 0 to continue scan, non-zero value will stop scan
+ */
+typedef int (*dtm_file_property_fn)(struct dtm_file *dfile, int offset, const char *name, const void *value, int value_len, void *priv);
+
+/**
+ * @brief Scan all the properties of a node in FDT file
+ *
+ * @param[in] dfile  dtm_file for FDT file opened for read
+ * @param[in] offset  Offset of the node
+ * @param[in] fn  Callback function called for each property
+ * @param[in] priv  Private data for callback
+ * @return 0 if all properties are scanned, -1 on failure, otherwise the
+ *         non-zero value returned by callback
+ */
+int dtm_file_scan_properties(struct dtm_file *dfile, int offset, dtm_file_property_fn fn, void *priv);
+
+/**
+ * @brief Overwrite the value of a property directly in FDT file
+ *
+ * The length of the new value must be same as the existing value.  The
+ * file is not modified if the value is unchanged.
+ *
+ * @param[in] dfile  dtm_file for FDT file opened for write
+ * @param[in] offset  Offset of the node
+ * @param[in] name  Name of the property
+ * @param[in] value  New value of the property
+ * @param[in] value_len  Length of the new value
+ * @return true on success, false on failure
+ */
+bool dtm_file_set_property(struct dtm_file *dfile, int offset, const char *name, const void *value, int value_len);
+
+/**
+ * @brief Get the name of override journal for FDT file
+ *
+ * @param[in] filename  Filename of FDT blob
+ * @return name of the journal file (to be freed by caller), NULL on failure
+ */
+char *dtm_file_journal_name(const char *filename);
+
+/**
+ * @brief Start an override journal for FDT file
+ *
+ * When FDT file has a journal, the property values written are appended to
+ * the journal instead of modifying FDT file.  The values in the journal
+ * override the values in FDT file for all the reads.  An existing journal
+ * is discarded.
+ *
+ * @param[in] filename  Filename of FDT blob
+ * @return true on success, false on failure
+ */
+bool dtm_file_journal_create(const char *filename);
+
+/**
+ * @brief Fold the override journal into FDT file
+ *
+ * A new FDT file is written with the values from the journal, which then
+ * replaces the original file.  The journal is emptied, but not removed.
+ *
+ * @param[in] filename  Filename of FDT blob
+ * @return 0 on success, -1 on failure
+ */
+int dtm_file_compact(const char *filename);
+
+/**
+ * @brief Create an overlay for FDT file
+ *
+ * An overlay is a sparse FDT file, which holds only the property values
+ * which override the values in the base FDT file.  An overlay is opened
+ * like any FDT file.  The base is mapped read-only, and the values written
+ * are stored in the overlay.  An existing overlay is discarded.
+ *
+ * @param[in] base  Filename of base FDT blob (or another overlay)
+ * @param[in] overlay  Filename of overlay
+ * @return true on success, false on failure
+ */
+bool dtm_file_overlay_create(const char *base, const char *overlay);
+
+/**
+ * @brief Write FDT file with all the overrides merged
+ *
+ * The values from overlays and journals are merged with the base FDT file
+ * and written as a complete FDT file.
+ *
+ * @param[in] filename  Filename of FDT blob (or overlay)
+ * @param[in] out  Filename of the merged FDT blob
+ * @return 0 on success, -1 on failure
+ */
+int dtm_file_flatten(const char *filename, const char *out);
+
+/**
+ * @brief Get the name of tree image for FDT file
+ *
+ * @param[in] filename  Filename of FDT blob
+ * @return name of the image file (to be freed by caller), NULL on failure
+ */
+char *dtm_file_image_name(const char *filename);
+
+/**
+ * @brief Create a tree image for FDT file
+ *
+ * A tree image is the parsed device tree stored without pointers, which
+ * can be mapped read-only by any number of processes instead of parsing
+ * FDT file.  The image records the file status and the hash of FDT file,
+ * and is not used once FDT file is modified.  FDT file with a journal or
+ * an overlay cannot have an image.
+ *
+ * @param[in] filename  Filename of FDT blob
+ * @param[in] image  Filename of the image
+ * @return 0 on success, -1 on failure
+ */
+int dtm_image_create(const char *filename, const char *image);
+
+/**
+ * @brief Open a tree image
+ *
+ * FDT file is read only if its file status has changed since the image was
+ * created, to compare its hash.
+ *
+ * @param[in] image  Filename of the image
+ * @param[in] filename  Filename of FDT blob the image was created from
+ * @return image, NULL if the image does not exist or does not match FDT file
+ */
+struct dtm_image *dtm_image_open(const char *image, const char *filename);
+
+/**
+ * @brief Close a tree image
+ *
+ * The trees read from the image must be freed before closing the image.
+ *
+ * @param[in] img  Tree image
+ */
+void dtm_image_close(struct dtm_image *img);
+
+/**
+ * @brief Get the tree from a tree image
+ *
+ * The property names and values are shared with the image, and copied
+ * only when a value is modified.
+ *
+ * @param[in] img  Tree image
+ * @return root node of the tree, NULL on failure
+ */
+struct dtm_node *dtm_image_read(struct dtm_image *img);
+
+/**
+ * @brief Find a node in a tree image
+ *
+ * @param[in] img  Tree image
+ * @param[in] path  Device tree path of the node
+ * @return node offset (root is 0), -1 if not found
+ */
+int dtm_image_node_offset(struct dtm_image *img, const char *path);
+
+/**
+ * @brief Get the name of a node in a tree image
+ *
+ * @param[in] img  Tree image
+ * @param[in] node  Node offset
+ * @return name of the node, NULL on failure
+ */
+const char *dtm_image_node_name(struct dtm_image *img, int node);
+
+/**
+ * @brief Iterate over the children of a node in a tree image
+ *
+ * @param[in] img  Tree image
+ * @param[in] parent  Node offset of parent
+ * @param[in] prev  Node offset of previous child, -1 for the first child
+ * @return node offset of the next child, -1 if there are no more children
+ */
+int dtm_image_next_subnode(struct dtm_image *img, int parent, int prev);
+
+/**
+ * @brief Get a property value from a tree image
+ *
+ * @param[in] img  Tree image
+ * @param[in] node  Node offset
+ * @param[in] name  Name of the property
+ * @param[out] value_len  Length of the property value
+ * @return value of the property, NULL if not found
+ */
+const void *dtm_image_get_property(struct dtm_image *img, int node, const char *name, int *value_len);
+
 /**
  * @brief Create a new tree with root node
  *
@@ -139,6 +443,65 @@ void dtm_tree_free(struct dtm_node *node);
  */
 struct dtm_node *dtm_tree_copy(const struct dtm_node *root);
 
+/**
+ * @brief Number of buckets in the fan-out histogram of struct dtm_tree_stats
+ *
+ * Bucket 0 counts the nodes without children, bucket i counts the nodes
+ * with 2^(i-1) to 2^i - 1 children, and the last bucket the rest.
+ */
+#define DTM_TREE_STATS_FANOUT	8
+
+/**
+ * @brief Number of largest properties in struct dtm_tree_stats
+ */
+#define DTM_TREE_STATS_LARGEST	10
+
+/**
+ * @brief Memory footprint of a device tree
+ *
+ * The sizes are as allocated for the tree, without the overhead of the
+ * allocator for each allocation.
+ */
+struct dtm_tree_stats {
+	int nodes;
+	int properties;
+	size_t name_bytes;	/* node and property names, with the nul */
+	size_t value_bytes;	/* property values owned by the tree */
+	size_t borrowed_bytes;	/* property values borrowed from a file or image */
+	size_t struct_bytes;	/* node and property structures */
+	size_t list_bytes;	/* list links, included in struct_bytes */
+	size_t allocs;		/* number of allocations */
+	int max_depth;		/* depth of the deepest node, root is 0 */
+	int fanout[DTM_TREE_STATS_FANOUT];
+	int largest_count;
+	struct {
+		struct dtm_node *node;
+		struct dtm_property *prop;
+	} largest[DTM_TREE_STATS_LARGEST];	/* largest first */
+};
+
+/**
+ * @brief Get the memory footprint of a device tree
+ *
+ * The largest properties refer to the tree, and are valid as long as the
+ * tree is not modified.
+ *
+ * @param[in] root  Root of the device tree
+ * @param[out] stats  Footprint of the tree
+ */
+void dtm_tree_stats(struct dtm_node *root, struct dtm_tree_stats *stats);
+
+/**
+ * @brief Add a new child node to a node
+ *
+ * The child is added after the existing children.
+ *
+ * @param[in] parent  Parent node
+ * @param[in] name  Name of the child node
+ * @return child node on success, NULL on failure
+ */
+struct dtm_node *dtm_node_add_child(struct dtm_node *parent, const char *name);
+
 /**
  * @brief Get name of a node
  *
@@ -158,6 +521,21 @@ const char *dtm_node_name(const struct dtm_node *node);
  */
 int dtm_node_add_property(struct dtm_node *node, const char *name, void *value, int valuelen);
 
+/**
+ * @brief Add a property to a node without copying name and value
+ *
+ * The name and the value are referenced by the property and must stay valid
+ * for the lifetime of the node.  The same value can be shared by many nodes.
+ * Setting the value of such a property makes a private copy first.
+ *
+ * @param[in] node  A node
+ * @param[in] name  Name of the property
+ * @param[in] value  Value of the property
+ * @param[in] valuelen  Length (in bytes) of the value of the property
+ * @return 0 on success, -1 on failure
+ */
+int dtm_node_add_property_ref(struct dtm_node *node, const char *name, void *value, int valuelen);
+
 /**
  * @brief Get a property from a node by name
  *
@@ -197,6 +575,34 @@ int dtm_node_index(const struct dtm_node *node);
  */
 struct dtm_node *dtm_node_parent(const struct dtm_node *node);
 
+/**
+ * @brief Get the next child of a node
+ *
+ * @param[in] node  A node
+ * @param[in] prev  Previous child, or NULL to get the first child
+ * @return next child, or NULL if there are no more children
+ */
+struct dtm_node *dtm_node_next_child(struct dtm_node *node, struct dtm_node *prev);
+
+/**
+ * @brief Get the tag of a node
+ *
+ * A tag is an integer associated with a node by the user of the tree, e.g. to
+ * cache a classification of the node.  A new node has tag -1.
+ *
+ * @param[in] node  A node
+ * @return tag of the node
+ */
+int dtm_node_tag(const struct dtm_node *node);
+
+/**
+ * @brief Set the tag of a node
+ *
+ * @param[in] node  A node
+ * @param[in] tag  Tag of the node
+ */
+void dtm_node_set_tag(struct dtm_node *node, int tag);
+
 /**
  * @brief Get the name of the property
  *
@@ -224,6 +630,25 @@ const void *dtm_prop_value(const struct dtm_property *prop, int *value_len);
  */
 int dtm_prop_set_value(struct dtm_property *prop, uint8_t *value, int value_len);
 
+/**
+ * @brief Get the tag of the property
+ *
+ * Same as a node tag, a property tag is an integer associated with a property
+ * by the user of the tree.  A new property has tag -1.
+ *
+ * @param[in] prop  A property
+ * @return tag of the property
+ */
+int dtm_prop_tag(const struct dtm_property *prop);
+
+/**
+ * @brief Set the tag of the property
+ *
+ * @param[in] prop  A property
+ * @param[in] tag  Tag of the property
+ */
+void dtm_prop_set_tag(struct dtm_property *prop, int tag);
+
 /**
  * @brief Get the value of the integer property
  *
@@ -242,7 +667,8 @@ uint32_t dtm_prop_value_u32(const struct dtm_property *prop);
  *   prop_fn - for each traverse node property (can be NULL)
  *
  * If any of the traverse function returns non-zero value, then the traverse
- * function returns with that return value.
+ * function returns with that return value.  The exceptions are
+ * DTM_TRAVERSE_SKIP and DTM_TRAVERSE_PRUNE returned by node_fn.
  *
  * @param[in] root  Root of the device tree
  * @param[in] do_all  Whether to traverse all nodes or only enabled nodes
@@ -289,4 +715,112 @@ struct dtm_node *dtm_find_node_by_path(struct dtm_node *root, const char *path);
 struct dtm_node *dtm_tree_rearrange(struct dtm_node *root,
 				    struct dtm_nodelist *nlist);
 
+/**
+ * @brief Phases timed by the statistics
+ *
+ * The phases nest (e.g. encode within traverse), so the times overlap.
+ * The times of the worker threads add up.
+ */
+enum dtm_stats_phase {
+	DTM_STATS_OPEN,		/* open and map the files */
+	DTM_STATS_PARSE,	/* FDT to tree */
+	DTM_STATS_INFODB,	/* infodb load */
+	DTM_STATS_TRAVERSE,	/* tree traversal for export */
+	DTM_STATS_ENCODE,	/* attribute value encode and decode */
+	DTM_STATS_FORMAT,	/* text dump formatting and parsing */
+	DTM_STATS_WRITE,	/* tree to FDT, file writes and flushes */
+	DTM_STATS_PHASE_MAX,
+};
+
+/**
+ * @brief Counters of the statistics
+ */
+enum dtm_stats_counter {
+	DTM_STATS_NODES,	/* nodes created */
+	DTM_STATS_PROPERTIES,	/* properties created */
+	DTM_STATS_LOOKUPS,	/* node and attribute lookups */
+	DTM_STATS_ALLOCS,	/* allocations for trees and buffers */
+	DTM_STATS_BYTES,	/* bytes written */
+	DTM_STATS_COUNTER_MAX,
+};
+
+/**
+ * @brief Statistics collected since enabled or reset
+ */
+struct dtm_stats {
+	uint64_t calls[DTM_STATS_PHASE_MAX];
+	uint64_t time_ns[DTM_STATS_PHASE_MAX];
+	uint64_t count[DTM_STATS_COUNTER_MAX];
+};
+
+/**
+ * @brief Whether statistics are collected, checked inline by the callers
+ */
+extern bool dtm_stats_enabled;
+
+/**
+ * @brief Enable or disable the collection of statistics
+ *
+ * @param[in] enable  Whether to collect statistics
+ */
+void dtm_stats_enable(bool enable);
+
+/**
+ * @brief Get the statistics collected so far
+ *
+ * @param[out] stats  Statistics
+ */
+void dtm_stats_get(struct dtm_stats *stats);
+
+/**
+ * @brief Clear the statistics
+ */
+void dtm_stats_reset(void);
+
+/**
+ * @brief Print the statistics collected so far
+ *
+ * @param[in] fp  File pointer for output
+ * @param[in] json  Whether to print JSON instead of a summary table
+ */
+void dtm_stats_print(FILE *fp, bool json);
+
+uint64_t dtm_stats_time(void);
+void dtm_stats_add_time(enum dtm_stats_phase phase, uint64_t start);
+void dtm_stats_add(enum dtm_stats_counter counter, uint64_t n);
+
+/**
+ * @brief Start timing a phase
+ *
+ * @return start time to pass to dtm_stats_stop(), 0 if not enabled
+ */
+static inline uint64_t dtm_stats_start(void)
+{
+	return dtm_stats_enabled ? dtm_stats_time() : 0;
+}
+
+/**
+ * @brief Stop timing a phase
+ *
+ * @param[in] phase  Phase
+ * @param[in] start  Start time from dtm_stats_start()
+ */
+static inline void dtm_stats_stop(enum dtm_stats_phase phase, uint64_t start)
+{
+	if (start)
+		dtm_stats_add_time(phase, start);
+}
+
+/**
+ * @brief Add to a counter
+ *
+ * @param[in] counter  Counter
+ * @param[in] n  Value to add
+ */
+static inline void dtm_stats_count(enum dtm_stats_counter counter, uint64_t n)
+{
+	if (dtm_stats_enabled)
+		dtm_stats_add(counter, n);
+}
+
 #endif /* __DTM_H__ */
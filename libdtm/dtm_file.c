@@ -17,17 +17,225 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <libgen.h>
 
-#include "fdt/fdt_prop.h"
+#include <libfdt.h>
 
 #include "dtm_internal.h"
+#include "dtm_probe.h"
 #include "dtm.h"
 
+/* Record the pages of the mapping modified by a write */
+static void dtm_file_mark_dirty(struct dtm_file *dfile, const void *value, int len)
+{
+	size_t start, end, page;
+	long page_size;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (page_size <= 0)
+		page_size = 4096;
+
+	if (!dfile->dirty) {
+		dfile->dirty = calloc(dfile->len / page_size / 8 + 1, 1);
+		if (!dfile->dirty)
+			return;
+	}
+
+	start = ((const char *)value - (const char *)dfile->ptr) / page_size;
+	end = ((const char *)value - (const char *)dfile->ptr + len - 1) / page_size;
+
+	for (page = start; page <= end; page++) {
+		if (dfile->dirty[page / 8] & (1 << (page % 8)))
+			continue;
+
+		dfile->dirty[page / 8] |= (1 << (page % 8));
+		dfile->dirty_pages += 1;
+	}
+
+	dfile->dirty_bytes += len;
+}
+
+/* Path hash of a node, used to look up the values in the override layers */
+struct dtm_file_path {
+	int offset;
+	uint64_t hash;
+};
+
+static int dtm_file_path_cmp(const void *a, const void *b)
+{
+	const struct dtm_file_path *p1 = (const struct dtm_file_path *)a;
+	const struct dtm_file_path *p2 = (const struct dtm_file_path *)b;
+
+	return (p1->offset > p2->offset) - (p1->offset < p2->offset);
+}
+
+/* Path hashes of all the nodes in the file, in offset order */
+static bool dtm_file_scan_paths(struct dtm_file *dfile)
+{
+	uint64_t *prefix = NULL, *tmp;
+	const char *name;
+	int offset = 0, depth = 0, max_depth = 0, allocated = 0;
+
+	do {
+		if (dfile->path_count == allocated) {
+			struct dtm_file_path *path;
+			int n = allocated ? allocated * 2 : 1024;
+
+			path = reallocarray(dfile->path, n, sizeof(struct dtm_file_path));
+			if (!path)
+				goto fail;
+
+			dfile->path = path;
+			allocated = n;
+		}
+
+		if (depth >= max_depth) {
+			max_depth = depth + 16;
+			tmp = reallocarray(prefix, max_depth, sizeof(uint64_t));
+			if (!tmp)
+				goto fail;
+
+			prefix = tmp;
+		}
+
+		if (depth == 0) {
+			prefix[0] = dtm_layer_path_hash("/");
+		} else {
+			name = fdt_get_name(dfile->ptr, offset, NULL);
+			if (!name)
+				goto fail;
+
+			prefix[depth] = dtm_layer_child_hash(prefix[depth-1], depth == 1, name);
+		}
+
+		dfile->path[dfile->path_count].offset = offset;
+		dfile->path[dfile->path_count].hash = prefix[depth];
+		dfile->path_count += 1;
+
+		offset = fdt_next_node(dfile->ptr, offset, &depth);
+	} while (offset >= 0 && depth > 0);
+
+	free(prefix);
+	return true;
+
+fail:
+	free(prefix);
+	free(dfile->path);
+	dfile->path = NULL;
+	dfile->path_count = 0;
+	return false;
+}
+
+bool dtm_file_offset_hash(struct dtm_file *dfile, int offset, uint64_t *hash)
+{
+	struct dtm_file_path key = { .offset = offset }, *p;
+
+	if (!dfile->path && !dtm_file_scan_paths(dfile))
+		return false;
+
+	p = bsearch(&key, dfile->path, dfile->path_count, sizeof(struct dtm_file_path),
+		    dtm_file_path_cmp);
+	if (!p)
+		return false;
+
+	*hash = p->hash;
+	return true;
+}
+
+/* Check if any of the layers (journal, overlay, base) overrides values */
+bool dtm_file_layered(struct dtm_file *dfile)
+{
+	for (; dfile; dfile = dfile->base) {
+		if (dfile->overlay)
+			return true;
+		if (dfile->journal && dtm_layer_count(dtm_journal_layer(dfile->journal)) > 0)
+			return true;
+	}
+
+	return false;
+}
+
+/* Current value of a property, from the topmost layer which overrides it */
+static const void *dtm_file_layer_value(struct dtm_file *dfile, uint64_t path_hash,
+					const char *name, const void *value, int len)
+{
+	const void *lvalue;
+	int llen;
+
+	for (; dfile; dfile = dfile->base) {
+		if (dfile->journal) {
+			lvalue = dtm_layer_lookup(dtm_journal_layer(dfile->journal),
+						  path_hash, name, &llen);
+			if (lvalue && llen == len)
+				return lvalue;
+		}
+
+		if (dfile->overlay) {
+			lvalue = dtm_layer_lookup(dfile->overlay, path_hash, name, &llen);
+			if (lvalue && llen == len)
+				return lvalue;
+		}
+	}
+
+	return value;
+}
+
+/*
+ * Write a property only if the value has changed, so that the pages of an
+ * unchanged device tree are not modified and written back to the file.
+ * With a journal, the value is appended to the journal instead, and with
+ * an overlay the value is added to the overlay.
+ *
+ * Returns the number of bytes written, 0 if the value is unchanged, or -1
+ * on failure.
+ */
+static int dtm_file_write_property(struct dtm_file *dfile, int offset, uint64_t path_hash,
+				    const char *path, const char *name,
+				    const void *value, int value_len)
+{
+	const void *cur;
+	bool ok;
+	int len;
+
+	cur = fdt_getprop(dfile->ptr, offset, name, &len);
+	if (!cur || len != value_len)
+		return -1;
+
+	if (dfile->journal || dfile->overlay) {
+		cur = dtm_file_layer_value(dfile, path_hash, name, cur, len);
+		if (memcmp(cur, value, len) == 0)
+			return 0;
+
+		if (dfile->overlay)
+			ok = dtm_overlay_set(dfile, path_hash, path, name, value, value_len);
+		else
+			ok = dtm_journal_append(dfile->journal, path_hash, name, value, value_len);
+
+		return ok ? len : -1;
+	}
+
+	if (memcmp(cur, value, len) == 0)
+		return 0;
+
+	if (fdt_setprop_inplace(dfile->ptr, offset, name, value, value_len) != 0)
+		return -1;
+
+	if (len > 0)
+		dtm_file_mark_dirty(dfile, cur, len);
+
+	return len;
+}
+
 bool dtm_file_update_node(struct dtm_file *dfile, struct dtm_node *node, const char *name)
 {
 	struct dtm_property *prop;
+	uint64_t path_hash = 0;
 	char *path;
-	int ret;
+	int offset, written, bytes = 0;
+	bool ok = true;
 
 	if (!dfile->ptr || dfile->do_create || !dfile->do_write)
 		return false;
@@ -36,22 +244,315 @@ bool dtm_file_update_node(struct dtm_file *dfile, struct dtm_node *node, const c
 	if (!path)
 		return false;
 
+	DTM_PROBE2(update_node_start, path, name);
+
+	if (dfile->journal || dfile->overlay)
+		path_hash = dtm_layer_path_hash(path);
+
+	offset = fdt_path_offset(dfile->ptr, path);
+	if (offset < 0) {
+		ok = false;
+		goto done;
+	}
+
 	list_for_each(&node->properties, prop, list) {
 		if (name && strcmp(prop->name, name) != 0)
 			continue;
 
-		ret = fdt_prop_write(dfile->ptr, path, name, prop->value, prop->len);
-		if (ret != 0)
-			goto fail;
+		written = dtm_file_write_property(dfile, offset, path_hash, path,
+						  prop->name, prop->value, prop->len);
+		if (written < 0) {
+			ok = false;
+			break;
+		}
+
+		bytes += written;
 
 		if (name)
 			break;
 	}
 
+done:
+	DTM_PROBE3(update_node_end, path, name, ok ? bytes : -1);
 	free(path);
+	return ok;
+}
+
+void dtm_file_dirty(struct dtm_file *dfile, size_t *bytes, int *pages)
+{
+	if (dfile->journal) {
+		dtm_journal_dirty(dfile->journal, bytes, pages);
+		return;
+	}
+
+	/* Overlay is rewritten with only the changed values */
+	if (dfile->overlay) {
+		long page_size = sysconf(_SC_PAGESIZE);
+
+		if (page_size <= 0)
+			page_size = 4096;
+
+		*bytes = dfile->dirty_bytes;
+		*pages = (dfile->dirty_bytes + page_size - 1) / page_size;
+		return;
+	}
+
+	*bytes = dfile->dirty_bytes;
+	*pages = dfile->dirty_pages;
+}
+
+int dtm_file_scan(struct dtm_file *dfile, dtm_file_scan_fn fn, void *priv)
+{
+	const char *name;
+	int offset = 0, depth = 0, ret;
+
+	if (!dfile->ptr || dfile->do_create)
+		return -1;
+
+	do {
+		name = fdt_get_name(dfile->ptr, offset, NULL);
+		if (!name)
+			return -1;
+
+		ret = fn(dfile, offset, depth, name, priv);
+		if (ret)
+			return ret;
+
+		offset = fdt_next_node(dfile->ptr, offset, &depth);
+	} while (offset >= 0 && depth > 0);
+
+	if (offset < 0 && offset != -FDT_ERR_NOTFOUND)
+		return -1;
+
+	return 0;
+}
+
+int dtm_file_node_offset(struct dtm_file *dfile, const char *path)
+{
+	int offset;
+
+	if (!dfile->ptr || dfile->do_create)
+		return -1;
+
+	dtm_stats_count(DTM_STATS_LOOKUPS, 1);
+
+	offset = fdt_path_offset(dfile->ptr, path);
+	if (offset < 0)
+		return -1;
+
+	return offset;
+}
+
+const void *dtm_file_get_property(struct dtm_file *dfile, int offset, const char *name, int *value_len)
+{
+	const void *value;
+	uint64_t path_hash;
+
+	if (!dfile->ptr || dfile->do_create)
+		return NULL;
+
+	value = fdt_getprop(dfile->ptr, offset, name, value_len);
+	if (!value || !dtm_file_layered(dfile))
+		return value;
+
+	if (!dtm_file_offset_hash(dfile, offset, &path_hash))
+		return NULL;
+
+	return dtm_file_layer_value(dfile, path_hash, name, value, *value_len);
+}
+
+const char *dtm_file_node_name(struct dtm_file *dfile, int offset)
+{
+	if (!dfile->ptr || dfile->do_create)
+		return NULL;
+
+	return fdt_get_name(dfile->ptr, offset, NULL);
+}
+
+int dtm_file_next_subnode(struct dtm_file *dfile, int parent, int prev)
+{
+	int offset;
+
+	if (!dfile->ptr || dfile->do_create)
+		return -1;
+
+	if (prev < 0)
+		offset = fdt_first_subnode(dfile->ptr, parent);
+	else
+		offset = fdt_next_subnode(dfile->ptr, prev);
+
+	if (offset < 0)
+		return -1;
+
+	return offset;
+}
+
+int dtm_file_subnode_offset(struct dtm_file *dfile, int parent, const char *name)
+{
+	int offset;
+
+	if (!dfile->ptr || dfile->do_create)
+		return -1;
+
+	dtm_stats_count(DTM_STATS_LOOKUPS, 1);
+
+	offset = fdt_subnode_offset(dfile->ptr, parent, name);
+	if (offset < 0)
+		return -1;
+
+	return offset;
+}
+
+int dtm_file_scan_properties(struct dtm_file *dfile, int offset, dtm_file_property_fn fn, void *priv)
+{
+	const void *value;
+	const char *name;
+	uint64_t path_hash = 0;
+	bool layered;
+	int prop, len, ret;
+
+	if (!dfile->ptr || dfile->do_create)
+		return -1;
+
+	layered = dtm_file_layered(dfile);
+	if (layered && !dtm_file_offset_hash(dfile, offset, &path_hash))
+		return -1;
+
+	fdt_for_each_property_offset(prop, dfile->ptr, offset) {
+		value = fdt_getprop_by_offset(dfile->ptr, prop, &name, &len);
+		if (!value)
+			return -1;
+
+		if (layered)
+			value = dtm_file_layer_value(dfile, path_hash, name, value, len);
+
+		ret = fn(dfile, offset, name, value, len, priv);
+		if (ret)
+			return ret;
+	}
+
+	if (prop < 0 && prop != -FDT_ERR_NOTFOUND)
+		return -1;
+
+	return 0;
+}
+
+bool dtm_file_set_property(struct dtm_file *dfile, int offset, const char *name, const void *value, int value_len)
+{
+	uint64_t path_hash = 0;
+	char path[1024];
+
+	if (!dfile->ptr || dfile->do_create || !dfile->do_write)
+		return false;
+
+	if ((dfile->journal || dfile->overlay) &&
+	    !dtm_file_offset_hash(dfile, offset, &path_hash))
+		return false;
+
+	/* Overlay needs the path to store the value */
+	if (dfile->overlay &&
+	    fdt_get_path(dfile->ptr, offset, path, sizeof(path)) != 0)
+		return false;
+
+	return dtm_file_write_property(dfile, offset, path_hash,
+				       dfile->overlay ? path : NULL,
+				       name, value, value_len) >= 0;
+}
+
+static bool dtm_file_sync_dir(const char *filename)
+{
+	char *copy;
+	bool ok;
+	int fd;
+
+	copy = strdup(filename);
+	if (!copy)
+		return false;
+
+	fd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+	free(copy);
+	if (fd == -1)
+		return false;
+
+	ok = (fsync(fd) == 0);
+	close(fd);
+	return ok;
+}
+
+/*
+ * Write the data to a new file, which then replaces the named file.  The
+ * new file and the directory entry are synced before returning, so the
+ * caller can drop anything the new file supersedes (e.g. the journal).
+ */
+bool dtm_file_replace(const char *filename, const void *buf, size_t len)
+{
+	const uint8_t *ptr = (const uint8_t *)buf;
+	uint64_t start;
+	size_t size = len;
+	char *tmp;
+	ssize_t n;
+	int fd;
+
+	tmp = malloc(strlen(filename) + 5);
+	if (!tmp)
+		return false;
+
+	sprintf(tmp, "%s.new", filename);
+
+	start = dtm_stats_start();
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		fprintf(stderr, "open() failed for %s\n", tmp);
+		free(tmp);
+		return false;
+	}
+
+	while (len > 0) {
+		n = write(fd, ptr, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			goto fail;
+		}
+
+		ptr += n;
+		len -= n;
+	}
+
+	if (fsync(fd) != 0) {
+		fprintf(stderr, "fsync() failed for %s\n", tmp);
+		goto fail;
+	}
+
+	if (close(fd) != 0) {
+		fd = -1;
+		goto fail;
+	}
+	fd = -1;
+
+	if (rename(tmp, filename) != 0) {
+		fprintf(stderr, "Failed to rename %s to %s\n", tmp, filename);
+		goto fail;
+	}
+
+	if (!dtm_file_sync_dir(filename)) {
+		fprintf(stderr, "fsync() failed for directory of %s\n", filename);
+		free(tmp);
+		return false;
+	}
+
+	dtm_stats_stop(DTM_STATS_WRITE, start);
+	dtm_stats_count(DTM_STATS_BYTES, size);
+
+	free(tmp);
 	return true;
 
 fail:
-	free(path);
+	if (fd != -1)
+		close(fd);
+	unlink(tmp);
+	free(tmp);
+	dtm_stats_stop(DTM_STATS_WRITE, start);
 	return false;
 }
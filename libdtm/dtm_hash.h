@@ -0,0 +1,60 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __DTM_HASH_H__
+#define __DTM_HASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * FNV-1a hash, used by libdtm and libdtree for names, paths and contents
+ *
+ * Start with the offset basis (or a seed), and hash more data by passing
+ * the previous hash.  The values are stored in journals, images, overlays
+ * and infodb digests, so the hash must not change.
+ */
+
+#define DTM_HASH32_INIT		2166136261u
+#define DTM_HASH64_INIT		0xcbf29ce484222325ULL
+
+static inline uint32_t dtm_hash32(uint32_t hash, const void *data, size_t len)
+{
+	const uint8_t *ptr = (const uint8_t *)data;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		hash ^= ptr[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static inline uint64_t dtm_hash64(uint64_t hash, const void *data, size_t len)
+{
+	const uint8_t *ptr = (const uint8_t *)data;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		hash ^= ptr[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+#endif /* __DTM_HASH_H__ */
@@ -0,0 +1,829 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "dtm_hash.h"
+#include "dtm_internal.h"
+#include "dtm.h"
+
+/*
+ * Tree image
+ *
+ * An image (<dtb>.image) is the parsed device tree, stored with offsets
+ * instead of pointers, so that it can be mapped read-only and shared by
+ * all the processes reading the device tree.  All integers are in host
+ * byte order, an image is not portable between hosts.
+ *
+ * Header:      magic "PDATAIMG", version, hash, size and file status of
+ *              device tree, counts and offsets of the sections
+ * Nodes:       in depth first order (root is 0), with parent, first child,
+ *              next sibling and the range of properties
+ * Properties:  name, length and offset of value, in device tree order
+ * Prop index:  properties of each node, sorted by name
+ * Names:       offsets of the unique node and property names, sorted
+ * Paths:       hash of the path of each node, sorted
+ * Values:      property values
+ * Strings:     names, NUL terminated
+ *
+ * The file status (device, inode, size, modification and change times) of
+ * the device tree is recorded before it is read.  An image is used without
+ * reading the device tree as long as the status is the same, and the device
+ * tree was not modified within a second of the image being written, when a
+ * later modification might keep the same times.  Otherwise the hash of the
+ * device tree decides.
+ */
+
+#define DTM_IMAGE_MAGIC		"PDATAIMG"
+#define DTM_IMAGE_VERSION	2
+#define DTM_IMAGE_SUFFIX	".image"
+#define DTM_IMAGE_NONE		UINT32_MAX
+
+struct dtm_image_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t size;
+	uint64_t dtb_hash;
+	uint32_t dtb_size;
+	uint32_t node_count;
+	uint32_t prop_count;
+	uint32_t name_count;
+	uint32_t node_offset;
+	uint32_t prop_offset;
+	uint32_t index_offset;
+	uint32_t name_offset;
+	uint32_t path_offset;
+	uint32_t value_offset;
+	uint32_t value_size;
+	uint32_t string_offset;
+	uint32_t string_size;
+	uint32_t reserved;
+	uint64_t dtb_dev;
+	uint64_t dtb_ino;
+	int64_t dtb_mtime;
+	int64_t dtb_ctime;
+	uint32_t dtb_mtime_nsec;
+	uint32_t dtb_ctime_nsec;
+};
+
+struct dtm_image_node {
+	uint32_t name;
+	uint32_t parent;
+	uint32_t first_child;
+	uint32_t next_sibling;
+	uint32_t first_prop;
+	uint32_t prop_count;
+};
+
+struct dtm_image_prop {
+	uint32_t name;
+	uint32_t len;
+	uint32_t value;
+};
+
+struct dtm_image_path {
+	uint64_t hash;
+	uint32_t node;
+	uint32_t reserved;
+};
+
+struct dtm_image {
+	void *ptr;
+	size_t len;
+	const struct dtm_image_header *hdr;
+	const struct dtm_image_node *node;
+	const struct dtm_image_prop *prop;
+	const uint32_t *index;
+	const uint32_t *name;
+	const struct dtm_image_path *path;
+	const uint8_t *value;
+	const char *string;
+};
+
+char *dtm_file_image_name(const char *filename)
+{
+	char *path;
+
+	path = malloc(strlen(filename) + strlen(DTM_IMAGE_SUFFIX) + 1);
+	if (!path)
+		return NULL;
+
+	sprintf(path, "%s%s", filename, DTM_IMAGE_SUFFIX);
+	return path;
+}
+
+/* Record the file status of the device tree in the header */
+static void dtm_image_set_stat(struct dtm_image_header *hdr, const struct stat *st)
+{
+	hdr->dtb_dev = st->st_dev;
+	hdr->dtb_ino = st->st_ino;
+	hdr->dtb_mtime = st->st_mtim.tv_sec;
+	hdr->dtb_mtime_nsec = st->st_mtim.tv_nsec;
+	hdr->dtb_ctime = st->st_ctim.tv_sec;
+	hdr->dtb_ctime_nsec = st->st_ctim.tv_nsec;
+}
+
+static bool dtm_image_same_stat(const struct dtm_image_header *hdr, const struct stat *st)
+{
+	return hdr->dtb_dev == (uint64_t)st->st_dev &&
+	       hdr->dtb_ino == (uint64_t)st->st_ino &&
+	       hdr->dtb_size == (uint64_t)st->st_size &&
+	       hdr->dtb_mtime == st->st_mtim.tv_sec &&
+	       hdr->dtb_mtime_nsec == (uint32_t)st->st_mtim.tv_nsec &&
+	       hdr->dtb_ctime == st->st_ctim.tv_sec &&
+	       hdr->dtb_ctime_nsec == (uint32_t)st->st_ctim.tv_nsec;
+}
+
+/*
+ * Hash of the device tree contents, fails if there are overrides.  The file
+ * status is taken before the contents are read, so that a modification while
+ * reading is seen as a different status.
+ */
+static bool dtm_image_dtb_hash(const char *filename, uint64_t *hash, uint32_t *size,
+			       struct stat *st)
+{
+	struct dtm_file *dfile;
+
+	dfile = dtm_file_open(filename, false);
+	if (!dfile)
+		return false;
+
+	/* Image has only the values from device tree */
+	if (dtm_file_layered(dfile) || fstat(dfile->fd, st) != 0) {
+		dtm_file_close(dfile);
+		return false;
+	}
+
+	*hash = dtm_hash64(DTM_HASH64_INIT, dfile->ptr, dfile->len);
+	*size = dfile->len;
+
+	dtm_file_close(dfile);
+	return true;
+}
+
+/*
+ * Check that an image matches the device tree, without reading the device
+ * tree when its file status is the same as when the image was created.
+ */
+static bool dtm_image_current(const struct dtm_image_header *hdr, const struct stat *img_st,
+			      const char *filename)
+{
+	struct stat st;
+	uint64_t dtb_hash;
+	uint32_t dtb_size;
+
+	if (stat(filename, &st) != 0)
+		return false;
+
+	/* Any records in the journal override the values in the image */
+	if (!dtm_journal_empty(filename))
+		return false;
+
+	if (dtm_image_same_stat(hdr, &st) && st.st_mtim.tv_sec + 1 < img_st->st_mtim.tv_sec)
+		return true;
+
+	if (!dtm_image_dtb_hash(filename, &dtb_hash, &dtb_size, &st))
+		return false;
+
+	return dtb_hash == hdr->dtb_hash && dtb_size == hdr->dtb_size;
+}
+
+/*
+ * Image creation
+ */
+
+struct dtm_image_build {
+	struct dtm_node **tnode;
+	struct dtm_image_node *node;
+	struct dtm_image_path *path;
+	uint32_t *last_child;
+	uint32_t node_count, node_allocated;
+	uint32_t prop_count;
+	const char **name;
+	uint32_t name_count, name_allocated;
+	size_t value_size;
+};
+
+static bool dtm_image_add_name(struct dtm_image_build *b, const char *name)
+{
+	if (b->name_count == b->name_allocated) {
+		const char **tmp;
+		uint32_t n = b->name_allocated ? b->name_allocated * 2 : 1024;
+
+		tmp = reallocarray(b->name, n, sizeof(const char *));
+		if (!tmp)
+			return false;
+
+		b->name = tmp;
+		b->name_allocated = n;
+	}
+
+	b->name[b->name_count++] = name;
+	return true;
+}
+
+static bool dtm_image_add_node(struct dtm_image_build *b, struct dtm_node *tnode,
+			       uint32_t parent, uint64_t hash)
+{
+	struct dtm_property *prop;
+	struct dtm_node *child;
+	uint32_t n;
+
+	if (b->node_count == b->node_allocated) {
+		uint32_t size = b->node_allocated ? b->node_allocated * 2 : 1024;
+		void *tmp;
+
+		tmp = reallocarray(b->tnode, size, sizeof(struct dtm_node *));
+		if (!tmp)
+			return false;
+		b->tnode = tmp;
+
+		tmp = reallocarray(b->node, size, sizeof(struct dtm_image_node));
+		if (!tmp)
+			return false;
+		b->node = tmp;
+
+		tmp = reallocarray(b->path, size, sizeof(struct dtm_image_path));
+		if (!tmp)
+			return false;
+		b->path = tmp;
+
+		tmp = reallocarray(b->last_child, size, sizeof(uint32_t));
+		if (!tmp)
+			return false;
+		b->last_child = tmp;
+
+		b->node_allocated = size;
+	}
+
+	n = b->node_count++;
+	b->tnode[n] = tnode;
+	b->node[n] = (struct dtm_image_node) {
+		.parent = parent,
+		.first_child = DTM_IMAGE_NONE,
+		.next_sibling = DTM_IMAGE_NONE,
+		.first_prop = b->prop_count,
+	};
+	b->path[n] = (struct dtm_image_path) {
+		.hash = hash,
+		.node = n,
+	};
+	b->last_child[n] = DTM_IMAGE_NONE;
+
+	if (parent != DTM_IMAGE_NONE) {
+		if (b->last_child[parent] == DTM_IMAGE_NONE)
+			b->node[parent].first_child = n;
+		else
+			b->node[b->last_child[parent]].next_sibling = n;
+		b->last_child[parent] = n;
+	}
+
+	if (!dtm_image_add_name(b, tnode->name))
+		return false;
+
+	dtm_node_for_each_property(tnode, prop) {
+		if (!dtm_image_add_name(b, prop->name))
+			return false;
+
+		b->node[n].prop_count += 1;
+		b->prop_count += 1;
+		b->value_size += prop->len;
+	}
+
+	dtm_node_for_each_child(tnode, child) {
+		if (!dtm_image_add_node(b, child, n, dtm_layer_child_hash(hash, n == 0, child->name)))
+			return false;
+	}
+
+	return true;
+}
+
+static int dtm_image_name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static int dtm_image_path_cmp(const void *a, const void *b)
+{
+	const struct dtm_image_path *p1 = (const struct dtm_image_path *)a;
+	const struct dtm_image_path *p2 = (const struct dtm_image_path *)b;
+
+	if (p1->hash != p2->hash)
+		return p1->hash > p2->hash ? 1 : -1;
+
+	return (p1->node > p2->node) - (p1->node < p2->node);
+}
+
+static uint32_t dtm_image_name_id(struct dtm_image_build *b, const char *name)
+{
+	const char **p;
+
+	p = bsearch(&name, b->name, b->name_count, sizeof(const char *), dtm_image_name_cmp);
+	return p - b->name;
+}
+
+/* Index keys are name id and property, so that sort is by name */
+static int dtm_image_index_cmp(const void *a, const void *b)
+{
+	uint64_t k1 = *(const uint64_t *)a;
+	uint64_t k2 = *(const uint64_t *)b;
+
+	return (k1 > k2) - (k1 < k2);
+}
+
+static size_t dtm_image_align(size_t offset)
+{
+	return (offset + 7) & ~(size_t)7;
+}
+
+int dtm_image_create(const char *filename, const char *image)
+{
+	struct dtm_image_build b = { 0 };
+	struct dtm_image_header *hdr;
+	struct dtm_image_prop *prop;
+	struct dtm_file *dfile;
+	struct dtm_node *root;
+	uint32_t *index, *name;
+	uint64_t *key = NULL;
+	uint8_t *buf = NULL;
+	char *string;
+	size_t size, offset, value, strings;
+	struct stat dtb_stat;
+	uint64_t dtb_hash;
+	uint32_t dtb_size, i, j, p;
+	int ret = -1;
+
+	if (!dtm_image_dtb_hash(filename, &dtb_hash, &dtb_size, &dtb_stat)) {
+		fprintf(stderr, "Failed to create image, %s has overrides\n", filename);
+		return -1;
+	}
+
+	dfile = dtm_file_open(filename, false);
+	if (!dfile)
+		return -1;
+
+	root = dtm_file_read(dfile);
+	dtm_file_close(dfile);
+	if (!root)
+		return -1;
+
+	if (!dtm_image_add_node(&b, root, DTM_IMAGE_NONE, dtm_layer_path_hash("/")))
+		goto fail;
+
+	/* Intern the names */
+	qsort(b.name, b.name_count, sizeof(const char *), dtm_image_name_cmp);
+	for (i=0, j=0; i<b.name_count; i++) {
+		if (j > 0 && strcmp(b.name[j-1], b.name[i]) == 0)
+			continue;
+		b.name[j++] = b.name[i];
+	}
+	b.name_count = j;
+
+	strings = 0;
+	for (i=0; i<b.name_count; i++)
+		strings += strlen(b.name[i]) + 1;
+
+	qsort(b.path, b.node_count, sizeof(struct dtm_image_path), dtm_image_path_cmp);
+
+	/* Layout of the sections */
+	hdr = &(struct dtm_image_header) {
+		.magic = DTM_IMAGE_MAGIC,
+		.version = DTM_IMAGE_VERSION,
+		.dtb_hash = dtb_hash,
+		.dtb_size = dtb_size,
+		.node_count = b.node_count,
+		.prop_count = b.prop_count,
+		.name_count = b.name_count,
+		.value_size = b.value_size,
+		.string_size = strings,
+	};
+	dtm_image_set_stat(hdr, &dtb_stat);
+
+	offset = dtm_image_align(sizeof(struct dtm_image_header));
+	hdr->node_offset = offset;
+	offset = dtm_image_align(offset + b.node_count * sizeof(struct dtm_image_node));
+	hdr->prop_offset = offset;
+	offset = dtm_image_align(offset + b.prop_count * sizeof(struct dtm_image_prop));
+	hdr->index_offset = offset;
+	offset = dtm_image_align(offset + b.prop_count * sizeof(uint32_t));
+	hdr->name_offset = offset;
+	offset = dtm_image_align(offset + b.name_count * sizeof(uint32_t));
+	hdr->path_offset = offset;
+	offset = dtm_image_align(offset + b.node_count * sizeof(struct dtm_image_path));
+	hdr->value_offset = offset;
+	offset = dtm_image_align(offset + b.value_size);
+	hdr->string_offset = offset;
+	size = offset + strings;
+
+	if (size > UINT32_MAX) {
+		fprintf(stderr, "Device tree %s is too large for image\n", filename);
+		goto fail;
+	}
+
+	hdr->size = size;
+
+	buf = calloc(1, size);
+	key = calloc(b.prop_count ? b.prop_count : 1, sizeof(uint64_t));
+	if (!buf || !key)
+		goto fail;
+
+	memcpy(buf, hdr, sizeof(*hdr));
+
+	string = (char *)buf + hdr->string_offset;
+	name = (uint32_t *)(buf + hdr->name_offset);
+	for (i=0, offset=0; i<b.name_count; i++) {
+		name[i] = offset;
+		strcpy(string + offset, b.name[i]);
+		offset += strlen(b.name[i]) + 1;
+	}
+
+	prop = (struct dtm_image_prop *)(buf + hdr->prop_offset);
+	index = (uint32_t *)(buf + hdr->index_offset);
+	value = 0;
+	for (i=0, p=0; i<b.node_count; i++) {
+		struct dtm_property *tprop;
+
+		b.node[i].name = dtm_image_name_id(&b, b.tnode[i]->name);
+
+		dtm_node_for_each_property(b.tnode[i], tprop) {
+			prop[p] = (struct dtm_image_prop) {
+				.name = dtm_image_name_id(&b, tprop->name),
+				.len = tprop->len,
+				.value = value,
+			};
+			memcpy(buf + hdr->value_offset + value, tprop->value, tprop->len);
+			value += tprop->len;
+
+			key[p] = ((uint64_t)prop[p].name << 32) | p;
+			p++;
+		}
+
+		qsort(&key[b.node[i].first_prop], b.node[i].prop_count, sizeof(uint64_t),
+		      dtm_image_index_cmp);
+	}
+
+	for (p=0; p<b.prop_count; p++)
+		index[p] = (uint32_t)key[p];
+
+	memcpy(buf + hdr->node_offset, b.node, b.node_count * sizeof(struct dtm_image_node));
+	memcpy(buf + hdr->path_offset, b.path, b.node_count * sizeof(struct dtm_image_path));
+
+	if (!dtm_file_replace(image, buf, size))
+		goto fail;
+
+	ret = 0;
+
+fail:
+	free(key);
+	free(buf);
+	free(b.tnode);
+	free(b.node);
+	free(b.path);
+	free(b.last_child);
+	free(b.name);
+	dtm_tree_free(root);
+	return ret;
+}
+
+/*
+ * Image access
+ */
+
+static bool dtm_image_section(const struct dtm_image_header *hdr, uint32_t offset,
+			      size_t count, size_t size)
+{
+	return offset <= hdr->size && count * size <= hdr->size - offset;
+}
+
+static bool dtm_image_valid(const struct dtm_image_header *hdr, size_t len)
+{
+	if (len < sizeof(*hdr))
+		return false;
+
+	if (memcmp(hdr->magic, DTM_IMAGE_MAGIC, sizeof(hdr->magic)) != 0 ||
+	    hdr->version != DTM_IMAGE_VERSION ||
+	    hdr->size != len ||
+	    hdr->node_count == 0)
+		return false;
+
+	if (!dtm_image_section(hdr, hdr->node_offset, hdr->node_count, sizeof(struct dtm_image_node)) ||
+	    !dtm_image_section(hdr, hdr->prop_offset, hdr->prop_count, sizeof(struct dtm_image_prop)) ||
+	    !dtm_image_section(hdr, hdr->index_offset, hdr->prop_count, sizeof(uint32_t)) ||
+	    !dtm_image_section(hdr, hdr->name_offset, hdr->name_count, sizeof(uint32_t)) ||
+	    !dtm_image_section(hdr, hdr->path_offset, hdr->node_count, sizeof(struct dtm_image_path)) ||
+	    !dtm_image_section(hdr, hdr->value_offset, hdr->value_size, 1) ||
+	    !dtm_image_section(hdr, hdr->string_offset, hdr->string_size, 1))
+		return false;
+
+	/* Strings are last, so a NUL at the end bounds all the names */
+	if (hdr->string_size == 0 || hdr->string_offset + hdr->string_size != hdr->size ||
+	    ((const char *)hdr)[hdr->size - 1] != '\0')
+		return false;
+
+	return true;
+}
+
+struct dtm_image *dtm_image_open(const char *image, const char *filename)
+{
+	struct dtm_image *img;
+	struct stat statbuf;
+	uint8_t *ptr;
+	int fd;
+
+	fd = open(image, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+
+	img = malloc(sizeof(struct dtm_image));
+	if (!img) {
+		close(fd);
+		return NULL;
+	}
+
+	*img = (struct dtm_image) {
+		.ptr = MAP_FAILED,
+	};
+
+	if (fstat(fd, &statbuf) != 0 || statbuf.st_size < (off_t)sizeof(struct dtm_image_header))
+		goto fail;
+
+	img->len = statbuf.st_size;
+	img->ptr = mmap(NULL, img->len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	fd = -1;
+	if (img->ptr == MAP_FAILED)
+		goto fail;
+
+	ptr = img->ptr;
+	img->hdr = (const struct dtm_image_header *)ptr;
+	if (!dtm_image_valid(img->hdr, img->len)) {
+		fprintf(stderr, "Invalid image %s\n", image);
+		goto fail;
+	}
+
+	/* Stale image is not an error, device tree is read instead */
+	if (!dtm_image_current(img->hdr, &statbuf, filename))
+		goto fail;
+
+	img->node = (const struct dtm_image_node *)(ptr + img->hdr->node_offset);
+	img->prop = (const struct dtm_image_prop *)(ptr + img->hdr->prop_offset);
+	img->index = (const uint32_t *)(ptr + img->hdr->index_offset);
+	img->name = (const uint32_t *)(ptr + img->hdr->name_offset);
+	img->path = (const struct dtm_image_path *)(ptr + img->hdr->path_offset);
+	img->value = ptr + img->hdr->value_offset;
+	img->string = (const char *)ptr + img->hdr->string_offset;
+
+	return img;
+
+fail:
+	if (fd != -1)
+		close(fd);
+	dtm_image_close(img);
+	return NULL;
+}
+
+void dtm_image_close(struct dtm_image *img)
+{
+	if (!img)
+		return;
+
+	if (img->ptr != MAP_FAILED)
+		munmap(img->ptr, img->len);
+
+	free(img);
+}
+
+static const char *dtm_image_string(struct dtm_image *img, uint32_t name)
+{
+	if (name >= img->hdr->name_count || img->name[name] >= img->hdr->string_size)
+		return NULL;
+
+	return img->string + img->name[name];
+}
+
+static bool dtm_image_valid_node(struct dtm_image *img, int node)
+{
+	return node >= 0 && (uint32_t)node < img->hdr->node_count;
+}
+
+static const void *dtm_image_prop_value(struct dtm_image *img, uint32_t p, int *value_len)
+{
+	const struct dtm_image_prop *prop = &img->prop[p];
+
+	if (prop->value > img->hdr->value_size || prop->len > img->hdr->value_size - prop->value)
+		return NULL;
+
+	if (value_len)
+		*value_len = prop->len;
+
+	return img->value + prop->value;
+}
+
+const char *dtm_image_node_name(struct dtm_image *img, int node)
+{
+	if (!dtm_image_valid_node(img, node))
+		return NULL;
+
+	return dtm_image_string(img, img->node[node].name);
+}
+
+/* Check the path of a node, as different paths may have the same hash */
+static bool dtm_image_path_match(struct dtm_image *img, uint32_t node, const char *path)
+{
+	const char *name;
+	size_t end, len;
+
+	end = strlen(path);
+	while (node != 0) {
+		if (node >= img->hdr->node_count)
+			return false;
+
+		name = dtm_image_string(img, img->node[node].name);
+		if (!name)
+			return false;
+
+		len = strlen(name);
+		if (end < len + 1 || path[end - len - 1] != '/' ||
+		    memcmp(path + end - len, name, len) != 0)
+			return false;
+
+		end -= len + 1;
+		node = img->node[node].parent;
+	}
+
+	return end == 0 || strcmp(path, "/") == 0;
+}
+
+int dtm_image_node_offset(struct dtm_image *img, const char *path)
+{
+	uint64_t hash;
+	uint32_t lo, hi, mid;
+
+	dtm_stats_count(DTM_STATS_LOOKUPS, 1);
+
+	hash = dtm_layer_path_hash(path);
+
+	/* First entry with the hash */
+	lo = 0;
+	hi = img->hdr->node_count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (img->path[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < img->hdr->node_count && img->path[lo].hash == hash; lo++) {
+		if (dtm_image_path_match(img, img->path[lo].node, path))
+			return img->path[lo].node;
+	}
+
+	return -1;
+}
+
+int dtm_image_next_subnode(struct dtm_image *img, int parent, int prev)
+{
+	uint32_t next;
+
+	if (prev < 0) {
+		if (!dtm_image_valid_node(img, parent))
+			return -1;
+		next = img->node[parent].first_child;
+	} else {
+		if (!dtm_image_valid_node(img, prev))
+			return -1;
+		next = img->node[prev].next_sibling;
+	}
+
+	/* Nodes are in depth first order, so a corrupt image cannot loop */
+	if (next >= img->hdr->node_count || (int)next <= (prev < 0 ? parent : prev))
+		return -1;
+
+	return next;
+}
+
+const void *dtm_image_get_property(struct dtm_image *img, int node, const char *name, int *value_len)
+{
+	const struct dtm_image_node *n;
+	const char *pname;
+	uint32_t lo, hi, mid, p;
+	int cmp;
+
+	if (!dtm_image_valid_node(img, node))
+		return NULL;
+
+	n = &img->node[node];
+	if (n->first_prop > img->hdr->prop_count || n->prop_count > img->hdr->prop_count - n->first_prop)
+		return NULL;
+
+	/* Names are sorted, so the index is sorted by name */
+	lo = 0;
+	hi = n->prop_count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		p = img->index[n->first_prop + mid];
+		if (p >= img->hdr->prop_count)
+			return NULL;
+
+		pname = dtm_image_string(img, img->prop[p].name);
+		if (!pname)
+			return NULL;
+
+		cmp = strcmp(pname, name);
+		if (cmp == 0)
+			return dtm_image_prop_value(img, p, value_len);
+
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return NULL;
+}
+
+struct dtm_node *dtm_image_read(struct dtm_image *img)
+{
+	struct dtm_node **tnode, *root = NULL;
+	const struct dtm_image_node *n;
+	const char *name;
+	const void *value;
+	uint64_t start;
+	uint32_t i, p;
+	int len;
+
+	tnode = calloc(img->hdr->node_count, sizeof(struct dtm_node *));
+	if (!tnode)
+		return NULL;
+
+	start = dtm_stats_start();
+
+	for (i=0; i<img->hdr->node_count; i++) {
+		n = &img->node[i];
+
+		name = dtm_image_string(img, n->name);
+		if (!name)
+			goto fail;
+
+		if (i == 0) {
+			root = dtm_tree_new();
+			tnode[i] = root;
+		} else {
+			/* Nodes are in depth first order */
+			if (n->parent >= i)
+				goto fail;
+
+			tnode[i] = dtm_node_new(name);
+			if (tnode[i])
+				dtm_tree_add_node(tnode[n->parent], tnode[i]);
+		}
+
+		if (!tnode[i])
+			goto fail;
+
+		if (n->first_prop > img->hdr->prop_count ||
+		    n->prop_count > img->hdr->prop_count - n->first_prop)
+			goto fail;
+
+		/* Values are borrowed from the image, and copied when modified */
+		for (p = n->first_prop; p < n->first_prop + n->prop_count; p++) {
+			name = dtm_image_string(img, img->prop[p].name);
+			value = dtm_image_prop_value(img, p, &len);
+			if (!name || !value)
+				goto fail;
+
+			if (dtm_node_add_property_ref(tnode[i], name, (void *)value, len) != 0)
+				goto fail;
+		}
+	}
+
+	free(tnode);
+	dtm_stats_stop(DTM_STATS_PARSE, start);
+	return root;
+
+fail:
+	free(tnode);
+	dtm_tree_free(root);
+	dtm_stats_stop(DTM_STATS_PARSE, start);
+	return NULL;
+}
@@ -17,8 +17,16 @@
 #ifndef __DTM_INTERNAL_H__
 #define __DTM_INTERNAL_H__
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
 #include <ccan/list/list.h>
 
+struct dtm_journal;
+struct dtm_layer;
+struct dtm_file_path;
+
 struct dtm_file {
 	const char *filename;
 	int fd;
@@ -26,6 +34,16 @@ struct dtm_file {
 	int len;
 	bool do_create;
 	bool do_write;
+	uint8_t *dirty;
+	int dirty_pages;
+	size_t dirty_bytes;
+	struct dtm_journal *journal;
+	struct dtm_file *base;
+	char *base_name;
+	struct dtm_layer *overlay;
+	bool overlay_dirty;
+	struct dtm_file_path *path;
+	int path_count;
 };
 
 struct dtm_property {
@@ -33,6 +51,8 @@ struct dtm_property {
 	char *name;
 	int len;
 	void *value;
+	bool borrowed;
+	int tag;
 };
 
 struct dtm_node {
@@ -42,6 +62,7 @@ struct dtm_node {
 	struct list_head properties;
 	struct list_head children;
 	bool enabled;
+	int tag;
 };
 
 struct dtm_nodelist {
@@ -50,13 +71,13 @@ struct dtm_nodelist {
 };
 
 struct dtm_property *dtm_prop_new(const char *name, void *value, int len);
+struct dtm_property *dtm_prop_new_ref(const char *name, void *value, int len);
 void dtm_prop_free(struct dtm_property *prop);
 struct dtm_property *dtm_prop_copy(struct dtm_property *prop);
 
 struct dtm_node *dtm_node_new(const char *name);
 void dtm_node_free(struct dtm_node *node);
 struct dtm_node *dtm_node_copy(const struct dtm_node *node);
-struct dtm_node *dtm_node_next_child(struct dtm_node *node, struct dtm_node *prev);
 struct dtm_property *dtm_node_next_property(struct dtm_node *node, struct dtm_property *prev);
 
 #define dtm_node_for_each_child(parent, child)          \
@@ -78,4 +99,38 @@ struct dtm_node *dtm_nodelist_get(struct dtm_nodelist *list, int index);
 
 void dtm_tree_add_node(struct dtm_node *parent, struct dtm_node *child);
 
+typedef int (*dtm_layer_fn)(const char *path, const char *name, const void *value, int len, void *priv);
+
+uint64_t dtm_layer_path_hash(const char *path);
+uint64_t dtm_layer_child_hash(uint64_t parent, bool root, const char *name);
+struct dtm_layer *dtm_layer_new(void);
+void dtm_layer_free(struct dtm_layer *layer);
+bool dtm_layer_add(struct dtm_layer *layer, uint64_t path_hash, const char *path,
+		   const char *name, const void *value, int len, bool copy);
+int dtm_layer_count(struct dtm_layer *layer);
+const void *dtm_layer_lookup(struct dtm_layer *layer, uint64_t path_hash,
+			     const char *name, int *value_len);
+int dtm_layer_for_each(struct dtm_layer *layer, dtm_layer_fn fn, void *priv);
+void dtm_layer_apply(struct dtm_layer *layer, struct dtm_node *root);
+
+int dtm_journal_open(const char *filename, bool do_write, struct dtm_journal **journal);
+void dtm_journal_free(struct dtm_journal *journal);
+bool dtm_journal_reset(const char *filename);
+bool dtm_journal_empty(const char *filename);
+struct dtm_layer *dtm_journal_layer(struct dtm_journal *journal);
+bool dtm_journal_append(struct dtm_journal *journal, uint64_t path_hash,
+			const char *name, const void *value, int value_len);
+void dtm_journal_dirty(struct dtm_journal *journal, size_t *bytes, int *pages);
+
+int dtm_overlay_open(struct dtm_file *dfile, int level);
+bool dtm_overlay_set(struct dtm_file *dfile, uint64_t path_hash, const char *path,
+		     const char *name, const void *value, int len);
+int dtm_overlay_save(struct dtm_file *dfile);
+
+bool dtm_file_layered(struct dtm_file *dfile);
+bool dtm_file_offset_hash(struct dtm_file *dfile, int offset, uint64_t *hash);
+bool dtm_file_replace(const char *filename, const void *buf, size_t len);
+bool dtm_file_replace_tree(const char *filename, struct dtm_node *root);
+struct dtm_file *dtm_file_open_level(const char *filename, bool do_write, int level);
+
 #endif /* __DTM_INTERNAL_H__ */
@@ -24,6 +24,7 @@
 
 #include "fdt/fdt_traverse.h"
 #include "dtm_internal.h"
+#include "dtm_probe.h"
 #include "dtm.h"
 
 static void dtm_file_free(struct dtm_file *dfile)
@@ -34,18 +35,25 @@ static void dtm_file_free(struct dtm_file *dfile)
 	if (dfile->do_create) {
 		if (dfile->ptr)
 			free(dfile->ptr);
-	} else {
-		if (dfile->ptr != MAP_FAILED)
+	} else if (dfile->ptr != MAP_FAILED) {
+		/* Overlay shares the mapping of the base */
+		if (!dfile->base || dfile->ptr != dfile->base->ptr)
 			munmap(dfile->ptr, dfile->len);
 	}
 
 	if (dfile->fd != -1)
 		close(dfile->fd);
 
+	dtm_journal_free(dfile->journal);
+	dtm_layer_free(dfile->overlay);
+	dtm_file_free(dfile->base);
+	free(dfile->base_name);
+	free(dfile->path);
+	free(dfile->dirty);
 	free(dfile);
 }
 
-static struct dtm_file *_dtm_file_open(const char *filename, bool do_create, bool do_write)
+static struct dtm_file *_dtm_file_open(const char *filename, bool do_create, bool do_write, int level)
 {
 	struct dtm_file *dfile;
 	struct stat statbuf;
@@ -101,6 +109,14 @@ static struct dtm_file *_dtm_file_open(const char *filename, bool do_create, boo
 		goto fail;
 	}
 
+	/* Values written to an overlay are kept in the overlay, not journal */
+	ret = dtm_overlay_open(dfile, level);
+	if (ret < 0)
+		goto fail;
+
+	if (ret == 0 && dtm_journal_open(filename, do_write, &dfile->journal) != 0)
+		goto fail;
+
 	return dfile;
 
 fail:
@@ -108,14 +124,29 @@ fail:
 	return NULL;
 }
 
+struct dtm_file *dtm_file_open_level(const char *filename, bool do_write, int level)
+{
+	return _dtm_file_open(filename, false, do_write, level);
+}
+
 struct dtm_file *dtm_file_open(const char *filename, bool do_write)
 {
-	return _dtm_file_open(filename, false, do_write);
+	struct dtm_file *dfile;
+	uint64_t start = dtm_stats_start();
+
+	dfile = _dtm_file_open(filename, false, do_write, 0);
+	dtm_stats_stop(DTM_STATS_OPEN, start);
+	return dfile;
 }
 
 struct dtm_file *dtm_file_create(const char *filename)
 {
-	return _dtm_file_open(filename, true, true);
+	struct dtm_file *dfile;
+	uint64_t start = dtm_stats_start();
+
+	dfile = _dtm_file_open(filename, true, true, 0);
+	dtm_stats_stop(DTM_STATS_OPEN, start);
+	return dfile;
 }
 
 static int dtm_file_store(struct dtm_file *dfile)
@@ -136,14 +167,33 @@ static int dtm_file_store(struct dtm_file *dfile)
 
 int dtm_file_close(struct dtm_file *dfile)
 {
-	int ret;
+	uint64_t start;
+	size_t bytes;
+	int pages, ret;
 
 	if (!dfile->do_create) {
+		/* Overlay is written as a new file, which is counted instead */
+		if (dtm_stats_enabled && dfile->do_write && !dfile->overlay) {
+			dtm_file_dirty(dfile, &bytes, &pages);
+			dtm_stats_count(DTM_STATS_BYTES, bytes);
+		}
+
+		ret = dtm_overlay_save(dfile);
 		dtm_file_free(dfile);
-		return 0;
+		return ret;
 	}
 
+	start = dtm_stats_start();
 	ret = dtm_file_store(dfile);
+	dtm_stats_stop(DTM_STATS_WRITE, start);
+
+	if (ret == 0)
+		dtm_stats_count(DTM_STATS_BYTES, dfile->len);
+
+	/* Journal of the previous contents does not apply any more */
+	if (ret == 0 && !dtm_journal_reset(dfile->filename))
+		ret = EIO;
+
 	dtm_file_free(dfile);
 
 	return ret;
@@ -169,23 +219,46 @@ static int dtm_file_read_prop(void *_node, const char *name, void *value, int va
 	return  dtm_node_add_property(node, name, value, valuelen);
 }
 
+/* Apply the values from the layers, starting with the bottom layer */
+static void dtm_file_apply_layers(struct dtm_file *dfile, struct dtm_node *root)
+{
+	if (dfile->base)
+		dtm_file_apply_layers(dfile->base, root);
+
+	if (dfile->overlay)
+		dtm_layer_apply(dfile->overlay, root);
+
+	if (dfile->journal)
+		dtm_layer_apply(dtm_journal_layer(dfile->journal), root);
+}
+
 struct dtm_node *dtm_file_read(struct dtm_file *dfile)
 {
 	struct dtm_node *root;
+	uint64_t start;
 
 	/* Parse only for files opened for read */
 	if (dfile->do_create)
 		return NULL;
 
+	DTM_PROBE1(file_read_start, dfile->filename);
+	start = dtm_stats_start();
+
 	root = dtm_tree_new();
 	if (!root)
-		return NULL;
+		goto done;
 
 	if (!fdt_traverse_read(dfile->ptr, root, dtm_file_read_node, dtm_file_read_prop, NULL)) {
 		dtm_tree_free(root);
-		return NULL;
+		root = NULL;
+		goto done;
 	}
 
+	dtm_file_apply_layers(dfile, root);
+
+done:
+	dtm_stats_stop(DTM_STATS_PARSE, start);
+	DTM_PROBE2(file_read_end, dfile->filename, root != NULL);
 	return root;
 }
 
@@ -224,14 +297,44 @@ static const void *dtm_file_write_prop(void *_node,
 	return next->value;
 }
 
+static void *dtm_file_blob(const char *filename, struct dtm_node *root, int *len)
+{
+	uint64_t start;
+	void *ptr;
+
+	DTM_PROBE1(fdt_traverse_write_start, filename);
+	start = dtm_stats_start();
+	ptr = fdt_traverse_write(root, dtm_file_write_node, dtm_file_write_prop, len);
+	dtm_stats_stop(DTM_STATS_WRITE, start);
+	DTM_PROBE2(fdt_traverse_write_end, filename, ptr ? *len : 0);
+
+	return ptr;
+}
+
 bool dtm_file_write(struct dtm_file *dfile, struct dtm_node *root)
 {
 	if (!dfile->do_create)
 		return false;
 
-	dfile->ptr = fdt_traverse_write(root, dtm_file_write_node, dtm_file_write_prop, &dfile->len);
+	dfile->ptr = dtm_file_blob(dfile->filename, root, &dfile->len);
 	if (!dfile->ptr)
 		return false;
 
 	return true;
 }
+
+/* Write a tree to a new file, which then replaces the named file */
+bool dtm_file_replace_tree(const char *filename, struct dtm_node *root)
+{
+	void *ptr;
+	int len;
+	bool ok;
+
+	ptr = dtm_file_blob(filename, root, &len);
+	if (!ptr)
+		return false;
+
+	ok = dtm_file_replace(filename, ptr, len);
+	free(ptr);
+	return ok;
+}
@@ -0,0 +1,635 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <endian.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "dtm_hash.h"
+#include "dtm_internal.h"
+#include "dtm.h"
+
+/*
+ * Override journal
+ *
+ * The journal (<dtb>.journal) is an append-only log of property values
+ * which override the values in the device tree.  Each record carries the
+ * hash of the node path, the property name, the encoded value and a
+ * sequence number.  The last record for a property wins.
+ *
+ * Header:  magic "PDATAJNL", version, generation (all integers are
+ *          big-endian)
+ * Record:  path hash, sequence number, checksum, name length, value length,
+ *          followed by the name and the value
+ *
+ * A record which is truncated or fails the checksum (e.g. interrupted
+ * write) ends the journal, and is overwritten by the next append.
+ *
+ * Several processes can append to the same journal.  The journal is opened
+ * for append and is locked (flock) for each append, which first picks up
+ * the records appended by the other processes.  The generation changes
+ * every time the journal is emptied.
+ */
+
+#define DTM_JOURNAL_MAGIC	"PDATAJNL"
+#define DTM_JOURNAL_VERSION	1
+#define DTM_JOURNAL_SUFFIX	".journal"
+
+struct dtm_journal_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t generation;
+};
+
+struct dtm_journal_record {
+	uint64_t path_hash;
+	uint32_t seq;
+	uint32_t check;
+	uint16_t name_len;
+	uint16_t reserved;
+	uint32_t value_len;
+};
+
+struct dtm_journal {
+	int fd;
+	uint8_t *data;
+	size_t len;
+	uint32_t seq;
+	uint32_t generation;
+	size_t end;
+	struct dtm_layer *layer;
+	off_t append_start;
+	size_t append_bytes;
+};
+
+static uint32_t dtm_journal_check(const struct dtm_journal_record *rec,
+				  const char *name, const void *value)
+{
+	uint64_t hash;
+
+	hash = dtm_hash64(DTM_HASH64_INIT, &rec->path_hash, sizeof(rec->path_hash));
+	hash = dtm_hash64(hash, &rec->seq, sizeof(rec->seq));
+	hash = dtm_hash64(hash, name, be16toh(rec->name_len));
+	hash = dtm_hash64(hash, value, be32toh(rec->value_len));
+
+	return (uint32_t)(hash ^ (hash >> 32));
+}
+
+char *dtm_file_journal_name(const char *filename)
+{
+	char *path;
+
+	path = malloc(strlen(filename) + strlen(DTM_JOURNAL_SUFFIX) + 1);
+	if (!path)
+		return NULL;
+
+	sprintf(path, "%s%s", filename, DTM_JOURNAL_SUFFIX);
+	return path;
+}
+
+static bool dtm_journal_valid_header(const struct dtm_journal_header *hdr)
+{
+	return memcmp(hdr->magic, DTM_JOURNAL_MAGIC, sizeof(hdr->magic)) == 0 &&
+	       be32toh(hdr->version) == DTM_JOURNAL_VERSION;
+}
+
+/*
+ * Index the valid records in data, starting at offset.  The end of the
+ * valid records is set in *valid.  Values are copied if data is not kept.
+ */
+static bool dtm_journal_scan(struct dtm_journal *j, const uint8_t *data, size_t offset,
+			     size_t len, bool copy, size_t *valid)
+{
+	struct dtm_journal_record rec;
+
+	while (offset + sizeof(rec) <= len) {
+		const char *name;
+		const uint8_t *value;
+		size_t name_len, value_len;
+
+		memcpy(&rec, data + offset, sizeof(rec));
+		name_len = be16toh(rec.name_len);
+		value_len = be32toh(rec.value_len);
+
+		if (name_len == 0 ||
+		    offset + sizeof(rec) + name_len + value_len > len)
+			break;
+
+		name = (const char *)data + offset + sizeof(rec);
+		value = (const uint8_t *)name + name_len;
+
+		/* Name is stored with the terminating NUL */
+		if (name[name_len-1] != '\0' || strlen(name) != name_len-1)
+			break;
+
+		if (be32toh(rec.check) != dtm_journal_check(&rec, name, value))
+			break;
+
+		if (!dtm_layer_add(j->layer, be64toh(rec.path_hash), NULL, name, value, value_len, copy))
+			return false;
+
+		j->seq = be32toh(rec.seq) + 1;
+		offset += sizeof(rec) + name_len + value_len;
+	}
+
+	*valid = offset;
+	return true;
+}
+
+/* Index the valid records, the length of the valid part is set in *valid */
+static bool dtm_journal_load(struct dtm_journal *j, size_t *valid)
+{
+	struct dtm_journal_header *hdr;
+
+	*valid = 0;
+
+	if (j->len < sizeof(*hdr))
+		return true;
+
+	hdr = (struct dtm_journal_header *)j->data;
+	if (!dtm_journal_valid_header(hdr))
+		return true;
+
+	j->generation = be32toh(hdr->generation);
+
+	return dtm_journal_scan(j, j->data, sizeof(*hdr), j->len, false, valid);
+}
+
+/* Read up to len bytes, fewer if the file is shorter */
+static ssize_t dtm_journal_pread(int fd, void *buf, size_t len, off_t offset)
+{
+	uint8_t *ptr = (uint8_t *)buf;
+	size_t n = 0;
+	ssize_t ret;
+
+	while (n < len) {
+		ret = pread(fd, ptr + n, len - n, offset + n);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret == -1)
+			return -1;
+		if (ret == 0)
+			break;
+
+		n += ret;
+	}
+
+	return n;
+}
+
+static bool dtm_journal_read(int fd, struct dtm_journal *j)
+{
+	struct stat st;
+	ssize_t ret;
+
+	if (fstat(fd, &st) != 0)
+		return false;
+
+	j->len = st.st_size;
+	if (j->len == 0)
+		return true;
+
+	j->data = malloc(j->len);
+	if (!j->data)
+		return false;
+
+	/* Journal may have been emptied meanwhile */
+	ret = dtm_journal_pread(fd, j->data, j->len, 0);
+	if (ret == -1)
+		return false;
+
+	j->len = ret;
+	return true;
+}
+
+static bool dtm_journal_lock(int fd)
+{
+	while (flock(fd, LOCK_EX) != 0) {
+		if (errno != EINTR)
+			return false;
+	}
+
+	return true;
+}
+
+static void dtm_journal_unlock(int fd)
+{
+	flock(fd, LOCK_UN);
+}
+
+/* Open the journal of a device tree and lock it */
+static int dtm_journal_open_locked(const char *filename, int flags)
+{
+	char *path;
+	int fd, err;
+
+	path = dtm_file_journal_name(filename);
+	if (!path)
+		return -1;
+
+	fd = open(path, flags, 0644);
+	err = errno;
+	free(path);
+	if (fd == -1) {
+		errno = err;
+		return -1;
+	}
+
+	if (!dtm_journal_lock(fd)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static bool dtm_journal_write_all(int fd, const void *buf, size_t len)
+{
+	const uint8_t *ptr = (const uint8_t *)buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, ptr, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		ptr += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+static bool dtm_journal_write_header(int fd, uint32_t generation)
+{
+	struct dtm_journal_header hdr = {
+		.magic = DTM_JOURNAL_MAGIC,
+		.version = htobe32(DTM_JOURNAL_VERSION),
+		.generation = htobe32(generation),
+	};
+
+	return dtm_journal_write_all(fd, &hdr, sizeof(hdr));
+}
+
+/* Empty a locked journal, opened for append */
+static bool dtm_journal_truncate(int fd)
+{
+	struct dtm_journal_header hdr;
+	uint32_t generation = 0;
+
+	if (dtm_journal_pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+	    dtm_journal_valid_header(&hdr))
+		generation = be32toh(hdr.generation) + 1;
+
+	if (ftruncate(fd, 0) != 0)
+		return false;
+
+	return dtm_journal_write_header(fd, generation);
+}
+
+/*
+ * Pick up the records appended by other processes since the journal was
+ * read, and drop an invalid tail, so that the next append follows the
+ * last valid record.  Called with the journal locked.
+ */
+static bool dtm_journal_sync(struct dtm_journal *j)
+{
+	struct dtm_journal_header hdr;
+	struct stat st;
+	uint8_t *buf;
+	size_t len, valid;
+	ssize_t ret;
+	bool ok;
+
+	if (fstat(j->fd, &st) != 0)
+		return false;
+
+	ret = dtm_journal_pread(j->fd, &hdr, sizeof(hdr), 0);
+	if (ret == -1)
+		return false;
+
+	if (ret != sizeof(hdr) || !dtm_journal_valid_header(&hdr)) {
+		if (ftruncate(j->fd, 0) != 0 || !dtm_journal_write_header(j->fd, j->generation))
+			return false;
+
+		j->end = sizeof(hdr);
+		return true;
+	}
+
+	/* Journal was emptied, its records are in the device tree now */
+	if (be32toh(hdr.generation) != j->generation || (size_t)st.st_size < j->end) {
+		j->generation = be32toh(hdr.generation);
+		j->end = sizeof(hdr);
+	}
+
+	if ((size_t)st.st_size == j->end)
+		return true;
+
+	len = st.st_size - j->end;
+	buf = malloc(len);
+	if (!buf)
+		return false;
+
+	ret = dtm_journal_pread(j->fd, buf, len, j->end);
+	ok = (ret != -1);
+	if (ok)
+		ok = dtm_journal_scan(j, buf, 0, ret, true, &valid);
+	free(buf);
+	if (!ok)
+		return false;
+
+	if (valid < (size_t)st.st_size - j->end &&
+	    ftruncate(j->fd, j->end + valid) != 0)
+		return false;
+
+	j->end += valid;
+	return true;
+}
+
+void dtm_journal_free(struct dtm_journal *j)
+{
+	if (!j)
+		return;
+
+	if (j->fd != -1)
+		close(j->fd);
+
+	dtm_layer_free(j->layer);
+	free(j->data);
+	free(j);
+}
+
+int dtm_journal_open(const char *filename, bool do_write, struct dtm_journal **out)
+{
+	struct dtm_journal *j;
+	char *path;
+	size_t valid;
+	int fd;
+
+	*out = NULL;
+
+	path = dtm_file_journal_name(filename);
+	if (!path)
+		return -1;
+
+	fd = open(path, do_write ? O_RDWR | O_APPEND : O_RDONLY);
+	if (fd == -1) {
+		free(path);
+		return errno == ENOENT ? 0 : -1;
+	}
+
+	j = malloc(sizeof(struct dtm_journal));
+	if (!j)
+		goto fail;
+
+	*j = (struct dtm_journal) {
+		.fd = -1,
+	};
+
+	j->layer = dtm_layer_new();
+	if (!j->layer)
+		goto fail;
+
+	/* Appends by other processes are not seen half written */
+	if (do_write && !dtm_journal_lock(fd))
+		goto fail;
+
+	if (!dtm_journal_read(fd, j))
+		goto fail_unlock;
+
+	if (!dtm_journal_load(j, &valid))
+		goto fail_unlock;
+
+	if (do_write) {
+		/* Drop the invalid tail, appends continue from there */
+		if (valid < sizeof(struct dtm_journal_header)) {
+			if (ftruncate(fd, 0) != 0 || !dtm_journal_write_header(fd, j->generation))
+				goto fail_unlock;
+			valid = sizeof(struct dtm_journal_header);
+		} else if (valid < j->len) {
+			if (ftruncate(fd, valid) != 0)
+				goto fail_unlock;
+		}
+
+		dtm_journal_unlock(fd);
+
+		j->end = valid;
+		j->append_start = valid;
+		j->fd = fd;
+	} else {
+		close(fd);
+	}
+
+	free(path);
+	*out = j;
+	return 0;
+
+fail_unlock:
+	if (do_write)
+		dtm_journal_unlock(fd);
+fail:
+	fprintf(stderr, "Failed to load journal %s\n", path);
+	close(fd);
+	free(path);
+	dtm_journal_free(j);
+	return -1;
+}
+
+bool dtm_file_journal_create(const char *filename)
+{
+	bool ok;
+	int fd;
+
+	fd = dtm_journal_open_locked(filename, O_RDWR | O_CREAT | O_APPEND);
+	if (fd == -1) {
+		fprintf(stderr, "Failed to create journal for %s\n", filename);
+		return false;
+	}
+
+	ok = dtm_journal_truncate(fd);
+	if (close(fd) != 0)
+		ok = false;
+
+	return ok;
+}
+
+struct dtm_layer *dtm_journal_layer(struct dtm_journal *j)
+{
+	return j->layer;
+}
+
+bool dtm_journal_append(struct dtm_journal *j, uint64_t path_hash,
+			const char *name, const void *value, int value_len)
+{
+	struct dtm_journal_record rec;
+	uint8_t *buf;
+	size_t name_len, len;
+	bool ok;
+
+	if (j->fd == -1)
+		return false;
+
+	name_len = strlen(name) + 1;
+	if (name_len > UINT16_MAX)
+		return false;
+
+	/* Single write, so a record is either complete or a truncated tail */
+	len = sizeof(rec) + name_len + value_len;
+	buf = malloc(len);
+	if (!buf)
+		return false;
+
+	if (!dtm_journal_lock(j->fd)) {
+		free(buf);
+		return false;
+	}
+
+	/* Sequence number follows the records of other processes */
+	ok = dtm_journal_sync(j);
+	if (ok) {
+		rec = (struct dtm_journal_record) {
+			.path_hash = htobe64(path_hash),
+			.seq = htobe32(j->seq),
+			.name_len = htobe16(name_len),
+			.value_len = htobe32(value_len),
+		};
+		rec.check = htobe32(dtm_journal_check(&rec, name, value));
+
+		memcpy(buf, &rec, sizeof(rec));
+		memcpy(buf + sizeof(rec), name, name_len);
+		memcpy(buf + sizeof(rec) + name_len, value, value_len);
+
+		ok = dtm_journal_write_all(j->fd, buf, len);
+	}
+
+	dtm_journal_unlock(j->fd);
+	free(buf);
+	if (!ok)
+		return false;
+
+	j->end += len;
+	j->append_bytes += len;
+	j->seq += 1;
+
+	return dtm_layer_add(j->layer, path_hash, NULL, name, value, value_len, true);
+}
+
+void dtm_journal_dirty(struct dtm_journal *j, size_t *bytes, int *pages)
+{
+	long page_size;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (page_size <= 0)
+		page_size = 4096;
+
+	*bytes = j->append_bytes;
+	*pages = 0;
+
+	/* Appends are contiguous from the end of the journal */
+	if (j->append_bytes > 0)
+		*pages = (j->append_start + j->append_bytes - 1) / page_size -
+			 j->append_start / page_size + 1;
+}
+
+bool dtm_journal_reset(const char *filename)
+{
+	bool ok;
+	int fd;
+
+	fd = dtm_journal_open_locked(filename, O_RDWR | O_APPEND);
+	if (fd == -1)
+		return errno == ENOENT;
+
+	ok = dtm_journal_truncate(fd);
+	if (close(fd) != 0)
+		ok = false;
+
+	return ok;
+}
+
+/* Check without reading it that a journal has no records, or does not exist */
+bool dtm_journal_empty(const char *filename)
+{
+	struct stat statbuf;
+	char *path;
+	int ret;
+
+	path = dtm_file_journal_name(filename);
+	if (!path)
+		return false;
+
+	ret = stat(path, &statbuf);
+	free(path);
+	if (ret != 0)
+		return errno == ENOENT;
+
+	return statbuf.st_size <= (off_t)sizeof(struct dtm_journal_header);
+}
+
+int dtm_file_compact(const char *filename)
+{
+	struct dtm_file *dfile;
+	struct dtm_node *root = NULL;
+	int fd, ret = -1;
+
+	/* No appends until the journal is emptied, they would be lost */
+	fd = dtm_journal_open_locked(filename, O_RDWR | O_APPEND);
+	if (fd == -1)
+		return errno == ENOENT ? 0 : -1;
+
+	dfile = dtm_file_open(filename, false);
+	if (!dfile)
+		goto fail;
+
+	if (!dfile->journal || dtm_layer_count(dtm_journal_layer(dfile->journal)) == 0) {
+		dtm_file_close(dfile);
+		ret = 0;
+		goto fail;
+	}
+
+	root = dtm_file_read(dfile);
+	dtm_file_close(dfile);
+	if (!root)
+		goto fail;
+
+	/*
+	 * The new device tree is on disk before the journal is emptied.  The
+	 * records are idempotent, so if the journal is not emptied after the
+	 * new device tree is in place, the records are applied again.
+	 */
+	if (!dtm_file_replace_tree(filename, root))
+		goto fail;
+
+	if (!dtm_journal_truncate(fd))
+		goto fail;
+
+	ret = 0;
+
+fail:
+	if (close(fd) != 0)
+		ret = -1;
+	dtm_tree_free(root);
+	return ret;
+}
@@ -0,0 +1,295 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "dtm_hash.h"
+#include "dtm_internal.h"
+#include "dtm.h"
+
+/*
+ * Override layer
+ *
+ * A layer holds property values which override the values of a device tree,
+ * indexed by the hash of the node path and the property name.  Layers are
+ * used by the journal and by the overlay files.
+ */
+
+struct dtm_layer_entry {
+	uint64_t path_hash;
+	char *path;
+	const char *name;
+	const uint8_t *value;
+	int len;
+	bool owned;
+	int next;
+};
+
+struct dtm_layer {
+	struct dtm_layer_entry *entry;
+	int count, allocated;
+	int *slot;
+	uint32_t mask;
+};
+
+uint64_t dtm_layer_path_hash(const char *path)
+{
+	return dtm_hash64(DTM_HASH64_INIT, path, strlen(path));
+}
+
+/* Hash of the path of a child from the hash of the path of parent */
+uint64_t dtm_layer_child_hash(uint64_t parent, bool root, const char *name)
+{
+	uint64_t hash;
+
+	/* Path of a child of root does not repeat "/" */
+	hash = root ? DTM_HASH64_INIT : parent;
+	hash = dtm_hash64(hash, "/", 1);
+	return dtm_hash64(hash, name, strlen(name));
+}
+
+struct dtm_layer *dtm_layer_new(void)
+{
+	return calloc(1, sizeof(struct dtm_layer));
+}
+
+static void dtm_layer_entry_free(struct dtm_layer_entry *e)
+{
+	free(e->path);
+	if (e->owned) {
+		free((void *)e->name);
+		free((void *)e->value);
+	}
+}
+
+void dtm_layer_free(struct dtm_layer *layer)
+{
+	int i;
+
+	if (!layer)
+		return;
+
+	for (i=0; i<layer->count; i++)
+		dtm_layer_entry_free(&layer->entry[i]);
+
+	free(layer->entry);
+	free(layer->slot);
+	free(layer);
+}
+
+static bool dtm_layer_rehash(struct dtm_layer *layer, int size)
+{
+	int *slot;
+	int i;
+
+	slot = malloc(size * sizeof(int));
+	if (!slot)
+		return false;
+
+	for (i=0; i<size; i++)
+		slot[i] = -1;
+
+	free(layer->slot);
+	layer->slot = slot;
+	layer->mask = size - 1;
+
+	for (i=0; i<layer->count; i++) {
+		struct dtm_layer_entry *e = &layer->entry[i];
+		uint32_t n = e->path_hash & layer->mask;
+
+		e->next = slot[n];
+		slot[n] = i;
+	}
+
+	return true;
+}
+
+static struct dtm_layer_entry *dtm_layer_find(struct dtm_layer *layer,
+					      uint64_t path_hash,
+					      const char *name)
+{
+	int i;
+
+	if (layer->count == 0)
+		return NULL;
+
+	for (i = layer->slot[path_hash & layer->mask]; i != -1; i = layer->entry[i].next) {
+		struct dtm_layer_entry *e = &layer->entry[i];
+
+		if (e->path_hash == path_hash && strcmp(e->name, name) == 0)
+			return e;
+	}
+
+	return NULL;
+}
+
+bool dtm_layer_add(struct dtm_layer *layer, uint64_t path_hash, const char *path,
+		   const char *name, const void *value, int len, bool copy)
+{
+	struct dtm_layer_entry entry, *e;
+	uint32_t n;
+
+	entry = (struct dtm_layer_entry) {
+		.path_hash = path_hash,
+		.name = name,
+		.value = value,
+		.len = len,
+		.owned = copy,
+	};
+
+	if (copy) {
+		uint8_t *buf;
+
+		entry.name = strdup(name);
+		buf = malloc(len ? len : 1);
+		if (!entry.name || !buf) {
+			free((void *)entry.name);
+			free(buf);
+			return false;
+		}
+
+		memcpy(buf, value, len);
+		entry.value = buf;
+	}
+
+	if (path) {
+		entry.path = strdup(path);
+		if (!entry.path) {
+			dtm_layer_entry_free(&entry);
+			return false;
+		}
+	}
+
+	e = dtm_layer_find(layer, path_hash, name);
+	if (e) {
+		/* Keep the path of the earlier entry, if not known now */
+		if (!entry.path && e->path) {
+			entry.path = e->path;
+			e->path = NULL;
+		}
+
+		entry.next = e->next;
+		dtm_layer_entry_free(e);
+		*e = entry;
+		return true;
+	}
+
+	if (layer->count == layer->allocated) {
+		int size = layer->allocated ? layer->allocated * 2 : 64;
+
+		e = reallocarray(layer->entry, size, sizeof(struct dtm_layer_entry));
+		if (!e) {
+			dtm_layer_entry_free(&entry);
+			return false;
+		}
+
+		layer->entry = e;
+		layer->allocated = size;
+
+		/* Keep the table at most half full */
+		if (!dtm_layer_rehash(layer, size * 2)) {
+			dtm_layer_entry_free(&entry);
+			return false;
+		}
+	}
+
+	n = path_hash & layer->mask;
+	entry.next = layer->slot[n];
+	layer->entry[layer->count] = entry;
+	layer->slot[n] = layer->count;
+	layer->count += 1;
+
+	return true;
+}
+
+int dtm_layer_count(struct dtm_layer *layer)
+{
+	return layer->count;
+}
+
+const void *dtm_layer_lookup(struct dtm_layer *layer, uint64_t path_hash,
+			     const char *name, int *value_len)
+{
+	struct dtm_layer_entry *e;
+
+	e = dtm_layer_find(layer, path_hash, name);
+	if (!e)
+		return NULL;
+
+	*value_len = e->len;
+	return e->value;
+}
+
+int dtm_layer_for_each(struct dtm_layer *layer, dtm_layer_fn fn, void *priv)
+{
+	int i, ret;
+
+	for (i=0; i<layer->count; i++) {
+		struct dtm_layer_entry *e = &layer->entry[i];
+
+		ret = fn(e->path, e->name, e->value, e->len, priv);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static void dtm_layer_apply_node(struct dtm_layer *layer, struct dtm_node *node, uint64_t hash)
+{
+	struct dtm_property *prop;
+	int i;
+
+	for (i = layer->slot[hash & layer->mask]; i != -1; i = layer->entry[i].next) {
+		struct dtm_layer_entry *e = &layer->entry[i];
+
+		if (e->path_hash != hash)
+			continue;
+
+		/* Values which do not fit the device tree any more are ignored */
+		prop = dtm_node_get_property(node, e->name);
+		if (prop && prop->len == e->len)
+			dtm_prop_set_value(prop, (uint8_t *)e->value, e->len);
+	}
+}
+
+static void dtm_layer_apply_subtree(struct dtm_layer *layer, struct dtm_node *node,
+				    uint64_t hash, bool root)
+{
+	struct dtm_node *child;
+	uint64_t child_hash;
+
+	dtm_node_for_each_child(node, child) {
+		child_hash = dtm_layer_child_hash(hash, root, child->name);
+
+		dtm_layer_apply_node(layer, child, child_hash);
+		dtm_layer_apply_subtree(layer, child, child_hash, false);
+	}
+}
+
+void dtm_layer_apply(struct dtm_layer *layer, struct dtm_node *root)
+{
+	uint64_t hash;
+
+	if (layer->count == 0)
+		return;
+
+	hash = dtm_layer_path_hash("/");
+	dtm_layer_apply_node(layer, root, hash);
+	dtm_layer_apply_subtree(layer, root, hash, true);
+}
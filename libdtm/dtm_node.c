@@ -19,6 +19,7 @@
 #include <string.h>
 
 #include "dtm_internal.h"
+#include "dtm_probe.h"
 #include "dtm.h"
 
 struct dtm_node *dtm_node_new(const char *name)
@@ -39,6 +40,10 @@ struct dtm_node *dtm_node_new(const char *name)
 	list_head_init(&node->children);
 
 	node->enabled = false;
+	node->tag = -1;
+
+	dtm_stats_count(DTM_STATS_NODES, 1);
+	dtm_stats_count(DTM_STATS_ALLOCS, 2);
 
 	return node;
 }
@@ -81,6 +86,7 @@ struct dtm_node *dtm_node_copy(const struct dtm_node *node)
 	}
 
 	node_copy->enabled = node->enabled;
+	node_copy->tag = node->tag;
 
 	return node_copy;
 }
@@ -97,6 +103,18 @@ int dtm_node_add_property(struct dtm_node *node, const char *name, void *value,
 	return 0;
 }
 
+int dtm_node_add_property_ref(struct dtm_node *node, const char *name, void *value, int valuelen)
+{
+	struct dtm_property *prop;
+
+	prop = dtm_prop_new_ref(name, value, valuelen);
+	if (!prop)
+		return -1;
+
+	list_add_tail(&node->properties, &prop->list);
+	return 0;
+}
+
 struct dtm_node *dtm_node_next_child(struct dtm_node *node, struct dtm_node *prev)
 {
 	struct dtm_node *next;
@@ -138,10 +156,13 @@ struct dtm_property *dtm_node_get_property(const struct dtm_node *node, const ch
 	struct dtm_property *prop = NULL;
 
 	list_for_each(&node->properties, prop, list) {
-		if (strcmp(prop->name, name) == 0)
+		if (strcmp(prop->name, name) == 0) {
+			DTM_PROBE3(node_get_property, node->name, name, prop->len);
 			return prop;
+		}
 	}
 
+	DTM_PROBE3(node_get_property, node->name, name, -1);
 	return NULL;
 }
 
@@ -194,3 +215,13 @@ struct dtm_node *dtm_node_parent(const struct dtm_node *node)
 {
 	return node->parent;
 }
+
+int dtm_node_tag(const struct dtm_node *node)
+{
+	return node->tag;
+}
+
+void dtm_node_set_tag(struct dtm_node *node, int tag)
+{
+	node->tag = tag;
+}
@@ -0,0 +1,355 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <libfdt.h>
+
+#include "dtm_hash.h"
+#include "dtm_internal.h"
+#include "dtm.h"
+
+/*
+ * Overlay files
+ *
+ * An overlay is a sparse FDT file with only the properties which override
+ * the values of a base FDT file.  The root node of the overlay names the
+ * base file and records its size and the hash of its structure (names of
+ * the nodes, names and lengths of the properties), to detect a base which
+ * has been replaced.  Values are not hashed, as the base may be written in
+ * place.  An overlay can itself be the base of another overlay.
+ *
+ * The base is mapped read-only and all the offset based accesses are done
+ * on the base, with the values looked up in the overlay first.  The values
+ * written are kept in the overlay, which is rewritten when closed.
+ */
+
+#define DTM_OVERLAY_BASE	"overlay-base"
+#define DTM_OVERLAY_BASE_SIZE	"overlay-base-size"
+#define DTM_OVERLAY_BASE_HASH	"overlay-base-hash"
+#define DTM_OVERLAY_MAX_LEVEL	8
+
+static bool dtm_overlay_load(struct dtm_file *dfile)
+{
+	const void *value;
+	const char *name;
+	char path[1024];
+	uint64_t path_hash;
+	int offset = 0, depth = 0, prop, len;
+
+	do {
+		if (fdt_get_path(dfile->ptr, offset, path, sizeof(path)) != 0)
+			return false;
+
+		path_hash = dtm_layer_path_hash(path);
+
+		fdt_for_each_property_offset(prop, dfile->ptr, offset) {
+			value = fdt_getprop_by_offset(dfile->ptr, prop, &name, &len);
+			if (!value)
+				return false;
+
+			if (depth == 0 &&
+			    (strcmp(name, DTM_OVERLAY_BASE) == 0 ||
+			     strcmp(name, DTM_OVERLAY_BASE_SIZE) == 0 ||
+			     strcmp(name, DTM_OVERLAY_BASE_HASH) == 0))
+				continue;
+
+			if (!dtm_layer_add(dfile->overlay, path_hash, path, name, value, len, true))
+				return false;
+		}
+
+		offset = fdt_next_node(dfile->ptr, offset, &depth);
+	} while (offset >= 0 && depth > 0);
+
+	return true;
+}
+
+/* Hash of the structure of FDT blob, which is not changed by writes in place */
+static bool dtm_overlay_base_hash(const void *fdt, uint64_t *hash)
+{
+	const char *name;
+	fdt32_t val;
+	int offset = 0, depth = 0, prop, len;
+
+	*hash = DTM_HASH64_INIT;
+
+	do {
+		name = fdt_get_name(fdt, offset, &len);
+		if (!name)
+			return false;
+
+		val = cpu_to_fdt32(depth);
+		*hash = dtm_hash64(*hash, &val, sizeof(val));
+		*hash = dtm_hash64(*hash, name, len + 1);
+
+		fdt_for_each_property_offset(prop, fdt, offset) {
+			if (!fdt_getprop_by_offset(fdt, prop, &name, &len))
+				return false;
+
+			val = cpu_to_fdt32(len);
+			*hash = dtm_hash64(*hash, name, strlen(name) + 1);
+			*hash = dtm_hash64(*hash, &val, sizeof(val));
+		}
+
+		offset = fdt_next_node(fdt, offset, &depth);
+	} while (offset >= 0 && depth > 0);
+
+	return true;
+}
+
+int dtm_overlay_open(struct dtm_file *dfile, int level)
+{
+	const fdt32_t *size;
+	const fdt64_t *hash;
+	const char *base;
+	uint64_t base_hash;
+	int len;
+
+	if (fdt_check_header(dfile->ptr) != 0)
+		return 0;
+
+	base = fdt_getprop(dfile->ptr, 0, DTM_OVERLAY_BASE, &len);
+	if (!base)
+		return 0;
+
+	size = fdt_getprop(dfile->ptr, 0, DTM_OVERLAY_BASE_SIZE, &len);
+	if (!size || len != sizeof(fdt32_t)) {
+		fprintf(stderr, "Invalid overlay %s\n", dfile->filename);
+		return -1;
+	}
+
+	hash = fdt_getprop(dfile->ptr, 0, DTM_OVERLAY_BASE_HASH, &len);
+	if (!hash || len != sizeof(fdt64_t)) {
+		fprintf(stderr, "Invalid overlay %s\n", dfile->filename);
+		return -1;
+	}
+
+	if (level >= DTM_OVERLAY_MAX_LEVEL) {
+		fprintf(stderr, "Too many overlay levels for %s\n", dfile->filename);
+		return -1;
+	}
+
+	dfile->base_name = strdup(base);
+	if (!dfile->base_name)
+		return -1;
+
+	dfile->base = dtm_file_open_level(dfile->base_name, false, level + 1);
+	if (!dfile->base)
+		return -1;
+
+	if (fdt_totalsize(dfile->base->ptr) != fdt32_to_cpu(*size) ||
+	    !dtm_overlay_base_hash(dfile->base->ptr, &base_hash) ||
+	    base_hash != fdt64_to_cpu(*hash)) {
+		fprintf(stderr, "Overlay %s does not match base %s\n",
+			dfile->filename, dfile->base_name);
+		return -1;
+	}
+
+	dfile->overlay = dtm_layer_new();
+	if (!dfile->overlay)
+		return -1;
+
+	if (!dtm_overlay_load(dfile)) {
+		fprintf(stderr, "Failed to load overlay %s\n", dfile->filename);
+		return -1;
+	}
+
+	/* All the accesses go to the base from now on */
+	munmap(dfile->ptr, dfile->len);
+	dfile->ptr = dfile->base->ptr;
+	dfile->len = dfile->base->len;
+
+	return 1;
+}
+
+bool dtm_overlay_set(struct dtm_file *dfile, uint64_t path_hash, const char *path,
+		     const char *name, const void *value, int len)
+{
+	if (!path)
+		return false;
+
+	if (!dtm_layer_add(dfile->overlay, path_hash, path, name, value, len, true))
+		return false;
+
+	dfile->overlay_dirty = true;
+	dfile->dirty_bytes += len;
+	return true;
+}
+
+/* Write a tree to a new file, which then replaces the named file */
+static int dtm_overlay_write(const char *filename, struct dtm_node *root)
+{
+	if (!dtm_file_replace_tree(filename, root))
+		return -1;
+
+	/* Journal of the previous contents does not apply any more */
+	if (!dtm_journal_reset(filename))
+		return -1;
+
+	return 0;
+}
+
+static struct dtm_node *dtm_overlay_tree(const char *base, const void *base_fdt)
+{
+	struct dtm_node *root;
+	fdt32_t size = cpu_to_fdt32(fdt_totalsize(base_fdt));
+	fdt64_t hash;
+	uint64_t base_hash;
+
+	if (!dtm_overlay_base_hash(base_fdt, &base_hash))
+		return NULL;
+
+	hash = cpu_to_fdt64(base_hash);
+
+	root = dtm_tree_new();
+	if (!root)
+		return NULL;
+
+	if (dtm_node_add_property(root, DTM_OVERLAY_BASE, (void *)base, strlen(base) + 1) != 0 ||
+	    dtm_node_add_property(root, DTM_OVERLAY_BASE_SIZE, &size, sizeof(size)) != 0 ||
+	    dtm_node_add_property(root, DTM_OVERLAY_BASE_HASH, &hash, sizeof(hash)) != 0) {
+		dtm_tree_free(root);
+		return NULL;
+	}
+
+	return root;
+}
+
+/* Find the node for a path, creating the missing nodes */
+static struct dtm_node *dtm_overlay_node(struct dtm_node *root, const char *path)
+{
+	struct dtm_node *node = root, *child;
+	char *copy, *tok, *saveptr = NULL;
+
+	copy = strdup(path);
+	if (!copy)
+		return NULL;
+
+	for (tok = strtok_r(copy, "/", &saveptr); tok; tok = strtok_r(NULL, "/", &saveptr)) {
+		dtm_node_for_each_child(node, child) {
+			if (strcmp(child->name, tok) == 0)
+				break;
+		}
+
+		if (!child) {
+			child = dtm_node_new(tok);
+			if (!child) {
+				node = NULL;
+				break;
+			}
+
+			dtm_tree_add_node(node, child);
+		}
+
+		node = child;
+	}
+
+	free(copy);
+	return node;
+}
+
+static int dtm_overlay_add_value(const char *path, const char *name,
+				 const void *value, int len, void *priv)
+{
+	struct dtm_node *root = (struct dtm_node *)priv;
+	struct dtm_node *node;
+
+	if (!path)
+		return -1;
+
+	node = dtm_overlay_node(root, path);
+	if (!node)
+		return -1;
+
+	return dtm_node_add_property(node, name, (void *)value, len);
+}
+
+int dtm_overlay_save(struct dtm_file *dfile)
+{
+	struct dtm_node *root;
+	int ret;
+
+	if (!dfile->overlay || !dfile->overlay_dirty)
+		return 0;
+
+	root = dtm_overlay_tree(dfile->base_name, dfile->base->ptr);
+	if (!root)
+		return -1;
+
+	ret = dtm_layer_for_each(dfile->overlay, dtm_overlay_add_value, root);
+	if (ret == 0)
+		ret = dtm_overlay_write(dfile->filename, root);
+
+	if (ret != 0)
+		fprintf(stderr, "Failed to write overlay %s\n", dfile->filename);
+
+	dtm_tree_free(root);
+	return ret;
+}
+
+bool dtm_file_overlay_create(const char *base, const char *overlay)
+{
+	struct dtm_file *dfile;
+	struct dtm_node *root;
+	char *path;
+	int ret;
+
+	path = realpath(base, NULL);
+	if (!path) {
+		fprintf(stderr, "Failed to find %s\n", base);
+		return false;
+	}
+
+	dfile = dtm_file_open(path, false);
+	if (!dfile) {
+		free(path);
+		return false;
+	}
+
+	root = dtm_overlay_tree(path, dfile->ptr);
+	dtm_file_close(dfile);
+	free(path);
+	if (!root)
+		return false;
+
+	ret = dtm_overlay_write(overlay, root);
+	dtm_tree_free(root);
+	return ret == 0;
+}
+
+int dtm_file_flatten(const char *filename, const char *out)
+{
+	struct dtm_file *dfile;
+	struct dtm_node *root;
+	int ret;
+
+	dfile = dtm_file_open(filename, false);
+	if (!dfile)
+		return -1;
+
+	root = dtm_file_read(dfile);
+	dtm_file_close(dfile);
+	if (!root)
+		return -1;
+
+	ret = dtm_overlay_write(out, root);
+	dtm_tree_free(root);
+	return ret;
+}
@@ -0,0 +1,50 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __DTM_PROBE_H__
+#define __DTM_PROBE_H__
+
+#include "config.h"
+
+/*
+ * USDT probes (provider "pdata") for tracing with bpftrace or perf
+ *
+ * With --enable-usdt, each probe is a nop in the code and a note in the
+ * library, which the tracers find and patch at runtime.  Otherwise the
+ * probes compile to nothing.  See scripts/bpftrace for the probes
+ * and their arguments.
+ */
+
+#ifdef HAVE_USDT
+
+#include <sys/sdt.h>
+
+#define DTM_PROBE(name)			DTRACE_PROBE(pdata, name)
+#define DTM_PROBE1(name, a)		DTRACE_PROBE1(pdata, name, a)
+#define DTM_PROBE2(name, a, b)		DTRACE_PROBE2(pdata, name, a, b)
+#define DTM_PROBE3(name, a, b, c)	DTRACE_PROBE3(pdata, name, a, b, c)
+
+#else
+
+/* Arguments are referenced, so that the variables are not unused */
+#define DTM_PROBE(name)			do { } while (0)
+#define DTM_PROBE1(name, a)		do { (void)(a); } while (0)
+#define DTM_PROBE2(name, a, b)		do { (void)(a); (void)(b); } while (0)
+#define DTM_PROBE3(name, a, b, c)	do { (void)(a); (void)(b); (void)(c); } while (0)
+
+#endif /* HAVE_USDT */
+
+#endif /* __DTM_PROBE_H__ */
@@ -45,12 +45,41 @@ struct dtm_property *dtm_prop_new(const char *name, void *value, int len)
 
 	memcpy(prop->value, value, len);
 	prop->len = len;
+	prop->tag = -1;
+
+	dtm_stats_count(DTM_STATS_PROPERTIES, 1);
+	dtm_stats_count(DTM_STATS_ALLOCS, 3);
+
+	return prop;
+}
+
+struct dtm_property *dtm_prop_new_ref(const char *name, void *value, int len)
+{
+	struct dtm_property *prop;
+
+	prop = calloc(1, sizeof(struct dtm_property));
+	if (!prop)
+		return NULL;
+
+	prop->name = (char *)name;
+	prop->value = value;
+	prop->len = len;
+	prop->borrowed = true;
+	prop->tag = -1;
+
+	dtm_stats_count(DTM_STATS_PROPERTIES, 1);
+	dtm_stats_count(DTM_STATS_ALLOCS, 1);
 
 	return prop;
 }
 
 void dtm_prop_free(struct dtm_property *prop)
 {
+	if (prop->borrowed) {
+		free(prop);
+		return;
+	}
+
 	if (prop->name)
 		free(prop->name);
 	if (prop->value)
@@ -60,7 +89,14 @@ void dtm_prop_free(struct dtm_property *prop)
 
 struct dtm_property *dtm_prop_copy(struct dtm_property *prop)
 {
-	return dtm_prop_new(prop->name, prop->value, prop->len);
+	struct dtm_property *prop_copy;
+
+	prop_copy = dtm_prop_new(prop->name, prop->value, prop->len);
+	if (!prop_copy)
+		return NULL;
+
+	prop_copy->tag = prop->tag;
+	return prop_copy;
 }
 
 const char *dtm_prop_name(const struct dtm_property *prop)
@@ -81,10 +117,42 @@ int dtm_prop_set_value(struct dtm_property *prop, uint8_t *value, int value_len)
 	if (prop->len != value_len)
 		return -1;
 
+	/* Borrowed value may be shared, so take a private copy first */
+	if (prop->borrowed) {
+		char *name;
+		void *copy;
+
+		name = strdup(prop->name);
+		if (!name)
+			return -1;
+
+		copy = malloc(value_len);
+		if (!copy) {
+			free(name);
+			return -1;
+		}
+
+		prop->name = name;
+		prop->value = copy;
+		prop->borrowed = false;
+
+		dtm_stats_count(DTM_STATS_ALLOCS, 2);
+	}
+
 	memcpy(prop->value, value, value_len);
 	return 0;
 }
 
+int dtm_prop_tag(const struct dtm_property *prop)
+{
+	return prop->tag;
+}
+
+void dtm_prop_set_tag(struct dtm_property *prop, int tag)
+{
+	prop->tag = tag;
+}
+
 uint32_t dtm_prop_value_u32(const struct dtm_property *prop)
 {
 	uint32_t data;
@@ -20,6 +20,7 @@
 #include <libfdt.h>
 
 #include "dtm_internal.h"
+#include "dtm_probe.h"
 #include "dtm.h"
 
 struct match_by_name {
@@ -46,10 +47,14 @@ struct dtm_node *dtm_find_node_by_name(struct dtm_node *root, const char *name)
 	};
 	int ret;
 
+	dtm_stats_count(DTM_STATS_LOOKUPS, 1);
+	DTM_PROBE2(find_node_start, "name", name);
+
 	ret = dtm_traverse(root, true, match_node_by_name, NULL, &state);
 	if (!ret)
-		return NULL;
+		state.match = NULL;
 
+	DTM_PROBE3(find_node_end, "name", name, state.match != NULL);
 	return state.match;
 }
 
@@ -84,10 +89,14 @@ struct dtm_node *dtm_find_node_by_compatible(struct dtm_node *root, const char *
 	};
 	int ret;
 
+	dtm_stats_count(DTM_STATS_LOOKUPS, 1);
+	DTM_PROBE2(find_node_start, "compatible", compatible);
+
 	ret = dtm_traverse(root, true, match_node_by_compatible, NULL, &state);
 	if (!ret)
-		return NULL;
+		state.match = NULL;
 
+	DTM_PROBE3(find_node_end, "compatible", compatible, state.match != NULL);
 	return state.match;
 }
 
@@ -126,9 +135,13 @@ struct dtm_node *dtm_find_node_by_path(struct dtm_node *root, const char *path)
 	};
 	int ret;
 
+	dtm_stats_count(DTM_STATS_LOOKUPS, 1);
+	DTM_PROBE2(find_node_start, "path", path);
+
 	ret = dtm_traverse(root, true, match_node_by_path, NULL, &state);
 	if (!ret)
-		return NULL;
+		state.match = NULL;
 
+	DTM_PROBE3(find_node_end, "path", path, state.match != NULL);
 	return state.match;
 }
@@ -0,0 +1,142 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "dtm.h"
+
+/*
+ * Phase timers and counters
+ *
+ * Nothing is collected unless enabled, the callers check the flag inline
+ * before reading the clock or updating a counter.  The updates are atomic,
+ * since export and import may run worker threads.
+ */
+
+bool dtm_stats_enabled;
+
+static struct dtm_stats dtm_stats;
+
+static const char *dtm_stats_phase_name[DTM_STATS_PHASE_MAX] = {
+	[DTM_STATS_OPEN] = "open",
+	[DTM_STATS_PARSE] = "parse",
+	[DTM_STATS_INFODB] = "infodb",
+	[DTM_STATS_TRAVERSE] = "traverse",
+	[DTM_STATS_ENCODE] = "encode",
+	[DTM_STATS_FORMAT] = "format",
+	[DTM_STATS_WRITE] = "write",
+};
+
+static const char *dtm_stats_counter_name[DTM_STATS_COUNTER_MAX] = {
+	[DTM_STATS_NODES] = "nodes",
+	[DTM_STATS_PROPERTIES] = "properties",
+	[DTM_STATS_LOOKUPS] = "lookups",
+	[DTM_STATS_ALLOCS] = "allocs",
+	[DTM_STATS_BYTES] = "bytes_written",
+};
+
+void dtm_stats_enable(bool enable)
+{
+	dtm_stats_enabled = enable;
+}
+
+uint64_t dtm_stats_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void dtm_stats_add_time(enum dtm_stats_phase phase, uint64_t start)
+{
+	uint64_t elapsed = dtm_stats_time() - start;
+
+	__atomic_add_fetch(&dtm_stats.calls[phase], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&dtm_stats.time_ns[phase], elapsed, __ATOMIC_RELAXED);
+}
+
+void dtm_stats_add(enum dtm_stats_counter counter, uint64_t n)
+{
+	__atomic_add_fetch(&dtm_stats.count[counter], n, __ATOMIC_RELAXED);
+}
+
+void dtm_stats_get(struct dtm_stats *stats)
+{
+	int i;
+
+	for (i=0; i<DTM_STATS_PHASE_MAX; i++) {
+		stats->calls[i] = __atomic_load_n(&dtm_stats.calls[i], __ATOMIC_RELAXED);
+		stats->time_ns[i] = __atomic_load_n(&dtm_stats.time_ns[i], __ATOMIC_RELAXED);
+	}
+
+	for (i=0; i<DTM_STATS_COUNTER_MAX; i++)
+		stats->count[i] = __atomic_load_n(&dtm_stats.count[i], __ATOMIC_RELAXED);
+}
+
+void dtm_stats_reset(void)
+{
+	memset(&dtm_stats, 0, sizeof(dtm_stats));
+}
+
+static void dtm_stats_print_json(FILE *fp, const struct dtm_stats *stats)
+{
+	int i;
+
+	fprintf(fp, "{\n  \"phases\": {\n");
+	for (i=0; i<DTM_STATS_PHASE_MAX; i++) {
+		fprintf(fp, "    \"%s\": { \"calls\": %" PRIu64 ", \"time_ns\": %" PRIu64 " }%s\n",
+			dtm_stats_phase_name[i], stats->calls[i], stats->time_ns[i],
+			(i < DTM_STATS_PHASE_MAX-1) ? "," : "");
+	}
+
+	fprintf(fp, "  },\n  \"counters\": {\n");
+	for (i=0; i<DTM_STATS_COUNTER_MAX; i++) {
+		fprintf(fp, "    \"%s\": %" PRIu64 "%s\n",
+			dtm_stats_counter_name[i], stats->count[i],
+			(i < DTM_STATS_COUNTER_MAX-1) ? "," : "");
+	}
+	fprintf(fp, "  }\n}\n");
+}
+
+void dtm_stats_print(FILE *fp, bool json)
+{
+	struct dtm_stats stats;
+	int i;
+
+	dtm_stats_get(&stats);
+
+	if (json) {
+		dtm_stats_print_json(fp, &stats);
+		return;
+	}
+
+	fprintf(fp, "%-14s %10s %12s\n", "phase", "calls", "time (ms)");
+	for (i=0; i<DTM_STATS_PHASE_MAX; i++) {
+		fprintf(fp, "%-14s %10" PRIu64 " %12.3f\n",
+			dtm_stats_phase_name[i], stats.calls[i],
+			stats.time_ns[i] / 1e6);
+	}
+
+	fprintf(fp, "%-14s %10s\n", "counter", "count");
+	for (i=0; i<DTM_STATS_COUNTER_MAX; i++) {
+		fprintf(fp, "%-14s %10" PRIu64 "\n",
+			dtm_stats_counter_name[i], stats.count[i]);
+	}
+}
@@ -27,13 +27,18 @@ int dtm_traverse(struct dtm_node *root,
 		 void *priv)
 {
 	struct dtm_node *child;
+	bool do_props = (prop_fn != NULL);
 	int ret;
 
 	ret = node_fn(root, priv);
-	if (ret)
+	if (ret == DTM_TRAVERSE_PRUNE)
+		return 0;
+	else if (ret == DTM_TRAVERSE_SKIP)
+		do_props = false;
+	else if (ret)
 		return ret;
 
-	if (prop_fn) {
+	if (do_props) {
 		struct dtm_property *prop;
 
 		dtm_node_for_each_property(root, prop) {
@@ -56,6 +56,18 @@ void dtm_tree_add_node(struct dtm_node *parent, struct dtm_node *child)
 	list_add_tail(&parent->children, &child->list);
 }
 
+struct dtm_node *dtm_node_add_child(struct dtm_node *parent, const char *name)
+{
+	struct dtm_node *child;
+
+	child = dtm_node_new(name);
+	if (!child)
+		return NULL;
+
+	dtm_tree_add_node(parent, child);
+	return child;
+}
+
 static bool dtm_tree_level_copy(const struct dtm_node *node, struct dtm_node *node_copy)
 {
 	struct dtm_node *child = NULL;
@@ -93,6 +105,78 @@ struct dtm_node *dtm_tree_copy(const struct dtm_node *root)
 	return root_copy;
 }
 
+static void dtm_tree_stats_prop(struct dtm_node *node, struct dtm_property *prop,
+				struct dtm_tree_stats *stats)
+{
+	int i;
+
+	stats->properties += 1;
+	stats->name_bytes += strlen(prop->name) + 1;
+	stats->struct_bytes += sizeof(struct dtm_property);
+	stats->list_bytes += sizeof(struct list_node);
+
+	if (prop->borrowed) {
+		stats->borrowed_bytes += prop->len;
+		stats->allocs += 2;
+	} else {
+		stats->value_bytes += prop->len;
+		stats->allocs += 3;
+	}
+
+	/* Insert in the largest properties, kept sorted by size */
+	for (i=stats->largest_count; i>0; i--) {
+		if (stats->largest[i-1].prop->len >= prop->len)
+			break;
+
+		if (i < DTM_TREE_STATS_LARGEST)
+			stats->largest[i] = stats->largest[i-1];
+	}
+
+	if (i < DTM_TREE_STATS_LARGEST) {
+		stats->largest[i].node = node;
+		stats->largest[i].prop = prop;
+		if (stats->largest_count < DTM_TREE_STATS_LARGEST)
+			stats->largest_count += 1;
+	}
+}
+
+static void dtm_tree_stats_node(struct dtm_node *node, int depth,
+				struct dtm_tree_stats *stats)
+{
+	struct dtm_node *child = NULL;
+	struct dtm_property *prop = NULL;
+	int count = 0, bucket = 0;
+
+	stats->nodes += 1;
+	stats->name_bytes += strlen(node->name) + 1;
+	stats->struct_bytes += sizeof(struct dtm_node);
+	stats->list_bytes += sizeof(struct list_node) + 2 * sizeof(struct list_head);
+	stats->allocs += 2;
+
+	if (depth > stats->max_depth)
+		stats->max_depth = depth;
+
+	list_for_each(&node->properties, prop, list)
+		dtm_tree_stats_prop(node, prop, stats);
+
+	list_for_each(&node->children, child, list) {
+		dtm_tree_stats_node(child, depth+1, stats);
+		count++;
+	}
+
+	while (count > 0 && bucket < DTM_TREE_STATS_FANOUT-1) {
+		count >>= 1;
+		bucket++;
+	}
+	stats->fanout[bucket] += 1;
+}
+
+void dtm_tree_stats(struct dtm_node *root, struct dtm_tree_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	dtm_tree_stats_node(root, 0, stats);
+}
+
 /*
  * keep track of old --> new mapping
  * keep track of all the old nodes added
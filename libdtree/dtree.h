@@ -17,7 +17,9 @@
 #ifndef __DTREE_H__
 #define __DTREE_H__
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 struct dtm_node;
 
@@ -55,6 +57,21 @@ struct dtree_attr {
 	uint8_t *value;
 };
 
+/**
+ * @brief Abstract data type representing a selection of nodes and attributes
+ */
+struct dtree_export_filter;
+
+/**
+ * @brief Export only the attributes which differ from the infodb default
+ */
+#define DTREE_EXPORT_NON_DEFAULT	0x01
+
+/**
+ * @brief Export in binary dump format instead of cronus format
+ */
+#define DTREE_EXPORT_BINARY	0x02
+
 /**
  * @brief Callback for each node during export
  *
@@ -100,6 +117,68 @@ int dtree_create(const char *dtb_path,
 		 const char *dtb_out_path);
 
 
+/**
+ * @brief Create an empty export filter
+ *
+ * An empty filter selects all the nodes and all the attributes.  A node is
+ * selected if it matches any of the classes (if added) and any of the paths
+ * or targets (if added).  An attribute is selected if it matches any of the
+ * attribute names (if added).
+ *
+ * @return filter on success, NULL on failure
+ */
+struct dtree_export_filter *dtree_export_filter_new(void);
+
+/**
+ * @brief Select nodes of a class
+ *
+ * @param[in] filter  Export filter
+ * @param[in] class_name  Device tree class (e.g. core) or cronus class (e.g. c)
+ * @return 0 on success, -1 for unknown class or on failure
+ */
+int dtree_export_filter_add_class(struct dtree_export_filter *filter, const char *class_name);
+
+/**
+ * @brief Select a node by device tree path
+ *
+ * Export fails if the path does not exist in the device tree.
+ *
+ * @param[in] filter  Export filter
+ * @param[in] path  Device tree path (e.g. /proc0)
+ * @param[in] recurse  Whether to select all the descendants of the node
+ * @return 0 on success, -1 on failure
+ */
+int dtree_export_filter_add_path(struct dtree_export_filter *filter, const char *path, bool recurse);
+
+/**
+ * @brief Select nodes by cronus target
+ *
+ * The target can contain shell wildcards (e.g. p10:k0:n0:s0:p00:c*).  Export
+ * fails if a target without wildcards does not exist, a pattern which does
+ * not match any target selects nothing.
+ *
+ * @param[in] filter  Export filter
+ * @param[in] pattern  Cronus target or pattern
+ * @return 0 on success, -1 on failure
+ */
+int dtree_export_filter_add_target(struct dtree_export_filter *filter, const char *pattern);
+
+/**
+ * @brief Select an attribute by name
+ *
+ * @param[in] filter  Export filter
+ * @param[in] attr_name  Name of attribute
+ * @return 0 on success, -1 on failure
+ */
+int dtree_export_filter_add_attr(struct dtree_export_filter *filter, const char *attr_name);
+
+/**
+ * @brief Free export filter
+ *
+ * @param[in] filter  Export filter
+ */
+void dtree_export_filter_free(struct dtree_export_filter *filter);
+
 /**
  * @brief Export attributes from a device tree
  *
@@ -127,6 +206,64 @@ int dtree_export(const char *dtb_path,
 		 dtree_export_attr_fn attr_fn,
 		 void *priv);
 
+/**
+ * @brief Export selected attributes from a device tree
+ *
+ * Same as dtree_export(), but the callbacks are called only for the nodes
+ * and attributes selected by the filter.  The subtrees without any selected
+ * node are not traversed.
+ *
+ * @param[in] dtb_path  Path to binary device tree
+ * @param[in] infodb_path  Path to attribute information database
+ * @param[in] attrdb_path  Path to list of attributes to export
+ * @param[in] filter  Export filter, NULL to export everything
+ * @param[in] node_fn  Callback function called for each node
+ * @param[in] attr_fn  Callback function called for each attribute
+ * @param[in] priv  Private data for callbacks
+ * @return 0 if all nodes and attributes are exported, non-zero otherwise
+ */
+int dtree_export_filtered(const char *dtb_path,
+			  const char *infodb_path,
+			  const char *attrdb_path,
+			  const struct dtree_export_filter *filter,
+			  dtree_export_node_fn node_fn,
+			  dtree_export_attr_fn attr_fn,
+			  void *priv);
+
+
+/**
+ * @brief Return value of dtree_read if the target is not found
+ */
+#define DTREE_READ_NO_TARGET	(-2)
+
+/**
+ * @brief Return value of dtree_read if the attribute is not found
+ */
+#define DTREE_READ_NO_ATTR	(-3)
+
+/**
+ * @brief Read a single attribute of a target
+ *
+ * Only the target node is looked up, in the tree image if there is an up to
+ * date one or else in the binary device tree, and only the information of
+ * the attribute is read from infodb, the device tree is not read into memory.  The callback is called once with the attribute value.
+ *
+ * @param[in] dtb_path  Path to binary device tree
+ * @param[in] infodb_path  Path to attribute information database
+ * @param[in] target  Device tree path or cronus target
+ * @param[in] attr_name  Name of attribute
+ * @param[in] attr_fn  Callback function called for the attribute
+ * @param[in] priv  Private data for callback
+ * @return value returned by callback, DTREE_READ_NO_TARGET or
+ *         DTREE_READ_NO_ATTR if not found, -1 on failure
+ */
+int dtree_read(const char *dtb_path,
+	       const char *infodb_path,
+	       const char *target,
+	       const char *attr_name,
+	       dtree_export_attr_fn attr_fn,
+	       void *priv);
+
 
 /**
  * @brief Import attributes to a device tree
@@ -140,6 +277,11 @@ int dtree_export(const char *dtb_path,
  * If any of the export callbacks returns non-zero value, then the export
  * is aborted and export returns with that return value.
  *
+ * The device tree and the attribute information database are loaded for
+ * the duration of the call only.  The nodes, attribute values and infodb
+ * reached through the import context are freed before dtree_import()
+ * returns, so parse_fn must not keep any references to them.
+ *
  * @param[in] dtb_path  Path to binary device tree
  * @param[in] infodb_path  Path to attribute information database
  * @param[in] parse_fn  Callback function called to parse import data
@@ -151,6 +293,38 @@ int dtree_import(const char *dtb_path,
 		 dtree_import_parse_fn parse_fn,
 		 void *priv);
 
+/**
+ * @brief Statistics of an import
+ */
+struct dtree_import_stats {
+	int updated;	/* attributes with changed value */
+	int unchanged;	/* attributes imported with the same value */
+	size_t bytes;	/* bytes modified in device tree file */
+	int pages;	/* pages modified in device tree file */
+};
+
+/**
+ * @brief Get the statistics of the last import
+ *
+ * Attributes imported with the same value are not written, so that the
+ * pages of device tree file are not modified unnecessarily.
+ *
+ * @param[out] stats  Statistics of the last import
+ */
+void dtree_import_get_stats(struct dtree_import_stats *stats);
+
+/**
+ * @brief Defer writing of updated attributes till the end of import
+ *
+ * By default every updated attribute is written to the device tree file
+ * immediately.  With deferred writes, all the updated attributes are written
+ * once after the parse function returns 0, and none of them are written if
+ * the parse function fails.
+ *
+ * @param[in] ctx  Import context
+ */
+void dtree_import_defer(void *ctx);
+
 /**
  * @brief Get device tree root from import context
  *
@@ -208,13 +382,41 @@ int dtree_import_attr_update(void *ctx);
  * @param[in] infodb_path  Attribute metadata database path
  * @param[in] attrdb_path  File with a list of attributes to export
  * @param[in] fp_export  File pointer for export
- * @return 0 on success, -1 on error
+ * @return 0 on success, -2 if the device tree cannot be parsed, -3 if the
+ *         infodb cannot be loaded, -4 if the attribute list is invalid,
+ *         -1 on any other error
  */
 int dtree_cronus_export(const char *dtb_path,
 			const char *infodb_path,
 			const char *attrdb_path,
 			FILE *fp_export);
 
+/**
+ * @brief Export device tree is cronus dump format using worker threads
+ *
+ * The root node and each of its subtrees (e.g. proc) are formatted by worker
+ * threads into separate buffers, which are then written to the file in
+ * device tree order.  The output is identical to dtree_cronus_export().
+ *
+ * @param[in] dtb_path  Device tree path
+ * @param[in] infodb_path  Attribute metadata database path
+ * @param[in] attrdb_path  File with a list of attributes to export
+ * @param[in] filter  Export filter, NULL to export everything
+ * @param[in] fp_export  File pointer for export
+ * @param[in] nthreads  Number of worker threads
+ * @param[in] flags  Export flags (DTREE_EXPORT_*)
+ * @return 0 on success, -2 if the device tree cannot be parsed, -3 if the
+ *         infodb cannot be loaded, -4 if the attribute list or the filter
+ *         is invalid, -1 on any other error
+ */
+int dtree_cronus_export_parallel(const char *dtb_path,
+				 const char *infodb_path,
+				 const char *attrdb_path,
+				 const struct dtree_export_filter *filter,
+				 FILE *fp_export,
+				 int nthreads,
+				 int flags);
+
 /**
  * @brief Import device tree from cronus dump format
  *
@@ -227,5 +429,137 @@ int dtree_cronus_import(const char *dtb_path,
 			const char *infodb_path,
 			FILE *fp_import);
 
+/**
+ * @brief Import device tree from cronus dump format using worker threads
+ *
+ * The dump is split at target lines into sections, which are parsed by
+ * worker threads.  The parsed values are then applied in the order of the
+ * dump, and written only if all the lines are valid.  The result is
+ * identical to dtree_cronus_import().
+ *
+ * @param[in] dtb_path  Device tree path
+ * @param[in] infodb_path  Attribute metadata database path
+ * @param[in] fp_import  File pointer for import
+ * @param[in] nthreads  Number of worker threads
+ * @return 0 on success, -1 on error
+ */
+int dtree_cronus_import_parallel(const char *dtb_path,
+				 const char *infodb_path,
+				 FILE *fp_import,
+				 int nthreads);
+
+/**
+ * @brief Export device tree in binary dump format
+ *
+ * The binary dump contains the encoded values of attributes as stored in
+ * device tree, along with the device tree path of targets and the names of
+ * attributes.  It can be imported only with the same infodb.
+ *
+ * @param[in] dtb_path  Device tree path
+ * @param[in] infodb_path  Attribute metadata database path
+ * @param[in] attrdb_path  File with a list of attributes to export
+ * @param[in] filter  Export filter, NULL to export everything
+ * @param[in] fp_export  File pointer for export
+ * @param[in] flags  Export flags (DTREE_EXPORT_*)
+ * @return 0 on success, -1 on error
+ */
+int dtree_binary_export(const char *dtb_path,
+			const char *infodb_path,
+			const char *attrdb_path,
+			const struct dtree_export_filter *filter,
+			FILE *fp_export,
+			int flags);
+
+/**
+ * @brief Check if a file is in binary dump format
+ *
+ * The file is restored to the current position after checking.  Input which
+ * is not seekable (e.g. a pipe) is not read, and is not a binary dump.
+ *
+ * @param[in] fp  File pointer
+ * @return true if the file is a binary dump, false otherwise
+ */
+bool dtree_binary_check(FILE *fp);
+
+/**
+ * @brief Import device tree from binary dump format
+ *
+ * All the records are checked before updating the device tree, so either
+ * all or none of the attributes are updated.
+ *
+ * @param[in] dtb_path  Device tree path
+ * @param[in] infodb_path  Attribute metadata database path
+ * @param[in] fp_import  File pointer for import
+ * @return 0 on success, -1 on error
+ */
+int dtree_binary_import(const char *dtb_path,
+			const char *infodb_path,
+			FILE *fp_import);
+
+/**
+ * @brief Migrate attribute values from an old device tree to a new one
+ *
+ * The attributes listed in attrdb are copied from each node of the old
+ * device tree to the node with the same path in the new device tree, which
+ * is updated in place.  Neither device tree is read into memory.  Encoded
+ * values are copied as is, unless the size of an attribute has changed, in
+ * which case the value is converted using the information from infodb.
+ * The old element size and number of elements are read from old infodb if
+ * given, otherwise they are guessed from the old length, and the attributes
+ * for which the guess is ambiguous are not converted.
+ *
+ * @param[in] old_dtb_path  Path to old binary device tree
+ * @param[in] new_dtb_path  Path to new binary device tree
+ * @param[in] infodb_path  Attribute metadata database path
+ * @param[in] old_infodb_path  Attribute metadata database of old device tree, or NULL
+ * @param[in] attrdb_path  File with a list of attributes to migrate
+ * @return 0 on success, 1 if some attributes could not be converted,
+ *         -1 on error
+ */
+int dtree_migrate(const char *old_dtb_path,
+		  const char *new_dtb_path,
+		  const char *infodb_path,
+		  const char *old_infodb_path,
+		  const char *attrdb_path);
+
+/**
+ * @brief Collect statistics if requested by PDATA_STATS
+ *
+ * The phase timers and counters of libdtree and libdtm are collected when
+ * PDATA_STATS is set, and printed when the program exits.  With
+ * PDATA_STATS=1 (or "stderr"), a summary is printed to stderr, otherwise
+ * PDATA_STATS is the name of a file to write the statistics as JSON.
+ *
+ * @return true if statistics are collected, false otherwise
+ */
+bool dtree_stats_init(void);
+
+/**
+ * @brief Print the statistics collected so far
+ *
+ * @param[in] fp  File pointer for output
+ * @param[in] json  Whether to print JSON instead of a summary table
+ */
+void dtree_stats_print(FILE *fp, bool json);
+
+/**
+ * @brief Clear the statistics collected so far
+ */
+void dtree_stats_reset(void);
+
+/**
+ * @brief Print the memory footprint of a device tree
+ *
+ * The device tree is read into memory, and the footprint is printed with
+ * the usage by target class and by attribute.  With the infodb, the usage
+ * by attribute also counts the values which are the same as the default.
+ *
+ * @param[in] dtb_path  Path to binary device tree
+ * @param[in] infodb_path  Path to attribute information database, or NULL
+ * @param[in] fp  File pointer for output
+ * @return 0 on success, non-zero on failure
+ */
+int dtree_stats_tree(const char *dtb_path, const char *infodb_path, FILE *fp);
+
 #endif /* __DTREE_H__ */
 
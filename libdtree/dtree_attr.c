@@ -19,6 +19,7 @@
 #include <string.h>
 #include <assert.h>
 
+#include "libdtm/dtm.h"
 #include "dtree.h"
 #include "dtree_attr.h"
 
@@ -203,6 +204,18 @@ void dtree_attr_copy(const struct dtree_attr *src, struct dtree_attr *dst)
 	memcpy(dst->value, src->value, dst->elem_size * dst->count);
 }
 
+/*
+ * A view shares dim, spec and enums with the source attribute, and only
+ * points to a different value buffer.  It must not be freed.
+ */
+void dtree_attr_view(const struct dtree_attr *src, struct dtree_attr *view, uint8_t *value)
+{
+	assert(view);
+
+	*view = *src;
+	view->value = value;
+}
+
 void dtree_attr_free(struct dtree_attr *attr)
 {
 	assert(attr);
@@ -219,15 +232,12 @@ void dtree_attr_free(struct dtree_attr *attr)
 		free(attr->value);
 }
 
-void dtree_attr_encode(const struct dtree_attr *attr, uint8_t **out, int *outlen)
+static void dtree_attr_encode_value(const struct dtree_attr *attr, uint8_t *buf)
 {
-	uint8_t *buf;
 	uint32_t buflen;
 	int i, j;
 
 	buflen = attr->count * attr->elem_size;
-	buf = malloc(buflen);
-	assert(buf);
 
 	if (attr->type == DTREE_ATTR_TYPE_COMPLEX) {
 		uint8_t *b = buf;
@@ -286,26 +296,38 @@ void dtree_attr_encode(const struct dtree_attr *attr, uint8_t **out, int *outlen
 				b[i] = htobe64(v[i]);
 		}
 	}
+}
 
-	*out = buf;
-	*outlen = buflen;
+void dtree_attr_encode_buf(const struct dtree_attr *attr, uint8_t *buf)
+{
+	uint64_t start = dtm_stats_start();
+
+	dtree_attr_encode_value(attr, buf);
+	dtm_stats_stop(DTM_STATS_ENCODE, start);
 }
 
-void dtree_attr_decode(struct dtree_attr *attr, const uint8_t *buf, int buflen)
+void dtree_attr_encode(const struct dtree_attr *attr, uint8_t **out, int *outlen)
 {
-	int i, j;
+	uint8_t *buf;
+	uint32_t buflen;
 
-	assert(buflen == attr->count * attr->elem_size);
+	buflen = attr->count * attr->elem_size;
+	buf = malloc(buflen);
+	assert(buf);
 
-	if (attr->value)
-		free(attr->value);
+	dtree_attr_encode_buf(attr, buf);
 
-	attr->value = malloc(attr->count * attr->elem_size);
-	assert(attr->value);
+	*out = buf;
+	*outlen = buflen;
+}
+
+static void dtree_attr_decode_value(const struct dtree_attr *attr, const uint8_t *buf, int buflen, uint8_t *value)
+{
+	int i, j;
 
 	if (attr->type == DTREE_ATTR_TYPE_COMPLEX) {
 		const uint8_t *b = buf;
-		uint8_t *v = attr->value;
+		uint8_t *v = value;
 		char ch;
 
 		for (i=0; i<attr->count; i++) {
@@ -333,31 +355,54 @@ void dtree_attr_decode(struct dtree_attr *attr, const uint8_t *buf, int buflen)
 		}
 
 	} else if (attr->type == DTREE_ATTR_TYPE_STRING) {
-		memcpy(attr->value, buf, buflen);
+		memcpy(value, buf, buflen);
 	} else {
 		if (attr->elem_size == 1) {
-			memcpy(attr->value, buf, buflen);
+			memcpy(value, buf, buflen);
 
 		} else if (attr->elem_size == 2) {
 			uint16_t *b = (uint16_t *)buf;
-			uint16_t *v = (uint16_t *)attr->value;
+			uint16_t *v = (uint16_t *)value;
 
 			for (i=0; i<attr->count; i++)
 				v[i] = be16toh(b[i]);
 
 		} else if (attr->elem_size == 4) {
 			uint32_t *b = (uint32_t *)buf;
-			uint32_t *v = (uint32_t *)attr->value;
+			uint32_t *v = (uint32_t *)value;
 
 			for (i=0; i<attr->count; i++)
 				v[i] = be32toh(b[i]);
 
 		} else if (attr->elem_size == 8) {
 			uint64_t *b = (uint64_t *)buf;
-			uint64_t *v = (uint64_t *)attr->value;
+			uint64_t *v = (uint64_t *)value;
 
 			for (i=0; i<attr->count; i++)
 				v[i] = htobe64(b[i]);
 		}
 	}
 }
+
+void dtree_attr_decode_buf(const struct dtree_attr *attr, const uint8_t *buf, int buflen, uint8_t *value)
+{
+	uint64_t start = dtm_stats_start();
+
+	assert(buflen == attr->count * attr->elem_size);
+
+	dtree_attr_decode_value(attr, buf, buflen, value);
+	dtm_stats_stop(DTM_STATS_ENCODE, start);
+}
+
+void dtree_attr_decode(struct dtree_attr *attr, const uint8_t *buf, int buflen)
+{
+	assert(buflen == attr->count * attr->elem_size);
+
+	if (attr->value)
+		free(attr->value);
+
+	attr->value = malloc(attr->count * attr->elem_size);
+	assert(attr->value);
+
+	dtree_attr_decode_buf(attr, buf, buflen, attr->value);
+}
@@ -32,9 +32,12 @@ bool dtree_attr_set_enum(struct dtree_attr *attr, uint8_t *ptr, const char *tok)
 void dtree_attr_set_string(struct dtree_attr *attr, uint8_t *ptr, const char *tok);
 
 void dtree_attr_copy(const struct dtree_attr *src, struct dtree_attr *dst);
+void dtree_attr_view(const struct dtree_attr *src, struct dtree_attr *view, uint8_t *value);
 void dtree_attr_free(struct dtree_attr *attr);
 
 void dtree_attr_encode(const struct dtree_attr *attr, uint8_t **out, int *outlen);
+void dtree_attr_encode_buf(const struct dtree_attr *attr, uint8_t *buf);
 void dtree_attr_decode(struct dtree_attr *attr, const uint8_t *buf, int buflen);
+void dtree_attr_decode_buf(const struct dtree_attr *attr, const uint8_t *buf, int buflen, uint8_t *value);
 
 #endif /* _DTREE_ATTR_H__ */
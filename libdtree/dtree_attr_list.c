@@ -116,3 +116,14 @@ bool dtree_attr_list_exists(const struct name_list *alist, const char *attr)
 
 	return name_list_find(alist, attr);
 }
+
+void dtree_attr_list_free(struct name_list *alist)
+{
+	int i;
+
+	for (i=0; i<alist->count; i++)
+		free(alist->name[i]);
+	free(alist->name);
+
+	name_list_init(alist);
+}
@@ -27,5 +27,6 @@ struct name_list {
 
 bool dtree_attr_list_parse(const char *attrdb, struct name_list *alist);
 bool dtree_attr_list_exists(const struct name_list *alist, const char *attr);
+void dtree_attr_list_free(struct name_list *alist);
 
 #endif /* __DTREE_ATTR_LIST_H__ */
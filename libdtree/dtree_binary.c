@@ -0,0 +1,592 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <endian.h>
+
+#include "libdtm/dtm.h"
+#include "dtree.h"
+#include "dtree_binary.h"
+#include "dtree_buf.h"
+#include "dtree_export.h"
+#include "dtree_import.h"
+#include "dtree_infodb.h"
+
+/*
+ * Binary dump format
+ *
+ * Header:   magic, version, digest of infodb, number of targets, number of
+ *           attributes and number of records
+ * Targets:  device tree path of each target, terminated by NUL
+ * Attrs:    name of each attribute, terminated by NUL
+ * Records:  target id, attribute id, length and the value encoded as stored
+ *           in device tree
+ *
+ * All the numbers are in big-endian byte order, same as device tree.  Only
+ * the targets and attributes used by records are listed.
+ */
+
+#define BINARY_MAGIC		"PDATADMP"
+#define BINARY_VERSION		1
+
+#define BINARY_PATH_MAX		4096
+#define BINARY_SCAN_MAX_DEPTH	64
+
+struct binary_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t target_count;
+	uint32_t attr_count;
+	uint32_t record_count;
+	uint64_t digest;
+};
+
+struct binary_record {
+	uint32_t target;
+	uint32_t attr;
+	uint32_t len;
+};
+
+struct binary_unknown {
+	char *name;
+	int id;
+};
+
+struct binary_export_state {
+	struct dtree_infodb *infodb;
+	struct dtree_buf targets, attrs, records;
+	struct dtm_node *node;
+	int target_count, attr_count, record_count;
+	int *attr_map;
+	struct binary_unknown *unknown;
+	int unknown_count;
+};
+
+static int binary_export_node(struct dtm_node *root, struct dtm_node *node, void *priv)
+{
+	struct binary_export_state *state = (struct binary_export_state *)priv;
+
+	state->node = node;
+	return 0;
+}
+
+static int binary_export_add_attr(struct binary_export_state *state, const char *name)
+{
+	dtree_buf_put(&state->attrs, name, strlen(name) + 1);
+	state->attr_count += 1;
+	return state->attr_count - 1;
+}
+
+/* Attributes not in infodb are looked up by name */
+static int binary_export_unknown_id(struct binary_export_state *state, const char *name)
+{
+	struct binary_unknown *unknown;
+	int i;
+
+	for (i=0; i<state->unknown_count; i++) {
+		if (strcmp(state->unknown[i].name, name) == 0)
+			return state->unknown[i].id;
+	}
+
+	unknown = reallocarray(state->unknown, state->unknown_count + 1, sizeof(struct binary_unknown));
+	if (!unknown)
+		return -1;
+
+	state->unknown = unknown;
+	unknown = &state->unknown[state->unknown_count];
+
+	unknown->name = strdup(name);
+	if (!unknown->name)
+		return -1;
+
+	unknown->id = binary_export_add_attr(state, name);
+	state->unknown_count += 1;
+	return unknown->id;
+}
+
+static int binary_export_attr_id(struct binary_export_state *state, const char *name)
+{
+	int id;
+
+	id = dtree_infodb_attr_id(state->infodb, name);
+	if (id < 0)
+		return binary_export_unknown_id(state, name);
+
+	if (state->attr_map[id] < 0)
+		state->attr_map[id] = binary_export_add_attr(state, name);
+
+	return state->attr_map[id];
+}
+
+static int binary_export_attr(const char *name, const uint8_t *value, int value_len, void *priv)
+{
+	struct binary_export_state *state = (struct binary_export_state *)priv;
+	struct binary_record rec;
+	int id;
+
+	/* Target is added with its first attribute */
+	if (state->node) {
+		char *path;
+
+		path = dtm_node_path(state->node);
+		if (!path)
+			return -1;
+
+		dtree_buf_put(&state->targets, path, strlen(path) + 1);
+		free(path);
+
+		state->target_count += 1;
+		state->node = NULL;
+	}
+
+	id = binary_export_attr_id(state, name);
+	if (id < 0)
+		return -1;
+
+	rec = (struct binary_record) {
+		.target = htobe32(state->target_count - 1),
+		.attr = htobe32(id),
+		.len = htobe32(value_len),
+	};
+
+	dtree_buf_put(&state->records, (const char *)&rec, sizeof(rec));
+	dtree_buf_put(&state->records, (const char *)value, value_len);
+	state->record_count += 1;
+
+	return 0;
+}
+
+int dtree_binary_export_ctx(struct dtree_export_ctx *ctx, FILE *fp)
+{
+	struct binary_export_state state;
+	struct binary_header hdr;
+	int count, i, ret;
+
+	state = (struct binary_export_state) {
+		.infodb = dtree_export_infodb(ctx),
+	};
+
+	dtree_buf_init(&state.targets, NULL);
+	dtree_buf_init(&state.attrs, NULL);
+	dtree_buf_init(&state.records, NULL);
+
+	/* Map infodb attribute id to the id in dump */
+	count = state.infodb->alist.count;
+	state.attr_map = malloc((count > 0 ? count : 1) * sizeof(int));
+	if (!state.attr_map)
+		return -1;
+
+	for (i=0; i<count; i++)
+		state.attr_map[i] = -1;
+
+	ret = dtree_export_subtree_raw(ctx, dtree_export_root(ctx),
+				       binary_export_node, binary_export_attr,
+				       &state);
+	if (ret)
+		goto done;
+
+	if (state.targets.error || state.attrs.error || state.records.error) {
+		ret = -1;
+		goto done;
+	}
+
+	memcpy(hdr.magic, BINARY_MAGIC, sizeof(hdr.magic));
+	hdr.version = htobe32(BINARY_VERSION);
+	hdr.target_count = htobe32(state.target_count);
+	hdr.attr_count = htobe32(state.attr_count);
+	hdr.record_count = htobe32(state.record_count);
+	hdr.digest = htobe64(dtree_infodb_digest(state.infodb));
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    fwrite(state.targets.data, 1, state.targets.len, fp) != state.targets.len ||
+	    fwrite(state.attrs.data, 1, state.attrs.len, fp) != state.attrs.len ||
+	    fwrite(state.records.data, 1, state.records.len, fp) != state.records.len)
+		ret = -1;
+
+done:
+	dtree_buf_free(&state.targets);
+	dtree_buf_free(&state.attrs);
+	dtree_buf_free(&state.records);
+	for (i=0; i<state.unknown_count; i++)
+		free(state.unknown[i].name);
+	free(state.unknown);
+	free(state.attr_map);
+	return ret;
+}
+
+int dtree_binary_export(const char *dtb_path,
+			const char *infodb_path,
+			const char *attrdb_path,
+			const struct dtree_export_filter *filter,
+			FILE *fp,
+			int flags)
+{
+	struct dtree_export_ctx *ctx;
+	int ret;
+
+	ret = dtree_export_open(dtb_path, infodb_path, attrdb_path, filter, flags, &ctx);
+	if (ret)
+		return ret;
+
+	ret = dtree_binary_export_ctx(ctx, fp);
+
+	dtree_export_close(ctx);
+	return ret;
+}
+
+bool dtree_binary_check(FILE *fp)
+{
+	char magic[8];
+	long pos;
+	size_t n;
+
+	/* The header cannot be put back on a pipe, so only sniff seekable input */
+	pos = ftell(fp);
+	if (pos < 0 || fseek(fp, pos, SEEK_SET) != 0)
+		return false;
+
+	n = fread(magic, 1, sizeof(magic), fp);
+	if (fseek(fp, pos, SEEK_SET) != 0)
+		return false;
+
+	return (n == sizeof(magic) && memcmp(magic, BINARY_MAGIC, sizeof(magic)) == 0);
+}
+
+static uint8_t *binary_read_all(FILE *fp, size_t *len)
+{
+	uint8_t *data = NULL, *ptr;
+	size_t size = 0, n;
+
+	*len = 0;
+
+	do {
+		if (*len == size) {
+			size = size ? size * 2 : 64 * 1024;
+			ptr = realloc(data, size);
+			if (!ptr) {
+				free(data);
+				return NULL;
+			}
+			data = ptr;
+		}
+
+		n = fread(data + *len, 1, size - *len, fp);
+		*len += n;
+	} while (n > 0);
+
+	if (ferror(fp)) {
+		free(data);
+		return NULL;
+	}
+
+	return data;
+}
+
+/* Split NUL terminated strings, returns the offset after the last string */
+static size_t binary_read_strings(const uint8_t *data, size_t len, size_t offset,
+				  const char **str, int count)
+{
+	const uint8_t *end;
+	int i;
+
+	for (i=0; i<count; i++) {
+		if (offset >= len)
+			return 0;
+
+		end = memchr(data + offset, '\0', len - offset);
+		if (!end)
+			return 0;
+
+		str[i] = (const char *)data + offset;
+		offset = end - data + 1;
+	}
+
+	return offset;
+}
+
+struct binary_import_state {
+	struct dtm_file *dfile;
+	const uint8_t *data;
+	size_t len;
+	const char **target;
+	int *offset;
+	const char **attr;
+	int target_count, attr_count, record_count;
+	size_t records;
+	struct dtree_import_stats stats;
+};
+
+struct binary_target {
+	const char *path;
+	int id;
+};
+
+struct binary_target_scan {
+	struct binary_import_state *state;
+	struct binary_target *sorted;
+	char path[BINARY_PATH_MAX];
+	int len[BINARY_SCAN_MAX_DEPTH];
+};
+
+static int binary_target_compare(const void *a, const void *b)
+{
+	return strcmp(((const struct binary_target *)a)->path,
+		      ((const struct binary_target *)b)->path);
+}
+
+static int binary_import_target(struct dtm_file *dfile, int offset, int depth,
+				const char *name, void *priv)
+{
+	struct binary_target_scan *scan = (struct binary_target_scan *)priv;
+	struct binary_import_state *state = scan->state;
+	struct binary_target key, *found;
+	int len;
+
+	if (depth >= BINARY_SCAN_MAX_DEPTH)
+		return -1;
+
+	if (depth == 0) {
+		strcpy(scan->path, "/");
+		len = 0;
+	} else {
+		len = scan->len[depth-1];
+		if (len + strlen(name) + 2 > BINARY_PATH_MAX)
+			return -1;
+
+		scan->path[len] = '/';
+		strcpy(scan->path + len + 1, name);
+		len += strlen(name) + 1;
+	}
+	scan->len[depth] = len;
+
+	key.path = scan->path;
+	found = bsearch(&key, scan->sorted, state->target_count,
+			sizeof(struct binary_target), binary_target_compare);
+	if (found)
+		state->offset[found->id] = offset;
+
+	return 0;
+}
+
+/*
+ * Look up all the targets in a single scan of device tree, instead of
+ * searching the device tree from root for each target.
+ */
+static int binary_import_targets(struct binary_import_state *state)
+{
+	struct binary_target_scan scan;
+	int i, ret;
+
+	scan.state = state;
+	scan.sorted = malloc((state->target_count + 1) * sizeof(struct binary_target));
+	if (!scan.sorted)
+		return -1;
+
+	for (i=0; i<state->target_count; i++) {
+		scan.sorted[i] = (struct binary_target) {
+			.path = state->target[i],
+			.id = i,
+		};
+		state->offset[i] = -1;
+	}
+
+	qsort(scan.sorted, state->target_count, sizeof(struct binary_target), binary_target_compare);
+
+	ret = dtm_file_scan(state->dfile, binary_import_target, &scan);
+
+	free(scan.sorted);
+	return ret;
+}
+
+/*
+ * Check all the records before writing any, so that a bad dump does not
+ * leave the device tree partially updated.
+ */
+static int binary_import_records(struct binary_import_state *state, bool do_write)
+{
+	struct binary_record rec;
+	const uint8_t *value;
+	const void *old;
+	size_t pos = state->records;
+	int i, offset, len;
+
+	for (i=0; i<state->record_count; i++) {
+		if (pos + sizeof(rec) > state->len)
+			goto truncated;
+
+		memcpy(&rec, state->data + pos, sizeof(rec));
+		rec.target = be32toh(rec.target);
+		rec.attr = be32toh(rec.attr);
+		rec.len = be32toh(rec.len);
+		pos += sizeof(rec);
+
+		if (rec.len > state->len - pos)
+			goto truncated;
+
+		value = state->data + pos;
+		pos += rec.len;
+
+		if (rec.target >= state->target_count || rec.attr >= state->attr_count) {
+			fprintf(stderr, "Invalid record %d in binary dump\n", i);
+			return -1;
+		}
+
+		offset = state->offset[rec.target];
+		if (offset < 0) {
+			fprintf(stderr, "Target %s not found\n", state->target[rec.target]);
+			return -1;
+		}
+
+		old = dtm_file_get_property(state->dfile, offset, state->attr[rec.attr], &len);
+		if (!old) {
+			fprintf(stderr, "Attribute %s not found for %s\n",
+				state->attr[rec.attr], state->target[rec.target]);
+			return -1;
+		}
+
+		if (len != rec.len) {
+			fprintf(stderr, "Invalid length %u for %s\n",
+				rec.len, state->attr[rec.attr]);
+			return -1;
+		}
+
+		if (!do_write)
+			continue;
+
+		if (memcmp(old, value, len) == 0) {
+			state->stats.unchanged += 1;
+			continue;
+		}
+
+		if (!dtm_file_set_property(state->dfile, offset, state->attr[rec.attr], value, len))
+			return -1;
+
+		state->stats.updated += 1;
+	}
+
+	return 0;
+
+truncated:
+	fprintf(stderr, "Truncated binary dump\n");
+	return -1;
+}
+
+int dtree_binary_import(const char *dtb_path,
+			const char *infodb_path,
+			FILE *fp)
+{
+	struct binary_import_state state;
+	struct binary_header hdr;
+	struct dtree_infodb infodb;
+	uint8_t *data;
+	size_t len, pos;
+	uint64_t digest;
+	int i, ret = -1;
+
+	data = binary_read_all(fp, &len);
+	if (!data)
+		return -1;
+
+	if (len < sizeof(hdr)) {
+		fprintf(stderr, "Truncated binary dump\n");
+		free(data);
+		return -1;
+	}
+
+	memcpy(&hdr, data, sizeof(hdr));
+	if (memcmp(hdr.magic, BINARY_MAGIC, sizeof(hdr.magic)) != 0 ||
+	    be32toh(hdr.version) != BINARY_VERSION) {
+		fprintf(stderr, "Invalid binary dump\n");
+		free(data);
+		return -1;
+	}
+
+	state = (struct binary_import_state) { 0 };
+
+	if (!dtree_infodb_load(infodb_path, &infodb))
+		goto fail;
+
+	digest = dtree_infodb_digest(&infodb);
+	if (be64toh(hdr.digest) != digest) {
+		fprintf(stderr, "Binary dump does not match infodb %s\n", infodb_path);
+		goto fail;
+	}
+
+	state = (struct binary_import_state) {
+		.data = data,
+		.len = len,
+		.target_count = be32toh(hdr.target_count),
+		.attr_count = be32toh(hdr.attr_count),
+		.record_count = be32toh(hdr.record_count),
+	};
+
+	/* Each target and attribute takes at least one byte */
+	if (state.target_count > len || state.attr_count > len) {
+		fprintf(stderr, "Truncated binary dump\n");
+		goto fail;
+	}
+
+	state.target = calloc(state.target_count + 1, sizeof(char *));
+	state.offset = calloc(state.target_count + 1, sizeof(int));
+	state.attr = calloc(state.attr_count + 1, sizeof(char *));
+	if (!state.target || !state.offset || !state.attr)
+		goto fail;
+
+	pos = binary_read_strings(data, len, sizeof(hdr), state.target, state.target_count);
+	if (pos > 0)
+		pos = binary_read_strings(data, len, pos, state.attr, state.attr_count);
+	if (pos == 0) {
+		fprintf(stderr, "Truncated binary dump\n");
+		goto fail;
+	}
+	state.records = pos;
+
+	/* Only attributes are written, not any other property */
+	for (i=0; i<state.attr_count; i++) {
+		if (!dtree_infodb_attr(&infodb, state.attr[i])) {
+			fprintf(stderr, "Unknown attribute %s in binary dump\n", state.attr[i]);
+			goto fail;
+		}
+	}
+
+	state.dfile = dtm_file_open(dtb_path, true);
+	if (!state.dfile)
+		goto fail;
+
+	ret = binary_import_targets(&state);
+	if (ret)
+		goto close;
+
+	ret = binary_import_records(&state, false);
+	if (ret == 0)
+		ret = binary_import_records(&state, true);
+
+	dtm_file_dirty(state.dfile, &state.stats.bytes, &state.stats.pages);
+	dtree_import_set_stats(&state.stats);
+
+close:
+	dtm_file_close(state.dfile);
+
+fail:
+	dtree_infodb_free(&infodb);
+	free(state.target);
+	free(state.offset);
+	free(state.attr);
+	free(data);
+	return ret;
+}
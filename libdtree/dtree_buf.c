@@ -0,0 +1,222 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "libdtm/dtm.h"
+#include "dtree_buf.h"
+
+/* Writing to a file descriptor needs a large buffer, stdio has its own */
+#define DTREE_BUF_SIZE_FD	(64 * 1024)
+#define DTREE_BUF_SIZE		1024
+
+/* Two hex digits for every byte value */
+static const char hex_pair[512] =
+	"000102030405060708090a0b0c0d0e0f"
+	"101112131415161718191a1b1c1d1e1f"
+	"202122232425262728292a2b2c2d2e2f"
+	"303132333435363738393a3b3c3d3e3f"
+	"404142434445464748494a4b4c4d4e4f"
+	"505152535455565758595a5b5c5d5e5f"
+	"606162636465666768696a6b6c6d6e6f"
+	"707172737475767778797a7b7c7d7e7f"
+	"808182838485868788898a8b8c8d8e8f"
+	"909192939495969798999a9b9c9d9e9f"
+	"a0a1a2a3a4a5a6a7a8a9aaabacadaeaf"
+	"b0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+	"c0c1c2c3c4c5c6c7c8c9cacbcccdcecf"
+	"d0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+	"e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
+	"f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+void dtree_buf_init(struct dtree_buf *buf, FILE *fp)
+{
+	*buf = (struct dtree_buf) {
+		.fd = -1,
+		.fp = fp,
+	};
+}
+
+void dtree_buf_init_fd(struct dtree_buf *buf, int fd)
+{
+	*buf = (struct dtree_buf) {
+		.fd = fd,
+	};
+}
+
+static bool dtree_buf_write(struct dtree_buf *buf)
+{
+	char *ptr = buf->data;
+	size_t len = buf->len;
+
+	dtm_stats_count(DTM_STATS_BYTES, len);
+
+	if (buf->fp) {
+		if (fwrite(ptr, 1, len, buf->fp) != len)
+			return false;
+
+		return true;
+	}
+
+	while (len > 0) {
+		ssize_t n;
+
+		n = write(buf->fd, ptr, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		ptr += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+bool dtree_buf_flush(struct dtree_buf *buf)
+{
+	if (buf->fd < 0 && !buf->fp)
+		return !buf->error;
+
+	if (buf->len > 0 && !buf->error) {
+		uint64_t start = dtm_stats_start();
+
+		if (!dtree_buf_write(buf))
+			buf->error = true;
+
+		dtm_stats_stop(DTM_STATS_WRITE, start);
+	}
+
+	buf->len = 0;
+	return !buf->error;
+}
+
+void dtree_buf_free(struct dtree_buf *buf)
+{
+	free(buf->data);
+	buf->data = NULL;
+	buf->len = 0;
+	buf->size = 0;
+}
+
+/* Make space for len more bytes */
+static bool dtree_buf_reserve(struct dtree_buf *buf, size_t len)
+{
+	size_t size;
+	char *data;
+
+	if (buf->len + len <= buf->size)
+		return true;
+
+	if (buf->fd >= 0 || buf->fp) {
+		dtree_buf_flush(buf);
+		if (len <= buf->size)
+			return true;
+	}
+
+	if (buf->size > 0)
+		size = buf->size;
+	else if (buf->fd >= 0)
+		size = DTREE_BUF_SIZE_FD;
+	else
+		size = DTREE_BUF_SIZE;
+
+	while (size < buf->len + len)
+		size *= 2;
+
+	data = realloc(buf->data, size);
+	if (!data) {
+		buf->error = true;
+		return false;
+	}
+
+	dtm_stats_count(DTM_STATS_ALLOCS, 1);
+
+	buf->data = data;
+	buf->size = size;
+	return true;
+}
+
+void dtree_buf_put(struct dtree_buf *buf, const char *data, size_t len)
+{
+	if (!dtree_buf_reserve(buf, len))
+		return;
+
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+void dtree_buf_puts(struct dtree_buf *buf, const char *str)
+{
+	dtree_buf_put(buf, str, strlen(str));
+}
+
+void dtree_buf_putc(struct dtree_buf *buf, char ch)
+{
+	if (!dtree_buf_reserve(buf, 1))
+		return;
+
+	buf->data[buf->len++] = ch;
+}
+
+/* Same as "0x%0<2*size>x" */
+void dtree_buf_hex(struct dtree_buf *buf, uint64_t val, int size)
+{
+	char *ptr;
+	int i;
+
+	assert(size == 1 || size == 2 || size == 4 || size == 8);
+
+	if (!dtree_buf_reserve(buf, 2 + 2 * size))
+		return;
+
+	ptr = buf->data + buf->len;
+	ptr[0] = '0';
+	ptr[1] = 'x';
+
+	for (i=size-1; i>=0; i--) {
+		memcpy(&ptr[2 + 2*i], &hex_pair[2 * (val & 0xff)], 2);
+		val >>= 8;
+	}
+
+	buf->len += 2 + 2 * size;
+}
+
+/* Same as "%d" */
+void dtree_buf_dec(struct dtree_buf *buf, int val)
+{
+	char tmp[12];
+	unsigned int v;
+	int n = sizeof(tmp);
+
+	v = val < 0 ? -(unsigned int)val : val;
+	do {
+		tmp[--n] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+
+	if (val < 0)
+		tmp[--n] = '-';
+
+	dtree_buf_put(buf, &tmp[n], sizeof(tmp) - n);
+}
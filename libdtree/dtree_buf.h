@@ -0,0 +1,50 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __DTREE_BUF_H__
+#define __DTREE_BUF_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Output buffer for formatting attribute values
+ *
+ * Buffer is either flushed to a file descriptor with write(), flushed to a
+ * stdio stream with fwrite(), or (without either) grows in memory.
+ */
+struct dtree_buf {
+	char *data;
+	size_t len;
+	size_t size;
+	int fd;
+	FILE *fp;
+	bool error;
+};
+
+void dtree_buf_init(struct dtree_buf *buf, FILE *fp);
+void dtree_buf_init_fd(struct dtree_buf *buf, int fd);
+bool dtree_buf_flush(struct dtree_buf *buf);
+void dtree_buf_free(struct dtree_buf *buf);
+
+void dtree_buf_put(struct dtree_buf *buf, const char *data, size_t len);
+void dtree_buf_puts(struct dtree_buf *buf, const char *str);
+void dtree_buf_putc(struct dtree_buf *buf, char ch);
+void dtree_buf_hex(struct dtree_buf *buf, uint64_t val, int size);
+void dtree_buf_dec(struct dtree_buf *buf, int val);
+
+#endif /* __DTREE_BUF_H__ */
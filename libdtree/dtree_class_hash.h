@@ -0,0 +1,109 @@
+/* Generated by scripts/genClassHash.pl from class_map in dtree_util.c, do not edit */
+
+#ifndef __DTREE_CLASS_HASH_H__
+#define __DTREE_CLASS_HASH_H__
+
+#define CLASS_HASH_SIZE		128
+#define DTREE_CLASS_SEED	9988
+#define CRONUS_CLASS_SEED	36013
+
+struct class_hash_entry {
+	const char *name;
+	int class_id;
+};
+
+static const struct class_hash_entry dtree_class_hash[CLASS_HASH_SIZE] = {
+	[2] = { "bmc", DTREE_CLASS_BMC },
+	[5] = { "obus", DTREE_CLASS_OBUS },
+	[6] = { "nmmu", DTREE_CLASS_NMMU },
+	[8] = { "pec", DTREE_CLASS_PEC },
+	[12] = { "phb", DTREE_CLASS_PHB },
+	[17] = { "root", DTREE_CLASS_SYSTEM },
+	[24] = { "perv", DTREE_CLASS_PERV },
+	[25] = { "occ", DTREE_CLASS_OCC },
+	[27] = { "tpm", DTREE_CLASS_TPM },
+	[28] = { "omi", DTREE_CLASS_OMI },
+	[34] = { "mba", DTREE_CLASS_MBA },
+	[36] = { "sbe", DTREE_CLASS_SBE },
+	[39] = { "capp", DTREE_CLASS_CAPP },
+	[41] = { "mcs", DTREE_CLASS_MCS },
+	[42] = { "membuf_chip", DTREE_CLASS_MEMBUF_CHIP },
+	[44] = { "chiplet", DTREE_CLASS_PERV },
+	[47] = { "gpio_expander", DTREE_CLASS_GPIO_EXPANDER },
+	[48] = { "mca", DTREE_CLASS_MCA },
+	[49] = { "mcc", DTREE_CLASS_MCC },
+	[53] = { "obus_brick", DTREE_CLASS_OBUS_BRICK },
+	[63] = { "adc", DTREE_CLASS_ADC },
+	[68] = { "ocmb", DTREE_CLASS_OCMB_CHIP },
+	[70] = { "mem_port", DTREE_CLASS_MEM_PORT },
+	[71] = { "dimm", DTREE_CLASS_DIMM },
+	[72] = { "dmi", DTREE_CLASS_DMI },
+	[75] = { "proc", DTREE_CLASS_PROC_CHIP },
+	[78] = { "smpgroup", DTREE_CLASS_ABUS },
+	[82] = { "l4", DTREE_CLASS_L4 },
+	[83] = { "ody_chiplet", DTREE_CLASS_PERV },
+	[91] = { "iohs", DTREE_CLASS_IOHS },
+	[99] = { "core", DTREE_CLASS_CORE },
+	[102] = { "fc", DTREE_CLASS_FC },
+	[103] = { "mi", DTREE_CLASS_MI },
+	[104] = { "omic", DTREE_CLASS_OMIC },
+	[106] = { "mc", DTREE_CLASS_MC },
+	[107] = { "eq", DTREE_CLASS_EQ },
+	[109] = { "xbus", DTREE_CLASS_XBUS },
+	[110] = { "pmic", DTREE_CLASS_PMIC },
+	[111] = { "ex", DTREE_CLASS_EX },
+	[113] = { "ppe", DTREE_CLASS_PPE },
+	[114] = { "nx", DTREE_CLASS_NX },
+	[115] = { "pauc", DTREE_CLASS_PAUC },
+	[117] = { "mcbist", DTREE_CLASS_MCBIST },
+	[123] = { "pau", DTREE_CLASS_PAU },
+	[126] = { "oscrefclk", DTREE_CLASS_OSCREFCLK },
+};
+
+static const struct class_hash_entry cronus_class_hash[CLASS_HASH_SIZE] = {
+	[0] = { "membuf_chip", DTREE_CLASS_MEMBUF_CHIP },
+	[2] = { "omic", DTREE_CLASS_OMIC },
+	[3] = { "tpm", DTREE_CLASS_TPM },
+	[5] = { "system", DTREE_CLASS_SYSTEM },
+	[7] = { "sbe", DTREE_CLASS_SBE },
+	[8] = { "pauc", DTREE_CLASS_PAUC },
+	[11] = { "l4", DTREE_CLASS_L4 },
+	[13] = { "obus", DTREE_CLASS_OBUS },
+	[14] = { "xbus", DTREE_CLASS_XBUS },
+	[24] = { "iohs", DTREE_CLASS_IOHS },
+	[27] = { "dmi", DTREE_CLASS_DMI },
+	[28] = { "omi", DTREE_CLASS_OMI },
+	[30] = { "proc_chip", DTREE_CLASS_PROC_CHIP },
+	[32] = { "dimm", DTREE_CLASS_DIMM },
+	[33] = { "mba", DTREE_CLASS_MBA },
+	[36] = { "capp", DTREE_CLASS_CAPP },
+	[37] = { "occ", DTREE_CLASS_OCC },
+	[42] = { "adc", DTREE_CLASS_ADC },
+	[44] = { "mcs", DTREE_CLASS_MCS },
+	[51] = { "mca", DTREE_CLASS_MCA },
+	[52] = { "mcc", DTREE_CLASS_MCC },
+	[55] = { "oscrefclk", DTREE_CLASS_OSCREFCLK },
+	[61] = { "perv", DTREE_CLASS_PERV },
+	[65] = { "nmmu", DTREE_CLASS_NMMU },
+	[71] = { "ocmb", DTREE_CLASS_OCMB_CHIP },
+	[74] = { "mem_port", DTREE_CLASS_MEM_PORT },
+	[75] = { "pec", DTREE_CLASS_PEC },
+	[82] = { "pau", DTREE_CLASS_PAU },
+	[88] = { "ppe", DTREE_CLASS_PPE },
+	[93] = { "bmc", DTREE_CLASS_BMC },
+	[95] = { "mc", DTREE_CLASS_MC },
+	[96] = { "smpgroup", DTREE_CLASS_ABUS },
+	[98] = { "mi", DTREE_CLASS_MI },
+	[100] = { "phb", DTREE_CLASS_PHB },
+	[103] = { "c", DTREE_CLASS_CORE },
+	[106] = { "ex", DTREE_CLASS_EX },
+	[107] = { "nx", DTREE_CLASS_NX },
+	[110] = { "eq", DTREE_CLASS_EQ },
+	[111] = { "fc", DTREE_CLASS_FC },
+	[115] = { "pmic", DTREE_CLASS_PMIC },
+	[117] = { "obus_brick", DTREE_CLASS_OBUS_BRICK },
+	[118] = { "gpio_expander", DTREE_CLASS_GPIO_EXPANDER },
+	[119] = { "mcbist", DTREE_CLASS_MCBIST },
+};
+
+#endif /* __DTREE_CLASS_HASH_H__ */
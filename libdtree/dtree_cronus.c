@@ -20,13 +20,27 @@
 #include <inttypes.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "libdtm/dtm.h"
 
 #include "dtree.h"
+#include "dtree_buf.h"
 #include "dtree_cronus.h"
+#include "dtree_export.h"
+#include "dtree_import.h"
+#include "dtree_infodb.h"
 
 struct cronus_export_state {
-	FILE *fp;
-	char *target;
+	struct dtree_buf *buf;
+	struct dtree_cronus_index *index;
+	const char *target;
 	bool printed;
 };
 
@@ -34,10 +48,14 @@ static int cronus_export_node(struct dtm_node *root, struct dtm_node *node, void
 {
 	struct cronus_export_state *state = (struct cronus_export_state *)priv;
 
-	if (state->target)
-		free(state->target);
+	/* Target strings for the whole tree are computed once */
+	if (!state->index) {
+		state->index = dtree_cronus_index_new(root);
+		if (!state->index)
+			return -1;
+	}
 
-	state->target = dtree_to_cronus_target(root, node);
+	state->target = dtree_cronus_index_target(state->index, node);
 	state->printed = false;
 	return 0;
 }
@@ -49,28 +67,288 @@ static int cronus_export_attr(const struct dtree_attr *attr, void *priv)
 	if (!state->target) {
 		return 0;
 	} else if (!state->printed) {
-		dtree_cronus_print_node(state->target, state->fp);
+		dtree_cronus_buf_print_node(state->target, state->buf);
 		state->printed = true;
 	}
 
-	dtree_cronus_print_attr(attr, state->fp);
+	dtree_cronus_buf_print_attr(attr, state->buf);
 	return 0;
 }
 
+int dtree_cronus_export_ctx(struct dtree_export_ctx *ctx, FILE *fp)
+{
+	struct cronus_export_state state;
+	struct dtree_buf buf;
+	int fd, ret;
+
+	/* Bypass stdio if the stream is backed by a file descriptor */
+	fd = fileno(fp);
+	if (fd >= 0 && fflush(fp) == 0)
+		dtree_buf_init_fd(&buf, fd);
+	else
+		dtree_buf_init(&buf, fp);
+
+	state = (struct cronus_export_state) {
+		.buf = &buf,
+	};
+
+	ret = dtree_export_subtree(ctx, dtree_export_root(ctx), true,
+				   cronus_export_node, cronus_export_attr,
+				   &state);
+
+	if (!dtree_buf_flush(&buf) && ret == 0)
+		ret = -1;
+
+	dtree_buf_free(&buf);
+
+	if (state.index)
+		dtree_cronus_index_free(state.index);
+
+	return ret;
+}
+
+static int cronus_export_serial(const char *dtb_path,
+				const char *infodb_path,
+				const char *attrdb_path,
+				const struct dtree_export_filter *filter,
+				FILE *fp,
+				int flags)
+{
+	struct dtree_export_ctx *ctx;
+	int ret;
+
+	ret = dtree_export_open(dtb_path, infodb_path, attrdb_path, filter, flags, &ctx);
+	if (ret)
+		return ret;
+
+	ret = dtree_cronus_export_ctx(ctx, fp);
+
+	dtree_export_close(ctx);
+	return ret;
+}
+
 int dtree_cronus_export(const char *dtb_path,
 			const char *infodb_path,
 			const char *attrdb_path,
 			FILE *fp)
+{
+	return cronus_export_serial(dtb_path, infodb_path, attrdb_path, NULL, fp, 0);
+}
+
+/*
+ * Parallel export
+ *
+ * The partitions are the root node (without children) followed by each of
+ * the subtrees of root, i.e. the same order as the serial export.  Workers
+ * pick the next unprocessed partition and format it into a memory buffer.
+ */
+struct cronus_partition {
+	struct dtm_node *node;
+	bool recurse;
+	struct dtree_buf buf;
+	int ret;
+};
+
+struct cronus_parallel_state {
+	struct dtree_export_ctx *ctx;
+	struct dtree_cronus_index *index;
+	struct cronus_partition *part;
+	int count;
+	int next;
+	pthread_mutex_t lock;
+};
+
+static void cronus_export_partition(struct cronus_parallel_state *pstate,
+				    struct cronus_partition *part)
 {
 	struct cronus_export_state state;
 
+	dtree_buf_init(&part->buf, NULL);
+
 	state = (struct cronus_export_state) {
-		.fp = fp,
+		.buf = &part->buf,
+		.index = pstate->index,
+	};
+
+	part->ret = dtree_export_subtree(pstate->ctx, part->node, part->recurse,
+					 cronus_export_node, cronus_export_attr,
+					 &state);
+
+	if (part->buf.error && part->ret == 0)
+		part->ret = -1;
+}
+
+static void *cronus_export_worker(void *arg)
+{
+	struct cronus_parallel_state *pstate = (struct cronus_parallel_state *)arg;
+	int i;
+
+	while (1) {
+		pthread_mutex_lock(&pstate->lock);
+		i = pstate->next;
+		if (i < pstate->count)
+			pstate->next += 1;
+		pthread_mutex_unlock(&pstate->lock);
+
+		if (i >= pstate->count)
+			break;
+
+		cronus_export_partition(pstate, &pstate->part[i]);
+	}
+
+	return NULL;
+}
+
+static int cronus_write_partitions(struct cronus_partition *part, int count, FILE *fp)
+{
+	struct iovec iov[64];
+	int fd, i, n;
+
+	fd = fileno(fp);
+	if (fd < 0) {
+		for (i=0; i<count; i++) {
+			if (fwrite(part[i].buf.data, 1, part[i].buf.len, fp) != part[i].buf.len)
+				return -1;
+		}
+		return 0;
+	}
+
+	if (fflush(fp) != 0)
+		return -1;
+
+	i = 0;
+	while (i < count) {
+		ssize_t written;
+
+		for (n=0; n<64 && i+n<count; n++) {
+			iov[n] = (struct iovec) {
+				.iov_base = part[i+n].buf.data,
+				.iov_len = part[i+n].buf.len,
+			};
+		}
+
+		written = writev(fd, iov, n);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		/* Skip over whatever got written, retry the rest */
+		while (i < count && written >= part[i].buf.len) {
+			written -= part[i].buf.len;
+			part[i].buf.len = 0;
+			i++;
+		}
+		if (i < count) {
+			part[i].buf.data += written;
+			part[i].buf.len -= written;
+			if (part[i].buf.len == 0)
+				i++;
+		}
+	}
+
+	return 0;
+}
+
+int dtree_cronus_export_parallel(const char *dtb_path,
+				 const char *infodb_path,
+				 const char *attrdb_path,
+				 const struct dtree_export_filter *filter,
+				 FILE *fp,
+				 int nthreads,
+				 int flags)
+{
+	struct cronus_parallel_state pstate;
+	struct dtm_node *root, *child;
+	pthread_t *thread;
+	char **buf;
+	int count, started, i, ret;
+
+	if (nthreads <= 1)
+		return cronus_export_serial(dtb_path, infodb_path, attrdb_path, filter, fp, flags);
+
+	ret = dtree_export_open(dtb_path, infodb_path, attrdb_path, filter, flags, &pstate.ctx);
+	if (ret)
+		return ret;
+
+	root = dtree_export_root(pstate.ctx);
+
+	/* Classifies all the nodes, so workers only read the tree */
+	pstate.index = dtree_cronus_index_new(root);
+	if (!pstate.index) {
+		dtree_export_close(pstate.ctx);
+		return -1;
+	}
+
+	count = 1;
+	for (child = dtm_node_next_child(root, NULL); child; child = dtm_node_next_child(root, child))
+		count++;
+
+	pstate.part = calloc(count, sizeof(struct cronus_partition));
+	thread = calloc(nthreads, sizeof(pthread_t));
+	buf = calloc(count, sizeof(char *));
+	if (!pstate.part || !thread || !buf) {
+		ret = -1;
+		goto done;
+	}
+
+	pstate.part[0] = (struct cronus_partition) {
+		.node = root,
+		.recurse = false,
 	};
 
-	return dtree_export(dtb_path, infodb_path, attrdb_path,
-			    cronus_export_node, cronus_export_attr,
-			    &state);
+	i = 1;
+	for (child = dtm_node_next_child(root, NULL); child; child = dtm_node_next_child(root, child)) {
+		pstate.part[i] = (struct cronus_partition) {
+			.node = child,
+			.recurse = true,
+		};
+		i++;
+	}
+
+	pstate.count = count;
+	pstate.next = 0;
+	pthread_mutex_init(&pstate.lock, NULL);
+
+	if (nthreads > count)
+		nthreads = count;
+
+	for (started=0; started<nthreads; started++) {
+		if (pthread_create(&thread[started], NULL, cronus_export_worker, &pstate) != 0)
+			break;
+	}
+
+	/* If no thread could be started, do all the work here */
+	if (started == 0)
+		cronus_export_worker(&pstate);
+
+	for (i=0; i<started; i++)
+		pthread_join(thread[i], NULL);
+
+	pthread_mutex_destroy(&pstate.lock);
+
+	/* Keep the buffers to free, writing moves the pointers */
+	ret = 0;
+	for (i=0; i<count; i++) {
+		buf[i] = pstate.part[i].buf.data;
+		if (pstate.part[i].ret != 0 && ret == 0)
+			ret = pstate.part[i].ret;
+	}
+
+	if (ret == 0)
+		ret = cronus_write_partitions(pstate.part, count, fp);
+
+	for (i=0; i<count; i++)
+		free(buf[i]);
+
+done:
+	free(buf);
+	free(thread);
+	free(pstate.part);
+	dtree_cronus_index_free(pstate.index);
+	dtree_export_close(pstate.ctx);
+	return ret;
 }
 
 struct cronus_import_state {
@@ -80,25 +358,42 @@ struct cronus_import_state {
 int cronus_import_parse(void *ctx, void *priv)
 {
 	struct cronus_import_state *state = (struct cronus_import_state *)priv;
+	struct dtree_cronus_index *index;
+	struct dtree_infodb *infodb;
+	uint8_t *value;
 	char *buf;
 	size_t len;
 	ssize_t n;
-	int ret = 0;
+	int lineno = 0, ret = 0;
+
+	index = dtree_cronus_index_new(dtree_import_root(ctx));
+	if (!index)
+		return -1;
+
+	infodb = dtree_import_infodb(ctx);
+	value = malloc(infodb->value_max > 0 ? infodb->value_max : 1);
+	assert(value);
 
 	len = 1024;
 	buf = malloc(len);
 	assert(buf);
 
 	while((n = getline(&buf, &len, state->fp)) != -1) {
+		lineno++;
+
 		if (buf[n-1] == '\n')
 			buf[n-1] = '\0';
 
-		ret = dtree_cronus_parse(ctx, buf);
-		if (ret)
+		ret = dtree_cronus_parse(ctx, index, buf, value);
+		if (ret) {
+			fprintf(stderr, "Invalid line %d in cronus dump\n", lineno);
 			break;
+		}
 	}
 
 	free(buf);
+	free(value);
+	dtree_cronus_index_free(index);
 	return ret;
 }
 
@@ -115,3 +410,423 @@ int dtree_cronus_import(const char *dtb_path,
 	return dtree_import(dtb_path, infodb_path, cronus_import_parse, &state);
 }
 
+/*
+ * Parallel import
+ *
+ * The dump is split into sections, each starting at a target line (except
+ * the first one).  Workers parse the sections into lists of updates, and
+ * the updates are then applied in the order of the dump, so the result is
+ * the same as the serial import.  Nothing is written if any of the lines is
+ * invalid.
+ */
+struct cronus_update {
+	struct dtm_node *node;
+	struct dtree_attr *attr;	/* NULL to (re)set the current node */
+	int index;
+	size_t value;			/* offset of the element in section values */
+};
+
+struct cronus_section {
+	const char *start;
+	const char *end;
+	struct cronus_update *update;
+	int count, allocated;
+	uint8_t *value;
+	size_t value_len, value_allocated;
+	int lines;
+	int error;			/* line number within section, 0 if none */
+};
+
+struct cronus_import_parallel_state {
+	FILE *fp;
+	int nthreads;
+	struct dtree_infodb *infodb;
+	struct dtm_node *root;
+	struct dtree_cronus_index *index;
+	struct cronus_section *section;
+	int count;
+	int next;
+	pthread_mutex_t lock;
+};
+
+/* Sections per thread, so that workers are evenly loaded */
+#define CRONUS_SECTIONS_PER_THREAD	8
+
+static bool cronus_section_add(struct cronus_section *sec,
+			       struct dtm_node *node,
+			       struct dtree_attr *attr,
+			       int index,
+			       const uint8_t *value)
+{
+	if (sec->count == sec->allocated) {
+		struct cronus_update *update;
+		int n = sec->allocated ? sec->allocated * 2 : 256;
+
+		update = reallocarray(sec->update, n, sizeof(struct cronus_update));
+		if (!update)
+			return false;
+
+		sec->update = update;
+		sec->allocated = n;
+	}
+
+	sec->update[sec->count] = (struct cronus_update) {
+		.node = node,
+		.attr = attr,
+		.index = index,
+		.value = sec->value_len,
+	};
+	sec->count += 1;
+
+	if (!attr)
+		return true;
+
+	if (sec->value_len + attr->elem_size > sec->value_allocated) {
+		uint8_t *buf;
+		size_t n = sec->value_allocated ? sec->value_allocated * 2 : 4096;
+
+		while (n < sec->value_len + attr->elem_size)
+			n *= 2;
+
+		buf = realloc(sec->value, n);
+		if (!buf)
+			return false;
+
+		sec->value = buf;
+		sec->value_allocated = n;
+	}
+
+	memcpy(sec->value + sec->value_len, value, attr->elem_size);
+	sec->value_len += attr->elem_size;
+	return true;
+}
+
+static void cronus_import_section(struct cronus_import_parallel_state *pstate,
+				  struct cronus_section *sec,
+				  char **line, size_t *line_len,
+				  uint8_t *value)
+{
+	struct dtm_node *node = NULL;
+	struct dtree_attr *attr;
+	const char *ptr, *eol;
+	size_t n;
+	int index, ret;
+
+	for (ptr = sec->start; ptr < sec->end; ptr = eol + 1) {
+		eol = memchr(ptr, '\n', sec->end - ptr);
+		if (!eol)
+			eol = sec->end;
+
+		sec->lines += 1;
+
+		/* Tokenizing modifies the line, so work on a copy */
+		n = eol - ptr;
+		if (n + 1 > *line_len) {
+			char *buf;
+
+			buf = realloc(*line, n + 1);
+			if (!buf)
+				goto fail;
+
+			*line = buf;
+			*line_len = n + 1;
+		}
+		memcpy(*line, ptr, n);
+		(*line)[n] = '\0';
+
+		/* Skip empty lines */
+		if (strlen(*line) < 6)
+			continue;
+
+		if (strncmp(*line, "target", 6) == 0) {
+			if (dtree_cronus_parse_target(pstate->index, pstate->root, *line, &node))
+				goto fail;
+
+			if (!cronus_section_add(sec, node, NULL, 0, NULL))
+				goto fail;
+
+			continue;
+		}
+
+		if (!node)
+			goto fail;
+
+		ret = dtree_cronus_parse_attr(pstate->infodb, node, *line, &attr, &index, value);
+		if (ret < 0)
+			goto fail;
+		if (ret == CRONUS_PARSE_SKIP)
+			continue;
+		if (ret == CRONUS_PARSE_MISSING)
+			attr = NULL;
+
+		if (!cronus_section_add(sec, node, attr, index, value))
+			goto fail;
+	}
+
+	return;
+
+fail:
+	sec->error = sec->lines;
+}
+
+static void *cronus_import_worker(void *arg)
+{
+	struct cronus_import_parallel_state *pstate = (struct cronus_import_parallel_state *)arg;
+	uint8_t *value;
+	char *line = NULL;
+	size_t line_len = 0;
+	int i;
+
+	value = malloc(pstate->infodb->value_max > 0 ? pstate->infodb->value_max : 1);
+
+	while (1) {
+		pthread_mutex_lock(&pstate->lock);
+		i = pstate->next;
+		if (i < pstate->count)
+			pstate->next += 1;
+		pthread_mutex_unlock(&pstate->lock);
+
+		if (i >= pstate->count)
+			break;
+
+		if (!value) {
+			pstate->section[i].error = 1;
+			continue;
+		}
+
+		cronus_import_section(pstate, &pstate->section[i], &line, &line_len, value);
+	}
+
+	free(line);
+	free(value);
+	return NULL;
+}
+
+/*
+ * Map the rest of the dump file, or read it if it cannot be mapped (e.g.
+ * a pipe).  Returns the length of the mapping in *map_len, 0 if read.
+ */
+static char *cronus_import_load(FILE *fp, size_t *len, size_t *map_len)
+{
+	struct stat st;
+	char *buf, *ptr;
+	off_t offset;
+	size_t allocated, n;
+	int fd;
+
+	*map_len = 0;
+
+	fd = fileno(fp);
+	offset = ftello(fp);
+	if (fd >= 0 && offset == 0 && fstat(fd, &st) == 0 &&
+	    S_ISREG(st.st_mode) && st.st_size > 0) {
+		buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (buf != MAP_FAILED) {
+			madvise(buf, st.st_size, MADV_SEQUENTIAL);
+			*len = st.st_size;
+			*map_len = st.st_size;
+			return buf;
+		}
+	}
+
+	allocated = 1024 * 1024;
+	buf = malloc(allocated);
+	if (!buf)
+		return NULL;
+
+	*len = 0;
+	while ((n = fread(buf + *len, 1, allocated - *len, fp)) > 0) {
+		*len += n;
+		if (*len < allocated)
+			continue;
+
+		ptr = realloc(buf, allocated * 2);
+		if (!ptr) {
+			free(buf);
+			return NULL;
+		}
+
+		buf = ptr;
+		allocated *= 2;
+	}
+
+	if (ferror(fp)) {
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+/* Find the next line starting with "target", returns the preceding newline */
+static const char *cronus_next_target(const char *ptr, const char *end)
+{
+	while ((ptr = memchr(ptr, '\n', end - ptr)) != NULL) {
+		if (end - ptr > 6 && strncmp(ptr + 1, "target", 6) == 0)
+			return ptr;
+		ptr++;
+	}
+
+	return NULL;
+}
+
+/* Split the dump at target lines into sections of roughly equal size */
+static int cronus_import_split(const char *data, size_t len, int nsections,
+			       struct cronus_section **out)
+{
+	struct cronus_section *section;
+	const char *ptr, *end = data + len, *next;
+	size_t size;
+	int count = 0;
+
+	section = calloc(nsections, sizeof(struct cronus_section));
+	if (!section)
+		return -1;
+
+	size = len / nsections + 1;
+	ptr = data;
+
+	while (ptr < end) {
+		next = NULL;
+		if (count < nsections - 1 && (size_t)(end - ptr) > size)
+			next = cronus_next_target(ptr + size - 1, end);
+
+		section[count] = (struct cronus_section) {
+			.start = ptr,
+			.end = next ? next : end,
+		};
+		count++;
+
+		if (!next)
+			break;
+
+		ptr = next + 1;
+	}
+
+	*out = section;
+	return count;
+}
+
+static int cronus_import_apply(void *ctx, struct cronus_section *sec)
+{
+	struct cronus_update *u;
+	int i;
+
+	for (i=0; i<sec->count; i++) {
+		u = &sec->update[i];
+
+		if (!u->attr) {
+			dtree_import_set_node(u->node, ctx);
+			continue;
+		}
+
+		if (dtree_cronus_import_value(ctx, u->attr, u->index, sec->value + u->value))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int cronus_import_parallel_parse(void *ctx, void *priv)
+{
+	struct cronus_import_parallel_state *pstate = (struct cronus_import_parallel_state *)priv;
+	pthread_t *thread = NULL;
+	char *data;
+	size_t len, map_len;
+	int started, lineno, i, ret = -1;
+
+	/* Nothing is written till all the updates are applied */
+	dtree_import_defer(ctx);
+
+	pstate->infodb = dtree_import_infodb(ctx);
+	pstate->root = dtree_import_root(ctx);
+
+	data = cronus_import_load(pstate->fp, &len, &map_len);
+	if (!data)
+		return -1;
+
+	pstate->index = dtree_cronus_index_new(pstate->root);
+	if (!pstate->index)
+		goto fail_index;
+
+	pstate->count = cronus_import_split(data, len,
+					    pstate->nthreads * CRONUS_SECTIONS_PER_THREAD,
+					    &pstate->section);
+	if (pstate->count < 0)
+		goto fail_split;
+
+	thread = calloc(pstate->nthreads, sizeof(pthread_t));
+	if (!thread)
+		goto done;
+
+	pstate->next = 0;
+	pthread_mutex_init(&pstate->lock, NULL);
+
+	for (started=0; started<pstate->nthreads; started++) {
+		if (pthread_create(&thread[started], NULL, cronus_import_worker, pstate) != 0)
+			break;
+	}
+
+	/* If no thread could be started, do all the work here */
+	if (started == 0)
+		cronus_import_worker(pstate);
+
+	for (i=0; i<started; i++)
+		pthread_join(thread[i], NULL);
+
+	pthread_mutex_destroy(&pstate->lock);
+
+	/* Report the first invalid line of the dump */
+	lineno = 0;
+	for (i=0; i<pstate->count; i++) {
+		if (pstate->section[i].error) {
+			fprintf(stderr, "Invalid line %d in cronus dump\n",
+				lineno + pstate->section[i].error);
+			goto done;
+		}
+		lineno += pstate->section[i].lines;
+	}
+
+	for (i=0; i<pstate->count; i++) {
+		if (cronus_import_apply(ctx, &pstate->section[i]))
+			goto done;
+	}
+
+	ret = 0;
+
+done:
+	for (i=0; i<pstate->count; i++) {
+		free(pstate->section[i].update);
+		free(pstate->section[i].value);
+	}
+	free(pstate->section);
+	free(thread);
+
+fail_split:
+	dtree_cronus_index_free(pstate->index);
+
+fail_index:
+	if (map_len)
+		munmap(data, map_len);
+	else
+		free(data);
+	return ret;
+}
+
+int dtree_cronus_import_parallel(const char *dtb_path,
+				 const char *infodb_path,
+				 FILE *fp,
+				 int nthreads)
+{
+	struct cronus_import_parallel_state pstate;
+
+	if (nthreads <= 1)
+		return dtree_cronus_import(dtb_path, infodb_path, fp);
+
+	pstate = (struct cronus_import_parallel_state) {
+		.fp = fp,
+		.nthreads = nthreads,
+	};
+
+	return dtree_import(dtb_path, infodb_path, cronus_import_parallel_parse, &pstate);
+}
@@ -17,12 +17,48 @@
 #ifndef __DTREE_CRONUS_H__
 #define __DTREE_CRONUS_H__
 
+#include <stdint.h>
+
+struct dtree_attr;
+struct dtree_buf;
+struct dtree_cronus_index;
+struct dtree_export_ctx;
+struct dtree_infodb;
+struct dtm_file;
+struct dtm_image;
+struct dtm_node;
+
+/* Return values of dtree_cronus_parse_attr() for the lines to be skipped */
+#define CRONUS_PARSE_SKIP	1
+#define CRONUS_PARSE_MISSING	2
+
+struct dtree_cronus_index *dtree_cronus_index_new(struct dtm_node *root);
+struct dtm_node *dtree_cronus_index_lookup(struct dtree_cronus_index *index, const char *name);
+const char *dtree_cronus_index_target(struct dtree_cronus_index *index,
+				      const struct dtm_node *node);
+void dtree_cronus_index_free(struct dtree_cronus_index *index);
+
 struct dtm_node *dtree_from_cronus_target(struct dtm_node *root, const char *name);
 char *dtree_to_cronus_target(const struct dtm_node *root, struct dtm_node *node);
+int dtree_cronus_file_offset(struct dtm_file *dfile, const char *name);
+int dtree_cronus_image_offset(struct dtm_image *img, const char *name);
+
+void dtree_cronus_buf_print_node(const char *target, struct dtree_buf *buf);
+void dtree_cronus_buf_print_attr(const struct dtree_attr *attr, struct dtree_buf *buf);
 
-void dtree_cronus_print_node(const char *target, FILE *fp);
-void dtree_cronus_print_attr(const struct dtree_attr *attr, FILE *fp);
+int dtree_cronus_export_ctx(struct dtree_export_ctx *ctx, FILE *fp);
 
-int dtree_cronus_parse(void *ctx, char *buf);
+int dtree_cronus_parse_target(struct dtree_cronus_index *index,
+			      struct dtm_node *root,
+			      char *line,
+			      struct dtm_node **node);
+int dtree_cronus_parse_attr(struct dtree_infodb *infodb,
+			    struct dtm_node *node,
+			    char *line,
+			    struct dtree_attr **attr,
+			    int *index,
+			    uint8_t *value);
+int dtree_cronus_import_value(void *ctx, struct dtree_attr *attr, int index, const uint8_t *value);
+int dtree_cronus_parse(void *ctx, struct dtree_cronus_index *index, char *buf, uint8_t *value);
 
 #endif /* __DTREE_CRONUS_H__ */
@@ -17,12 +17,16 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <inttypes.h>
 #include <assert.h>
 
+#include "libdtm/dtm.h"
+
 #include "dtree.h"
 #include "dtree_attr.h"
+#include "dtree_buf.h"
 #include "dtree_cronus.h"
+#include "dtree_import.h"
+#include "dtree_infodb.h"
 
 struct {
 	enum dtree_attr_type type;
@@ -65,26 +69,22 @@ static const char *attr_type_to_cronus_string(uint8_t type)
 	return "<NULL>";
 }
 
-static void cronus_print_single_num(FILE *fp, uint8_t *ptr, int elem_size)
+static void cronus_print_single_num(struct dtree_buf *buf, uint8_t *ptr, int elem_size)
 {
 	if (elem_size == 1) {
-		uint8_t val = *ptr;
-		fprintf(fp, "0x%02x", val);
+		dtree_buf_hex(buf, *ptr, 1);
 	} else if (elem_size == 2) {
-		uint16_t val = *(uint16_t *)ptr;
-		fprintf(fp, "0x%04x", val);
+		dtree_buf_hex(buf, *(uint16_t *)ptr, 2);
 	} else if (elem_size == 4) {
-		uint32_t val = *(uint32_t *)ptr;
-		fprintf(fp, "0x%08x", val);
+		dtree_buf_hex(buf, *(uint32_t *)ptr, 4);
 	} else if (elem_size == 8) {
-		uint64_t val = *(uint64_t *)ptr;
-		fprintf(fp, "0x%016" PRIx64, val);
+		dtree_buf_hex(buf, *(uint64_t *)ptr, 8);
 	} else {
 		assert(0);
 	}
 }
 
-static void cronus_print_single(FILE *fp, const struct dtree_attr *attr, uint8_t *ptr)
+static void cronus_print_single(struct dtree_buf *buf, const struct dtree_attr *attr, uint8_t *ptr)
 {
 	int count = 1, i;
 
@@ -109,15 +109,15 @@ static void cronus_print_single(FILE *fp, const struct dtree_attr *attr, uint8_t
 	}
 
 	for (i=0; i<count; i++) {
-		cronus_print_single_num(fp, ptr, attr->elem_size);
+		cronus_print_single_num(buf, ptr, attr->elem_size);
 		ptr += attr->elem_size;
 
 		if (i < count-1)
-			fprintf(fp, " ");
+			dtree_buf_putc(buf, ' ');
 	}
 }
 
-static bool cronus_print_enum(FILE *fp, const struct dtree_attr *attr, uint8_t *ptr)
+static bool cronus_print_enum(struct dtree_buf *buf, const struct dtree_attr *attr, uint8_t *ptr)
 {
 	uint64_t val = 0;
 	int count = 1, i, j;
@@ -149,27 +149,27 @@ static bool cronus_print_enum(FILE *fp, const struct dtree_attr *attr, uint8_t *
 			struct dtree_attr_enum *ae = &attr->aenum[j];
 
 			if (ae->value == val) {
-				fprintf(fp, "%s", ae->key);
+				dtree_buf_puts(buf, ae->key);
 				found = true;
 				break;
 			}
 		}
 		if (!found) {
-			fprintf(fp, "UNKNOWN_ENUM (");
-			cronus_print_single_num(fp, ptr, attr->elem_size);
-			fprintf(fp, ")");
+			dtree_buf_puts(buf, "UNKNOWN_ENUM (");
+			cronus_print_single_num(buf, ptr, attr->elem_size);
+			dtree_buf_putc(buf, ')');
 		}
 
 		ptr += attr->elem_size;
 
 		if (i < count-1)
-			fprintf(fp, " ");
+			dtree_buf_putc(buf, ' ');
 	}
 
 	return true;
 }
 
-void cronus_print_string(FILE *fp, const struct dtree_attr *attr, uint8_t *ptr)
+void cronus_print_string(struct dtree_buf *buf, const struct dtree_attr *attr, uint8_t *ptr)
 {
 	int count = 1, i;
 
@@ -179,15 +179,17 @@ void cronus_print_string(FILE *fp, const struct dtree_attr *attr, uint8_t *ptr)
 	}
 
 	for (i=0; i<count; i++) {
-		fprintf(fp, "\"%.*s\"", attr->elem_size, (char *)ptr);
+		dtree_buf_putc(buf, '"');
+		dtree_buf_put(buf, (char *)ptr, strnlen((char *)ptr, attr->elem_size));
+		dtree_buf_putc(buf, '"');
 		ptr += attr->elem_size;
 
 		if (i < count-1)
-			fprintf(fp, " ");
+			dtree_buf_putc(buf, ' ');
 	}
 }
 
-void cronus_print_complex(FILE *fp, const struct dtree_attr *attr, uint8_t *ptr)
+void cronus_print_complex(struct dtree_buf *buf, const struct dtree_attr *attr, uint8_t *ptr)
 {
 	int count = 1, i, j;
 
@@ -202,154 +204,165 @@ void cronus_print_complex(FILE *fp, const struct dtree_attr *attr, uint8_t *ptr)
 		for (j=0; j<n; j++) {
 			int elem_size = attr->spec[j] - '0';
 
-			cronus_print_single_num(fp, ptr, elem_size);
+			cronus_print_single_num(buf, ptr, elem_size);
 			ptr += elem_size;
 
 			if (j < n-1)
-				fprintf(fp, " ");
+				dtree_buf_putc(buf, ' ');
 		}
 
 		if (i < count-1)
-			fprintf(fp, " ");
+			dtree_buf_putc(buf, ' ');
 	}
 }
 
-static void cronus_print_node(FILE *fp, const char *node)
+static void cronus_print_node(struct dtree_buf *buf, const char *node)
 {
-	fprintf(fp, "target = %s\n", node);
+	dtree_buf_puts(buf, "target = ");
+	dtree_buf_puts(buf, node);
+	dtree_buf_putc(buf, '\n');
 }
 
-static void cronus_print_data_type(FILE *fp, const struct dtree_attr *attr)
+static void cronus_print_data_type(struct dtree_buf *buf, const struct dtree_attr *attr)
 {
-	fprintf(fp, "%s", attr_type_to_cronus_string(attr->type));
+	dtree_buf_puts(buf, attr_type_to_cronus_string(attr->type));
 	if (attr->enum_count > 0) {
-		fprintf(fp, "e");
+		dtree_buf_putc(buf, 'e');
 	}
 }
 
-static void cronus_print_value(FILE *fp, const struct dtree_attr *attr, uint8_t *value)
+static void cronus_print_value(struct dtree_buf *buf, const struct dtree_attr *attr, uint8_t *value)
 {
 	if (attr->type == DTREE_ATTR_TYPE_COMPLEX) {
-		cronus_print_complex(fp, attr, value);
+		cronus_print_complex(buf, attr, value);
 	} else if (attr->type == DTREE_ATTR_TYPE_STRING) {
-		cronus_print_string(fp, attr, value);
+		cronus_print_string(buf, attr, value);
 	} else {
-		if (!cronus_print_enum(fp, attr, value))
-			cronus_print_single(fp, attr, value);
+		if (!cronus_print_enum(buf, attr, value))
+			cronus_print_single(buf, attr, value);
 	}
 }
 
-static void cronus_print_scalar(FILE *fp, const struct dtree_attr *attr)
+static void cronus_print_scalar(struct dtree_buf *buf, const struct dtree_attr *attr)
 {
-	fprintf(fp, "%s", attr->name);
-	fprintf(fp, "    ");
-	cronus_print_data_type(fp, attr);
-	fprintf(fp, "    ");
-	cronus_print_value(fp, attr, attr->value);
-	fprintf(fp, "\n");
+	dtree_buf_puts(buf, attr->name);
+	dtree_buf_puts(buf, "    ");
+	cronus_print_data_type(buf, attr);
+	dtree_buf_puts(buf, "    ");
+	cronus_print_value(buf, attr, attr->value);
+	dtree_buf_putc(buf, '\n');
 }
 
-static void cronus_print_array1(FILE *fp, const struct dtree_attr *attr)
+static void cronus_print_index(struct dtree_buf *buf, int value)
 {
-	uint8_t *ptr = attr->value;
-	int i;
-
-	for (i=0; i<attr->dim[0]; i++) {
-		fprintf(fp, "%s", attr->name);
-		fprintf(fp, "[%d]", i);
-		fprintf(fp, " ");
-		cronus_print_data_type(fp, attr);
-		fprintf(fp, "[%d]", attr->dim[0]);
-		fprintf(fp, " ");
-		cronus_print_value(fp, attr, ptr);
-		ptr += attr->elem_size;
-		fprintf(fp, "\n");
-	}
+	dtree_buf_putc(buf, '[');
+	dtree_buf_dec(buf, value);
+	dtree_buf_putc(buf, ']');
 }
 
-static void cronus_print_array2(FILE *fp, const struct dtree_attr *attr)
+/*
+ * Every element of an array is printed as
+ *
+ *   NAME[i][j] TYPE[dim0][dim1] VALUE
+ *
+ * Only the index and the value change, so " TYPE[dim0][dim1] " is formatted
+ * once per attribute.
+ */
+static void cronus_print_array(struct dtree_buf *buf, const struct dtree_attr *attr)
 {
+	struct dtree_buf type;
 	uint8_t *ptr = attr->value;
+	size_t name_len;
+	int idx[3] = { 0, 0, 0 };
 	int i, j;
 
-	for (i=0; i<attr->dim[0]; i++) {
-	for (j=0; j<attr->dim[1]; j++) {
-		fprintf(fp, "%s", attr->name);
-		fprintf(fp, "[%d][%d]", i, j);
-		fprintf(fp, " ");
-		cronus_print_data_type(fp, attr);
-		fprintf(fp, "[%d][%d]", attr->dim[0], attr->dim[1]);
-		fprintf(fp, " ");
-		cronus_print_value(fp, attr, ptr);
-		ptr += attr->elem_size;
-		fprintf(fp, "\n");
-	}
+	dtree_buf_init(&type, NULL);
+	dtree_buf_putc(&type, ' ');
+	cronus_print_data_type(&type, attr);
+	for (j=0; j<attr->dim_count; j++)
+		cronus_print_index(&type, attr->dim[j]);
+	dtree_buf_putc(&type, ' ');
+
+	if (type.error) {
+		buf->error = true;
+		goto done;
 	}
-}
 
-static void cronus_print_array3(FILE *fp, const struct dtree_attr *attr)
-{
-	uint8_t *ptr = attr->value;
-	int i, j, k;
-
-	for (i=0; i<attr->dim[0]; i++) {
-	for (j=0; j<attr->dim[1]; j++) {
-	for (k=0; k<attr->dim[2]; k++) {
-		fprintf(fp, "%s", attr->name);
-		fprintf(fp, "[%d][%d][%d]", i, j, k);
-		fprintf(fp, " ");
-		cronus_print_data_type(fp, attr);
-		fprintf(fp, "[%d][%d][%d]", attr->dim[0], attr->dim[1], attr->dim[2]);
-		fprintf(fp, " ");
-		cronus_print_value(fp, attr, ptr);
+	name_len = strlen(attr->name);
+
+	for (i=0; i<attr->count; i++) {
+		dtree_buf_put(buf, attr->name, name_len);
+		for (j=0; j<attr->dim_count; j++)
+			cronus_print_index(buf, idx[j]);
+		dtree_buf_put(buf, type.data, type.len);
+		cronus_print_value(buf, attr, ptr);
 		ptr += attr->elem_size;
-		fprintf(fp, "\n");
-	}
-	}
+		dtree_buf_putc(buf, '\n');
+
+		/* Last index changes fastest */
+		for (j=attr->dim_count-1; j>=0; j--) {
+			idx[j] += 1;
+			if (idx[j] < attr->dim[j])
+				break;
+			idx[j] = 0;
+		}
 	}
+
+done:
+	dtree_buf_free(&type);
 }
 
-void dtree_cronus_print_node(const char *target, FILE *fp)
+void dtree_cronus_buf_print_node(const char *target, struct dtree_buf *buf)
 {
-	cronus_print_node(fp, target);
+	uint64_t start = dtm_stats_start();
+
+	cronus_print_node(buf, target);
+	dtm_stats_stop(DTM_STATS_FORMAT, start);
 }
 
-void dtree_cronus_print_attr(const struct dtree_attr *attr, FILE *fp)
+void dtree_cronus_buf_print_attr(const struct dtree_attr *attr, struct dtree_buf *buf)
 {
+	uint64_t start;
+
 	if (attr->type == DTREE_ATTR_TYPE_UNKNOWN)
 		return;
 
+	start = dtm_stats_start();
+
 	switch (attr->dim_count) {
 	case 0:
-		cronus_print_scalar(fp, attr);
+		cronus_print_scalar(buf, attr);
 		break;
 
 	case 1:
-		cronus_print_array1(fp, attr);
-		break;
-
 	case 2:
-		cronus_print_array2(fp, attr);
-		break;
-
 	case 3:
-		cronus_print_array3(fp, attr);
+		cronus_print_array(buf, attr);
 		break;
 	}
+
+	dtm_stats_stop(DTM_STATS_FORMAT, start);
 }
 
-static int cronus_parse_target(void *ctx, char *line)
+/*
+ * Find the node of a target line, "target = <cronus-target>"
+ *
+ * Returns 0 on success, -1 if the line is invalid or the target is not found.
+ */
+int dtree_cronus_parse_target(struct dtree_cronus_index *index,
+			      struct dtm_node *root,
+			      char *line,
+			      struct dtm_node **node)
 {
-	struct dtm_node *node, *root;
-	char *tok, *ptr;
+	char *tok, *ptr, *saveptr = NULL;
 
-	dtree_import_set_node(NULL, ctx);
+	*node = NULL;
 
-	tok = strtok(line, "=");
+	tok = strtok_r(line, "=", &saveptr);
 	if (!tok)
 		return -1;
 
-	tok = strtok(NULL, "=");
+	tok = strtok_r(NULL, "=", &saveptr);
 	if (!tok)
 		return -1;
 
@@ -357,53 +370,67 @@ static int cronus_parse_target(void *ctx, char *line)
 	while (*ptr == ' ')
 		ptr++;
 
-	root = dtree_import_root(ctx);
-	node = dtree_from_cronus_target(root, ptr);
-	if (!node)
+	if (index)
+		*node = dtree_cronus_index_lookup(index, ptr);
+	else
+		*node = dtree_from_cronus_target(root, ptr);
+	if (!*node)
 		return -1;
 
-	dtree_import_set_node(node, ctx);
 	return 0;
 }
 
-static int cronus_parse_attr(void *ctx, char *line)
+/*
+ * Parse an attribute line for the node into the attribute information from
+ * infodb, the index of the element and the value of the element.  The value
+ * buffer must be large enough for an element of any attribute.  Only
+ * reentrant tokenizing is used, so lines can be parsed in parallel.
+ *
+ * Returns 0 on success, -1 if the line is invalid, and for the lines to be
+ * skipped CRONUS_PARSE_SKIP if it is not an attribute, CRONUS_PARSE_MISSING
+ * if the attribute is not in device tree.
+ */
+int dtree_cronus_parse_attr(struct dtree_infodb *infodb,
+			    struct dtm_node *node,
+			    char *line,
+			    struct dtree_attr **out,
+			    int *out_index,
+			    uint8_t *value)
 {
-	struct dtm_node *node;
 	struct dtree_attr *attr;
 	enum dtree_attr_type type;
 	char *attr_name, *data_type;
-	char *tok, *saveptr = NULL;
+	char *tok, *saveptr = NULL, *saveptr2 = NULL;
 	uint8_t *ptr;
 	int dim_count, count, index;
 	int idx[3] = { -1, -1, -1 };
 	int dim[3] = { -1, -1, -1 };
-	int i, ret;
+	int i;
 	bool is_enum = false;
 
-	node = dtree_import_node(ctx);
-	if (!node)
-		return -1;
-
 	/* attribute name */
 	tok = strtok_r(line, " ", &saveptr);
 	if (!tok)
 		return -1;
 
-	attr_name = strtok(tok, "[");
+	attr_name = strtok_r(tok, "[", &saveptr2);
 	if (!attr_name)
 		return -1;
 
 	/* Skip properties that don't begin with "ATTR" */
 	if (strlen(attr_name) < 4 || strncmp(attr_name, "ATTR", 4))
-		return 0;
+		return CRONUS_PARSE_SKIP;
 
 	/* Skip attributes that are not in device tree */
-	ret = dtree_import_attr(attr_name, ctx, &attr);
-	if (ret != 0)
-		return 0;
+	attr = dtree_infodb_attr(infodb, attr_name);
+	if (!attr)
+		return CRONUS_PARSE_MISSING;
+
+	if (!dtm_node_get_property(node, attr_name))
+		return CRONUS_PARSE_MISSING;
 
 	for (i=0; i<3; i++) {
-		tok = strtok(NULL, "[");
+		tok = strtok_r(NULL, "[", &saveptr2);
 		if (!tok)
 			break;
 
@@ -417,7 +444,7 @@ static int cronus_parse_attr(void *ctx, char *line)
 	if (!tok)
 		return -1;
 
-	data_type = strtok(tok, "[");
+	data_type = strtok_r(tok, "[", &saveptr2);
 	if (!data_type)
 		return -1;
 
@@ -427,7 +454,7 @@ static int cronus_parse_attr(void *ctx, char *line)
 	}
 
 	for (i=0; i<3; i++) {
-		tok = strtok(NULL, "[");
+		tok = strtok_r(NULL, "[", &saveptr2);
 		if (!tok)
 			break;
 
@@ -473,8 +500,7 @@ static int cronus_parse_attr(void *ctx, char *line)
 			idx[2];
 	}
 
-	ptr = attr->value + index * attr->elem_size;
-	ret = -1;
+	ptr = value;
 
 	/* attribute value */
 	if (attr->type == DTREE_ATTR_TYPE_COMPLEX) {
@@ -520,22 +546,76 @@ static int cronus_parse_attr(void *ctx, char *line)
 		}
 	}
 
+	*out = attr;
+	*out_index = index;
+	return 0;
+}
+
+/* Update an element of the attribute of the current node */
+int dtree_cronus_import_value(void *ctx, struct dtree_attr *attr, int index, const uint8_t *value)
+{
+	struct dtree_attr *current;
+
+	if (dtree_import_attr(attr->name, ctx, &current) != 0)
+		return -1;
+
+	memcpy(current->value + index * attr->elem_size, value, attr->elem_size);
 	return dtree_import_attr_update(ctx);
 }
 
-int dtree_cronus_parse(void *ctx, char *buf)
+static int cronus_parse_target(void *ctx, struct dtree_cronus_index *index, char *line)
 {
+	struct dtm_node *node;
+
+	dtree_import_set_node(NULL, ctx);
+
+	if (dtree_cronus_parse_target(index, dtree_import_root(ctx), line, &node))
+		return -1;
+
+	dtree_import_set_node(node, ctx);
+	return 0;
+}
+
+static int cronus_parse_attr(void *ctx, char *line, uint8_t *value)
+{
+	struct dtm_node *node;
+	struct dtree_attr *attr;
+	int index, ret;
+
+	node = dtree_import_node(ctx);
+	if (!node)
+		return -1;
+
+	ret = dtree_cronus_parse_attr(dtree_import_infodb(ctx), node, line, &attr, &index, value);
+	if (ret < 0)
+		return -1;
+	if (ret == CRONUS_PARSE_SKIP)
+		return 0;
+
+	/* Looking up a missing attribute drops the partially updated value */
+	if (ret == CRONUS_PARSE_MISSING)
+		return dtree_import_set_node(node, ctx);
+
+	return dtree_cronus_import_value(ctx, attr, index, value);
+}
+
+int dtree_cronus_parse(void *ctx, struct dtree_cronus_index *index, char *buf, uint8_t *value)
+{
+	uint64_t start;
 	int ret;
 
 	/* Skip empty lines */
 	if (strlen(buf) < 6)
 		return 0;
 
+	start = dtm_stats_start();
+
 	if (strncmp(buf, "target", 6) == 0) {
-		ret = cronus_parse_target(ctx, buf);
+		ret = cronus_parse_target(ctx, index, buf);
 	} else {
-		ret = cronus_parse_attr(ctx, buf);
+		ret = cronus_parse_attr(ctx, buf, value);
 	}
 
+	dtm_stats_stop(DTM_STATS_FORMAT, start);
 	return ret;
 }
@@ -19,8 +19,10 @@
 #include <string.h>
 #include <assert.h>
 #include <ctype.h>
+#include <endian.h>
 
 #include "libdtm/dtm.h"
+#include "libdtm/dtm_hash.h"
 
 #include "config.h"
 #include "dtree.h"
@@ -56,7 +58,7 @@ static void cronus_target_init(struct cronus_target *ct)
  */
 static bool split_cronus_target(char *name, struct cronus_target *ct)
 {
-	char *tok, *saveptr = NULL;
+	char *tok, *saveptr = NULL, *saveptr2 = NULL;
 
 	cronus_target_init(ct);
 
@@ -66,21 +68,18 @@ static bool split_cronus_target(char *name, struct cronus_target *ct)
 
 	/* chip.hwunit */
 	if (tok[0] == 'p') {
-		tok = strtok(tok, ".");
+		tok = strtok_r(tok, ".", &saveptr2);
 		if (!tok)
 			return false;
 
 		if (strcmp(tok, PCHIP) != 0)
 			return false;
 
-		ct->chip_name = strdup(tok);
-		assert(ct->chip_name);
+		ct->chip_name = tok;
 
-		tok = strtok(NULL, ".");
-		if (tok) {
-			ct->class_name = strdup(tok);
-			assert(ct->class_name);
-		}
+		tok = strtok_r(NULL, ".", &saveptr2);
+		if (tok)
+			ct->class_name = tok;
 
 		tok = strtok_r(NULL, ":", &saveptr);
 		if (!tok)
@@ -175,153 +174,617 @@ done:
 	return true;
 }
 
-struct match_by_class {
-	struct cronus_target *ct;
-	struct dtm_node *match;
+/*
+ * Cronus target index
+ *
+ * All the nodes of the tree are recorded in a single top-down traversal.
+ * Each node inherits the chip position (index of proc) and the index from
+ * its parent, so no lookups up the tree are required.  Nodes which have a
+ * cronus target are hashed by (class, chip position, chip unit) and by the
+ * canonical cronus target string.
+ */
+struct cronus_index_entry {
+	struct dtm_node *node;
+	int class_id;
+	int chip_position;
+	int chip_unit;
+	int index;
+	int target;
 };
 
-static int match_node_by_class(struct dtm_node *node, void *priv)
+struct dtree_cronus_index {
+	struct dtm_node *root;
+
+	struct cronus_index_entry *entry;
+	int count, allocated;
+
+	/* Ancestors of the node being added */
+	int *stack;
+	int depth, stack_allocated;
+
+	/* Target strings */
+	char *arena;
+	size_t arena_len, arena_size;
+
+	/* Hash tables of entry numbers, -1 for empty slot */
+	int *by_node;
+	int *by_unit;
+	int *by_target;
+	uint32_t mask;
+};
+
+static uint32_t cronus_index_hash_unit(int class_id, int chip_position, int chip_unit)
 {
-	struct match_by_class *state = (struct match_by_class *)priv;
-	const char *name, *cronus_class;
-	char *dtree_class;
-	uint32_t index;
+	int key[3] = { class_id, chip_position, chip_unit };
 
-	name = dtm_node_name(node);
-	dtree_class = dtree_name_to_class(name);
-	assert(dtree_class);
+	return dtm_hash32(DTM_HASH32_INIT, key, sizeof(key));
+}
 
-	cronus_class = dtree_to_cronus_class(dtree_class);
-	free(dtree_class);
+static uint32_t cronus_index_hash_target(const char *target)
+{
+	return dtm_hash32(DTM_HASH32_INIT, target, strlen(target));
+}
 
-	if (!cronus_class)
-		return 0;
+static uint32_t cronus_index_hash_node(const struct dtm_node *node)
+{
+	uint64_t key = (uintptr_t)node;
 
-	if (strcmp(cronus_class, state->ct->class_name) != 0)
-		return 0;
+	return (key * 0x9e3779b97f4a7c15ULL) >> 32;
+}
 
-	index = dtm_node_index(node);
-	if (index == state->ct->chip_unit) {
-		state->match = node;
-		return 1;
+static bool cronus_index_grow(struct dtree_cronus_index *index)
+{
+	struct cronus_index_entry *entry;
+	int *stack;
+
+	if (index->count == index->allocated) {
+		int n = index->allocated ? index->allocated * 2 : 256;
+
+		entry = realloc(index->entry, n * sizeof(struct cronus_index_entry));
+		if (!entry)
+			return false;
+
+		index->entry = entry;
+		index->allocated = n;
 	}
 
-	return 0;
+	if (index->depth == index->stack_allocated) {
+		int n = index->stack_allocated ? index->stack_allocated * 2 : 16;
+
+		stack = realloc(index->stack, n * sizeof(int));
+		if (!stack)
+			return false;
+
+		index->stack = stack;
+		index->stack_allocated = n;
+	}
+
+	return true;
+}
+
+static int cronus_index_add_target(struct dtree_cronus_index *index, struct cronus_index_entry *e)
+{
+	struct cronus_target ct;
+	char cname[128];
+	size_t len;
+	int offset;
+
+	cronus_target_init(&ct);
+
+	ct.cage = 0;
+	ct.node = 0;
+	ct.slot = 0;
+	if (e->node != index->root) {
+		ct.chip_name = PCHIP;
+		ct.chip_position = e->chip_position;
+
+		if (e->class_id != DTREE_CLASS_PROC_CHIP) {
+			if (e->class_id < 0 || e->index == -1)
+				return -1;
+
+			ct.class_name = dtree_class_to_cronus(e->class_id);
+			ct.chip_unit = e->index;
+		}
+	}
+
+	if (!construct_cronus_target(&ct, cname, sizeof(cname)))
+		return -1;
+
+	len = strlen(cname) + 1;
+	if (index->arena_len + len > index->arena_size) {
+		size_t n = index->arena_size ? index->arena_size * 2 : 4096;
+		char *arena;
+
+		arena = realloc(index->arena, n);
+		if (!arena)
+			return -1;
+
+		index->arena = arena;
+		index->arena_size = n;
+	}
+
+	offset = index->arena_len;
+	memcpy(index->arena + offset, cname, len);
+	index->arena_len += len;
+
+	return offset;
 }
 
-static struct dtm_node *dtm_find_node_by_class(struct dtm_node *root, struct cronus_target *ct)
+static int cronus_index_add_node(struct dtm_node *node, void *priv)
 {
-	struct match_by_class state = {
-		.ct = ct,
+	struct dtree_cronus_index *index = (struct dtree_cronus_index *)priv;
+	struct dtm_node *parent = dtm_node_parent(node);
+	struct cronus_index_entry *e;
+	struct dtm_property *prop;
+
+	if (!cronus_index_grow(index))
+		return -1;
+
+	/* Unwind till the parent of this node */
+	while (index->depth > 0 &&
+	       index->entry[index->stack[index->depth-1]].node != parent)
+		index->depth--;
+
+	e = &index->entry[index->count];
+	*e = (struct cronus_index_entry) {
+		.node = node,
+		.class_id = dtree_node_class(node),
+		.chip_position = -1,
+		.chip_unit = -1,
+		.index = -1,
 	};
+
+	if (index->depth > 0) {
+		struct cronus_index_entry *p = &index->entry[index->stack[index->depth-1]];
+
+		e->chip_position = p->chip_position;
+		e->index = p->index;
+
+		prop = dtm_node_get_property(node, "index");
+		if (prop)
+			e->index = dtm_prop_value_u32(prop);
+
+		if (e->class_id == DTREE_CLASS_PROC_CHIP)
+			e->chip_position = e->index;
+		else
+			e->chip_unit = e->index;
+	}
+
+	e->target = cronus_index_add_target(index, e);
+
+	index->stack[index->depth] = index->count;
+	index->depth += 1;
+	index->count += 1;
+
+	return 0;
+}
+
+static bool cronus_index_build_hash(struct dtree_cronus_index *index)
+{
+	uint32_t size = 64;
+	int i;
+
+	while (size < 2 * index->count)
+		size *= 2;
+
+	index->mask = size - 1;
+
+	index->by_node = malloc(size * sizeof(int));
+	index->by_unit = malloc(size * sizeof(int));
+	index->by_target = malloc(size * sizeof(int));
+	if (!index->by_node || !index->by_unit || !index->by_target)
+		return false;
+
+	memset(index->by_node, 0xff, size * sizeof(int));
+	memset(index->by_unit, 0xff, size * sizeof(int));
+	memset(index->by_target, 0xff, size * sizeof(int));
+
+	/* On duplicates, the first node in traverse order wins */
+	for (i=0; i<index->count; i++) {
+		struct cronus_index_entry *e = &index->entry[i];
+		const char *target;
+		uint32_t slot;
+
+		slot = cronus_index_hash_node(e->node) & index->mask;
+		while (index->by_node[slot] != -1)
+			slot = (slot + 1) & index->mask;
+		index->by_node[slot] = i;
+
+		if (e->target == -1)
+			continue;
+
+		slot = cronus_index_hash_unit(e->class_id, e->chip_position, e->chip_unit) & index->mask;
+		while (index->by_unit[slot] != -1) {
+			struct cronus_index_entry *o = &index->entry[index->by_unit[slot]];
+
+			if (o->class_id == e->class_id &&
+			    o->chip_position == e->chip_position &&
+			    o->chip_unit == e->chip_unit)
+				break;
+
+			slot = (slot + 1) & index->mask;
+		}
+		if (index->by_unit[slot] == -1)
+			index->by_unit[slot] = i;
+
+		target = index->arena + e->target;
+		slot = cronus_index_hash_target(target) & index->mask;
+		while (index->by_target[slot] != -1) {
+			struct cronus_index_entry *o = &index->entry[index->by_target[slot]];
+
+			if (strcmp(index->arena + o->target, target) == 0)
+				break;
+
+			slot = (slot + 1) & index->mask;
+		}
+		if (index->by_target[slot] == -1)
+			index->by_target[slot] = i;
+	}
+
+	return true;
+}
+
+struct dtree_cronus_index *dtree_cronus_index_new(struct dtm_node *root)
+{
+	struct dtree_cronus_index *index;
 	int ret;
 
-	ret = dtm_traverse(root, true, match_node_by_class, NULL, &state);
-	if (!ret)
+	index = calloc(1, sizeof(struct dtree_cronus_index));
+	if (!index)
 		return NULL;
 
-	return state.match;
+	index->root = root;
+
+	ret = dtm_traverse(root, true, cronus_index_add_node, NULL, index);
+	if (ret)
+		goto fail;
+
+	if (!cronus_index_build_hash(index))
+		goto fail;
+
+	free(index->stack);
+	index->stack = NULL;
+
+	return index;
+
+fail:
+	dtree_cronus_index_free(index);
+	return NULL;
 }
 
-struct dtm_node *dtree_from_cronus_target(struct dtm_node *root, const char *name)
+void dtree_cronus_index_free(struct dtree_cronus_index *index)
+{
+	free(index->entry);
+	free(index->stack);
+	free(index->arena);
+	free(index->by_node);
+	free(index->by_unit);
+	free(index->by_target);
+	free(index);
+}
+
+static struct dtm_node *cronus_index_find_unit(struct dtree_cronus_index *index,
+					       int class_id,
+					       int chip_position,
+					       int chip_unit)
+{
+	uint32_t slot;
+
+	slot = cronus_index_hash_unit(class_id, chip_position, chip_unit) & index->mask;
+	while (index->by_unit[slot] != -1) {
+		struct cronus_index_entry *e = &index->entry[index->by_unit[slot]];
+
+		if (e->class_id == class_id &&
+		    e->chip_position == chip_position &&
+		    e->chip_unit == chip_unit)
+			return e->node;
+
+		slot = (slot + 1) & index->mask;
+	}
+
+	return NULL;
+}
+
+static struct dtm_node *cronus_index_find_target(struct dtree_cronus_index *index,
+						 const char *name)
+{
+	uint32_t slot;
+
+	slot = cronus_index_hash_target(name) & index->mask;
+	while (index->by_target[slot] != -1) {
+		struct cronus_index_entry *e = &index->entry[index->by_target[slot]];
+
+		if (strcmp(index->arena + e->target, name) == 0)
+			return e->node;
+
+		slot = (slot + 1) & index->mask;
+	}
+
+	return NULL;
+}
+
+const char *dtree_cronus_index_target(struct dtree_cronus_index *index,
+				      const struct dtm_node *node)
 {
-	struct dtm_node *proc, *target;
+	uint32_t slot;
+
+	slot = cronus_index_hash_node(node) & index->mask;
+	while (index->by_node[slot] != -1) {
+		struct cronus_index_entry *e = &index->entry[index->by_node[slot]];
+
+		if (e->node == node) {
+			if (e->target == -1)
+				return NULL;
+
+			return index->arena + e->target;
+		}
+
+		slot = (slot + 1) & index->mask;
+	}
+
+	return NULL;
+}
+
+struct dtm_node *dtree_cronus_index_lookup(struct dtree_cronus_index *index, const char *name)
+{
+	struct dtm_node *node;
 	struct cronus_target ct;
 	char *copy;
-	char path[128];
+	int class_id;
+
+	/* Canonical target string */
+	node = cronus_index_find_target(index, name);
+	if (node)
+		return node;
 
 	copy = strdup(name);
-	assert(copy);
+	if (!copy)
+		return NULL;
 
 	if (!split_cronus_target(copy, &ct)) {
 		free(copy);
 		return NULL;
 	}
 
-	free(copy);
-
 	/* Root */
-	if (!ct.chip_name)
-		return root;
+	if (!ct.chip_name) {
+		free(copy);
+		return index->root;
+	}
 
-	/* Targets which are sitting outside proc e.g bmc, tpm */
-	if (ct.chip_position == -1) {
-		assert(ct.class_name);
-		assert(ct.chip_unit != -1);
+	if (ct.class_name)
+		class_id = cronus_class_id(ct.class_name);
+	else
+		class_id = DTREE_CLASS_PROC_CHIP;
 
-		sprintf(path, "%s%d", ct.class_name, ct.chip_unit);
-		target = dtm_find_node_by_name(root, path);
-		return target;
-	}
+	free(copy);
 
-	/* Proc with index */
-	sprintf(path, "/proc%d", ct.chip_position);
-	proc = dtm_find_node_by_path(root, path);
-	assert(proc);
+	if (class_id < 0)
+		return NULL;
 
-	if (!ct.class_name) {
-		return proc;
-	}
+	return cronus_index_find_unit(index, class_id, ct.chip_position, ct.chip_unit);
+}
 
-	/* Proc with index --> hwunit with index */
-	assert(ct.chip_unit != -1);
+struct dtm_node *dtree_from_cronus_target(struct dtm_node *root, const char *name)
+{
+	struct dtree_cronus_index *index;
+	struct dtm_node *node;
 
-	target = dtm_find_node_by_class(proc, &ct);
+	index = dtree_cronus_index_new(root);
+	if (!index)
+		return NULL;
 
-	return target;
+	node = dtree_cronus_index_lookup(index, name);
+	dtree_cronus_index_free(index);
+
+	return node;
 }
 
 char *dtree_to_cronus_target(const struct dtm_node *root, struct dtm_node *node)
 {
-	struct cronus_target ct;
-	char cname[128];
+	struct dtree_cronus_index *index;
+	const char *target;
+	char *cname = NULL;
 
-	cronus_target_init(&ct);
+	index = dtree_cronus_index_new((struct dtm_node *)root);
+	if (!index)
+		return NULL;
 
-	ct.cage = 0;
-	ct.node = 0;
-	ct.slot = 0;
-	if (node != root) {
-		struct dtm_node *proc = NULL;
-		const char *name, *cronus_class;
-		char *dtree_class;
+	target = dtree_cronus_index_target(index, node);
+	if (target)
+		cname = strdup(target);
 
-		ct.chip_name = PCHIP;
+	dtree_cronus_index_free(index);
+	return cname;
+}
 
-		for (proc = node; proc; proc = dtm_node_parent(proc)) {
-			name = dtm_node_name(proc);
+/*
+ * Lookup of cronus target directly in FDT file
+ *
+ * Same as the cronus target index, the chip position and the index are
+ * inherited from the parent, but only the ancestors of the node being
+ * scanned are recorded.  The scan stops at the first matching node.
+ */
+#define CRONUS_SCAN_MAX_DEPTH	64
 
-			dtree_class = dtree_name_to_class(name);
-			assert(dtree_class);
+struct cronus_scan_state {
+	int class_id;
+	int chip_position;
+	int chip_unit;
 
-			if (strcmp(dtree_class, "proc") == 0) {
-				free(dtree_class);
-				ct.chip_position = dtm_node_index(proc);
-				break;
-			}
+	struct {
+		int chip_position;
+		int index;
+	} stack[CRONUS_SCAN_MAX_DEPTH];
+
+	int offset;
+};
+
+/* Check a node, given the value of its index property */
+static int cronus_scan_check(struct cronus_scan_state *state, int offset, int depth,
+			     const char *name, const void *value, int len)
+{
+	int class_id, chip_position = -1, chip_unit = -1, index = -1;
+	uint32_t be_index;
+
+	if (depth >= CRONUS_SCAN_MAX_DEPTH)
+		return -1;
 
-			free(dtree_class);
+	if (depth > 0) {
+		chip_position = state->stack[depth-1].chip_position;
+		index = state->stack[depth-1].index;
+
+		if (value && len == sizeof(uint32_t)) {
+			memcpy(&be_index, value, sizeof(be_index));
+			index = be32toh(be_index);
 		}
+	}
 
-		if (node != proc) {
-			name = dtm_node_name(node);
+	class_id = dtree_name_to_class_id(name);
+	if (depth > 0) {
+		if (class_id == DTREE_CLASS_PROC_CHIP)
+			chip_position = index;
+		else
+			chip_unit = index;
+	}
 
-			dtree_class = dtree_name_to_class(name);
-			assert(dtree_class);
+	state->stack[depth].chip_position = chip_position;
+	state->stack[depth].index = index;
 
-			cronus_class = dtree_to_cronus_class(dtree_class);
-			free(dtree_class);
+	if (class_id != DTREE_CLASS_PROC_CHIP && index == -1)
+		return 0;
 
-			if (!cronus_class)
-				return NULL;
+	if (class_id == state->class_id &&
+	    chip_position == state->chip_position &&
+	    chip_unit == state->chip_unit) {
+		state->offset = offset;
+		return 1;
+	}
 
-			ct.class_name = cronus_class;
-			ct.chip_unit = dtm_node_index(node);
-		}
+	return 0;
+}
+
+static int cronus_scan_node(struct dtm_file *dfile, int offset, int depth, const char *name, void *priv)
+{
+	struct cronus_scan_state *state = (struct cronus_scan_state *)priv;
+	const void *value = NULL;
+	int len = 0;
+
+	if (depth > 0)
+		value = dtm_file_get_property(dfile, offset, "index", &len);
+
+	return cronus_scan_check(state, offset, depth, name, value, len);
+}
+
+/* Nodes of an image in depth first order, same as the FDT file */
+static int cronus_scan_image(struct dtm_image *img, int node, int depth,
+			     struct cronus_scan_state *state)
+{
+	const void *value = NULL;
+	const char *name;
+	int child, len = 0, ret;
+
+	name = dtm_image_node_name(img, node);
+	if (!name)
+		return -1;
+
+	if (depth > 0)
+		value = dtm_image_get_property(img, node, "index", &len);
+
+	ret = cronus_scan_check(state, node, depth, name, value, len);
+	if (ret)
+		return ret;
+
+	for (child = dtm_image_next_subnode(img, node, -1);
+	     child >= 0;
+	     child = dtm_image_next_subnode(img, node, child)) {
+		ret = cronus_scan_image(img, child, depth + 1, state);
+		if (ret)
+			return ret;
 	}
 
-	if (!construct_cronus_target(&ct, cname, sizeof(cname)))
+	return 0;
+}
+
+/*
+ * Allocate the scan state for a cronus target, NULL with *offset set for
+ * the root (0) or an invalid target (-1)
+ */
+static struct cronus_scan_state *cronus_scan_new(const char *name, int *offset)
+{
+	struct cronus_scan_state *state;
+	struct cronus_target ct;
+	char *copy;
+	int class_id;
+
+	*offset = -1;
+
+	copy = strdup(name);
+	if (!copy)
+		return NULL;
+
+	if (!split_cronus_target(copy, &ct)) {
+		free(copy);
+		return NULL;
+	}
+
+	/* Root */
+	if (!ct.chip_name) {
+		free(copy);
+		*offset = 0;
+		return NULL;
+	}
+
+	if (ct.class_name)
+		class_id = cronus_class_id(ct.class_name);
+	else
+		class_id = DTREE_CLASS_PROC_CHIP;
+
+	free(copy);
+
+	if (class_id < 0)
+		return NULL;
+
+	state = malloc(sizeof(struct cronus_scan_state));
+	if (!state)
 		return NULL;
 
-	return strdup(cname);
+	state->class_id = class_id;
+	state->chip_position = ct.chip_position;
+	state->chip_unit = ct.chip_unit;
+	state->offset = -1;
+
+	return state;
+}
+
+int dtree_cronus_file_offset(struct dtm_file *dfile, const char *name)
+{
+	struct cronus_scan_state *state;
+	int offset;
+
+	state = cronus_scan_new(name, &offset);
+	if (!state)
+		return offset;
+
+	if (dtm_file_scan(dfile, cronus_scan_node, state) == 1)
+		offset = state->offset;
+
+	free(state);
+	return offset;
+}
+
+int dtree_cronus_image_offset(struct dtm_image *img, const char *name)
+{
+	struct cronus_scan_state *state;
+	int offset;
+
+	state = cronus_scan_new(name, &offset);
+	if (!state)
+		return offset;
+
+	if (cronus_scan_image(img, 0, 0, state) == 1)
+		offset = state->offset;
+
+	free(state);
+	return offset;
 }
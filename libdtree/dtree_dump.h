@@ -19,8 +19,10 @@
 
 #include <stdio.h>
 
-void dtree_dump_print_node(const struct dtm_node *node, FILE *fp);
-void dtree_dump_print_attr_name(const struct dtree_attr *attr, FILE *fp);
-void dtree_dump_print_attr(const struct dtree_attr *attr, FILE *fp);
+struct dtree_buf;
+
+void dtree_dump_buf_print_node(const struct dtm_node *node, struct dtree_buf *buf);
+void dtree_dump_buf_print_attr_name(const struct dtree_attr *attr, struct dtree_buf *buf);
+void dtree_dump_buf_print_attr(const struct dtree_attr *attr, struct dtree_buf *buf);
 
 #endif /* __DTREE_DUMP_H__ */
@@ -16,13 +16,13 @@
 
 #include <stdio.h>
 #include <assert.h>
-#include <inttypes.h>
 #include <string.h>
 #include <stdlib.h>
 
 #include "libdtm/dtm.h"
 
 #include "dtree.h"
+#include "dtree_buf.h"
 #include "dtree_dump.h"
 
 struct {
@@ -54,22 +54,22 @@ static const char *attr_type_to_dump_string(uint8_t type)
 	return "invalid";
 }
 
-static void dump_print_value_num(uint8_t *ptr, int data_size, FILE *fp)
+static void dump_print_value_num(uint8_t *ptr, int data_size, struct dtree_buf *buf)
 {
 	if (data_size == 1) {
-		fprintf(fp, "0x%02x", *ptr);
+		dtree_buf_hex(buf, *ptr, 1);
 	} else if (data_size == 2) {
-		fprintf(fp, "0x%04x", *(uint16_t *)ptr);
+		dtree_buf_hex(buf, *(uint16_t *)ptr, 2);
 	} else if (data_size == 4) {
-		fprintf(fp, "0x%08x", *(uint32_t *)ptr);
+		dtree_buf_hex(buf, *(uint32_t *)ptr, 4);
 	} else if (data_size == 8) {
-		fprintf(fp, "0x%016" PRIx64, *(uint64_t *)ptr);
+		dtree_buf_hex(buf, *(uint64_t *)ptr, 8);
 	} else {
 		assert(0);
 	}
 }
 
-static void dump_print_value(const struct dtree_attr *attr, FILE *fp)
+static void dump_print_value(const struct dtree_attr *attr, struct dtree_buf *buf)
 {
 	uint8_t *ptr;
 	int i;
@@ -92,15 +92,15 @@ static void dump_print_value(const struct dtree_attr *attr, FILE *fp)
 	ptr = attr->value;
 
 	for (i=0; i<attr->count; i++) {
-		dump_print_value_num(ptr, attr->elem_size, fp);
+		dump_print_value_num(ptr, attr->elem_size, buf);
 		ptr += attr->elem_size;
 
 		if (i < attr->count-1)
-			fprintf(fp, " ");
+			dtree_buf_putc(buf, ' ');
 	}
 }
 
-static bool dump_print_enum(const struct dtree_attr *attr, FILE *fp)
+static bool dump_print_enum(const struct dtree_attr *attr, struct dtree_buf *buf)
 {
 	uint8_t *ptr;
 	uint64_t val = 0;
@@ -130,19 +130,19 @@ static bool dump_print_enum(const struct dtree_attr *attr, FILE *fp)
 			struct dtree_attr_enum *ae = &attr->aenum[j];
 
 			if (ae->value == val) {
-				fprintf(fp, "%s", ae->key);
+				dtree_buf_puts(buf, ae->key);
 				found = true;
 				break;
 			}
 		}
 		if (!found) {
-			fprintf(fp, "UNKNOWN_ENUM (");
-			dump_print_value_num(ptr, attr->elem_size, fp);
-			fprintf(fp, ")");
+			dtree_buf_puts(buf, "UNKNOWN_ENUM (");
+			dump_print_value_num(ptr, attr->elem_size, buf);
+			dtree_buf_putc(buf, ')');
 		}
 
 		if (i < attr->count-1)
-			fprintf(fp, " ");
+			dtree_buf_putc(buf, ' ');
 
 		ptr += attr->elem_size;
 	}
@@ -150,7 +150,7 @@ static bool dump_print_enum(const struct dtree_attr *attr, FILE *fp)
 	return true;
 }
 
-static void dump_print_string(const struct dtree_attr *attr, FILE *fp)
+static void dump_print_string(const struct dtree_attr *attr, struct dtree_buf *buf)
 {
 	uint8_t *ptr;
 	int i;
@@ -158,15 +158,17 @@ static void dump_print_string(const struct dtree_attr *attr, FILE *fp)
 	ptr = attr->value;
 
 	for (i=0; i<attr->count; i++) {
-		fprintf(fp, "\"%.*s\"", attr->elem_size, (char *)ptr);
+		dtree_buf_putc(buf, '"');
+		dtree_buf_put(buf, (char *)ptr, strnlen((char *)ptr, attr->elem_size));
+		dtree_buf_putc(buf, '"');
 		ptr += attr->elem_size;
 
 		if (i < attr->count-1)
-			fprintf(fp, " ");
+			dtree_buf_putc(buf, ' ');
 	}
 }
 
-static void dump_print_complex(const struct dtree_attr *attr, FILE *fp)
+static void dump_print_complex(const struct dtree_attr *attr, struct dtree_buf *buf)
 {
 	uint8_t *ptr;
 	int i, j;
@@ -179,43 +181,52 @@ static void dump_print_complex(const struct dtree_attr *attr, FILE *fp)
 		for (j=0; j<n; j++) {
 			int data_size = attr->spec[j] - '0';
 
-			dump_print_value_num(ptr, data_size, fp);
+			dump_print_value_num(ptr, data_size, buf);
 			ptr += data_size;
 
 			if (j < n-1)
-				fprintf(fp, " ");
+				dtree_buf_putc(buf, ' ');
 		}
 
 		if (i < attr->count-1)
-			fprintf(fp, " ");
+			dtree_buf_putc(buf, ' ');
 	}
 }
 
-void dtree_dump_print_node(const struct dtm_node *node, FILE *fp)
+void dtree_dump_buf_print_node(const struct dtm_node *node, struct dtree_buf *buf)
 {
 	char *path;
 
 	path = dtm_node_path(node);
 	assert(path);
-	fprintf(fp, "%s\n", path);
+	dtree_buf_puts(buf, path);
+	dtree_buf_putc(buf, '\n');
 	free(path);
 }
 
-void dtree_dump_print_attr_name(const struct dtree_attr *attr, FILE *fp)
+void dtree_dump_buf_print_attr_name(const struct dtree_attr *attr, struct dtree_buf *buf)
 {
-	fprintf(fp, "  %s: %s ", attr->name, attr_type_to_dump_string(attr->type));
+	dtree_buf_puts(buf, "  ");
+	dtree_buf_puts(buf, attr->name);
+	dtree_buf_puts(buf, ": ");
+	dtree_buf_puts(buf, attr_type_to_dump_string(attr->type));
+	dtree_buf_putc(buf, ' ');
 }
 
-void dtree_dump_print_attr(const struct dtree_attr *attr, FILE *fp)
+void dtree_dump_buf_print_attr(const struct dtree_attr *attr, struct dtree_buf *buf)
 {
+	uint64_t start = dtm_stats_start();
+
 	if (attr->type == DTREE_ATTR_TYPE_UNKNOWN) {
-		fprintf(fp, "**UNKNOWN**");
+		dtree_buf_puts(buf, "**UNKNOWN**");
 	} else if (attr->type == DTREE_ATTR_TYPE_COMPLEX) {
-		dump_print_complex(attr, fp);
+		dump_print_complex(attr, buf);
 	} else if (attr->type == DTREE_ATTR_TYPE_STRING) {
-		dump_print_string(attr, fp);
+		dump_print_string(attr, buf);
 	} else {
-		if (!dump_print_enum(attr, fp))
-			dump_print_value(attr, fp);
+		if (!dump_print_enum(attr, buf))
+			dump_print_value(attr, buf);
 	}
+
+	dtm_stats_stop(DTM_STATS_FORMAT, start);
 }
@@ -23,54 +23,42 @@
 #include "dtree.h"
 #include "dtree_attr.h"
 #include "dtree_attr_list.h"
+#include "dtree_cronus.h"
+#include "dtree_export.h"
+#include "dtree_filter.h"
 #include "dtree_infodb.h"
 #include "dtree_util.h"
 
 struct dtree_create_state {
 	struct dtree_infodb *infodb;
+	struct dtree_target **class_target;
 };
 
 static int dtree_create_node(struct dtm_node *node, void *priv)
 {
 	struct dtree_create_state *state = (struct dtree_create_state *)priv;
-	struct dtree_target *target = NULL;
-	const char *name, *fapi_target;
-	char *cname;
-	int i, ret;
+	struct dtree_target *target;
+	int class_id, i, ret;
 
-	name = dtm_node_name(node);
-	cname = dtree_name_to_class(name);
-	fapi_target = dtree_to_fapi_class(cname);
-	free(cname);
-
-	if (!fapi_target)
+	class_id = dtree_node_class(node);
+	if (class_id < 0)
 		return 0;
 
-	for (i=0; i<state->infodb->tlist.count; i++) {
-		struct dtree_target *t = &state->infodb->tlist.target[i];
-		if (strcmp(fapi_target, t->name) == 0) {
-			target = t;
-			break;
-		}
-	}
-
+	target = state->class_target[class_id];
 	if (!target)
 		return 0;
 
 	for (i=0; i<target->id_count; i++) {
 		struct dtree_attr *attr;
-		uint8_t *buf = NULL;
-		int len;
+		struct dtree_attr_blob *blob;
 		int id = target->id[i];
 
 		assert(id < state->infodb->alist.count);
 		attr = &state->infodb->alist.attr[id];
+		blob = &state->infodb->blob[id];
+		assert(blob->len > 0);
 
-		dtree_attr_encode(attr, &buf, &len);
-		assert(buf && len > 0);
-
-		ret = dtm_node_add_property(node, attr->name, buf, len);
-		free(buf);
+		ret = dtm_node_add_property_ref(node, attr->name, blob->data, blob->len);
 		if (ret)
 			return ret;
 	}
@@ -86,7 +74,8 @@ int dtree_create(const char *dtb_path,
 	struct dtm_file *dfile;
 	struct dtm_node *root;
 	struct dtree_infodb infodb;
-	int ret;
+	struct dtree_target **class_target;
+	int count, i, ret;
 
 	dfile = dtm_file_open(dtb_path, false);
 	if (!dfile)
@@ -100,114 +89,464 @@ int dtree_create(const char *dtb_path,
 	if (!dtree_infodb_load(infodb_path, &infodb))
 		return -3;
 
+	/* Resolve the infodb target for every class only once */
+	count = dtree_class_count();
+	class_target = calloc(count, sizeof(struct dtree_target *));
+	if (!class_target)
+		return -3;
+
+	for (i=0; i<count; i++)
+		class_target[i] = dtree_infodb_target(&infodb, dtree_class_to_fapi(i));
+
 	state = (struct dtree_create_state) {
 		.infodb = &infodb,
+		.class_target = class_target,
 	};
 
 	ret = dtm_traverse(root, true, dtree_create_node, NULL, &state);
 	if (ret)
-		return ret;
+		goto done;
 
 	dfile = dtm_file_create(dtb_out_path);
-	if (!dfile)
-		return -4;
+	if (!dfile) {
+		ret = -4;
+		goto done;
+	}
 
-	if (!dtm_file_write(dfile, root))
-		return -5;
+	if (!dtm_file_write(dfile, root)) {
+		ret = -5;
+		goto done;
+	}
 
 	dtm_file_close(dfile);
-	return 0;
+
+done:
+	free(class_target);
+	return ret;
 }
 
+struct dtree_export_ctx {
+	struct dtm_node *root;
+	struct dtree_infodb *infodb;
+	struct dtree_infodb infodb_loaded;
+	struct dtm_image *image;
+	bool borrowed;
+	struct name_list alist;
+	struct dtree_filter *filter;
+	int flags;
+};
+
 struct dtree_export_state {
 	struct dtree_infodb *infodb;
 	struct dtm_node *root;
-	struct name_list *alist;
+	struct dtm_node *only;
+	struct dtree_filter *filter;
 	dtree_export_node_fn node_fn;
 	dtree_export_attr_fn attr_fn;
+	dtree_export_raw_fn raw_fn;
 	void *priv;
+	uint8_t *scratch;
+	bool non_default;
+	bool stopped;
 };
 
 static int dtree_export_node(struct dtm_node *node, void *priv)
 {
 	struct dtree_export_state *state = (struct dtree_export_state *)priv;
+	int ret;
+
+	/* Reached the first child when exporting a single node */
+	if (state->only && node != state->only) {
+		state->stopped = true;
+		return 1;
+	}
+
+	/* Skip the properties or the subtree of nodes not selected */
+	ret = dtree_filter_node(state->filter, node);
+	if (ret)
+		return ret;
 
 	return state->node_fn(state->root, node, state->priv);
 }
 
+/* Property tags, other than infodb attribute id */
+#define PROP_TAG_UNRESOLVED	-1
+#define PROP_TAG_UNKNOWN	-2	/* attribute not in infodb */
+#define PROP_TAG_OTHER		-3	/* not an attribute */
+
+/* Map property to infodb attribute id, only the first time */
+static int dtree_export_prop_id(struct dtree_infodb *infodb, struct dtm_property *prop)
+{
+	const char *name;
+	int id;
+
+	id = dtm_prop_tag(prop);
+	if (id != PROP_TAG_UNRESOLVED)
+		return id;
+
+	name = dtm_prop_name(prop);
+	if (strncmp(name, "ATTR", 4) != 0) {
+		id = PROP_TAG_OTHER;
+	} else {
+		id = dtree_infodb_attr_id(infodb, name);
+		if (id < 0)
+			id = PROP_TAG_UNKNOWN;
+	}
+
+	dtm_prop_set_tag(prop, id);
+	return id;
+}
+
 static int dtree_export_attr(struct dtm_node *node, struct dtm_property *prop, void *priv)
 {
 	struct dtree_export_state *state = (struct dtree_export_state *)priv;
 	struct dtree_attr *attr, value;
 	const char *name;
 	const uint8_t *buf;
-	int buflen, ret;
+	int buflen, id;
 
-	name = dtm_prop_name(prop);
-	if (strncmp(name, "ATTR", 4) != 0)
+	id = dtree_export_prop_id(state->infodb, prop);
+	if (id == PROP_TAG_OTHER)
 		return 0;
 
-	if (!dtree_attr_list_exists(state->alist, name))
+	name = dtm_prop_name(prop);
+	if (!dtree_filter_attr(state->filter, id, name))
 		return 0;
 
-	attr = dtree_infodb_attr(state->infodb, name);
-	if (attr) {
-		dtree_attr_copy(attr, &value);
+	if (id >= 0) {
+		attr = &state->infodb->alist.attr[id];
 		buf = dtm_prop_value(prop, &buflen);
-		dtree_attr_decode(&value, buf, buflen);
+
+		/* Default values are encoded the same way, compare the encoding */
+		if (state->non_default) {
+			struct dtree_attr_blob *blob;
+
+			blob = &state->infodb->blob[id];
+			if (buflen == blob->len && memcmp(buf, blob->data, buflen) == 0)
+				return 0;
+		}
+
+		if (state->raw_fn)
+			return state->raw_fn(name, buf, buflen, state->priv);
+
+		/* Decode into the scratch buffer, everything else is borrowed */
+		dtree_attr_view(attr, &value, state->scratch);
+		dtree_attr_decode_buf(&value, buf, buflen, value.value);
 	} else {
+		if (state->raw_fn) {
+			buf = dtm_prop_value(prop, &buflen);
+			return state->raw_fn(name, buf, buflen, state->priv);
+		}
+
 		value = (struct dtree_attr) {
 			.type = DTREE_ATTR_TYPE_UNKNOWN,
 		};
 		memcpy(value.name, name, strlen(name)+1);
 	}
 
-	ret = state->attr_fn(&value, state->priv);
-
-	if (value.dim)
-		free(value.dim);
-	if (value.value)
-		free(value.value);
-
-	return ret;
+	return state->attr_fn(&value, state->priv);
 }
 
-int dtree_export(const char *dtb_path,
-		 const char *infodb_path,
-		 const char *attrdb_path,
-		 dtree_export_node_fn node_fn,
-		 dtree_export_attr_fn attr_fn,
-		 void *priv)
+int dtree_export_open(const char *dtb_path,
+		      const char *infodb_path,
+		      const char *attrdb_path,
+		      const struct dtree_export_filter *filter,
+		      int flags,
+		      struct dtree_export_ctx **out)
 {
-	struct dtree_export_state state;
+	struct dtree_export_ctx *ctx;
 	struct dtm_file *dfile;
-	struct dtm_node *root;
-	struct dtree_infodb infodb;
-	struct name_list alist;
+	char *image;
 
-	dfile = dtm_file_open(dtb_path, false);
-	if (!dfile)
+	ctx = calloc(1, sizeof(struct dtree_export_ctx));
+	if (!ctx)
 		return -1;
 
-	root = dtm_file_read(dfile);
-	dtm_file_close(dfile);
-	if (!root)
+	/* Use the tree image if there is an up to date one */
+	image = dtm_file_image_name(dtb_path);
+	if (image) {
+		ctx->image = dtm_image_open(image, dtb_path);
+		free(image);
+	}
+
+	if (ctx->image) {
+		ctx->root = dtm_image_read(ctx->image);
+	} else {
+		dfile = dtm_file_open(dtb_path, false);
+		if (!dfile) {
+			free(ctx);
+			return -1;
+		}
+
+		ctx->root = dtm_file_read(dfile);
+		dtm_file_close(dfile);
+	}
+
+	if (!ctx->root) {
+		dtm_image_close(ctx->image);
+		free(ctx);
 		return -2;
+	}
 
-	if (!dtree_infodb_load(infodb_path, &infodb))
+	ctx->infodb = &ctx->infodb_loaded;
+	if (!dtree_infodb_load(infodb_path, ctx->infodb)) {
+		dtree_export_close(ctx);
 		return -3;
+	}
+
+	if (!dtree_attr_list_parse(attrdb_path, &ctx->alist)) {
+		dtree_export_close(ctx);
+		return -4;
+	}
+
+	ctx->filter = dtree_filter_compile(filter, &ctx->alist, ctx->infodb, ctx->root);
+	if (!ctx->filter) {
+		dtree_export_close(ctx);
+		return -4;
+	}
+
+	ctx->flags = flags;
+
+	*out = ctx;
+	return 0;
+}
 
-	if (!dtree_attr_list_parse(attrdb_path, &alist))
+int dtree_export_open_tree(struct dtm_node *root,
+			   struct dtree_infodb *infodb,
+			   const struct dtree_export_filter *filter,
+			   int flags,
+			   struct dtree_export_ctx **out)
+{
+	struct dtree_export_ctx *ctx;
+
+	ctx = calloc(1, sizeof(struct dtree_export_ctx));
+	if (!ctx)
+		return -1;
+
+	ctx->root = root;
+	ctx->infodb = infodb;
+	ctx->borrowed = true;
+
+	ctx->filter = dtree_filter_compile(filter, &ctx->alist, ctx->infodb, ctx->root);
+	if (!ctx->filter) {
+		dtree_export_close(ctx);
 		return -4;
+	}
+
+	ctx->flags = flags;
+
+	*out = ctx;
+	return 0;
+}
+
+struct dtm_node *dtree_export_root(struct dtree_export_ctx *ctx)
+{
+	return ctx->root;
+}
+
+struct dtree_infodb *dtree_export_infodb(struct dtree_export_ctx *ctx)
+{
+	return ctx->infodb;
+}
+
+int dtree_export_subtree(struct dtree_export_ctx *ctx,
+			 struct dtm_node *node,
+			 bool recurse,
+			 dtree_export_node_fn node_fn,
+			 dtree_export_attr_fn attr_fn,
+			 void *priv)
+{
+	struct dtree_export_state state;
+	uint64_t start;
+	int ret;
 
 	state = (struct dtree_export_state) {
-		.infodb = &infodb,
-		.root = root,
-		.alist = &alist,
+		.infodb = ctx->infodb,
+		.root = ctx->root,
+		.only = recurse ? NULL : node,
+		.filter = ctx->filter,
 		.node_fn = node_fn,
 		.attr_fn = attr_fn,
 		.priv = priv,
+		.non_default = (ctx->flags & DTREE_EXPORT_NON_DEFAULT),
+	};
+
+	/* Large enough for the value of any attribute */
+	state.scratch = malloc(ctx->infodb->value_max > 0 ? ctx->infodb->value_max : 1);
+	if (!state.scratch)
+		return -1;
+
+	start = dtm_stats_start();
+	ret = dtm_traverse(node, true, dtree_export_node, dtree_export_attr, &state);
+	dtm_stats_stop(DTM_STATS_TRAVERSE, start);
+	if (state.stopped)
+		ret = 0;
+
+	free(state.scratch);
+	return ret;
+}
+
+int dtree_export_subtree_raw(struct dtree_export_ctx *ctx,
+			     struct dtm_node *node,
+			     dtree_export_node_fn node_fn,
+			     dtree_export_raw_fn raw_fn,
+			     void *priv)
+{
+	struct dtree_export_state state;
+	uint64_t start;
+	int ret;
+
+	state = (struct dtree_export_state) {
+		.infodb = ctx->infodb,
+		.root = ctx->root,
+		.filter = ctx->filter,
+		.node_fn = node_fn,
+		.raw_fn = raw_fn,
+		.priv = priv,
+		.non_default = (ctx->flags & DTREE_EXPORT_NON_DEFAULT),
 	};
 
-	return dtm_traverse(root, true, dtree_export_node, dtree_export_attr, &state);
+	start = dtm_stats_start();
+	ret = dtm_traverse(node, true, dtree_export_node, dtree_export_attr, &state);
+	dtm_stats_stop(DTM_STATS_TRAVERSE, start);
+	if (state.stopped)
+		ret = 0;
+
+	return ret;
+}
+
+void dtree_export_close(struct dtree_export_ctx *ctx)
+{
+	if (ctx->filter)
+		dtree_filter_free(ctx->filter);
+	if (!ctx->borrowed) {
+		dtm_tree_free(ctx->root);
+		if (ctx->infodb)
+			dtree_infodb_free(ctx->infodb);
+	}
+	dtm_image_close(ctx->image);
+	free(ctx);
+}
+
+int dtree_export_filtered(const char *dtb_path,
+			  const char *infodb_path,
+			  const char *attrdb_path,
+			  const struct dtree_export_filter *filter,
+			  dtree_export_node_fn node_fn,
+			  dtree_export_attr_fn attr_fn,
+			  void *priv)
+{
+	struct dtree_export_ctx *ctx;
+	int ret;
+
+	ret = dtree_export_open(dtb_path, infodb_path, attrdb_path, filter, 0, &ctx);
+	if (ret)
+		return ret;
+
+	ret = dtree_export_subtree(ctx, ctx->root, true, node_fn, attr_fn, priv);
+
+	dtree_export_close(ctx);
+	return ret;
+}
+
+int dtree_export(const char *dtb_path,
+		 const char *infodb_path,
+		 const char *attrdb_path,
+		 dtree_export_node_fn node_fn,
+		 dtree_export_attr_fn attr_fn,
+		 void *priv)
+{
+	return dtree_export_filtered(dtb_path, infodb_path, attrdb_path, NULL,
+				     node_fn, attr_fn, priv);
+}
+
+int dtree_read(const char *dtb_path,
+	       const char *infodb_path,
+	       const char *target,
+	       const char *attr_name,
+	       dtree_export_attr_fn attr_fn,
+	       void *priv)
+{
+	struct dtm_file *dfile = NULL;
+	struct dtm_image *img = NULL;
+	struct dtree_attr attr;
+	const uint8_t *buf;
+	char *image;
+	int offset, buflen, ret;
+
+	/* Look up in the tree image if there is an up to date one */
+	image = dtm_file_image_name(dtb_path);
+	if (image) {
+		img = dtm_image_open(image, dtb_path);
+		free(image);
+	}
+
+	if (img) {
+		if (target[0] == '/')
+			offset = dtm_image_node_offset(img, target);
+		else
+			offset = dtree_cronus_image_offset(img, target);
+	} else {
+		dfile = dtm_file_open(dtb_path, false);
+		if (!dfile)
+			return -1;
+
+		if (target[0] == '/')
+			offset = dtm_file_node_offset(dfile, target);
+		else
+			offset = dtree_cronus_file_offset(dfile, target);
+	}
+
+	if (offset < 0) {
+		ret = DTREE_READ_NO_TARGET;
+		goto done;
+	}
+
+	if (strncmp(attr_name, "ATTR", 4) != 0) {
+		ret = DTREE_READ_NO_ATTR;
+		goto done;
+	}
+
+	if (img)
+		buf = dtm_image_get_property(img, offset, attr_name, &buflen);
+	else
+		buf = dtm_file_get_property(dfile, offset, attr_name, &buflen);
+	if (!buf) {
+		ret = DTREE_READ_NO_ATTR;
+		goto done;
+	}
+
+	ret = dtree_infodb_load_attr(infodb_path, attr_name, &attr);
+	if (ret < 0) {
+		ret = -1;
+		goto done;
+	}
+
+	/* Attribute not in infodb */
+	if (ret == 1) {
+		attr = (struct dtree_attr) {
+			.type = DTREE_ATTR_TYPE_UNKNOWN,
+		};
+		strcpy(attr.name, attr_name);
+
+		ret = attr_fn(&attr, priv);
+		goto done;
+	}
+
+	if (buflen != attr.count * attr.elem_size) {
+		fprintf(stderr, "Invalid length %d for %s\n", buflen, attr_name);
+		dtree_infodb_attr_free(&attr);
+		ret = -1;
+		goto done;
+	}
+
+	dtree_attr_decode(&attr, buf, buflen);
+	ret = attr_fn(&attr, priv);
+	dtree_infodb_attr_free(&attr);
+
+done:
+	if (dfile)
+		dtm_file_close(dfile);
+	dtm_image_close(img);
+	return ret;
 }
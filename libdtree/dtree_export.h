@@ -0,0 +1,62 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __DTREE_EXPORT_H__
+#define __DTREE_EXPORT_H__
+
+#include <stdbool.h>
+
+#include "dtree.h"
+
+struct dtree_export_ctx;
+struct dtree_infodb;
+
+/*
+ * Callback for each attribute during raw export, with the value encoded
+ * as stored in device tree
+ */
+typedef int (*dtree_export_raw_fn)(const char *name,
+				   const uint8_t *value,
+				   int value_len,
+				   void *priv);
+
+int dtree_export_open(const char *dtb_path,
+		      const char *infodb_path,
+		      const char *attrdb_path,
+		      const struct dtree_export_filter *filter,
+		      int flags,
+		      struct dtree_export_ctx **out);
+int dtree_export_open_tree(struct dtm_node *root,
+			   struct dtree_infodb *infodb,
+			   const struct dtree_export_filter *filter,
+			   int flags,
+			   struct dtree_export_ctx **out);
+struct dtm_node *dtree_export_root(struct dtree_export_ctx *ctx);
+struct dtree_infodb *dtree_export_infodb(struct dtree_export_ctx *ctx);
+int dtree_export_subtree(struct dtree_export_ctx *ctx,
+			 struct dtm_node *node,
+			 bool recurse,
+			 dtree_export_node_fn node_fn,
+			 dtree_export_attr_fn attr_fn,
+			 void *priv);
+int dtree_export_subtree_raw(struct dtree_export_ctx *ctx,
+			     struct dtm_node *node,
+			     dtree_export_node_fn node_fn,
+			     dtree_export_raw_fn raw_fn,
+			     void *priv);
+void dtree_export_close(struct dtree_export_ctx *ctx);
+
+#endif /* __DTREE_EXPORT_H__ */
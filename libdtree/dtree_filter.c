@@ -0,0 +1,432 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <fnmatch.h>
+
+#include "libdtm/dtm.h"
+
+#include "dtree.h"
+#include "dtree_cronus.h"
+#include "dtree_filter.h"
+#include "dtree_util.h"
+
+/*
+ * Export filter
+ *
+ * The filter is specified with class names, device tree paths, cronus target
+ * patterns and attribute names.  When exporting, it is compiled against the
+ * device tree and the infodb, i.e. paths and cronus targets are resolved to
+ * nodes and attribute names to attribute ids.
+ *
+ * A node is selected if it matches one of the classes (if any) and one of the
+ * paths or targets (if any).  An attribute is selected if it is in the
+ * attribute list (if any) and in the filter (if any).
+ *
+ * A path or a cronus target without wildcards which does not exist is an
+ * error, a pattern which does not match any target selects no node.
+ */
+
+struct dtree_filter_path {
+	char *path;
+	bool recurse;
+};
+
+struct dtree_export_filter {
+	uint64_t class_mask;
+	struct dtree_filter_path *path;
+	int path_count;
+	char **target;
+	int target_count;
+	char **attr;
+	int attr_count;
+};
+
+struct dtree_filter_loc {
+	struct dtm_node *node;
+	bool recurse;
+};
+
+#define FILTER_ATTR_LIST	0x01
+#define FILTER_ATTR_SPEC	0x02
+
+struct dtree_filter {
+	const struct dtree_export_filter *spec;
+	const struct name_list *alist;
+	uint64_t class_mask;
+	bool have_loc;
+	struct dtree_filter_loc *loc;
+	int loc_count;
+	const char **pattern;
+	int pattern_count;
+	struct dtree_cronus_index *index;
+	uint8_t *attr_mask;
+	uint8_t attr_required;
+};
+
+struct dtree_export_filter *dtree_export_filter_new(void)
+{
+	return calloc(1, sizeof(struct dtree_export_filter));
+}
+
+static int filter_add_string(char ***list, int *count, const char *str)
+{
+	char **tmp;
+
+	tmp = reallocarray(*list, *count + 1, sizeof(char *));
+	if (!tmp)
+		return -1;
+
+	*list = tmp;
+
+	tmp[*count] = strdup(str);
+	if (!tmp[*count])
+		return -1;
+
+	*count += 1;
+	return 0;
+}
+
+int dtree_export_filter_add_class(struct dtree_export_filter *filter, const char *class_name)
+{
+	int class_id;
+
+	class_id = dtree_class_id(class_name);
+	if (class_id < 0)
+		class_id = cronus_class_id(class_name);
+	if (class_id < 0)
+		return -1;
+
+	assert(DTREE_CLASS_COUNT <= 64);
+	filter->class_mask |= (1ULL << class_id);
+	return 0;
+}
+
+int dtree_export_filter_add_path(struct dtree_export_filter *filter, const char *path, bool recurse)
+{
+	struct dtree_filter_path *tmp;
+
+	tmp = reallocarray(filter->path, filter->path_count + 1, sizeof(struct dtree_filter_path));
+	if (!tmp)
+		return -1;
+
+	filter->path = tmp;
+
+	tmp[filter->path_count] = (struct dtree_filter_path) {
+		.path = strdup(path),
+		.recurse = recurse,
+	};
+	if (!tmp[filter->path_count].path)
+		return -1;
+
+	filter->path_count += 1;
+	return 0;
+}
+
+int dtree_export_filter_add_target(struct dtree_export_filter *filter, const char *pattern)
+{
+	return filter_add_string(&filter->target, &filter->target_count, pattern);
+}
+
+int dtree_export_filter_add_attr(struct dtree_export_filter *filter, const char *attr_name)
+{
+	return filter_add_string(&filter->attr, &filter->attr_count, attr_name);
+}
+
+void dtree_export_filter_free(struct dtree_export_filter *filter)
+{
+	int i;
+
+	for (i=0; i<filter->path_count; i++)
+		free(filter->path[i].path);
+	for (i=0; i<filter->target_count; i++)
+		free(filter->target[i]);
+	for (i=0; i<filter->attr_count; i++)
+		free(filter->attr[i]);
+
+	free(filter->path);
+	free(filter->target);
+	free(filter->attr);
+	free(filter);
+}
+
+static void filter_add_loc(struct dtree_filter *filter, struct dtm_node *node, bool recurse)
+{
+	filter->loc[filter->loc_count] = (struct dtree_filter_loc) {
+		.node = node,
+		.recurse = recurse,
+	};
+	filter->loc_count += 1;
+}
+
+static bool filter_compile_nodes(struct dtree_filter *filter,
+				 const struct dtree_export_filter *spec,
+				 struct dtm_node *root)
+{
+	struct dtree_cronus_index *index = NULL;
+	struct dtm_node *node;
+	int i;
+
+	filter->class_mask = spec->class_mask;
+
+	if (spec->path_count + spec->target_count == 0)
+		return true;
+
+	/* Nodes are selected by location, even if none is resolved */
+	filter->have_loc = true;
+
+	filter->loc = calloc(spec->path_count + spec->target_count, sizeof(struct dtree_filter_loc));
+	filter->pattern = calloc(spec->target_count + 1, sizeof(char *));
+	if (!filter->loc || !filter->pattern)
+		return false;
+
+	for (i=0; i<spec->path_count; i++) {
+		node = dtm_find_node_by_path(root, spec->path[i].path);
+		if (!node) {
+			fprintf(stderr, "No such target %s\n", spec->path[i].path);
+			return false;
+		}
+
+		filter_add_loc(filter, node, spec->path[i].recurse);
+	}
+
+	if (spec->target_count > 0) {
+		index = dtree_cronus_index_new(root);
+		if (!index)
+			return false;
+	}
+
+	for (i=0; i<spec->target_count; i++) {
+		const char *target = spec->target[i];
+
+		/* Target without wildcards is a single node */
+		if (!strpbrk(target, "*?[")) {
+			node = dtree_cronus_index_lookup(index, target);
+			if (!node) {
+				fprintf(stderr, "No such target %s\n", target);
+				dtree_cronus_index_free(index);
+				return false;
+			}
+
+			filter_add_loc(filter, node, false);
+			continue;
+		}
+
+		filter->pattern[filter->pattern_count] = target;
+		filter->pattern_count += 1;
+	}
+
+	/* Patterns are matched against the precomputed target strings */
+	if (filter->pattern_count == 0) {
+		if (index)
+			dtree_cronus_index_free(index);
+		return true;
+	}
+
+	filter->index = index;
+	return true;
+}
+
+static bool filter_compile_attrs(struct dtree_filter *filter,
+				 const struct dtree_export_filter *spec,
+				 const struct name_list *alist,
+				 struct dtree_infodb *infodb)
+{
+	int i, id;
+
+	if (alist && alist->count > 0)
+		filter->attr_required |= FILTER_ATTR_LIST;
+	if (spec && spec->attr_count > 0)
+		filter->attr_required |= FILTER_ATTR_SPEC;
+
+	if (!filter->attr_required)
+		return true;
+
+	filter->attr_mask = calloc(infodb->alist.count, sizeof(uint8_t));
+	if (!filter->attr_mask)
+		return false;
+
+	if (filter->attr_required & FILTER_ATTR_LIST) {
+		for (i=0; i<alist->count; i++) {
+			id = dtree_infodb_attr_id(infodb, alist->name[i]);
+			if (id >= 0)
+				filter->attr_mask[id] |= FILTER_ATTR_LIST;
+		}
+	}
+
+	if (filter->attr_required & FILTER_ATTR_SPEC) {
+		for (i=0; i<spec->attr_count; i++) {
+			id = dtree_infodb_attr_id(infodb, spec->attr[i]);
+			if (id >= 0)
+				filter->attr_mask[id] |= FILTER_ATTR_SPEC;
+		}
+	}
+
+	return true;
+}
+
+struct dtree_filter *dtree_filter_compile(const struct dtree_export_filter *spec,
+					  const struct name_list *alist,
+					  struct dtree_infodb *infodb,
+					  struct dtm_node *root)
+{
+	struct dtree_filter *filter;
+
+	filter = calloc(1, sizeof(struct dtree_filter));
+	if (!filter)
+		return NULL;
+
+	filter->spec = spec;
+	filter->alist = alist;
+
+	if (spec && !filter_compile_nodes(filter, spec, root))
+		goto fail;
+
+	if (!filter_compile_attrs(filter, spec, alist, infodb))
+		goto fail;
+
+	return filter;
+
+fail:
+	dtree_filter_free(filter);
+	return NULL;
+}
+
+static bool filter_is_ancestor(const struct dtm_node *node, const struct dtm_node *child)
+{
+	const struct dtm_node *parent;
+
+	for (parent = dtm_node_parent(child); parent; parent = dtm_node_parent(parent)) {
+		if (parent == node)
+			return true;
+	}
+
+	return false;
+}
+
+static bool filter_match_loc(const struct dtree_filter *filter, struct dtm_node *node)
+{
+	const char *target;
+	int i;
+
+	for (i=0; i<filter->loc_count; i++) {
+		const struct dtree_filter_loc *loc = &filter->loc[i];
+
+		if (node == loc->node)
+			return true;
+		if (loc->recurse && filter_is_ancestor(loc->node, node))
+			return true;
+	}
+
+	if (filter->pattern_count == 0)
+		return false;
+
+	target = dtree_cronus_index_target(filter->index, node);
+	if (!target)
+		return false;
+
+	for (i=0; i<filter->pattern_count; i++) {
+		if (fnmatch(filter->pattern[i], target, 0) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Returns 0 if the node is selected, otherwise DTM_TRAVERSE_SKIP if any of the
+ * descendants can be selected or DTM_TRAVERSE_PRUNE if none can be.
+ */
+int dtree_filter_node(const struct dtree_filter *filter, struct dtm_node *node)
+{
+	bool have_loc = filter->have_loc, loc_match = true, class_match = true;
+	int class_id, i;
+
+	if (!have_loc && !filter->class_mask)
+		return 0;
+
+	if (filter->class_mask) {
+		class_id = dtree_node_class(node);
+		class_match = (class_id >= 0 && (filter->class_mask & (1ULL << class_id)));
+	}
+
+	if (have_loc)
+		loc_match = filter_match_loc(filter, node);
+
+	if (loc_match && class_match)
+		return 0;
+
+	/* Without patterns, only the subtrees with selected nodes are visited */
+	if (!have_loc || filter->pattern_count > 0 || loc_match)
+		return DTM_TRAVERSE_SKIP;
+
+	for (i=0; i<filter->loc_count; i++) {
+		if (filter_is_ancestor(node, filter->loc[i].node))
+			return DTM_TRAVERSE_SKIP;
+	}
+
+	return DTM_TRAVERSE_PRUNE;
+}
+
+static bool filter_find_name(char **name, int count, const char *attr_name)
+{
+	int i;
+
+	for (i=0; i<count; i++) {
+		if (strcmp(name[i], attr_name) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Attributes are matched by infodb attribute id.  Attributes which are not
+ * in infodb (id < 0) are rare, and are matched by name.
+ */
+bool dtree_filter_attr(const struct dtree_filter *filter, int id, const char *name)
+{
+	if (!filter->attr_required)
+		return true;
+
+	if (id >= 0)
+		return (filter->attr_mask[id] == filter->attr_required);
+
+	if ((filter->attr_required & FILTER_ATTR_LIST) &&
+	    !dtree_attr_list_exists(filter->alist, name))
+		return false;
+
+	if ((filter->attr_required & FILTER_ATTR_SPEC) &&
+	    !filter_find_name(filter->spec->attr, filter->spec->attr_count, name))
+		return false;
+
+	return true;
+}
+
+void dtree_filter_free(struct dtree_filter *filter)
+{
+	if (filter->index)
+		dtree_cronus_index_free(filter->index);
+
+	free(filter->loc);
+	free(filter->pattern);
+	free(filter->attr_mask);
+	free(filter);
+}
@@ -0,0 +1,36 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __DTREE_FILTER_H__
+#define __DTREE_FILTER_H__
+
+#include <stdbool.h>
+
+#include "dtree.h"
+#include "dtree_attr_list.h"
+#include "dtree_infodb.h"
+
+struct dtree_filter;
+
+struct dtree_filter *dtree_filter_compile(const struct dtree_export_filter *spec,
+					  const struct name_list *alist,
+					  struct dtree_infodb *infodb,
+					  struct dtm_node *root);
+int dtree_filter_node(const struct dtree_filter *filter, struct dtm_node *node);
+bool dtree_filter_attr(const struct dtree_filter *filter, int id, const char *name);
+void dtree_filter_free(struct dtree_filter *filter);
+
+#endif /* __DTREE_FILTER_H__ */
@@ -20,12 +20,23 @@
 #include <assert.h>
 
 #include "libdtm/dtm.h"
+#include "libdtm/dtm_probe.h"
 #include "dtree.h"
 #include "dtree_attr.h"
 #include "dtree_attr_list.h"
+#include "dtree_import.h"
 #include "dtree_infodb.h"
 
 
+/* Attribute updated in the tree, but not yet written to the file */
+struct dtree_import_pending {
+	struct dtm_node *node;
+	const char *name;
+};
+
+/* Statistics of the last import */
+static struct dtree_import_stats import_stats;
+
 struct dtree_import_state {
 	struct dtm_file *dfile;
 	struct dtree_infodb *infodb;
@@ -33,8 +44,28 @@ struct dtree_import_state {
 	struct dtm_node *node;
 	struct dtree_attr *value;
 	int count;
+
+	bool defer;
+	struct dtree_import_pending *pending;
+	int pending_count, pending_allocated;
 };
 
+static void dtree_import_free_value(struct dtree_import_state *state);
+
+static int dtree_import_flush(struct dtree_import_state *state)
+{
+	int i;
+
+	for (i=0; i<state->pending_count; i++) {
+		struct dtree_import_pending *p = &state->pending[i];
+
+		if (!dtm_file_update_node(state->dfile, p->node, p->name))
+			return -1;
+	}
+
+	return 0;
+}
+
 int dtree_import(const char *dtb_path,
 		 const char *infodb_path,
 		 dtree_import_parse_fn parse_fn,
@@ -51,11 +82,17 @@ int dtree_import(const char *dtb_path,
 		return -1;
 
 	root = dtm_file_read(dfile);
-	if (!root)
+	if (!root) {
+		dtm_file_close(dfile);
 		return -2;
+	}
 
-	if (!dtree_infodb_load(infodb_path, &infodb))
+	if (!dtree_infodb_load(infodb_path, &infodb)) {
+		dtree_infodb_free(&infodb);
+		dtm_tree_free(root);
+		dtm_file_close(dfile);
 		return -3;
+	}
 
 	state = (struct dtree_import_state) {
 		.dfile = dfile,
@@ -63,11 +100,50 @@ int dtree_import(const char *dtb_path,
 		.root = root,
 	};
 
+	import_stats = (struct dtree_import_stats) { 0 };
+
 	ret = parse_fn(&state, priv);
+	if (ret == 0) {
+		uint64_t start = dtm_stats_start();
+
+		ret = dtree_import_flush(&state);
+		dtm_stats_stop(DTM_STATS_WRITE, start);
+	}
+
+	dtm_file_dirty(dfile, &import_stats.bytes, &import_stats.pages);
+
+	free(state.pending);
+	dtree_import_free_value(&state);
+	dtree_infodb_free(&infodb);
+	dtm_tree_free(root);
 	dtm_file_close(dfile);
 	return ret;
 }
 
+void dtree_import_get_stats(struct dtree_import_stats *stats)
+{
+	*stats = import_stats;
+}
+
+void dtree_import_set_stats(const struct dtree_import_stats *stats)
+{
+	import_stats = *stats;
+}
+
+void dtree_import_defer(void *ctx)
+{
+	struct dtree_import_state *state = (struct dtree_import_state *)ctx;
+
+	state->defer = true;
+}
+
+struct dtree_infodb *dtree_import_infodb(void *ctx)
+{
+	struct dtree_import_state *state = (struct dtree_import_state *)ctx;
+
+	return state->infodb;
+}
+
 void *dtree_import_root(void *ctx)
 {
 	struct dtree_import_state *state = (struct dtree_import_state *)ctx;
@@ -101,7 +177,7 @@ int dtree_import_set_node(struct dtm_node *node, void *ctx)
 	return 0;
 }
 
-int dtree_import_attr(const char *attr_name, void *ctx, struct dtree_attr **value)
+static int _dtree_import_attr(const char *attr_name, void *ctx, struct dtree_attr **value)
 {
 	struct dtree_import_state *state = (struct dtree_import_state *)ctx;
 	struct dtree_attr *attr;
@@ -143,12 +219,24 @@ done:
 	return 0;
 }
 
-int dtree_import_attr_update(void *ctx)
+int dtree_import_attr(const char *attr_name, void *ctx, struct dtree_attr **value)
+{
+	int ret;
+
+	DTM_PROBE1(import_attr_start, attr_name);
+	ret = _dtree_import_attr(attr_name, ctx, value);
+	DTM_PROBE2(import_attr_end, attr_name, ret);
+
+	return ret;
+}
+
+static int _dtree_import_attr_update(void *ctx)
 {
 	struct dtree_import_state *state = (struct dtree_import_state *)ctx;
 	struct dtm_property *prop;
+	const uint8_t *cur;
 	uint8_t *buf;
-	int len = 0;
+	int len = 0, cur_len;
 	bool ok;
 
 	if (!state->node)
@@ -166,8 +254,39 @@ int dtree_import_attr_update(void *ctx)
 		return -1;
 
 	dtree_attr_encode(state->value, &buf, &len);
+
+	/* Most of the values in a re-imported dump are not changed */
+	cur = dtm_prop_value(prop, &cur_len);
+	if (cur_len == len && memcmp(cur, buf, len) == 0) {
+		free(buf);
+		import_stats.unchanged += 1;
+		return 0;
+	}
+
 	dtm_prop_set_value(prop, buf, len);
 	free(buf);
+	import_stats.updated += 1;
+
+	if (state->defer) {
+		if (state->pending_count == state->pending_allocated) {
+			struct dtree_import_pending *pending;
+			int n = state->pending_allocated ? state->pending_allocated * 2 : 64;
+
+			pending = realloc(state->pending, n * sizeof(struct dtree_import_pending));
+			if (!pending)
+				return -1;
+
+			state->pending = pending;
+			state->pending_allocated = n;
+		}
+
+		state->pending[state->pending_count] = (struct dtree_import_pending) {
+			.node = state->node,
+			.name = dtm_prop_name(prop),
+		};
+		state->pending_count += 1;
+		return 0;
+	}
 
 	ok = dtm_file_update_node(state->dfile, state->node, state->value->name);
 	if (!ok)
@@ -175,3 +294,21 @@ int dtree_import_attr_update(void *ctx)
 
 	return 0;
 }
+
+int dtree_import_attr_update(void *ctx)
+{
+	struct dtree_import_state *state = (struct dtree_import_state *)ctx;
+	const char *name = NULL;
+	int len = 0, ret;
+
+	if (state->value) {
+		name = state->value->name;
+		len = state->value->count * state->value->elem_size;
+	}
+
+	DTM_PROBE2(import_attr_update_start, name, len);
+	ret = _dtree_import_attr_update(ctx);
+	DTM_PROBE3(import_attr_update_end, name, len, ret);
+
+	return ret;
+}
@@ -0,0 +1,27 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __DTREE_IMPORT_H__
+#define __DTREE_IMPORT_H__
+
+#include "dtree.h"
+
+struct dtree_infodb;
+
+struct dtree_infodb *dtree_import_infodb(void *ctx);
+void dtree_import_set_stats(const struct dtree_import_stats *stats);
+
+#endif /* __DTREE_IMPORT_H__ */
@@ -18,7 +18,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <endian.h>
 
+#include "libdtm/dtm.h"
+#include "libdtm/dtm_hash.h"
 #include "dtree.h"
 #include "dtree_attr.h"
 #include "dtree_infodb.h"
@@ -275,7 +278,7 @@ static bool dtree_infodb_read_targets(FILE *fp, struct dtree_infodb *infodb)
 	count = count_values(data);
 
 	infodb->tlist.count = count;
-	infodb->tlist.target = (struct dtree_target *)malloc(count * sizeof(struct dtree_target));
+	infodb->tlist.target = (struct dtree_target *)calloc(count, sizeof(struct dtree_target));
 	if(!infodb->tlist.target)
 		return false;
 
@@ -328,19 +331,111 @@ static bool dtree_infodb_read_target(FILE *fp, struct dtree_infodb *infodb)
 	return true;
 }
 
+/*
+ * Encode default values of all the attributes once, so that the same encoded
+ * value can be shared by all the targets.
+ */
+static bool dtree_infodb_encode_defaults(struct dtree_infodb *infodb)
+{
+	uint8_t *ptr;
+	size_t total = 0;
+	int i;
+
+	for (i=0; i<infodb->alist.count; i++) {
+		struct dtree_attr *attr = &infodb->alist.attr[i];
+		int len = attr->count * attr->elem_size;
+
+		total += len;
+		if (len > infodb->value_max)
+			infodb->value_max = len;
+	}
+
+	/* Nothing to encode, calloc(0) and malloc(0) may return NULL */
+	if (total == 0)
+		total = 1;
+
+	infodb->blob = calloc(infodb->alist.count ? infodb->alist.count : 1,
+			      sizeof(struct dtree_attr_blob));
+	if (!infodb->blob)
+		return false;
+
+	infodb->blob_data = malloc(total);
+	if (!infodb->blob_data)
+		return false;
+
+	ptr = infodb->blob_data;
+	for (i=0; i<infodb->alist.count; i++) {
+		struct dtree_attr *attr = &infodb->alist.attr[i];
+
+		infodb->blob[i] = (struct dtree_attr_blob) {
+			.data = ptr,
+			.len = attr->count * attr->elem_size,
+		};
+
+		dtree_attr_encode_buf(attr, ptr);
+		ptr += infodb->blob[i].len;
+	}
+
+	return true;
+}
+
+static uint32_t dtree_infodb_name_hash(const char *name)
+{
+	return dtm_hash64(DTM_HASH64_INIT, name, strlen(name));
+}
+
+/*
+ * Open addressing hash table of attribute ids indexed by attribute name, with
+ * at least twice as many slots as attributes.  Empty slots are -1.
+ */
+static bool dtree_infodb_build_hash(struct dtree_infodb *infodb)
+{
+	uint32_t size = 16, slot;
+	int i;
+
+	while (size < 2 * infodb->alist.count)
+		size *= 2;
+
+	infodb->attr_hash = malloc(size * sizeof(int));
+	if (!infodb->attr_hash)
+		return false;
+
+	memset(infodb->attr_hash, 0xff, size * sizeof(int));
+	infodb->attr_mask = size - 1;
+
+	for (i=0; i<infodb->alist.count; i++) {
+		slot = dtree_infodb_name_hash(infodb->alist.attr[i].name) & infodb->attr_mask;
+		while (infodb->attr_hash[slot] != -1)
+			slot = (slot + 1) & infodb->attr_mask;
+
+		infodb->attr_hash[slot] = i;
+	}
+
+	return true;
+}
+
 bool dtree_infodb_load(const char *filename, struct dtree_infodb *infodb)
 {
 	FILE *fp;
+	uint64_t start;
 	bool rc;
 
+	*infodb = (struct dtree_infodb) { 0 };
+
 	fp = fopen(filename, "r");
 	if (!fp)
 		return false;
 
+	start = dtm_stats_start();
+
 	rc = dtree_infodb_read_all(fp, infodb);
 	if (!rc)
 		goto done;
 
+	rc = dtree_infodb_build_hash(infodb);
+	if (!rc)
+		goto done;
+
 	rc = dtree_infodb_read_attr(fp, infodb);
 	if (!rc)
 		goto done;
@@ -353,19 +448,156 @@ bool dtree_infodb_load(const char *filename, struct dtree_infodb *infodb)
 	if (!rc)
 		goto done;
 
+	rc = dtree_infodb_encode_defaults(infodb);
+	if (!rc)
+		goto done;
+
 done:
 	fclose(fp);
+	dtm_stats_stop(DTM_STATS_INFODB, start);
 	return rc;
 }
 
-struct dtree_attr *dtree_infodb_attr(struct dtree_infodb *infodb, const char *name)
+/*
+ * Read the information of a single attribute without loading the whole
+ * database.  Returns 0 on success, 1 if the attribute is not found and -1
+ * on failure.
+ */
+int dtree_infodb_load_attr(const char *filename, const char *name, struct dtree_attr *attr)
+{
+	FILE *fp;
+	char *line = NULL;
+	size_t len = 0, namelen;
+	ssize_t n;
+	int ret = 1;
+
+	namelen = strlen(name);
+	if (namelen >= DTREE_ATTR_MAX_LEN)
+		return 1;
+
+	fp = fopen(filename, "r");
+	if (!fp)
+		return -1;
+
+	while ((n = getline(&line, &len, fp)) != -1) {
+		if (strncmp(line, name, namelen) != 0 || line[namelen] != ' ')
+			continue;
+
+		if (line[n-1] == '\n')
+			line[n-1] = '\0';
+
+		*attr = (struct dtree_attr) { 0 };
+		strcpy(attr->name, name);
+
+		if (dtree_infodb_attr_parse(attr, line + namelen + 1)) {
+			ret = 0;
+		} else {
+			fprintf(stderr, "Failed to read %s\n", name);
+			dtree_attr_free(attr);
+			ret = -1;
+		}
+		break;
+	}
+
+	free(line);
+	fclose(fp);
+	return ret;
+}
+
+/*
+ * Digest of the encoding of all the attributes, i.e. name, type, element
+ * size and count.  Encoded values can be copied between device trees built
+ * with infodbs having the same digest.
+ */
+uint64_t dtree_infodb_digest(const struct dtree_infodb *infodb)
 {
+	uint64_t hash = DTM_HASH64_INIT;
 	int i;
 
 	for (i=0; i<infodb->alist.count; i++) {
-		struct dtree_attr *attr = &infodb->alist.attr[i];
-		if (strcmp(attr->name, name) == 0)
-			return attr;
+		const struct dtree_attr *attr = &infodb->alist.attr[i];
+		uint32_t val[3];
+
+		val[0] = htobe32(attr->type);
+		val[1] = htobe32(attr->elem_size);
+		val[2] = htobe32(attr->count);
+
+		hash = dtm_hash64(hash, attr->name, strlen(attr->name) + 1);
+		hash = dtm_hash64(hash, val, sizeof(val));
+		if (attr->spec)
+			hash = dtm_hash64(hash, attr->spec, strlen(attr->spec) + 1);
+	}
+
+	return hash;
+}
+
+/*
+ * Free an attribute loaded from infodb, including the enumeration keys
+ */
+void dtree_infodb_attr_free(struct dtree_attr *attr)
+{
+	int i;
+
+	for (i=0; i<attr->enum_count && attr->aenum; i++)
+		free(attr->aenum[i].key);
+	free(attr->aenum);
+	dtree_attr_free(attr);
+}
+
+void dtree_infodb_free(struct dtree_infodb *infodb)
+{
+	int i;
+
+	for (i=0; i<infodb->alist.count && infodb->alist.attr; i++)
+		dtree_infodb_attr_free(&infodb->alist.attr[i]);
+	free(infodb->alist.attr);
+
+	for (i=0; i<infodb->tlist.count && infodb->tlist.target; i++)
+		free(infodb->tlist.target[i].id);
+	free(infodb->tlist.target);
+
+	free(infodb->blob);
+	free(infodb->blob_data);
+	free(infodb->attr_hash);
+}
+
+int dtree_infodb_attr_id(struct dtree_infodb *infodb, const char *name)
+{
+	uint32_t slot;
+	int id;
+
+	dtm_stats_count(DTM_STATS_LOOKUPS, 1);
+
+	slot = dtree_infodb_name_hash(name) & infodb->attr_mask;
+	while ((id = infodb->attr_hash[slot]) != -1) {
+		if (strcmp(infodb->alist.attr[id].name, name) == 0)
+			return id;
+
+		slot = (slot + 1) & infodb->attr_mask;
+	}
+
+	return -1;
+}
+
+struct dtree_attr *dtree_infodb_attr(struct dtree_infodb *infodb, const char *name)
+{
+	int id;
+
+	id = dtree_infodb_attr_id(infodb, name);
+	if (id < 0)
+		return NULL;
+
+	return &infodb->alist.attr[id];
+}
+
+struct dtree_target *dtree_infodb_target(struct dtree_infodb *infodb, const char *name)
+{
+	int i;
+
+	for (i=0; i<infodb->tlist.count; i++) {
+		struct dtree_target *target = &infodb->tlist.target[i];
+		if (strcmp(target->name, name) == 0)
+			return target;
 	}
 
 	return NULL;
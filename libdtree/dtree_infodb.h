@@ -39,12 +39,29 @@ struct dtree_target_list {
 	struct dtree_target *target;
 };
 
+/* Encoded default value of an attribute, as stored in device tree */
+struct dtree_attr_blob {
+	uint8_t *data;
+	int len;
+};
+
 struct dtree_infodb {
 	struct dtree_attr_list alist;
 	struct dtree_target_list tlist;
+	struct dtree_attr_blob *blob;
+	uint8_t *blob_data;
+	int value_max;
+	int *attr_hash;
+	uint32_t attr_mask;
 };
 
 bool dtree_infodb_load(const char *filename, struct dtree_infodb *infodb);
+void dtree_infodb_free(struct dtree_infodb *infodb);
+int dtree_infodb_load_attr(const char *filename, const char *name, struct dtree_attr *attr);
+void dtree_infodb_attr_free(struct dtree_attr *attr);
+uint64_t dtree_infodb_digest(const struct dtree_infodb *infodb);
+int dtree_infodb_attr_id(struct dtree_infodb *infodb, const char *name);
 struct dtree_attr *dtree_infodb_attr(struct dtree_infodb *infodb, const char *name);
+struct dtree_target *dtree_infodb_target(struct dtree_infodb *infodb, const char *name);
 
 #endif /* __DTREE_INFODB_H__ */
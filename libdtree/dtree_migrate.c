@@ -0,0 +1,508 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <endian.h>
+
+#include "libdtm/dtm.h"
+#include "dtree.h"
+#include "dtree_attr.h"
+#include "dtree_attr_list.h"
+#include "dtree_infodb.h"
+
+/*
+ * Migrate attribute values from an old device tree to a new device tree
+ *
+ * Both the device trees are walked together without reading them into
+ * memory.  The nodes are matched by path, and the children of a node are
+ * expected in the same order in both the trees, so the matching node is
+ * usually the next sibling of the previous match.
+ *
+ * If the encoded value has the same length in both the trees, the value is
+ * copied as is, unless the old infodb shows that the type or dimensions have
+ * changed.  Otherwise the attribute information from infodb is used to
+ * convert the value.  With the old infodb, the old element size and number
+ * of elements are known:
+ *
+ *   - numbers (or strings) are converted to the new element size
+ *   - for a 1-D array with a different number of elements, the common
+ *     elements are converted
+ *
+ * Without the old infodb, they are guessed from the old length:
+ *
+ *   - scalar with a different element size, the number is converted
+ *   - 1-D array with the same element size and different number of
+ *     elements, the common elements are copied
+ *   - array with the same number of elements and a different element size,
+ *     each number (or string) is converted
+ *
+ * A 1-D array whose old length fits both a different element size and a
+ * different number of elements cannot be guessed.  Such attributes, and any
+ * other change, are reported and the new value is retained.
+ */
+
+#define MIGRATE_MAX_DEPTH	64
+
+struct dtree_migrate_state {
+	struct dtm_file *old_dfile;
+	const char *infodb_path;
+	const char *old_infodb_path;
+	struct name_list alist;
+	int old_offset[MIGRATE_MAX_DEPTH];
+	int old_prev[MIGRATE_MAX_DEPTH];
+	int old_node;
+	struct dtree_attr *attr;
+	int attr_count;
+	struct dtree_attr *old_attr;
+	int old_attr_count;
+	uint8_t *buf;
+	int buflen;
+	int failed;
+};
+
+/* Values are only 4-byte aligned in device tree, so copy the numbers */
+static uint64_t migrate_get_num(const uint8_t *ptr, int size, bool is_signed)
+{
+	uint64_t val;
+
+	if (size == 1) {
+		val = is_signed ? (uint64_t)(int8_t)*ptr : *ptr;
+	} else if (size == 2) {
+		uint16_t v;
+
+		memcpy(&v, ptr, 2);
+		v = be16toh(v);
+		val = is_signed ? (uint64_t)(int16_t)v : v;
+	} else if (size == 4) {
+		uint32_t v;
+
+		memcpy(&v, ptr, 4);
+		v = be32toh(v);
+		val = is_signed ? (uint64_t)(int32_t)v : v;
+	} else {
+		memcpy(&val, ptr, 8);
+		val = be64toh(val);
+	}
+
+	return val;
+}
+
+static void migrate_set_num(uint8_t *ptr, int size, uint64_t val)
+{
+	if (size == 1) {
+		*ptr = val & 0xff;
+	} else if (size == 2) {
+		uint16_t v = htobe16(val & 0xffff);
+
+		memcpy(ptr, &v, 2);
+	} else if (size == 4) {
+		uint32_t v = htobe32(val & 0xffffffff);
+
+		memcpy(ptr, &v, 4);
+	} else {
+		uint64_t v = htobe64(val);
+
+		memcpy(ptr, &v, 8);
+	}
+}
+
+static bool migrate_valid_size(int size)
+{
+	return (size == 1 || size == 2 || size == 4 || size == 8);
+}
+
+/* Check if the value has the same encoding in both the infodbs */
+static bool migrate_same_type(const struct dtree_attr *attr, const struct dtree_attr *old_attr)
+{
+	int i;
+
+	if (attr->type != old_attr->type ||
+	    attr->elem_size != old_attr->elem_size ||
+	    attr->count != old_attr->count ||
+	    attr->dim_count != old_attr->dim_count)
+		return false;
+
+	for (i=0; i<attr->dim_count; i++) {
+		if (attr->dim[i] != old_attr->dim[i])
+			return false;
+	}
+
+	return true;
+}
+
+static bool migrate_is_signed(const struct dtree_attr *attr)
+{
+	return (attr->type == DTREE_ATTR_TYPE_INT8 ||
+		attr->type == DTREE_ATTR_TYPE_INT16 ||
+		attr->type == DTREE_ATTR_TYPE_INT32 ||
+		attr->type == DTREE_ATTR_TYPE_INT64);
+}
+
+static void migrate_copy_string(const struct dtree_attr *attr, int i,
+				const uint8_t *old, int old_size, uint8_t *buf)
+{
+	const char *s = (const char *)old + i * old_size;
+	size_t len = strnlen(s, old_size);
+
+	if (len > attr->elem_size - 1)
+		len = attr->elem_size - 1;
+
+	memcpy(buf + i * attr->elem_size, s, len);
+}
+
+/* Convert old encoded value using the attribute information from old infodb */
+static bool migrate_convert_old(const struct dtree_attr *attr,
+				const struct dtree_attr *old_attr,
+				const uint8_t *old, int old_len,
+				uint8_t *buf, int buflen)
+{
+	bool is_string = (attr->type == DTREE_ATTR_TYPE_STRING);
+	int count, i;
+
+	if (attr->type == DTREE_ATTR_TYPE_COMPLEX ||
+	    old_attr->type == DTREE_ATTR_TYPE_COMPLEX)
+		return false;
+
+	if (is_string != (old_attr->type == DTREE_ATTR_TYPE_STRING))
+		return false;
+
+	if (old_len != old_attr->count * old_attr->elem_size)
+		return false;
+
+	count = old_attr->count;
+	if (old_attr->dim_count > 1 || attr->dim_count > 1) {
+		/* The elements of multi-dimensional arrays move with the dimensions */
+		if (old_attr->dim_count != attr->dim_count)
+			return false;
+
+		for (i=0; i<attr->dim_count; i++) {
+			if (old_attr->dim[i] != attr->dim[i])
+				return false;
+		}
+	} else if (count > attr->count) {
+		count = attr->count;
+	}
+
+	if (is_string)
+		memset(buf, 0, buflen);
+
+	for (i=0; i<count; i++) {
+		uint64_t val;
+
+		if (is_string) {
+			migrate_copy_string(attr, i, old, old_attr->elem_size, buf);
+			continue;
+		}
+
+		val = migrate_get_num(old + i * old_attr->elem_size,
+				      old_attr->elem_size, migrate_is_signed(old_attr));
+		migrate_set_num(buf + i * attr->elem_size, attr->elem_size, val);
+	}
+
+	return true;
+}
+
+/*
+ * Convert old encoded value to the new encoding, buf contains the new
+ * value which is retained for the elements missing in old value.
+ */
+static bool migrate_convert(const struct dtree_attr *attr,
+			    const struct dtree_attr *old_attr,
+			    const uint8_t *old, int old_len,
+			    uint8_t *buf, int buflen)
+{
+	bool is_signed;
+	int old_size, i;
+
+	if (old_attr && old_attr->type != DTREE_ATTR_TYPE_UNKNOWN)
+		return migrate_convert_old(attr, old_attr, old, old_len, buf, buflen);
+
+	if (attr->type == DTREE_ATTR_TYPE_COMPLEX)
+		return false;
+
+	if (attr->type == DTREE_ATTR_TYPE_STRING) {
+		if (old_len % attr->count != 0)
+			return false;
+
+		old_size = old_len / attr->count;
+		memset(buf, 0, buflen);
+
+		for (i=0; i<attr->count; i++)
+			migrate_copy_string(attr, i, old, old_size, buf);
+
+		return true;
+	}
+
+	if (attr->count > 1 && attr->dim_count == 1 &&
+	    old_len % attr->elem_size == 0) {
+		/* Same number of elements of another size, cannot guess which */
+		if (old_len % attr->count == 0 &&
+		    migrate_valid_size(old_len / attr->count))
+			return false;
+
+		memcpy(buf, old, old_len < buflen ? old_len : buflen);
+		return true;
+	}
+
+	if (old_len % attr->count != 0)
+		return false;
+
+	old_size = old_len / attr->count;
+	if (!migrate_valid_size(old_size))
+		return false;
+
+	is_signed = migrate_is_signed(attr);
+
+	for (i=0; i<attr->count; i++) {
+		uint64_t val;
+
+		val = migrate_get_num(old + i * old_size, old_size, is_signed);
+		migrate_set_num(buf + i * attr->elem_size, attr->elem_size, val);
+	}
+
+	return true;
+}
+
+/* Attribute information is loaded from infodb only for the changed attributes */
+static struct dtree_attr *migrate_attr(const char *infodb_path,
+				       struct dtree_attr **attr_list, int *attr_count,
+				       const char *name)
+{
+	struct dtree_attr *attr;
+	int i, ret;
+
+	for (i=0; i<*attr_count; i++) {
+		if (strcmp((*attr_list)[i].name, name) == 0)
+			return &(*attr_list)[i];
+	}
+
+	attr = reallocarray(*attr_list, *attr_count + 1, sizeof(struct dtree_attr));
+	if (!attr)
+		return NULL;
+
+	*attr_list = attr;
+	attr = &attr[*attr_count];
+
+	ret = dtree_infodb_load_attr(infodb_path, name, attr);
+	if (ret == 1) {
+		*attr = (struct dtree_attr) {
+			.type = DTREE_ATTR_TYPE_UNKNOWN,
+		};
+		strcpy(attr->name, name);
+	} else if (ret < 0) {
+		return NULL;
+	}
+
+	*attr_count += 1;
+	return attr;
+}
+
+static int dtree_migrate_prop(struct dtm_file *dfile, int offset,
+			      const char *name, const void *value, int value_len,
+			      void *priv)
+{
+	struct dtree_migrate_state *state = (struct dtree_migrate_state *)priv;
+	struct dtree_attr *attr, *old_attr = NULL;
+	const uint8_t *old;
+	int old_len;
+
+	if (strncmp(name, "ATTR", 4) != 0)
+		return 0;
+
+	if (!dtree_attr_list_exists(&state->alist, name))
+		return 0;
+
+	old = dtm_file_get_property(state->old_dfile, state->old_node, name, &old_len);
+	if (!old)
+		return 0;
+
+	if (old_len == value_len && !state->old_infodb_path)
+		goto copy;
+
+	attr = migrate_attr(state->infodb_path, &state->attr, &state->attr_count, name);
+	if (!attr)
+		return -1;
+
+	if (state->old_infodb_path) {
+		old_attr = migrate_attr(state->old_infodb_path, &state->old_attr,
+					&state->old_attr_count, name);
+		if (!old_attr)
+			return -1;
+
+		/* Same length is not the same encoding, e.g. uint8[8] and uint64 */
+		if (old_len == value_len &&
+		    (attr->type == DTREE_ATTR_TYPE_UNKNOWN ||
+		     old_attr->type == DTREE_ATTR_TYPE_UNKNOWN ||
+		     migrate_same_type(attr, old_attr)))
+			goto copy;
+	}
+
+	if (attr->type == DTREE_ATTR_TYPE_UNKNOWN) {
+		fprintf(stderr, "Cannot migrate %s, not found in infodb\n", name);
+		state->failed += 1;
+		return 0;
+	}
+
+	if (value_len != attr->count * attr->elem_size) {
+		fprintf(stderr, "Invalid length %d for %s\n", value_len, name);
+		state->failed += 1;
+		return 0;
+	}
+
+	if (value_len > state->buflen) {
+		uint8_t *buf;
+
+		buf = realloc(state->buf, value_len);
+		if (!buf)
+			return -1;
+
+		state->buf = buf;
+		state->buflen = value_len;
+	}
+
+	memcpy(state->buf, value, value_len);
+
+	if (!migrate_convert(attr, old_attr, old, old_len, state->buf, value_len)) {
+		fprintf(stderr, "Cannot migrate %s, size changed from %d to %d%s\n",
+			name, old_len, value_len,
+			state->old_infodb_path ? "" : " (needs old infodb)");
+		state->failed += 1;
+		return 0;
+	}
+
+	if (!dtm_file_set_property(dfile, offset, name, state->buf, value_len))
+		return -1;
+
+	return 0;
+
+copy:
+	if (memcmp(old, value, value_len) == 0)
+		return 0;
+
+	if (!dtm_file_set_property(dfile, offset, name, old, old_len))
+		return -1;
+
+	return 0;
+}
+
+static int dtree_migrate_node(struct dtm_file *dfile, int offset, int depth,
+			      const char *name, void *priv)
+{
+	struct dtree_migrate_state *state = (struct dtree_migrate_state *)priv;
+	const char *old_name;
+	int parent, old_offset;
+
+	if (depth >= MIGRATE_MAX_DEPTH)
+		return -1;
+
+	if (depth == 0) {
+		old_offset = 0;
+	} else {
+		parent = state->old_offset[depth-1];
+		if (parent < 0) {
+			old_offset = -1;
+			goto done;
+		}
+
+		/* Try the next sibling of previous match, before searching */
+		old_offset = dtm_file_next_subnode(state->old_dfile, parent, state->old_prev[depth]);
+		if (old_offset >= 0) {
+			old_name = dtm_file_node_name(state->old_dfile, old_offset);
+			if (!old_name || strcmp(old_name, name) != 0)
+				old_offset = -1;
+		}
+
+		if (old_offset < 0)
+			old_offset = dtm_file_subnode_offset(state->old_dfile, parent, name);
+
+		if (old_offset >= 0)
+			state->old_prev[depth] = old_offset;
+	}
+
+done:
+	state->old_offset[depth] = old_offset;
+	if (depth+1 < MIGRATE_MAX_DEPTH)
+		state->old_prev[depth+1] = -1;
+
+	if (old_offset < 0)
+		return 0;
+
+	state->old_node = old_offset;
+	return dtm_file_scan_properties(dfile, offset, dtree_migrate_prop, state);
+}
+
+int dtree_migrate(const char *old_dtb_path,
+		  const char *new_dtb_path,
+		  const char *infodb_path,
+		  const char *old_infodb_path,
+		  const char *attrdb_path)
+{
+	struct dtree_migrate_state state;
+	struct dtm_file *dfile;
+	int ret = -1, i;
+
+	state = (struct dtree_migrate_state) {
+		.infodb_path = infodb_path,
+		.old_infodb_path = old_infodb_path,
+	};
+
+	if (!dtree_attr_list_parse(attrdb_path, &state.alist)) {
+		fprintf(stderr, "Failed to read %s\n", attrdb_path);
+		return -1;
+	}
+
+	if (state.alist.count == 0) {
+		dtree_attr_list_free(&state.alist);
+		return 0;
+	}
+
+	state.buflen = 256;
+	state.buf = malloc(state.buflen);
+	if (!state.buf)
+		goto fail_buf;
+
+	state.old_dfile = dtm_file_open(old_dtb_path, false);
+	if (!state.old_dfile)
+		goto fail_old;
+
+	dfile = dtm_file_open(new_dtb_path, true);
+	if (!dfile)
+		goto fail_new;
+
+	ret = dtm_file_scan(dfile, dtree_migrate_node, &state);
+	if (ret == 0 && state.failed > 0)
+		ret = 1;
+
+	dtm_file_close(dfile);
+
+fail_new:
+	dtm_file_close(state.old_dfile);
+
+fail_old:
+	free(state.buf);
+
+fail_buf:
+	for (i=0; i<state.attr_count; i++)
+		dtree_infodb_attr_free(&state.attr[i]);
+	free(state.attr);
+	for (i=0; i<state.old_attr_count; i++)
+		dtree_infodb_attr_free(&state.old_attr[i]);
+	free(state.old_attr);
+	dtree_attr_list_free(&state.alist);
+	return ret;
+}
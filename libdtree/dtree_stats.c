@@ -0,0 +1,328 @@
+/* Copyright 2021 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libdtm/dtm.h"
+#include "dtree.h"
+#include "dtree_infodb.h"
+#include "dtree_util.h"
+
+/* Destination of the statistics printed at exit, from PDATA_STATS */
+static const char *stats_output;
+
+static void dtree_stats_exit(void)
+{
+	FILE *fp;
+
+	if (strcmp(stats_output, "1") == 0 || strcmp(stats_output, "stderr") == 0) {
+		dtm_stats_print(stderr, false);
+		return;
+	}
+
+	fp = fopen(stats_output, "w");
+	if (!fp) {
+		fprintf(stderr, "Failed to write statistics to %s\n", stats_output);
+		return;
+	}
+
+	dtm_stats_print(fp, true);
+	fclose(fp);
+}
+
+bool dtree_stats_init(void)
+{
+	const char *output;
+
+	if (stats_output)
+		return true;
+
+	output = getenv("PDATA_STATS");
+	if (!output || output[0] == '\0')
+		return false;
+
+	if (atexit(dtree_stats_exit) != 0)
+		return false;
+
+	stats_output = output;
+	dtm_stats_enable(true);
+	return true;
+}
+
+void dtree_stats_print(FILE *fp, bool json)
+{
+	dtm_stats_print(fp, json);
+}
+
+void dtree_stats_reset(void)
+{
+	dtm_stats_reset();
+}
+
+/* Usage of a target class, the last one for nodes without a class */
+struct dtree_stats_class {
+	int nodes;
+	int properties;
+	size_t value_bytes;
+};
+
+/* A property, or the usage of all the properties with the same name */
+struct dtree_stats_attr {
+	const char *name;
+	int count;
+	size_t value_bytes;
+	int defaults;
+};
+
+struct dtree_stats_state {
+	struct dtree_infodb *infodb;
+	struct dtree_stats_class cls[DTREE_CLASS_COUNT+1];
+	struct dtree_stats_attr *attr;
+	int attr_count, attr_alloc;
+};
+
+static int dtree_stats_class_id(struct dtm_node *node)
+{
+	int class_id;
+
+	class_id = dtree_node_class(node);
+	if (class_id < 0)
+		return DTREE_CLASS_COUNT;
+
+	return class_id;
+}
+
+static int dtree_stats_node(struct dtm_node *node, void *priv)
+{
+	struct dtree_stats_state *state = (struct dtree_stats_state *)priv;
+
+	state->cls[dtree_stats_class_id(node)].nodes += 1;
+	return 0;
+}
+
+static int dtree_stats_prop(struct dtm_node *node, struct dtm_property *prop, void *priv)
+{
+	struct dtree_stats_state *state = (struct dtree_stats_state *)priv;
+	struct dtree_stats_class *cls;
+	struct dtree_stats_attr *attr;
+	const void *buf;
+	int buflen, id;
+
+	buf = dtm_prop_value(prop, &buflen);
+
+	cls = &state->cls[dtree_stats_class_id(node)];
+	cls->properties += 1;
+	cls->value_bytes += buflen;
+
+	if (state->attr_count == state->attr_alloc) {
+		int alloc = state->attr_alloc ? 2 * state->attr_alloc : 1024;
+
+		attr = realloc(state->attr, alloc * sizeof(struct dtree_stats_attr));
+		if (!attr)
+			return -1;
+
+		state->attr = attr;
+		state->attr_alloc = alloc;
+	}
+
+	attr = &state->attr[state->attr_count++];
+	*attr = (struct dtree_stats_attr) {
+		.name = dtm_prop_name(prop),
+		.count = 1,
+		.value_bytes = buflen,
+		.defaults = -1,
+	};
+
+	if (state->infodb) {
+		id = dtree_infodb_attr_id(state->infodb, attr->name);
+		if (id >= 0) {
+			struct dtree_attr_blob *blob = &state->infodb->blob[id];
+
+			attr->defaults = (buflen == blob->len && memcmp(buf, blob->data, buflen) == 0);
+		}
+	}
+
+	return 0;
+}
+
+static int dtree_stats_attr_name_cmp(const void *a, const void *b)
+{
+	const struct dtree_stats_attr *attr1 = a, *attr2 = b;
+
+	return strcmp(attr1->name, attr2->name);
+}
+
+static int dtree_stats_attr_size_cmp(const void *a, const void *b)
+{
+	const struct dtree_stats_attr *attr1 = a, *attr2 = b;
+
+	if (attr1->value_bytes != attr2->value_bytes)
+		return (attr1->value_bytes < attr2->value_bytes) ? 1 : -1;
+
+	return strcmp(attr1->name, attr2->name);
+}
+
+/* Merge the properties with the same name, largest usage first */
+static void dtree_stats_attr_merge(struct dtree_stats_state *state)
+{
+	int i, count = 0;
+
+	if (state->attr_count == 0)
+		return;
+
+	qsort(state->attr, state->attr_count, sizeof(struct dtree_stats_attr),
+	      dtree_stats_attr_name_cmp);
+
+	for (i=1; i<state->attr_count; i++) {
+		struct dtree_stats_attr *attr = &state->attr[count];
+
+		if (strcmp(attr->name, state->attr[i].name) == 0) {
+			attr->count += 1;
+			attr->value_bytes += state->attr[i].value_bytes;
+			if (attr->defaults >= 0)
+				attr->defaults += state->attr[i].defaults;
+		} else {
+			state->attr[++count] = state->attr[i];
+		}
+	}
+	state->attr_count = count + 1;
+
+	qsort(state->attr, state->attr_count, sizeof(struct dtree_stats_attr),
+	      dtree_stats_attr_size_cmp);
+}
+
+static void dtree_stats_tree_print(const struct dtm_tree_stats *stats,
+				   struct dtree_stats_state *state,
+				   FILE *fp)
+{
+	int i;
+
+	fprintf(fp, "Tree\n");
+	fprintf(fp, "  %-20s %12d\n", "nodes", stats->nodes);
+	fprintf(fp, "  %-20s %12d\n", "properties", stats->properties);
+	fprintf(fp, "  %-20s %12zu\n", "name bytes", stats->name_bytes);
+	fprintf(fp, "  %-20s %12zu\n", "value bytes", stats->value_bytes);
+	fprintf(fp, "  %-20s %12zu\n", "borrowed bytes", stats->borrowed_bytes);
+	fprintf(fp, "  %-20s %12zu\n", "struct bytes", stats->struct_bytes);
+	fprintf(fp, "  %-20s %12zu\n", "list bytes", stats->list_bytes);
+	fprintf(fp, "  %-20s %12zu\n", "allocations", stats->allocs);
+	fprintf(fp, "  %-20s %12zu\n", "total bytes",
+		stats->name_bytes + stats->value_bytes + stats->struct_bytes);
+	fprintf(fp, "  %-20s %12d\n", "max depth", stats->max_depth);
+
+	fprintf(fp, "\nFan-out\n");
+	fprintf(fp, "  %-20s %12s\n", "children", "nodes");
+	for (i=0; i<DTM_TREE_STATS_FANOUT; i++) {
+		char range[32];
+
+		if (i == 0)
+			snprintf(range, sizeof(range), "0");
+		else if (i == 1)
+			snprintf(range, sizeof(range), "1");
+		else if (i == DTM_TREE_STATS_FANOUT-1)
+			snprintf(range, sizeof(range), "%d+", 1 << (i-1));
+		else
+			snprintf(range, sizeof(range), "%d-%d", 1 << (i-1), (1 << i) - 1);
+
+		fprintf(fp, "  %-20s %12d\n", range, stats->fanout[i]);
+	}
+
+	fprintf(fp, "\nLargest properties\n");
+	fprintf(fp, "  %12s  %s\n", "bytes", "property");
+	for (i=0; i<stats->largest_count; i++) {
+		char *path;
+		int len;
+
+		dtm_prop_value(stats->largest[i].prop, &len);
+		path = dtm_node_path(stats->largest[i].node);
+		if (!path)
+			continue;
+
+		/* Root path is "/", avoid printing "//name" */
+		fprintf(fp, "  %12d  %s/%s\n", len, strcmp(path, "/") == 0 ? "" : path,
+			dtm_prop_name(stats->largest[i].prop));
+		free(path);
+	}
+
+	fprintf(fp, "\nBy target class\n");
+	fprintf(fp, "  %-24s %8s %12s %12s\n", "class", "nodes", "properties", "value bytes");
+	for (i=0; i<=DTREE_CLASS_COUNT; i++) {
+		struct dtree_stats_class *cls = &state->cls[i];
+
+		if (cls->nodes == 0)
+			continue;
+
+		fprintf(fp, "  %-24s %8d %12d %12zu\n",
+			i < DTREE_CLASS_COUNT ? dtree_class_to_fapi(i) : "(none)",
+			cls->nodes, cls->properties, cls->value_bytes);
+	}
+
+	fprintf(fp, "\nBy attribute\n");
+	fprintf(fp, "  %-48s %8s %12s %8s\n", "attribute", "nodes", "value bytes", "default");
+	for (i=0; i<state->attr_count; i++) {
+		struct dtree_stats_attr *attr = &state->attr[i];
+
+		if (attr->defaults >= 0)
+			fprintf(fp, "  %-48s %8d %12zu %8d\n",
+				attr->name, attr->count, attr->value_bytes, attr->defaults);
+		else
+			fprintf(fp, "  %-48s %8d %12zu %8s\n",
+				attr->name, attr->count, attr->value_bytes, "-");
+	}
+}
+
+int dtree_stats_tree(const char *dtb_path, const char *infodb_path, FILE *fp)
+{
+	struct dtree_stats_state state = { 0 };
+	struct dtree_infodb infodb;
+	struct dtm_tree_stats stats;
+	struct dtm_file *dfile;
+	struct dtm_node *root;
+	int ret;
+
+	dfile = dtm_file_open(dtb_path, false);
+	if (!dfile)
+		return -1;
+
+	root = dtm_file_read(dfile);
+	dtm_file_close(dfile);
+	if (!root)
+		return -2;
+
+	if (infodb_path) {
+		if (!dtree_infodb_load(infodb_path, &infodb)) {
+			dtm_tree_free(root);
+			return -3;
+		}
+		state.infodb = &infodb;
+	}
+
+	dtm_tree_stats(root, &stats);
+
+	ret = dtm_traverse(root, true, dtree_stats_node, dtree_stats_prop, &state);
+	if (ret == 0) {
+		dtree_stats_attr_merge(&state);
+		dtree_stats_tree_print(&stats, &state, fp);
+	}
+
+	free(state.attr);
+	if (state.infodb)
+		dtree_infodb_free(state.infodb);
+	dtm_tree_free(root);
+	return ret;
+}
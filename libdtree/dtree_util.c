@@ -21,135 +21,205 @@
 #include <ctype.h>
 
 #include "libdtm/dtm.h"
+#include "libdtm/dtm_hash.h"
 
 #include "config.h"
 #include "dtree.h"
 #include "dtree_cronus.h"
+#include "dtree_util.h"
 
-struct {
+static const struct {
 	const char *fapi;
 	const char *dtree;
 	const char *cronus;
-} class_map[] = {
-	{ "TARGET_TYPE_ABUS", "smpgroup", "smpgroup" },
-	{ "TARGET_TYPE_CAPP", "capp", "capp" },
-	{ "TARGET_TYPE_CORE", "core", "c" },
-	{ "TARGET_TYPE_DIMM", "dimm", "dimm" },
-	{ "TARGET_TYPE_DMI", "dmi", "dmi" },
-	{ "TARGET_TYPE_EQ", "eq", "eq" },
-	{ "TARGET_TYPE_EX", "ex", "ex" },
-	{ "TARGET_TYPE_FC", "fc", "fc" },
-	{ "TARGET_TYPE_IOHS", "iohs", "iohs" },
-	{ "TARGET_TYPE_L4", "l4", "l4" },
-	{ "TARGET_TYPE_MBA", "mba", "mba" },
-	{ "TARGET_TYPE_MC", "mc", "mc" },
-	{ "TARGET_TYPE_MCA", "mca", "mca" },
-	{ "TARGET_TYPE_MCBIST", "mcbist", "mcbist" },
-	{ "TARGET_TYPE_MCC", "mcc", "mcc" },
-	{ "TARGET_TYPE_MCS", "mcs", "mcs" },
-	{ "TARGET_TYPE_MEMBUF_CHIP", "membuf_chip", "membuf_chip" },
-	{ "TARGET_TYPE_MEM_PORT", "mem_port", "mem_port" },
-	{ "TARGET_TYPE_MI", "mi", "mi" },
-	{ "TARGET_TYPE_NMMU", "nmmu", "nmmu" },
-	{ "TARGET_TYPE_OBUS", "obus", "obus" },
-	{ "TARGET_TYPE_OBUS_BRICK", "obus_brick", "obus_brick" },
-	{ "TARGET_TYPE_OCMB_CHIP", "ocmb", "ocmb" },
-	{ "TARGET_TYPE_OMI", "omi", "omi" },
-	{ "TARGET_TYPE_OMIC", "omic", "omic" },
-        { "TARGET_TYPE_PAU", "pau", "pau" },
-        { "TARGET_TYPE_PAUC", "pauc", "pauc" },
-	{ "TARGET_TYPE_PEC", "pec", "pec" },
-	{ "TARGET_TYPE_PERV", "chiplet", "perv" },
-	{ "TARGET_TYPE_PERV", "perv", "perv" },
-	{ "TARGET_TYPE_PERV", "ody_chiplet", "perv" },
-	{ "TARGET_TYPE_PHB", "phb", "phb" },
-	{ "TARGET_TYPE_PMIC", "pmic", "pmic" },
-	{ "TARGET_TYPE_PPE", "ppe", "ppe" },
-	{ "TARGET_TYPE_PROC_CHIP", "proc", "proc_chip" },
-	{ "TARGET_TYPE_SBE", "sbe", "sbe" },
-	{ "TARGET_TYPE_SYSTEM", "root", "system" },
-	{ "TARGET_TYPE_XBUS", "xbus", "xbus" },
-	{ "TARGET_TYPE_ADC", "adc", "adc" },
-	{ "TARGET_TYPE_GPIO_EXPANDER", "gpio_expander", "gpio_expander" },
-	{ "TARGET_TYPE_PMIC", "pmic", "pmic" },
-
-	{ "TARGET_TYPE_NX", "nx", "nx" },
-	{ "TARGET_TYPE_OCC", "occ", "occ" },
-
-	{ "TARGET_TYPE_TPM", "tpm", "tpm" },
-	{ "TARGET_TYPE_BMC", "bmc", "bmc" },
-	{ "TARGET_TYPE_OSCREFCLK", "oscrefclk", "oscrefclk" },
-	{ NULL, NULL, NULL },
+} class_map[DTREE_CLASS_COUNT] = {
+	[DTREE_CLASS_ABUS] = { "TARGET_TYPE_ABUS", "smpgroup", "smpgroup" },
+	[DTREE_CLASS_CAPP] = { "TARGET_TYPE_CAPP", "capp", "capp" },
+	[DTREE_CLASS_CORE] = { "TARGET_TYPE_CORE", "core", "c" },
+	[DTREE_CLASS_DIMM] = { "TARGET_TYPE_DIMM", "dimm", "dimm" },
+	[DTREE_CLASS_DMI] = { "TARGET_TYPE_DMI", "dmi", "dmi" },
+	[DTREE_CLASS_EQ] = { "TARGET_TYPE_EQ", "eq", "eq" },
+	[DTREE_CLASS_EX] = { "TARGET_TYPE_EX", "ex", "ex" },
+	[DTREE_CLASS_FC] = { "TARGET_TYPE_FC", "fc", "fc" },
+	[DTREE_CLASS_IOHS] = { "TARGET_TYPE_IOHS", "iohs", "iohs" },
+	[DTREE_CLASS_L4] = { "TARGET_TYPE_L4", "l4", "l4" },
+	[DTREE_CLASS_MBA] = { "TARGET_TYPE_MBA", "mba", "mba" },
+	[DTREE_CLASS_MC] = { "TARGET_TYPE_MC", "mc", "mc" },
+	[DTREE_CLASS_MCA] = { "TARGET_TYPE_MCA", "mca", "mca" },
+	[DTREE_CLASS_MCBIST] = { "TARGET_TYPE_MCBIST", "mcbist", "mcbist" },
+	[DTREE_CLASS_MCC] = { "TARGET_TYPE_MCC", "mcc", "mcc" },
+	[DTREE_CLASS_MCS] = { "TARGET_TYPE_MCS", "mcs", "mcs" },
+	[DTREE_CLASS_MEMBUF_CHIP] = { "TARGET_TYPE_MEMBUF_CHIP", "membuf_chip", "membuf_chip" },
+	[DTREE_CLASS_MEM_PORT] = { "TARGET_TYPE_MEM_PORT", "mem_port", "mem_port" },
+	[DTREE_CLASS_MI] = { "TARGET_TYPE_MI", "mi", "mi" },
+	[DTREE_CLASS_NMMU] = { "TARGET_TYPE_NMMU", "nmmu", "nmmu" },
+	[DTREE_CLASS_OBUS] = { "TARGET_TYPE_OBUS", "obus", "obus" },
+	[DTREE_CLASS_OBUS_BRICK] = { "TARGET_TYPE_OBUS_BRICK", "obus_brick", "obus_brick" },
+	[DTREE_CLASS_OCMB_CHIP] = { "TARGET_TYPE_OCMB_CHIP", "ocmb", "ocmb" },
+	[DTREE_CLASS_OMI] = { "TARGET_TYPE_OMI", "omi", "omi" },
+	[DTREE_CLASS_OMIC] = { "TARGET_TYPE_OMIC", "omic", "omic" },
+	[DTREE_CLASS_PAU] = { "TARGET_TYPE_PAU", "pau", "pau" },
+	[DTREE_CLASS_PAUC] = { "TARGET_TYPE_PAUC", "pauc", "pauc" },
+	[DTREE_CLASS_PEC] = { "TARGET_TYPE_PEC", "pec", "pec" },
+	[DTREE_CLASS_PERV] = { "TARGET_TYPE_PERV", "chiplet", "perv" },
+	[DTREE_CLASS_PHB] = { "TARGET_TYPE_PHB", "phb", "phb" },
+	[DTREE_CLASS_PMIC] = { "TARGET_TYPE_PMIC", "pmic", "pmic" },
+	[DTREE_CLASS_PPE] = { "TARGET_TYPE_PPE", "ppe", "ppe" },
+	[DTREE_CLASS_PROC_CHIP] = { "TARGET_TYPE_PROC_CHIP", "proc", "proc_chip" },
+	[DTREE_CLASS_SBE] = { "TARGET_TYPE_SBE", "sbe", "sbe" },
+	[DTREE_CLASS_SYSTEM] = { "TARGET_TYPE_SYSTEM", "root", "system" },
+	[DTREE_CLASS_XBUS] = { "TARGET_TYPE_XBUS", "xbus", "xbus" },
+	[DTREE_CLASS_ADC] = { "TARGET_TYPE_ADC", "adc", "adc" },
+	[DTREE_CLASS_GPIO_EXPANDER] = { "TARGET_TYPE_GPIO_EXPANDER", "gpio_expander", "gpio_expander" },
+	[DTREE_CLASS_NX] = { "TARGET_TYPE_NX", "nx", "nx" },
+	[DTREE_CLASS_OCC] = { "TARGET_TYPE_OCC", "occ", "occ" },
+	[DTREE_CLASS_TPM] = { "TARGET_TYPE_TPM", "tpm", "tpm" },
+	[DTREE_CLASS_BMC] = { "TARGET_TYPE_BMC", "bmc", "bmc" },
+	[DTREE_CLASS_OSCREFCLK] = { "TARGET_TYPE_OSCREFCLK", "oscrefclk", "oscrefclk" },
 };
 
-const char *dtree_to_fapi_class(const char *dtree_class)
+/*
+ * Perfect hash tables for the dtree and cronus class names.
+ *
+ * The slot of a name is the top 7 bits of 32-bit FNV-1a hash of the name,
+ * with the seed instead of the usual offset basis.  The seeds are chosen
+ * such that there are no collisions.  When a class is added to class_map,
+ * re-create the tables with:
+ *
+ *   scripts/genClassHash.pl libdtree/dtree_util.c > libdtree/dtree_class_hash.h
+ *
+ * Besides the names in class_map, dtree names "perv" and "ody_chiplet" are
+ * aliases of "chiplet".
+ */
+#include "dtree_class_hash.h"
+
+static unsigned int class_hash(const char *name, size_t len, uint32_t seed)
 {
-	int i;
+	return dtm_hash32(seed, name, len) >> 25;
+}
 
-	assert(dtree_class);
+static int class_hash_lookup(const struct class_hash_entry *table,
+			     uint32_t seed,
+			     const char *name,
+			     size_t len)
+{
+	const struct class_hash_entry *entry;
 
-	for (i=0; class_map[i].fapi; i++) {
-		if (strcmp(dtree_class, class_map[i].dtree) == 0)
-			return class_map[i].fapi;
-	}
+	entry = &table[class_hash(name, len, seed)];
+	if (!entry->name)
+		return -1;
 
-	return NULL;
+	if (strncmp(entry->name, name, len) != 0 || entry->name[len] != '\0')
+		return -1;
+
+	return entry->class_id;
 }
 
-const char *cronus_to_dtree_class(const char *cronus_class)
+int dtree_class_count(void)
 {
-	int i;
+	return DTREE_CLASS_COUNT;
+}
 
+int dtree_class_id(const char *dtree_class)
+{
+	assert(dtree_class);
+
+	return class_hash_lookup(dtree_class_hash, DTREE_CLASS_SEED,
+				 dtree_class, strlen(dtree_class));
+}
+
+int cronus_class_id(const char *cronus_class)
+{
 	assert(cronus_class);
 
-	for (i=0; class_map[i].fapi; i++) {
-		if (strcmp(cronus_class, class_map[i].cronus) == 0)
-			return class_map[i].dtree;
-	}
+	return class_hash_lookup(cronus_class_hash, CRONUS_CLASS_SEED,
+				 cronus_class, strlen(cronus_class));
+}
+
+const char *dtree_class_to_fapi(int class_id)
+{
+	assert(class_id >= 0 && class_id < DTREE_CLASS_COUNT);
 
-	return NULL;
+	return class_map[class_id].fapi;
 }
 
-const char *dtree_to_cronus_class(const char *dtree_class)
+const char *dtree_class_to_cronus(int class_id)
 {
-	int i;
+	assert(class_id >= 0 && class_id < DTREE_CLASS_COUNT);
 
-	assert(dtree_class);
+	return class_map[class_id].cronus;
+}
 
-	for (i=0; class_map[i].fapi; i++) {
-		if (strcmp(dtree_class, class_map[i].dtree) == 0)
-			return class_map[i].cronus;
-	}
+const char *dtree_to_fapi_class(const char *dtree_class)
+{
+	int class_id;
+
+	class_id = dtree_class_id(dtree_class);
+	if (class_id < 0)
+		return NULL;
+
+	return class_map[class_id].fapi;
+}
+
+const char *cronus_to_dtree_class(const char *cronus_class)
+{
+	int class_id;
+
+	class_id = cronus_class_id(cronus_class);
+	if (class_id < 0)
+		return NULL;
+
+	return class_map[class_id].dtree;
+}
+
+const char *dtree_to_cronus_class(const char *dtree_class)
+{
+	int class_id;
+
+	class_id = dtree_class_id(dtree_class);
+	if (class_id < 0)
+		return NULL;
 
-	return NULL;
+	return class_map[class_id].cronus;
 }
 
-char *dtree_name_to_class(const char *name)
+/*
+ * Node name is class name followed by index and optional unit address,
+ * e.g. core12, ocmb0@...  Root node has empty name.
+ */
+int dtree_name_to_class_id(const char *name)
 {
-	char *tmp, *tok, *class_name;
-	size_t i, n;
+	size_t len;
 
 	if (name[0] == '\0')
-		return strdup("root");
+		return DTREE_CLASS_SYSTEM;
 
-	tmp = strdup(name);
-	assert(tmp);
+	len = strcspn(name, "@");
+	while (len > 0 && isdigit(name[len-1]))
+		len--;
 
-	tok = strtok(tmp, "@");
-	assert(tok);
+	return class_hash_lookup(dtree_class_hash, DTREE_CLASS_SEED, name, len);
+}
 
-	n = strlen(tok);
-	for (i = n-1; i >= 0; i--) {
-		if (isdigit(tok[i]))
-			tok[i] = '\0';
-		else
-			break;
-	}
+/*
+ * Class of a node is computed only once, and cached as node tag.  Nodes
+ * which do not belong to any class are tagged with DTREE_CLASS_COUNT.
+ */
+int dtree_node_class(struct dtm_node *node)
+{
+	int class_id;
+
+	class_id = dtm_node_tag(node);
+	if (class_id == -1) {
+		class_id = dtree_name_to_class_id(dtm_node_name(node));
+		if (class_id < 0)
+			class_id = DTREE_CLASS_COUNT;
 
-	class_name = strdup(tok);
-	assert(class_name);
+		dtm_node_set_tag(node, class_id);
+	}
 
-	free(tmp);
+	if (class_id == DTREE_CLASS_COUNT)
+		return -1;
 
-	return class_name;
+	return class_id;
 }
@@ -17,9 +17,65 @@
 #ifndef __DTREE_UTIL_H__
 #define __DTREE_UTIL_H__
 
+struct dtm_node;
+
+enum dtree_class {
+	DTREE_CLASS_ABUS,
+	DTREE_CLASS_CAPP,
+	DTREE_CLASS_CORE,
+	DTREE_CLASS_DIMM,
+	DTREE_CLASS_DMI,
+	DTREE_CLASS_EQ,
+	DTREE_CLASS_EX,
+	DTREE_CLASS_FC,
+	DTREE_CLASS_IOHS,
+	DTREE_CLASS_L4,
+	DTREE_CLASS_MBA,
+	DTREE_CLASS_MC,
+	DTREE_CLASS_MCA,
+	DTREE_CLASS_MCBIST,
+	DTREE_CLASS_MCC,
+	DTREE_CLASS_MCS,
+	DTREE_CLASS_MEMBUF_CHIP,
+	DTREE_CLASS_MEM_PORT,
+	DTREE_CLASS_MI,
+	DTREE_CLASS_NMMU,
+	DTREE_CLASS_OBUS,
+	DTREE_CLASS_OBUS_BRICK,
+	DTREE_CLASS_OCMB_CHIP,
+	DTREE_CLASS_OMI,
+	DTREE_CLASS_OMIC,
+	DTREE_CLASS_PAU,
+	DTREE_CLASS_PAUC,
+	DTREE_CLASS_PEC,
+	DTREE_CLASS_PERV,
+	DTREE_CLASS_PHB,
+	DTREE_CLASS_PMIC,
+	DTREE_CLASS_PPE,
+	DTREE_CLASS_PROC_CHIP,
+	DTREE_CLASS_SBE,
+	DTREE_CLASS_SYSTEM,
+	DTREE_CLASS_XBUS,
+	DTREE_CLASS_ADC,
+	DTREE_CLASS_GPIO_EXPANDER,
+	DTREE_CLASS_NX,
+	DTREE_CLASS_OCC,
+	DTREE_CLASS_TPM,
+	DTREE_CLASS_BMC,
+	DTREE_CLASS_OSCREFCLK,
+	DTREE_CLASS_COUNT,
+};
+
 const char *dtree_to_fapi_class(const char *dtree_class);
 const char *cronus_to_dtree_class(const char *cronus_class);
 const char *dtree_to_cronus_class(const char *dtree_class);
-char *dtree_name_to_class(const char *name);
+
+int dtree_class_count(void);
+int dtree_class_id(const char *dtree_class);
+int cronus_class_id(const char *cronus_class);
+int dtree_name_to_class_id(const char *name);
+const char *dtree_class_to_fapi(int class_id);
+const char *dtree_class_to_cronus(int class_id);
+int dtree_node_class(struct dtm_node *node);
 
 #endif /* __DTREE_UTIL_H__ */
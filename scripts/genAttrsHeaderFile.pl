@@ -33,6 +33,8 @@ my $outAttrsHeaderFN;
 my %attributeDefList;
 # To store required targets and attributes
 my %reqAttrsList;
+# To store attributes compile time meta data (name, type, element size, count, spec)
+my @attrInfoList;
 
 # To use for header file handler
 my $AIHeaderFH;
@@ -185,8 +187,8 @@ sub prepareMacros
         }
 
         print {$AIHeaderFH} "\n/* $attrPrefix$attrID */\n";
-        print {$AIHeaderFH} "#define $attrPrefix$attrID\_GETMACRO(ID, TARGET, VAL) getProperty(TARGET, #ID, &VAL, dtAttr::ID##_ElementCount, sizeof(VAL), dtAttr::ID##_TypeName, dtAttr::ID##_Spec)\n" if $attributeDefList{$attrID}->readable eq 1;
-        print {$AIHeaderFH} "#define $attrPrefix$attrID\_SETMACRO(ID, TARGET, VAL) setProperty(TARGET, #ID, &VAL, dtAttr::ID##_ElementCount, sizeof(VAL), dtAttr::ID##_TypeName, dtAttr::ID##_Spec)\n" if $attributeDefList{$attrID}->writeable eq 1;
+        print {$AIHeaderFH} "#define $attrPrefix$attrID\_GETMACRO(ID, TARGET, VAL) getAttr<dtAttr::ID>(TARGET, VAL)\n" if $attributeDefList{$attrID}->readable eq 1;
+        print {$AIHeaderFH} "#define $attrPrefix$attrID\_SETMACRO(ID, TARGET, VAL) setAttr<dtAttr::ID>(TARGET, VAL)\n" if $attributeDefList{$attrID}->writeable eq 1;
     }
     print {$AIHeaderFH} "\n";
 }
@@ -197,9 +199,10 @@ sub prepareMacroToCallPdbgAPI
     # fapi2 namespace, hence its fourced us to use namespace in macros as well to avoid pass
     # fapi2 namespace in application when using below macros
     print {$AIHeaderFH} "// This macro used to read both FAPI and Non-FAPI attribute values from device tree\n";
-    print {$AIHeaderFH} "#define DT_GET_PROP(ID, TARGET, VAL) fapi2::getProperty(TARGET, #ID, &VAL, dtAttr::fapi2::ID##_ElementCount, sizeof(VAL), dtAttr::fapi2::ID##_TypeName, dtAttr::fapi2::ID##_Spec)\n\n";
+    # The attribute meta data is picked at compile time by getAttr and setAttr
+    print {$AIHeaderFH} "#define DT_GET_PROP(ID, TARGET, VAL) fapi2::getAttr<dtAttr::fapi2::ID>(TARGET, VAL)\n\n";
     print {$AIHeaderFH} "// This macro used to write both FAPI and Non-FAPI attribute values into device tree\n";
-    print {$AIHeaderFH} "#define DT_SET_PROP(ID, TARGET, VAL) fapi2::setProperty(TARGET, #ID, &VAL, dtAttr::fapi2::ID##_ElementCount, sizeof(VAL), dtAttr::fapi2::ID##_TypeName, dtAttr::fapi2::ID##_Spec)\n\n";
+    print {$AIHeaderFH} "#define DT_SET_PROP(ID, TARGET, VAL) fapi2::setAttr<dtAttr::fapi2::ID>(TARGET, VAL)\n\n";
 }
 
 sub prepareEndOfHeaderFile
@@ -236,10 +239,44 @@ sub prepareAttrsMetaData
         print {$AIHeaderFH} "\n";
     }
 
+    prepareAttrsId();
+
     print {$AIHeaderFH} "}\n\n"; # fapi2 namespace end
+
+    prepareAttrsInfo();
+
     print {$AIHeaderFH} "}\n\n"; # dtAttr namespace end
 }
 
+sub prepareAttrsId
+{
+    # Attribute ids are used as template argument to pick the attribute meta data
+    print {$AIHeaderFH} "\t/* Attributes id to use with getAttr and setAttr */\n";
+    print {$AIHeaderFH} "\tenum AttrId : uint32_t\n\t{\n";
+    foreach my $attrInfo (@attrInfoList)
+    {
+        print {$AIHeaderFH} "\t\t$attrInfo->[0],\n";
+    }
+    print {$AIHeaderFH} "\t};\n\n";
+}
+
+sub prepareAttrsInfo
+{
+    print {$AIHeaderFH} "/* Attributes meta data known at compile time, used by getAttr and setAttr */\n";
+    foreach my $attrInfo (@attrInfoList)
+    {
+        my ($attrName, $attrType, $attrElemSize, $attrEleCount, $attrSpec) = @{$attrInfo};
+
+        print {$AIHeaderFH} "\ttemplate <> struct AttrInfo<fapi2::$attrName>\n\t{\n";
+        print {$AIHeaderFH} "\t\tstatic constexpr AttrType type = AttrType::$attrType;\n";
+        print {$AIHeaderFH} "\t\tstatic constexpr uint32_t elemSize = $attrElemSize;\n";
+        print {$AIHeaderFH} "\t\tstatic constexpr uint32_t count = $attrEleCount;\n";
+        print {$AIHeaderFH} "\t\tstatic constexpr const char *spec = \"$attrSpec\";\n";
+        print {$AIHeaderFH} "\t\tstatic constexpr const char *name = \"$attrName\";\n";
+        print {$AIHeaderFH} "\t};\n\n";
+    }
+}
+
 sub prepareSimpleTypeAttrMetaData
 {
     my $attrID = $_[0];
@@ -317,6 +354,21 @@ sub prepareAllCommonReqMetaDataForAttr
     print {$AIHeaderFH} "\tconst std::string $attrPrefix$attrID\_TypeName = \"$tmpTypeName\";\n"; 
     print {$AIHeaderFH} "\tconst std::string $attrPrefix$attrID\_Spec = \"$attrSpec\";\n";
     print {$AIHeaderFH} "\tconst uint32_t $attrPrefix$attrID\_ElementCount = $attrEleCount;\n";
+
+    # Struct element size is the sum of the fields size given in spec
+    my $attrType = "Number";
+    my $attrElemSize = $attrSpec;
+    if ( $tmpTypeName eq "struct" )
+    {
+        $attrType = "Struct";
+        $attrElemSize = 0;
+        $attrElemSize += $_ foreach split(//, $attrSpec);
+    }
+    elsif ( $tmpTypeName eq "string" )
+    {
+        $attrType = "String";
+    }
+    push(@attrInfoList, [ "$attrPrefix$attrID", $attrType, $attrElemSize, $attrEleCount, $attrSpec ]);
 }
 
 sub prepareAttrsTypeInfo
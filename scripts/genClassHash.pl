@@ -0,0 +1,131 @@
+#!/usr/bin/env perl
+# SPDX-License-Identifier: Apache-2.0
+
+###############################################################
+#                                                             #
+# This tool will generate the perfect hash tables for dtree   #
+# and cronus class names from class_map in dtree_util.c.      #
+#                                                             #
+# Usage: genClassHash.pl libdtree/dtree_util.c \              #
+#            > libdtree/dtree_class_hash.h                    #
+#                                                             #
+###############################################################
+
+use File::Basename;
+use strict;
+
+my $tool = basename($0);
+
+# Must match CLASS_HASH_SIZE and class_hash() in dtree_util.c
+my $hashBits = 7;
+my $hashSize = 1 << $hashBits;
+my $maxSeed = 1 << 20;
+
+# Dtree names which are aliases of a class
+my %dtreeAliases = (
+    "perv" => "DTREE_CLASS_PERV",
+    "ody_chiplet" => "DTREE_CLASS_PERV",
+);
+
+# 32-bit FNV-1a with the seed as offset basis, same as dtm_hash32()
+sub classHash
+{
+    my ($seed, $name) = @_;
+    my $hash = $seed;
+
+    foreach my $c (unpack("C*", $name)) {
+        $hash ^= $c;
+        $hash = ($hash * 16777619) & 0xffffffff;
+    }
+
+    return $hash >> (32 - $hashBits);
+}
+
+# Find the first seed for which no names collide
+sub findSeed
+{
+    my ($names) = @_;
+
+    SEED: for (my $seed = 1; $seed < $maxSeed; $seed++) {
+        my %used;
+
+        foreach my $name (@$names) {
+            my $slot = classHash($seed, $name);
+            next SEED if exists $used{$slot};
+            $used{$slot} = 1;
+        }
+
+        return $seed;
+    }
+
+    die "$tool: No seed found without collisions\n";
+}
+
+sub printTable
+{
+    my ($table, $seed, $classes) = @_;
+    my %slots;
+
+    foreach my $name (keys %$classes) {
+        $slots{classHash($seed, $name)} = $name;
+    }
+
+    print "static const struct class_hash_entry ${table}[CLASS_HASH_SIZE] = {\n";
+    foreach my $slot (sort { $a <=> $b } keys %slots) {
+        my $name = $slots{$slot};
+        print "\t[$slot] = { \"$name\", $classes->{$name} },\n";
+    }
+    print "};\n";
+}
+
+if (@ARGV != 1) {
+    die "Usage: $tool <dtree_util.c>\n";
+}
+
+my $srcFile = $ARGV[0];
+my %dtreeClasses = %dtreeAliases;
+my %cronusClasses;
+
+open(my $fh, "<", $srcFile) or die "$tool: Failed to open $srcFile\n";
+while (my $line = <$fh>) {
+    if ($line =~ /^\s*\[(DTREE_CLASS_\w+)\]\s*=\s*\{\s*"\w+",\s*"(\w+)",\s*"(\w+)"\s*\}/) {
+        $dtreeClasses{$2} = $1;
+        $cronusClasses{$3} = $1;
+    }
+}
+close($fh);
+
+if (!%cronusClasses) {
+    die "$tool: No class_map entries found in $srcFile\n";
+}
+
+my @dtreeNames = sort keys %dtreeClasses;
+my @cronusNames = sort keys %cronusClasses;
+my $dtreeSeed = findSeed(\@dtreeNames);
+my $cronusSeed = findSeed(\@cronusNames);
+
+print <<EOF;
+/* Generated by scripts/$tool from class_map in dtree_util.c, do not edit */
+
+#ifndef __DTREE_CLASS_HASH_H__
+#define __DTREE_CLASS_HASH_H__
+
+#define CLASS_HASH_SIZE\t\t$hashSize
+#define DTREE_CLASS_SEED\t$dtreeSeed
+#define CRONUS_CLASS_SEED\t$cronusSeed
+
+struct class_hash_entry {
+\tconst char *name;
+\tint class_id;
+};
+
+EOF
+
+printTable("dtree_class_hash", $dtreeSeed, \%dtreeClasses);
+print "\n";
+printTable("cronus_class_hash", $cronusSeed, \%cronusClasses);
+
+print <<EOF;
+
+#endif /* __DTREE_CLASS_HASH_H__ */
+EOF